@@ -21,9 +21,13 @@ module bitpacker_tb();
                  .data_in_valid(data_in_valid),
                  .data_in(data_in),
                  .input_length(input_length),
+                 .data_in_marker(1'b0),
+
+                 .pad(1'b0),
 
                  .data_out_valid(data_out_valid),
-                 .data_out(data_out));
+                 .data_out(data_out),
+                 .data_out_marker());
 
     // generate clock
     always begin
@@ -16,6 +16,8 @@ module bytestuffer_tb();
                             .nreset(nreset),
                             .data_in_valid(data_in_valid),
                             .data_in(data_in),
+                            .data_in_marker(1'b0),
+                            .hold(1'b0),
                             .data_out_valid(data_out_valid),
                             .data_out(data_out),
                             .overflow(overflow));
@@ -1,38 +1,39 @@
 #include "dct_utils.h"
 
-#include "vpi_user.h"
+// This file doesn't depend on VPI, so that the reference implementation's fdct_bench can link it
+// too.
 
 // k * cos((n * pi) / 16) for 1c3 = 0.8314696123 * 0.35355339059
 // 75.2560385539
-const int16_t _1C3_COS_7Q8 = (75);
+static const int16_t _1C3_COS_7Q8 = (75);
 
 // k * sin((n * pi) / 16) for 1c3 = 0.5555702330 * 0.35355339059
 // 50.2844773345
-const int16_t _1C3_SIN_7Q8 = (50);
+static const int16_t _1C3_SIN_7Q8 = (50);
 
 // k * cos((n * pi) / 16) for 1c1 = 0.9807852804 * 0.35355339059
 // 88.7705500995
-const int16_t _1C1_COS_7Q8 = (89);
+static const int16_t _1C1_COS_7Q8 = (89);
 
 // k * sin((n * pi) / 16) for 1c1 = 0.1950903220 * 0.35355339059
 // 17.6575602725
-const int16_t _1C1_SIN_7Q8 = (18);
+static const int16_t _1C1_SIN_7Q8 = (18);
 
 // k * cos((n * pi) / 16) for sqrt= (2);c1 = 0.54119610014 * 0.35355339059
 // 48.9834793417
-const int16_t _R2C1_COS_7Q8 = (49);
+static const int16_t _R2C1_COS_7Q8 = (49);
 
 // k * sin((n * pi) / 16) for sqrt(2)c1 = 1.30656296488 * 0.35355339059
 // 118.256580161
-const int16_t _R2C1_SIN_7Q8 = (118);
+static const int16_t _R2C1_SIN_7Q8 = (118);
 
 // 1.41421356237
 // 362.038671967
-const int16_t _SQRT2_7Q8 = (362);
+static const int16_t _SQRT2_7Q8 = (362);
 
 // 1.41421356237 * 0.25
 // 90.5096679917
-const int16_t _SQRT2_OVER4_7Q8 = (90);
+static const int16_t _SQRT2_OVER4_7Q8 = (90);
 
 
 static int16_t _8q7_multiply(int16_t a, int16_t b)
@@ -146,17 +147,6 @@ static void dct8_7q8(const int16_t* input, int16_t* output)
     output[1] = scratchpad[2][4] + scratchpad[2][7];
 }
 
-void print_88(int16_t* dat)
-{
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            vpi_printf("%04x, ", *(uint16_t*)(dat + (i * 8) + j));
-        }
-        vpi_printf("\n");
-    }
-    vpi_printf("\n");
-}
-
 void dct88_q8(const int8_t* input, int16_t* output)
 {
     int16_t intermediate[64];
@@ -165,9 +155,6 @@ void dct88_q8(const int8_t* input, int16_t* output)
         dct8_q8(input + (i * 8), intermediate + (i * 8));
     }
 
-    //printf("intermediate\r\n");
-    //print_88(intermediate);
-
     for (int i = 0; i < 8; i++) {
         int16_t input_buf[8];
         int16_t output_buf[8];
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 
+/**
+ * Fixed-point model of loeffler_dct_88.v that the testbenches check against. input is 64
+ * level-shifted samples, row-major, treated as q8.
+ * output is 7q8 in natural order, which works out to the same scale as a JPEG FDCT's output.
+ */
 void dct88_q8(const int8_t* input, int16_t* output);
 
 #endif
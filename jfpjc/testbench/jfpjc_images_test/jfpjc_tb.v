@@ -1,7 +1,5 @@
 `timescale 1ns/100ps
 
-`define QUANT_TABLE_OFFSET (25)
-
 module jfpjc_tb();
     reg clock;
     reg nreset;
@@ -39,6 +37,10 @@ module jfpjc_tb();
                      .hm01b0_hsync(roi_hsync),
                      .hm01b0_vsync(roi_vsync),
 
+                     .cfg_wren(1'b0),
+                     .cfg_addr(10'h000),
+                     .cfg_wdata(8'h00),
+
                      .hsync(compressor_data_good),
                      .data_out(compressor_data_out));
 
@@ -69,15 +71,12 @@ module jfpjc_tb();
     reg signed [15:0] test;
     reg signed [7:0] test2;
     integer file_handle;
-    reg [7:0] fixed_header_info [0:327];
     initial begin
         //$dumpfile("jfpjc_tb.vcd");
         //$dumpvars(0, jfpjc_tb);
 
         $readmemh("./testimg.hex", hm01b0.hm01b0_image);
 
-        $readmemh("../common_data/jpeg_header_info.hextestcase", fixed_header_info);
-        $readmemh("./quantization_table_1s.hextestcase", fixed_header_info, `QUANT_TABLE_OFFSET, `QUANT_TABLE_OFFSET + 63);
         $readmemh("./quantization_table_1s.hextestcase", compressor.quantization_table_ebr.mem, 0, 63);
 
         //
@@ -100,13 +99,9 @@ module jfpjc_tb();
         end
 
         file_handle = $fopen("output.jpg", "w");
-        for (i = 0; i < 9'h148; i = i + 1) begin
-            $fwrite(file_handle, "%c", fixed_header_info[i]);
-        end
         for (i = 0; i < outbuf_idx; i = i + 1) begin
             $fwrite(file_handle, "%c", huffman_out[i]);
         end
-        $fwrite(file_handle, "\377\331");
         $fclose(file_handle);
 
         $finish;
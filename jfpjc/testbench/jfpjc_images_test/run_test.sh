@@ -1,5 +1,8 @@
 #!/bin/bash
 
+# Needs wget, unzip, ImageMagick's convert and bc on the path, and python3 with Pillow and numpy
+# for tools/image_to_hex.py (pip install pillow numpy).
+
 # If we don't have images yet, get them.
 IMAGE_COUNT=$(ls -1q ./dsp-test-images/ | wc -l)
 >&2 echo $IMAGE_COUNT " images found"
@@ -18,6 +21,10 @@ IMAGE_COUNT=$(ls -1q ./dsp-test-images/ | wc -l)
 >&2 echo
 
 PROJECT_BASE=$(git rev-parse --show-toplevel)
+IMAGE_QUALITY=$PROJECT_BASE/tools/image_quality/image_quality
+make -C $PROJECT_BASE/tools/image_quality > /dev/null || exit 1
+JFPJC_MODEL=$PROJECT_BASE/tools/jfpjc_model/jfpjc_model
+make -C $PROJECT_BASE/tools/jfpjc_model > /dev/null || exit 1
 
 for f in ./dsp-test-images/*.tiff; do
     rm output.jpg 2> /dev/null
@@ -36,22 +43,35 @@ for f in ./dsp-test-images/*.tiff; do
     # Run verilog
     ./jfpjc_tb.vvp
 
+    # The C model of the hardware should produce exactly the same file.
+    $JFPJC_MODEL -q ./quantization_table_1s.hextestcase -o "${newpgm}_model.jpg" "${newpgm}_320x240.pgm" 2> /dev/null
+    if cmp -s "output.jpg" "${newpgm}_model.jpg"; then
+        rm "${newpgm}_model.jpg"
+    else
+        >&2 echo "output for $f doesn't match jfpjc_model." \
+                 "Retaining ${newpgm}_model.jpg and ${newpgm}_320x240_jfpjc_mismatch.jpg."
+        cp "output.jpg" "${newpgm}_320x240_jfpjc_mismatch.jpg"
+    fi
+
     # Compare input and output image, providing a similarity score
     convert -quality 100 "${newpgm}_320x240.pgm" "${newpgm}_320x240_q100.jpg"
     echo "Image ${newpgm}.pgm compressed to size" $(ls -l "output.jpg"  | awk '{print $5}')
-    SCORE1=$($PROJECT_BASE/tools/image_error.py "${newpgm}_320x240.pgm" "output.jpg")
+    SCORE1=$($IMAGE_QUALITY -j 1 -m l2 "${newpgm}_320x240.pgm" "output.jpg")
     if [ "$?" -ne 0 ]; then exit 1; fi
-    SCORE2=$($PROJECT_BASE/tools/image_error.py "${newpgm}_320x240.pgm" "${newpgm}_320x240_q100.jpg")
+    SCORE2=$($IMAGE_QUALITY -j 1 -m l2 "${newpgm}_320x240.pgm" "${newpgm}_320x240_q100.jpg")
     if [ "$?" -ne 0 ]; then exit 1; fi
     >&2 echo "     jfpjc     imagemagick"
     printf "% 10.1f      % 10.1f" $SCORE1 $SCORE2
 
-    THRESHOLD=2000.0
+    # These are real L2 norms over 320x240 8-bit pixels. With the all-1's quantization table, jfpjc
+    # and a quality 100 jpeg came out within 6.3 of each other on 66 test crops, while being off by
+    # 4 on every other row costs 200+.
+    THRESHOLD=25.0
     if (($(echo "sqrt(($SCORE1 - $SCORE2) * ($SCORE1 - $SCORE2)) > $THRESHOLD" | bc -l))); then
         >&2 printf " ************************"
         stdbuf -i0 -o0 -e0 echo
         >&2 echo "Scores for $f differ by more than $THRESHOLD. Retaining images."
-        mv "output.jpg" "${newpgm}_320x240_jfpjc.jpg"
+        mv "output.jpg" "${newpgm}_320x240_jfpjc_score.jpg"
     else
         stdbuf -i0 -o0 -e0 echo
         rm output.jpg
@@ -1,7 +1,5 @@
 `timescale 1ns/100ps
 
-`define QUANT_TABLE_OFFSET (25)
-
 module jfpjc_multiframe_tb();
     reg clock;
     reg nreset;
@@ -30,6 +28,10 @@ module jfpjc_multiframe_tb();
                      .hm01b0_hsync(hm01b0_hsync),
                      .hm01b0_vsync(hm01b0_vsync),
 
+                     .cfg_wren(1'b0),
+                     .cfg_addr(10'h000),
+                     .cfg_wdata(8'h00),
+
                      .hsync(compressor_data_good),
                      .data_out(compressor_data_out));
 
@@ -71,7 +73,6 @@ module jfpjc_multiframe_tb();
     localparam nframes = 3;
     integer i, j, k;
     integer file_handle;
-    reg [7:0] fixed_header_info [0:327];
     reg [7:0] frames_in [0 : nframes-1][0 : (320 * 240) - 1];
     reg [7:0] frames_out [0 : nframes-1][0 : (320 * 240) - 1];
     initial begin
@@ -79,8 +80,6 @@ module jfpjc_multiframe_tb();
         $dumpvars(0, jfpjc_multiframe_tb);
 
         // set up constant data
-        $readmemh("../common_data/jpeg_header_info.hextestcase", fixed_header_info);
-        $readmemh("./quantization_table_1s.hextestcase", fixed_header_info, `QUANT_TABLE_OFFSET, `QUANT_TABLE_OFFSET + 63);
         $readmemh("./quantization_table_1s.hextestcase", compressor.quantization_table_ebr.mem, 0, 63);
         $readmemh("./testimg0.hex", frames_in_0);
         for (i = 0; i < 320 * 240; i = i + 1) begin
@@ -91,13 +90,11 @@ module jfpjc_multiframe_tb();
         $readmemh("./testimg2.hex", frames_in_2);
         for (i = 0; i < 320 * 240; i = i + 1) begin frames_in[2][i] = frames_in_2[i]; end
 
-        for (i = 0; i < 5; i = i + 1) begin
-            $dumpvars(1, compressor.dct_buffer_fetch_addr[i]);
-        end
-        for (i = 0; i < 4; i = i + 1) begin
-            $dumpvars(1, compressor.encoder.index[i]);
+        $dumpvars(1, compressor.dct_buffer_fetch_addrs);
+        for (i = 0; i < 2; i = i + 1) begin
+            $dumpvars(1, compressor.encoder.encode_valid[i]);
+            $dumpvars(1, compressor.encoder.encode_position[i]);
         end
-        $dumpvars(1, compressor.encoder.do_rollback[0]); $dumpvars(1, compressor.encoder.do_rollback[1]);
         $dumpvars(1, compressor.vsync_prev[0]);
         $dumpvars(1, compressor.vsync_prev[1]);
 
@@ -129,33 +126,21 @@ module jfpjc_multiframe_tb();
         // write results to files
         $display("Writing %d frames to files", nframes);
         file_handle = $fopen("output0.jpg", "w");
-        for (i = 0; i < 9'h148; i = i + 1) begin
-            $fwrite(file_handle, "%c", fixed_header_info[i]);
-        end
         for (i = 0; i < jpeg_widths[0]; i = i + 1) begin
             $fwrite(file_handle, "%c", frames_out[0][i]);
         end
-        $fwrite(file_handle, "\377\331");
         $fclose(file_handle);
 
         file_handle = $fopen("output1.jpg", "w");
-        for (i = 0; i < 9'h148; i = i + 1) begin
-            $fwrite(file_handle, "%c", fixed_header_info[i]);
-        end
         for (i = 0; i < jpeg_widths[1]; i = i + 1) begin
             $fwrite(file_handle, "%c", frames_out[1][i]);
         end
-        $fwrite(file_handle, "\377\331");
         $fclose(file_handle);
 
         file_handle = $fopen("output2.jpg", "w");
-        for (i = 0; i < 9'h148; i = i + 1) begin
-            $fwrite(file_handle, "%c", fixed_header_info[i]);
-        end
         for (i = 0; i < jpeg_widths[2]; i = i + 1) begin
             $fwrite(file_handle, "%c", frames_out[2][i]);
         end
-        $fwrite(file_handle, "\377\331");
         $fclose(file_handle);
 
         $finish;
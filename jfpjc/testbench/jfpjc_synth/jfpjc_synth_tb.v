@@ -5,8 +5,6 @@
 
 `timescale 1ns/100ps
 
-`define QUANT_TABLE_OFFSET (25)
-
 module jfpjc_synth_tb();
     reg clock;
     reg nreset;
@@ -36,6 +34,10 @@ module jfpjc_synth_tb();
                      .hm01b0_hsync(hm01b0_hsync),
                      .hm01b0_vsync(hm01b0_vsync),
 
+                     .cfg_wren(1'b0),
+                     .cfg_addr(10'h000),
+                     .cfg_wdata(8'h00),
+
                      .hsync(compressor_data_good),
                      .vsync(compressor_vsync),
                      .data_out(compressor_data_out));
@@ -52,6 +54,10 @@ module jfpjc_synth_tb();
                                  .hm01b0_hsync(hm01b0_hsync),
                                  .hm01b0_vsync(hm01b0_vsync),
 
+                                 .cfg_wren(1'b0),
+                                 .cfg_addr(10'h000),
+                                 .cfg_wdata(8'h00),
+
                                  .hsync(compressor_synth_data_good),
                                  .vsync(compressor_synth_vsync),
                                  .data_out(compressor_synth_data_out));
@@ -86,7 +92,6 @@ module jfpjc_synth_tb();
 
     integer i, j, k;
     integer file_handle;
-    reg [7:0] fixed_header_info [0:327];
     initial begin
         $dumpfile("jfpjc_synth_tb.vcd");
         $dumpvars(0, jfpjc_synth_tb);
@@ -94,8 +99,6 @@ module jfpjc_synth_tb();
         //$readmemh("../pictures/checkerboard_highfreq_80x80.hex", hm01b0.hm01b0_image);
         $readmemh("../pictures/boat_gray.hex", hm01b0.hm01b0_image);
 
-        $readmemh("../common_data/jpeg_header_info.hextestcase", fixed_header_info);
-        $readmemh("quantization_table.hextestcase", fixed_header_info, `QUANT_TABLE_OFFSET, `QUANT_TABLE_OFFSET + 64);
         //$readmemh("quantization_table.hextestcase", compressor.quantization_table_ebr.mem);
         $readmemh("quantization_table.hextestcase", compressor_synth.compressor.quantization_table_ebr.mem);
 
@@ -124,18 +127,12 @@ module jfpjc_synth_tb();
         $display();
 
         file_handle = $fopen("output.jpg", "w");
-        for (i = 0; i < 9'h148; i = i + 1) begin
-            $fwrite(file_handle, "%c", fixed_header_info[i]);
-        end
         for (i = 0; i < outbuf_idx; i = i + 1) begin
             $fwrite(file_handle, "%c", huffman_out[i]);
         end
         $fclose(file_handle);
 
         file_handle = $fopen("output_synth.jpg", "w");
-        for (i = 0; i < 9'h148; i = i + 1) begin
-            $fwrite(file_handle, "%c", fixed_header_info[i]);
-        end
         for (i = 0; i < synth_outbuf_idx; i = i + 1) begin
             $fwrite(file_handle, "%c", synth_huffman_out[i]);
         end
@@ -1,7 +1,5 @@
 `timescale 1ns/100ps
 
-`define QUANT_TABLE_OFFSET (25)
-
 module jfpjc_tb();
     reg clock;
     reg nreset;
@@ -38,6 +36,10 @@ module jfpjc_tb();
                      .hm01b0_hsync(hm01b0_hsync),
                      .hm01b0_vsync(hm01b0_vsync),
 
+                     .cfg_wren(1'b0),
+                     .cfg_addr(10'h000),
+                     .cfg_wdata(8'h00),
+
                      .hsync(compressor_data_good),
                      .data_out(compressor_data_out));
     defparam compressor.quant_table_file = "./quantization_table.hextestcase";
@@ -67,25 +69,19 @@ module jfpjc_tb();
     reg signed [15:0] test;
     reg signed [7:0] test2;
     integer file_handle;
-    reg [7:0] fixed_header_info [0:327];
     initial begin
         $dumpfile("jfpjc_tb.vcd");
         $dumpvars(0, jfpjc_tb);
 
         $readmemh("./testimg.hex", hm01b0.hm01b0_image);
 
-        $readmemh("../common_data/jpeg_header_info.hextestcase", fixed_header_info);
-        $readmemh("./quantization_table.hextestcase", fixed_header_info, `QUANT_TABLE_OFFSET, `QUANT_TABLE_OFFSET + 64);
         //$readmemh("./quantization_table.hextestcase", compressor.quantization_table_ebr.mem);
 
-        for (i = 0; i < 5; i = i + 1) begin
-            $dumpvars(1, compressor.dct_buffer_fetch_addr[i]);
+        $dumpvars(1, compressor.dct_buffer_fetch_addrs);
+        for (i = 0; i < 2; i = i + 1) begin
+            $dumpvars(1, compressor.encoder.encode_valid[i]);
+            $dumpvars(1, compressor.encoder.encode_position[i]);
         end
-        for (i = 0; i < 4; i = i + 1) begin
-            $dumpvars(1, compressor.encoder.index[i]);
-            $dumpvars(1, compressor.encoder.valid[i]);
-        end
-        $dumpvars(1, compressor.encoder.do_rollback[0]); $dumpvars(1, compressor.encoder.do_rollback[1]);
 
         //
         clock = 1'b0;
@@ -107,13 +103,9 @@ module jfpjc_tb();
         $display();
 
         file_handle = $fopen("output.jpg", "w");
-        for (i = 0; i < 9'h148; i = i + 1) begin
-            $fwrite(file_handle, "%c", fixed_header_info[i]);
-        end
         for (i = 0; i < outbuf_idx; i = i + 1) begin
             $fwrite(file_handle, "%c", huffman_out[i]);
         end
-        $fwrite(file_handle, "\377\331");
         $fclose(file_handle);
 
         $finish;
@@ -0,0 +1,384 @@
+/**
+ * Verilator harness for the jfpjc top level.
+ *
+ *     jfpjc_verilator [-j jobs] [-p pixclk_half_period] [-b hblank] [-c] [-d dir] image.pgm ...
+ *
+ * Instead of simulating an hm01b0 and then trimming its padding off with vsync_hsync_roi, this
+ * drives the camera bus straight from the pgm files in memory: vsync is only high for the active
+ * lines, hsync is only high for active pixels, and every line is followed by 'hblank' pixel clocks
+ * of horizontal blanking. All of the images given go through the same model back to back, like
+ * jfpjc_multiframe_tb does; the next frame starts once jfpjc drops its output vsync.
+ *
+ * Bytes are captured on every rising edge of clock where hsync is high, the same way the iverilog
+ * testbenches do it. They're already a complete jpeg, so each frame is written out as-is to
+ * <dir>/<image name>.jpg. With -c, each frame is also checked against tools/jfpjc_model and the
+ * exit status is nonzero if any of them differ.
+ *
+ * -j splits the images between that many processes, each with its own model.
+ *
+ * The quantization table, the frame size and the restart interval are baked in when the model is
+ * verilated; see the Makefile. Images have to be exactly that size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Vjfpjc.h"
+#include "verilated.h"
+
+extern "C" {
+#include "jfpjc_model.h"
+#include "pnm.h"
+}
+
+#ifndef FRAME_WIDTH
+#define FRAME_WIDTH (320)
+#endif
+
+#ifndef FRAME_HEIGHT
+#define FRAME_HEIGHT (240)
+#endif
+
+#ifndef RESTART_INTERVAL
+#define RESTART_INTERVAL (0)
+#endif
+
+// blank lines before each frame's first active line.
+#define VBLANK_LINES (2)
+
+typedef struct harness_options
+{
+    // system clock cycles per half pixel clock. jfpjc_tb.v's hm01b0_sim runs at 10.
+    int pixclk_half_period;
+
+    // pixel clocks between lines with hsync low.
+    int hblank;
+
+    // give up on a frame if jfpjc hasn't finished it this many pixel clocks after its last line.
+    long drain_timeout;
+
+    int check;
+    const char* output_dir;
+} harness_options_t;
+
+typedef struct harness
+{
+    Vjfpjc* top;
+    const harness_options_t* options;
+
+    uint64_t cycles;
+
+    // bytes captured off of data_out for the current frame.
+    jfpjc_model_output_t captured;
+
+    // set when jfpjc's vsync falls, which it only does once it's done with a frame.
+    int vsync_prev;
+    int frame_done;
+} harness_t;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static void captured_push(jfpjc_model_output_t* out, uint8_t byte)
+{
+    if (out->len == out->capacity) {
+        out->capacity = (out->capacity == 0) ? 65536 : (out->capacity * 2);
+        out->data = (uint8_t*)realloc(out->data, out->capacity);
+    }
+    out->data[out->len++] = byte;
+}
+
+/**
+ * One system clock cycle. Outputs are sampled just before the rising edge, which is what an
+ * always @(posedge clock) block in a testbench would see.
+ */
+static void tick(harness_t* h)
+{
+    Vjfpjc* top = h->top;
+
+    top->clock = 0;
+    top->eval();
+
+    if (top->hsync) {
+        captured_push(&h->captured, top->data_out);
+    }
+    if (h->vsync_prev && !top->vsync) {
+        h->frame_done = 1;
+    }
+    h->vsync_prev = top->vsync;
+
+    top->clock = 1;
+    top->eval();
+    h->cycles++;
+}
+
+/**
+ * One pixel clock period. Camera signals change on the falling edge of pixclk, like the hm01b0's.
+ */
+static void pixel(harness_t* h, int hsync, int vsync, uint8_t pixdata)
+{
+    Vjfpjc* top = h->top;
+
+    top->hm01b0_pixclk = 0;
+    top->hm01b0_hsync = hsync;
+    top->hm01b0_vsync = vsync;
+    top->hm01b0_pixdata = pixdata;
+    for (int i = 0; i < h->options->pixclk_half_period; i++) {
+        tick(h);
+    }
+
+    top->hm01b0_pixclk = 1;
+    for (int i = 0; i < h->options->pixclk_half_period; i++) {
+        tick(h);
+    }
+}
+
+static void harness_reset(harness_t* h)
+{
+    h->top->nreset = 0;
+    h->top->hm01b0_pixclk = 0;
+    h->top->hm01b0_hsync = 0;
+    h->top->hm01b0_vsync = 0;
+    h->top->hm01b0_pixdata = 0;
+    h->top->cfg_wren = 0;
+    h->top->cfg_addr = 0;
+    h->top->cfg_wdata = 0;
+    for (int i = 0; i < 16; i++) {
+        tick(h);
+    }
+    h->top->nreset = 1;
+    tick(h);
+}
+
+/**
+ * Feeds one frame in and runs until jfpjc has finished putting it out. Returns nonzero on timeout.
+ */
+static int harness_run_frame(harness_t* h, const uint8_t* pixels)
+{
+    const int line_length = FRAME_WIDTH + h->options->hblank;
+
+    h->captured.len = 0;
+    h->frame_done = 0;
+
+    for (int i = 0; i < (VBLANK_LINES * line_length); i++) {
+        pixel(h, 0, 0, 0);
+    }
+
+    for (int y = 0; y < FRAME_HEIGHT; y++) {
+        for (int x = 0; x < FRAME_WIDTH; x++) {
+            pixel(h, 1, 1, pixels[(y * FRAME_WIDTH) + x]);
+        }
+        for (int x = 0; x < h->options->hblank; x++) {
+            pixel(h, 0, 1, 0);
+        }
+    }
+
+    for (long i = 0; !h->frame_done; i++) {
+        if (i == h->options->drain_timeout) {
+            return -1;
+        }
+        pixel(h, 0, 0, 0);
+    }
+    return 0;
+}
+
+static char* output_path_for(const char* dir, const char* image_path)
+{
+    const char* name = strrchr(image_path, '/');
+    name = (name == NULL) ? image_path : (name + 1);
+    const char* dot = strrchr(name, '.');
+    const size_t stem_len = (dot == NULL) ? strlen(name) : (size_t)(dot - name);
+
+    char* path = (char*)malloc(strlen(dir) + stem_len + 6);
+    sprintf(path, "%s/%.*s.jpg", dir, (int)stem_len, name);
+    return path;
+}
+
+/**
+ * Runs every 'stride'th image starting from 'first' through one model. Returns the number of
+ * images that failed.
+ */
+static int run_images(const harness_options_t* options, const jfpjc_model_quant_table_t* quant_table,
+                      char** images, int nimages, int first, int stride)
+{
+    int failures = 0;
+    harness_t h;
+    memset(&h, 0, sizeof(h));
+    h.top = new Vjfpjc;
+    h.options = options;
+    jfpjc_model_output_t expected = { 0 };
+
+    harness_reset(&h);
+
+    for (int i = first; i < nimages; i += stride) {
+        pnm_image_t image;
+        int err;
+        if ((err = pnm_image_map(images[i], &image))) {
+            printf("%s: failed to load (%i)\n", images[i], err);
+            failures++;
+            continue;
+        }
+        if ((image.depth != 1) || (image.width != FRAME_WIDTH) || (image.height != FRAME_HEIGHT)) {
+            printf("%s: needs to be a %ix%i pgm\n", images[i], FRAME_WIDTH, FRAME_HEIGHT);
+            pnm_image_unmap(&image);
+            failures++;
+            continue;
+        }
+
+        const uint64_t start_cycles = h.cycles;
+        const double start = now_seconds();
+        if (harness_run_frame(&h, image.pixels)) {
+            printf("%s: timed out waiting for jfpjc to finish the frame\n", images[i]);
+            pnm_image_unmap(&image);
+            failures++;
+
+            // whatever state it's in now isn't useful for the next image.
+            harness_reset(&h);
+            continue;
+        }
+        const double elapsed = now_seconds() - start;
+
+        const char* verdict = "";
+        if (options->check) {
+            expected.len = 0;
+            jfpjc_model_compress_frame(image.pixels, image.width, image.height, image.width,
+                                       quant_table, RESTART_INTERVAL, &expected);
+            if ((expected.len == h.captured.len) &&
+                !memcmp(expected.data, h.captured.data, expected.len)) {
+                verdict = ", matches jfpjc_model";
+            } else {
+                verdict = ", DOES NOT MATCH jfpjc_model";
+                failures++;
+            }
+        }
+        pnm_image_unmap(&image);
+
+        if (options->output_dir != NULL) {
+            char* path = output_path_for(options->output_dir, images[i]);
+            FILE* f = fopen(path, "wb");
+            if (f == NULL) {
+                printf("%s: couldn't open %s\n", images[i], path);
+                failures++;
+            } else {
+                fwrite(h.captured.data, 1, h.captured.len, f);
+                fclose(f);
+            }
+            free(path);
+        }
+
+        printf("%s: %zu bytes, %llu cycles in %.2f s%s\n", images[i], h.captured.len,
+               (unsigned long long)(h.cycles - start_cycles), elapsed, verdict);
+        fflush(stdout);
+    }
+
+    h.top->final();
+    delete h.top;
+    jfpjc_model_output_destroy(&h.captured);
+    jfpjc_model_output_destroy(&expected);
+    return failures;
+}
+
+static void usage(const char* argv0)
+{
+    printf("Usage: %s [-j jobs] [-p pixclk_half_period] [-b hblank] [-c] [-n] [-d dir] "
+           "image ...\n", argv0);
+    printf("    -j jobs                 processes to split the images between (1).\n");
+    printf("    -p pixclk_half_period   system clocks per half pixel clock (10).\n");
+    printf("    -b hblank               pixel clocks of blanking after each line (124).\n");
+    printf("    -c                      check every frame against jfpjc_model.\n");
+    printf("    -n                      don't write any output files.\n");
+    printf("    -d dir                  directory to put <image name>.jpg files in (.).\n");
+    printf("images need to be %ix%i pgms. quantization table: %s\n", FRAME_WIDTH, FRAME_HEIGHT,
+           QUANT_TABLE_PATH);
+}
+
+int main(int argc, char** argv)
+{
+    harness_options_t options = { 10, 124, 0, 0, "." };
+    int jobs = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:p:b:cnd:")) != -1) {
+        switch (opt) {
+            case 'j': jobs = atoi(optarg); break;
+            case 'p': options.pixclk_half_period = atoi(optarg); break;
+            case 'b': options.hblank = atoi(optarg); break;
+            case 'c': options.check = 1; break;
+            case 'n': options.output_dir = NULL; break;
+            case 'd': options.output_dir = optarg; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    if ((optind == argc) || (jobs < 1) || (options.pixclk_half_period < 1) ||
+        (options.hblank < 1)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    // a whole frame's worth of pixel clocks is much more than the pipeline could ever need.
+    options.drain_timeout = (long)(FRAME_WIDTH + options.hblank) * FRAME_HEIGHT;
+
+    char** images = &argv[optind];
+    const int nimages = argc - optind;
+
+    int retval = 0;
+    uint8_t* quant_bytes = NULL;
+    int quant_len = 0;
+    jfpjc_model_quant_table_t quant_table;
+
+    if (jfpjc_model_read_hex_file(QUANT_TABLE_PATH, &quant_bytes, &quant_len) || (quant_len < 64)) {
+        printf("couldn't read 64 quantization table entries from %s\n", QUANT_TABLE_PATH);
+        retval = -1;
+        goto _end;
+    }
+    memcpy(quant_table.Q, quant_bytes, 64);
+
+    Verilated::commandArgs(argc, argv);
+
+    if (jobs > nimages) {
+        jobs = nimages;
+    }
+
+    if (jobs == 1) {
+        retval = run_images(&options, &quant_table, images, nimages, 0, 1);
+    } else {
+        // each child gets its own model and its own share of the images.
+        for (int j = 0; j < jobs; j++) {
+            const pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                retval = -1;
+                break;
+            } else if (pid == 0) {
+                const int failures = run_images(&options, &quant_table, images, nimages, j,
+                                                jobs);
+                exit((failures > 255) ? 255 : failures);
+            }
+        }
+
+        int status;
+        while (wait(&status) > 0) {
+            if (!WIFEXITED(status)) {
+                retval = -1;
+            } else if (retval >= 0) {
+                retval += WEXITSTATUS(status);
+            }
+        }
+    }
+
+    if (retval > 0) {
+        printf("%i images failed\n", retval);
+    }
+
+_end:
+    free(quant_bytes);
+    return (retval == 0) ? 0 : 1;
+}
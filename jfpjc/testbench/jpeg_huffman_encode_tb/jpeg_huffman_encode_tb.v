@@ -5,8 +5,9 @@ module jpeg_huffman_encode_tb();
     reg nreset;
     reg start;
 
-    wire [5:0] fetch_addr;
-    wire signed [15:0] src_data_into_huff;
+    wire [5:0] fetch_addr_0, fetch_addr_1;
+    wire signed [15:0] src_data_into_huff_0, src_data_into_huff_1;
+    wire [63:0] nonzero;
 
     wire huff_output_wren;
     wire [5:0] huff_output_length;
@@ -19,9 +20,20 @@ module jpeg_huffman_encode_tb();
     jpeg_huffman_encode huff(.clock(clock),
                              .nreset(nreset),
                              .start(start),
+                             .reset_prediction(1'b0),
 
-                             .fetch_addr(fetch_addr),
-                             .src_data_in(src_data_into_huff),
+                             .fetch_addr_0(fetch_addr_0),
+                             .fetch_addr_1(fetch_addr_1),
+                             .src_data_in_0(src_data_into_huff_0),
+                             .src_data_in_1(src_data_into_huff_1),
+                             .nonzero(nonzero),
+
+                             .dc_table_wren(1'b0),
+                             .dc_table_waddr(4'h0),
+                             .dc_table_wdata(20'h00000),
+                             .ac_table_wren(1'b0),
+                             .ac_table_waddr(8'h00),
+                             .ac_table_wdata(20'h00000),
 
                              .output_wren(huff_output_wren),
                              .output_length(huff_output_length),
@@ -32,20 +44,46 @@ module jpeg_huffman_encode_tb();
     // Memory holding 64 int16_t coefficients.
     //
     // Practically all of the coefficients will be in [-128, 127], but they can theoretically be
-    // in [-1024, 1023].
-    wire [5:0] row_major_index;
+    // in [-1024, 1023]. The encoder reads 2 at a time, so there are 2 copies of it.
+    wire [5:0] row_major_index_0, row_major_index_1;
     reg  [1:0] encoder_in_buf;
-    ice40_ebr #(.addr_width(8), .data_width(16)) sample_memory(.din(16'h0000),
-                                                               .write_en(1'b0),
-                                                               .waddr(8'h00),
-                                                               .wclk(1'b0),
-
-                                                               .raddr({encoder_in_buf, row_major_index}),
-                                                               .rclk(clock),
-                                                               .dout(src_data_into_huff));
-
-    zig_zag_to_row_major ziggy(.zig_zag_index(fetch_addr),
-                               .row_major_index(row_major_index));
+    ice40_ebr #(.addr_width(8), .data_width(16)) sample_memory_0(.din(16'h0000),
+                                                                 .write_en(1'b0),
+                                                                 .waddr(8'h00),
+                                                                 .wclk(1'b0),
+
+                                                                 .raddr({encoder_in_buf, row_major_index_0}),
+                                                                 .rclk(clock),
+                                                                 .dout(src_data_into_huff_0));
+
+    ice40_ebr #(.addr_width(8), .data_width(16)) sample_memory_1(.din(16'h0000),
+                                                                 .write_en(1'b0),
+                                                                 .waddr(8'h00),
+                                                                 .wclk(1'b0),
+
+                                                                 .raddr({encoder_in_buf, row_major_index_1}),
+                                                                 .rclk(clock),
+                                                                 .dout(src_data_into_huff_1));
+
+    zig_zag_to_row_major ziggy_0(.zig_zag_index(fetch_addr_0),
+                                 .row_major_index(row_major_index_0));
+    zig_zag_to_row_major ziggy_1(.zig_zag_index(fetch_addr_1),
+                                 .row_major_index(row_major_index_1));
+
+    // in jfpjc, the nonzero bitmap gets built as the quantizer writes the block. Here we just
+    // look at the whole block at once.
+    genvar nonzero_i;
+    generate
+        for (nonzero_i = 0; nonzero_i < 64; nonzero_i = nonzero_i + 1) begin: nonzero_bits
+            wire [5:0] zig_zag_index = nonzero_i;
+            wire [5:0] row_major_index;
+            zig_zag_to_row_major ziggy(.zig_zag_index(zig_zag_index),
+                                       .row_major_index(row_major_index));
+            assign nonzero[nonzero_i] =
+                (sample_memory_0.mem[{ encoder_in_buf, row_major_index }] != 16'h0000) &&
+                (sample_memory_0.mem[{ encoder_in_buf, row_major_index }] != 16'h8000);
+        end
+    endgenerate
 
     // generate clock
     always begin
@@ -61,17 +99,16 @@ module jpeg_huffman_encode_tb();
         $dumpvars(0, jpeg_huffman_encode_tb);
 
         // icarus / gtkwave take a little extra effort to dump array variables
-        for (i = 0; i < 4; i = i + 1) begin
-            $dumpvars(1, huff.index[i]);
-            $dumpvars(1, huff.valid[i]);
-        end
-
         for (i = 0; i < 2; i = i + 1) begin
-            $dumpvars(1, huff.coded_coefficient_reg[i]);
-            $dumpvars(1, huff.coded_coefficient_length_reg[i]);
+            $dumpvars(1, huff.encode_valid[i]);
+            $dumpvars(1, huff.encode_position[i]);
+            $dumpvars(1, huff.pack_valid[i]);
+            $dumpvars(1, huff.symbol_data[i]);
+            $dumpvars(1, huff.symbol_length[i]);
         end
 
-        $readmemh("jpeg_huffman_encode_testcase_3_in.hextestcase", sample_memory.mem);
+        $readmemh("jpeg_huffman_encode_testcase_3_in.hextestcase", sample_memory_0.mem);
+        $readmemh("jpeg_huffman_encode_testcase_3_in.hextestcase", sample_memory_1.mem);
         output_index = 0;
 
         clock = 'b0;
@@ -90,10 +127,7 @@ module jpeg_huffman_encode_tb();
             start = 'b0;
             while (busy == 1'b1) begin
                 if (huff_output_wren) begin
-                    $display("packing %h, with length %d", huff.bit_concatenator_data0, huff.bit_concatenator_length0);
-                    if (huff.bit_concatenator_length1 > 0) begin
-                        $display("packing %h, with length %d", huff.bit_concatenator_data1, huff.bit_concatenator_length1);
-                    end
+                    $display("packing %h, with length %d", huff_output_data, huff_output_length);
                 end
                 #1000;
             end
@@ -104,7 +138,8 @@ module jpeg_huffman_encode_tb();
         $display("================================================================");
         $display("");
 
-        $readmemh("jpeg_huffman_encode_testcase_2_in.hextestcase", sample_memory.mem);
+        $readmemh("jpeg_huffman_encode_testcase_2_in.hextestcase", sample_memory_0.mem);
+        $readmemh("jpeg_huffman_encode_testcase_2_in.hextestcase", sample_memory_1.mem);
         output_index = 0;
 
         clock = 'b0;
@@ -117,10 +152,7 @@ module jpeg_huffman_encode_tb();
         start = 'b0;
         while (busy == 1'b1) begin
             if (huff_output_wren) begin
-                $display("packing %h, with length %d", huff.bit_concatenator_data0, huff.bit_concatenator_length0);
-                if (huff.bit_concatenator_length1 > 0) begin
-                    $display("packing %h, with length %d", huff.bit_concatenator_data1, huff.bit_concatenator_length1);
-                end
+                $display("packing %h, with length %d", huff_output_data, huff_output_length);
             end
 
             #1000;
@@ -5,6 +5,16 @@
  * (up to 32 bits), and it aligns and packs them into 32-bit words.
  *
  * The data coming in should be LEFT JUSTIFIED, lsbs should all be zero.
+ *
+ * For restart markers, there are two extra things it can do:
+ *   - When pad is high (and data_in_valid isn't), whatever's in the accumulator is padded out to a
+ *     byte boundary with 1's, the rest of the word is filled up with 0xff fill bytes, and the word
+ *     is put out. If the accumulator is empty, nothing happens.
+ *   - When data_in_marker is high along with data_in_valid, the word on data_in is a marker. It
+ *     has to be a whole 32-bit word and it has to come in right after a pad, so it gets put out
+ *     just as it is.
+ * data_out_marker has a bit for each byte of data_out ([3] for data_out[31:24]) that's set when
+ * that byte is a fill byte or part of a marker and must not be stuffed.
  */
 module bitpacker(input         clock,
                  input         nreset,
@@ -12,9 +22,13 @@ module bitpacker(input         clock,
                  input         data_in_valid,
                  input [31:0]  data_in,
                  input  [5:0]  input_length,
+                 input         data_in_marker,
+
+                 input         pad,
 
                  output reg         data_out_valid,
-                 output reg  [31:0] data_out);
+                 output reg  [31:0] data_out,
+                 output reg   [3:0] data_out_marker);
     reg [4:0] bit_counter;
     reg [4:0] bit_counter_next;
     reg       bit_counter_carry;
@@ -46,27 +60,43 @@ module bitpacker(input         clock,
         end
     end
 
+    // number of bytes in the accumulator that have data in them, counting a partly filled one.
+    wire [5:0] bytes_used = ({ 1'b0, bit_counter } + 6'd7) >> 3;
+
     always @(posedge clock) begin
         if (nreset) begin
-            if (bit_counter_carry) begin
+            if (pad) begin
+                bit_accumulator_register <= 32'h0000_0000;
+            end else if (bit_counter_carry) begin
                 bit_accumulator_register <= shifted_input[31:0];
             end else begin
                 bit_accumulator_register <= bit_accumulator_with_input_added;
             end
 
-            if (bit_counter_carry) begin
+            if (pad && (bit_counter != 5'h0)) begin
+                data_out <= bit_accumulator_register | (32'hffff_ffff >> bit_counter);
+                data_out_valid <= 1'b1;
+                data_out_marker <= 4'hf >> bytes_used;
+            end else if (!pad && bit_counter_carry) begin
                 data_out <= bit_accumulator_with_input_added;
                 data_out_valid <= 1'b1;
+                data_out_marker <= data_in_marker ? 4'hf : 4'h0;
             end else begin
                 data_out <= 32'hxxxx_xxxx;
                 data_out_valid <= 1'b0;
+                data_out_marker <= 4'hx;
             end
 
-            bit_counter <= bit_counter_next;
+            if (pad) begin
+                bit_counter <= 5'h0;
+            end else begin
+                bit_counter <= bit_counter_next;
+            end
         end else begin
             bit_accumulator_register <= 32'h0000_0000;
             data_out <= 32'hxxxx_xxxx;
             data_out_valid <= 1'b0;
+            data_out_marker <= 4'hx;
             bit_counter <= 5'h0;
         end
     end
@@ -7,7 +7,8 @@
  * state - it recieves more valid 0xff data_in bytes than invalid bytes in. This module has a buffer
  * depth of 512, so this will never happen for sane jpeg encodings.
  *
- * This module assumes that the buffer depth is a power of 2.
+ * This module assumes that the buffer depth is a power of 2. Every entry carries a marker bit along
+ * with the byte, so the buffer takes 2 EBRs.
  *
  * @port in  clock         Clock signal for the module. All input and output signals are latched on
  *                         rising edges of this clock
@@ -17,6 +18,11 @@
  *                         be ingested.
  * @port in  data_in       If data_in_valid is 1'b1, data on this port will be ingested
  *                         @ posedge clock
+ * @port in  data_in_marker  If this is high along with data_in_valid, data_in is part of a marker
+ *                           (or a fill byte in front of one) and an 0xff won't be stuffed.
+ * @port in  hold          While this is high, no new bytes are put out; bytes that come in are
+ *                         kept until it goes low again. A 0x00 that's owed to an 0xff that was
+ *                         already put out still gets put out.
  *
  * @port out data_out_valid   If data_out_valid is 1'b1 @ posedge clock, value presented on data_out
  *                            is valid and must be read by subsequent circuitry.
@@ -24,16 +30,22 @@
  *                            driven on this port @ posedge clock.
  * @port out overflow         If this buffer overflows becuase it recieved too many 0xffs in a row,
  *                            this signal is driven high. It can be cleared with a module reset.
+ * @port out idle             High when every byte that came in has been put out, including the
+ *                            last 0x00 that was stuffed.
  */
 module bytestuffer(input               clock,
                    input               nreset,
 
                    input               data_in_valid,
                    input         [7:0] data_in,
+                   input               data_in_marker,
+
+                   input               hold,
 
                    output reg          data_out_valid,
                    output reg    [7:0] data_out,
-                   output reg          overflow);
+                   output reg          overflow,
+                   output              idle);
     reg data_out_valid_next;
     reg [7:0] data_out_next;
 
@@ -42,9 +54,9 @@ module bytestuffer(input               clock,
 
     reg [8:0] data_out_ptr;
     reg [8:0] data_out_ptr_next;
-    wire [7:0] mem_out;
+    wire [8:0] mem_out;
 
-    ice40_ebr ice40_ebr(.din(data_in),
+    ice40_ebr ice40_ebr(.din({ data_in_marker, data_in }),
                         .write_en(data_in_valid),
                         .waddr(data_in_ptr),
                         .wclk(clock),
@@ -52,7 +64,7 @@ module bytestuffer(input               clock,
                         .rclk(clock),
                         .dout(mem_out));
     defparam ice40_ebr.addr_width = 9;
-    defparam ice40_ebr.data_width = 8;
+    defparam ice40_ebr.data_width = 9;
 
 `define BYTESTUFFER_STATE_WAIT 2'b00
 `define BYTESTUFFER_STATE_OUTPUT_MEMVAL 2'b01
@@ -71,7 +83,7 @@ module bytestuffer(input               clock,
             `BYTESTUFFER_STATE_WAIT: begin
                 data_out_valid_next = 1'b0;
                 data_out_next = 8'hxx;
-                if (data_in_ptr != data_out_ptr) begin
+                if (!hold && (data_in_ptr != data_out_ptr)) begin
                     data_out_ptr_next = data_out_ptr + 9'h001;
                     bytestuffer_state_next = `BYTESTUFFER_STATE_OUTPUT_MEMVAL;
                 end else begin
@@ -82,11 +94,11 @@ module bytestuffer(input               clock,
 
             `BYTESTUFFER_STATE_OUTPUT_MEMVAL: begin
                 data_out_valid_next = 1'b1;
-                data_out_next = mem_out;
-                if (mem_out == 8'hff) begin
+                data_out_next = mem_out[7:0];
+                if ((mem_out[7:0] == 8'hff) && !mem_out[8]) begin
                     data_out_ptr_next = data_out_ptr;
                     bytestuffer_state_next = `BYTESTUFFER_STATE_OUTPUT_ZERO;
-                end else if (data_out_ptr != data_in_ptr) begin
+                end else if (!hold && (data_out_ptr != data_in_ptr)) begin
                     data_out_ptr_next = data_out_ptr + 9'h001;
                     bytestuffer_state_next = `BYTESTUFFER_STATE_OUTPUT_MEMVAL;
                 end else begin
@@ -98,7 +110,7 @@ module bytestuffer(input               clock,
             `BYTESTUFFER_STATE_OUTPUT_ZERO: begin
                 data_out_valid_next = 1'b1;
                 data_out_next = 8'h00;
-                if (data_out_ptr != data_in_ptr) begin
+                if (!hold && (data_out_ptr != data_in_ptr)) begin
                     data_out_ptr_next = data_out_ptr + 9'h001;
                     bytestuffer_state_next = `BYTESTUFFER_STATE_OUTPUT_MEMVAL;
                 end else begin
@@ -116,6 +128,10 @@ module bytestuffer(input               clock,
         endcase
     end
 
+    assign idle = ((data_in_ptr == data_out_ptr) &&
+                   (bytestuffer_state == `BYTESTUFFER_STATE_WAIT) &&
+                   !data_out_valid);
+
     always @(posedge clock) begin
         if (nreset) begin
             // Overflow detection
@@ -6,6 +6,12 @@
 /**
  * This connects to an hm01b0 and outputs the given pixels to a
  *
+ * Each MCU row gets dealt out round-robin between num_ebr EBRs one MCU at a time: MCU n of a row
+ * goes to EBR (n % num_ebr) at offset ((n / num_ebr) * 64). width_pix and height_pix need to be
+ * multiples of 8, but width_pix doesn't need to be a multiple of (8 * num_ebr); if it isn't, the
+ * last few EBRs just get one less MCU per row than the first few. The EBRs are sized to hold
+ * ceil(width_mcu / num_ebr) MCUs, rounded up to a power of 2.
+ *
  * TODO: make ingester clock rate not the same as rest of system.
  */
 `define SYNCHRONOUS
@@ -32,9 +38,14 @@ module camera_ingester(input                      clock,
     parameter left_active_padding = 0, right_active_padding = 0;
     parameter top_active_padding = 0, bottom_active_padding = 0;
 
-    localparam width_pix = 320, height_pix = 240, num_ebr = 5, ebr_size = 512;
+    parameter width_pix = 320, height_pix = 240, num_ebr = 5;
     localparam width_mcu = (width_pix / 8), height_mcu = (height_pix / 8);
 
+    // number of MCUs that each EBR needs to hold for one MCU row.
+    localparam mcus_per_ebr = ((width_mcu + num_ebr - 1) / num_ebr);
+    localparam mcu_slot_width = (mcus_per_ebr > 1) ? $clog2(mcus_per_ebr) : 1;
+    localparam ebr_size = (64 << mcu_slot_width);
+
     // Logic for tracking whether we're in padding or in the active part of the image
     reg [$clog2(width_pix + left_active_padding + right_active_padding + 2) - 1 : 0] x;
     reg [$clog2(height_pix + top_active_padding + bottom_active_padding + 2) - 1 : 0] y;
@@ -43,8 +54,8 @@ module camera_ingester(input                      clock,
 
     reg [2:0] px;
     reg [2:0] py;
-    reg [$clog2(width_pix / 8) - 1 : 0] mcux;
-    reg [$clog2(height_pix / 8) - 1 : 0] mcuy;
+    reg [$clog2(width_mcu) - 1 : 0] mcux;
+    reg [$clog2(height_mcu) - 1 : 0] mcuy;
 
     // Latches for preventing metastability.
     // prev[0] is the most recent, prev[1] is older.
@@ -83,8 +94,7 @@ module camera_ingester(input                      clock,
 
     reg new_mcu_row;
 
-    // TODO: does this name make sense given the consts used to size it?
-    reg [$clog2(ebr_size / 64) - 1 : 0] mcunum_div_num_ebr;
+    reg [mcu_slot_width - 1 : 0] mcunum_div_num_ebr;
     always @(posedge clock) begin
         if (nreset) begin
             // Advance logic for x and y pointers inside image.
@@ -149,51 +159,46 @@ module camera_ingester(input                      clock,
                 //    mcunum_div_num_ebr
                 //    mcux
                 //    frontbuffer_select
-                if (px == 'h7) begin
+                // Every line starts over at EBR 0, even if the last MCU of the line didn't land
+                // in the last EBR because the MCUs don't divide evenly between the EBRs.
+                if ((px == 'h7) && (mcux == (width_mcu - 1))) begin
+                    output_block_select <= 'h0;
+                    mcunum_div_num_ebr <= 'h0;
+                end else if (px == 'h7) begin
                     if (output_block_select == (num_ebr - 1)) begin
                         output_block_select <= 'h0;
+                        mcunum_div_num_ebr <= mcunum_div_num_ebr + 'h1;
                     end else begin
                         output_block_select <= output_block_select + 'h1;
+                        mcunum_div_num_ebr <= mcunum_div_num_ebr;
                     end
                 end else begin
                     output_block_select <= output_block_select;
+                    mcunum_div_num_ebr <= mcunum_div_num_ebr;
                 end
 
                 px <= (px == 'h7) ? ('h0) : (px + 'h1);
 
-                if ((px == 'h7) && (output_block_select == (num_ebr - 1))) begin
-                    // even though this condition doesn't directly check that mcunum_div_num_ebr
-                    // won't overflow the size of an EBR (for instance, a value of 8 for
-                    // mcunum_div_num_ebr would try to deposit line 0 of an MCU outside of an EBR),
-                    // we are still guaranteed by our precompile condition of
-                    // ((width_pix * 8) >= (num_ebr * ebr_size)) that this won't happen.
-                    if (mcux == ((width_pix / 8) - 1)) begin
-                        mcunum_div_num_ebr <= 'h0;
-                    end else begin
-                        mcunum_div_num_ebr <= mcunum_div_num_ebr + 'h1;
-                    end
-                end else begin
-                    mcunum_div_num_ebr <= mcunum_div_num_ebr;
-                end
-
                 // mcux
                 if (px == 'h7) begin
-                    mcux <= (mcux == ((width_pix / 8) - 1)) ? 'h0 : (mcux + 'h1);
+                    mcux <= (mcux == (width_mcu - 1)) ? 'h0 : (mcux + 'h1);
                 end else begin
                     mcux <= mcux;
                 end
 
-                py <= ((px == 'h7) && (mcux == ((width_pix / 8) - 1))) ? (py + 'h1) : py;
+                py <= ((px == 'h7) && (mcux == (width_mcu - 1))) ? (py + 'h1) : py;
                 mcuy <= mcuy;
                 frontbuffer_select <= new_mcu_row ? (frontbuffer_select + 'h1) : frontbuffer_select;
             end else begin
+                // frontbuffer_select isn't reset here. If there are an odd number of MCU rows,
+                // it's left at 1 after a frame, and setting it back to 0 would look like another
+                // MCU row to the DCT engines.
                 if (!vsync_prev[1]) begin
                     px <= 0; py <= 0;
                     mcux <= 0; mcuy <= 0;
 
                     output_block_select <= 0;
                     mcunum_div_num_ebr <= 0;
-                    frontbuffer_select <= 0;
                 end
             end
         end else begin
@@ -216,7 +221,7 @@ module camera_ingester(input                      clock,
         // this is a cheaper (mcunum_div_num_ebr * 64) + (py * 8) + px
         output_write_addr = {mcunum_div_num_ebr, py, px};
 
-        new_mcu_row = ((px == 'h7) && (mcux == ((width_pix / 8) - 1)) && (py == 'h7));
+        new_mcu_row = ((px == 'h7) && (mcux == (width_mcu - 1)) && (py == 'h7));
     end
 endmodule
 
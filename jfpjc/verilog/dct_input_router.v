@@ -0,0 +1,60 @@
+`timescale 1ns/100ps
+
+/**
+ * This routes the ingester's EBRs to the DCT engines when there aren't the same number of each.
+ *
+ * The ingester deals each MCU row out round-robin between num_ebrs EBRs: MCU n of a row goes into
+ * EBR (n % num_ebrs) at slot (n / num_ebrs). The DCT engines take the MCUs num_dcts at a time, so
+ * on run r of a row, DCT engine e works on MCU ((r * num_dcts) + e).
+ *
+ * All of the DCT engines are reset together, so they all fetch the same address on the same
+ * cycle. As long as no 2 of them ever need the same EBR during the same run, that means that each
+ * EBR just needs to be pointed at the right slot and each DCT engine needs to be muxed to the right
+ * EBR. num_dcts <= num_ebrs guarantees this, because any num_dcts MCUs in a row land in different
+ * EBRs.
+ *
+ * ebr_read_addrs, ebr_data and dct_data are flattened arrays; element i is at [(i * width) +: width].
+ */
+module dct_input_router(input                                         clock,
+
+                        input      [(mcu_group_width - 1):0]          mcu_group,
+                        input      [5:0]                              fetch_addr,
+
+                        output reg [((num_ebrs * ebr_addr_width) - 1):0] ebr_read_addrs,
+                        input      [((num_ebrs * 8) - 1):0]           ebr_data,
+
+                        output reg [((num_dcts * 8) - 1):0]           dct_data);
+    parameter num_ebrs = 5, num_dcts = 5, mcus_per_row = 40;
+
+    localparam mcu_groups_per_row = (mcus_per_row + num_dcts - 1) / num_dcts;
+    localparam mcu_group_width = (mcu_groups_per_row > 1) ? $clog2(mcu_groups_per_row) : 1;
+    localparam slots_per_ebr = (mcus_per_row + num_ebrs - 1) / num_ebrs;
+    localparam slot_width = (slots_per_ebr > 1) ? $clog2(slots_per_ebr) : 1;
+    localparam ebr_addr_width = slot_width + 6;
+    localparam ebr_index_width = (num_ebrs > 1) ? $clog2(num_ebrs) : 1;
+
+    // EBR and slot of the first MCU in this run. mcu_group changes at least 3 cycles before the
+    // DCT engines start fetching (see dct_reset_manager), so these can take a cycle to catch up.
+    reg [(ebr_index_width - 1):0] base_ebr;
+    reg [(slot_width - 1):0]      base_slot;
+    always @(posedge clock) begin
+        base_ebr <= (mcu_group * num_dcts) % num_ebrs;
+        base_slot <= (mcu_group * num_dcts) / num_ebrs;
+    end
+
+    integer i;
+    reg [ebr_index_width:0] dct_ebr;
+    always @* begin
+        // EBRs before base_ebr wrapped around; the MCUs they hold for this run are in the next slot.
+        for (i = 0; i < num_ebrs; i = i + 1) begin
+            ebr_read_addrs[(i * ebr_addr_width) +: ebr_addr_width] =
+                { ((i < base_ebr) ? (base_slot + 1'b1) : base_slot), fetch_addr };
+        end
+
+        for (i = 0; i < num_dcts; i = i + 1) begin
+            dct_ebr = base_ebr + i;
+            if (dct_ebr >= num_ebrs) dct_ebr = dct_ebr - num_ebrs;
+            dct_data[(i * 8) +: 8] = ebr_data[(dct_ebr * 8) +: 8];
+        end
+    end
+endmodule
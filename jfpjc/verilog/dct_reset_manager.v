@@ -8,6 +8,9 @@
  *
  * When the backbuffer changes, this state machine holds the DCT engines in reset for 3 clock
  * cycles, then sets them loose with new base addresses and output addresses.
+ *
+ * Every MCU row takes mcu_groups_per_row runs of the DCT engines; each run does one MCU from each
+ * of the ingester's EBRs.
  */
 module dct_reset_manager(input            clock,
                          input            nreset,
@@ -15,9 +18,11 @@ module dct_reset_manager(input            clock,
                          input            ingester_frontbuffer_select,
                          input            dcts_finished,
 
-                         output reg [2:0] mcu_groups_processed,
+                         output reg [(mcu_group_width - 1):0] mcu_groups_processed,
                          output reg [1:0] dcts_frontbuffer,
                          output reg       dct_nreset);
+    parameter mcu_groups_per_row = 8;
+    localparam mcu_group_width = (mcu_groups_per_row > 1) ? $clog2(mcu_groups_per_row) : 1;
 
 `define DCTS_STATE_WAIT_FRAMEBUFFER 3'h0
 `define DCTS_STATE_RESET 3'h1
@@ -69,7 +74,7 @@ module dct_reset_manager(input            clock,
                         dcts_frontbuffer <= dcts_frontbuffer;
                     end else if (dcts_finished) begin
                         mcu_groups_processed <= mcu_groups_processed + 'h1;
-                        if (mcu_groups_processed == 'h7) begin
+                        if (mcu_groups_processed == (mcu_groups_per_row - 1)) begin
                             DCTs_state <= `DCTS_STATE_WAIT_FRAMEBUFFER;
                             dcts_frontbuffer <= dcts_frontbuffer + 'h1;
                         end else begin
@@ -0,0 +1,420 @@
+`ifndef HUFFMAN_TABLE_BUILDER_V
+`define HUFFMAN_TABLE_BUILDER_V
+
+`timescale 1ns/100ps
+
+/**
+ * The huffman tables are specified the same way that a DHT segment specifies them: 16 bytes of
+ * BITS (how many codes there are of each length from 1 to 16) followed by HUFFVAL (the values
+ * that get those codes, shortest codes first). See section B.2.4.2 of the spec.
+ *
+ * This holds one of those specifications. jpeg_header_generator copies it straight into the DHT
+ * segment and huffman_table_builder turns it into the { bitlen, code } table that the encoder
+ * looks values up in, so the two can't disagree. Address 0 - 15 is BITS and address 16 onwards is
+ * HUFFVAL.
+ *
+ * Coming out of configuration, it holds the standard luminance tables from sections K.3 (ac = 0)
+ * and K.5 (ac = 1).
+ *
+ * Like an EBR, reads take one clock cycle.
+ */
+module huffman_spec_ram(input              clock,
+
+                        input              wren,
+                        input      [7:0]   waddr,
+                        input      [7:0]   wdata,
+
+                        input      [7:0]   raddr,
+                        output reg [7:0]   rdata);
+    parameter ac = 1;
+
+    reg [7:0] mem [0:255];
+
+    always @(posedge clock) begin
+        if (wren) mem[waddr] <= wdata;
+        rdata <= mem[raddr];
+    end
+
+    function [7:0] default_dc_bits;
+        input [3:0] length_minus_1;
+        begin
+            case (length_minus_1)
+                4'h1: default_dc_bits = 8'd1;
+                4'h2: default_dc_bits = 8'd5;
+                4'h3, 4'h4, 4'h5, 4'h6, 4'h7, 4'h8: default_dc_bits = 8'd1;
+                default: default_dc_bits = 8'd0;
+            endcase
+        end
+    endfunction
+
+    function [7:0] default_ac_bits;
+        input [3:0] length_minus_1;
+        begin
+            case (length_minus_1)
+                4'h1: default_ac_bits = 8'd2;
+                4'h2: default_ac_bits = 8'd1;
+                4'h3: default_ac_bits = 8'd3;
+                4'h4: default_ac_bits = 8'd3;
+                4'h5: default_ac_bits = 8'd2;
+                4'h6: default_ac_bits = 8'd4;
+                4'h7: default_ac_bits = 8'd3;
+                4'h8: default_ac_bits = 8'd5;
+                4'h9: default_ac_bits = 8'd5;
+                4'ha: default_ac_bits = 8'd4;
+                4'hb: default_ac_bits = 8'd4;
+                4'he: default_ac_bits = 8'd1;
+                4'hf: default_ac_bits = 8'd125;
+                default: default_ac_bits = 8'd0;
+            endcase
+        end
+    endfunction
+
+    function [7:0] default_ac_val;
+        input [7:0] k;
+        begin
+            case (k)
+                8'd0:   default_ac_val = 8'h01;
+                8'd1:   default_ac_val = 8'h02;
+                8'd2:   default_ac_val = 8'h03;
+                8'd3:   default_ac_val = 8'h00;
+                8'd4:   default_ac_val = 8'h04;
+                8'd5:   default_ac_val = 8'h11;
+                8'd6:   default_ac_val = 8'h05;
+                8'd7:   default_ac_val = 8'h12;
+                8'd8:   default_ac_val = 8'h21;
+                8'd9:   default_ac_val = 8'h31;
+                8'd10:  default_ac_val = 8'h41;
+                8'd11:  default_ac_val = 8'h06;
+                8'd12:  default_ac_val = 8'h13;
+                8'd13:  default_ac_val = 8'h51;
+                8'd14:  default_ac_val = 8'h61;
+                8'd15:  default_ac_val = 8'h07;
+                8'd16:  default_ac_val = 8'h22;
+                8'd17:  default_ac_val = 8'h71;
+                8'd18:  default_ac_val = 8'h14;
+                8'd19:  default_ac_val = 8'h32;
+                8'd20:  default_ac_val = 8'h81;
+                8'd21:  default_ac_val = 8'h91;
+                8'd22:  default_ac_val = 8'ha1;
+                8'd23:  default_ac_val = 8'h08;
+                8'd24:  default_ac_val = 8'h23;
+                8'd25:  default_ac_val = 8'h42;
+                8'd26:  default_ac_val = 8'hb1;
+                8'd27:  default_ac_val = 8'hc1;
+                8'd28:  default_ac_val = 8'h15;
+                8'd29:  default_ac_val = 8'h52;
+                8'd30:  default_ac_val = 8'hd1;
+                8'd31:  default_ac_val = 8'hf0;
+                8'd32:  default_ac_val = 8'h24;
+                8'd33:  default_ac_val = 8'h33;
+                8'd34:  default_ac_val = 8'h62;
+                8'd35:  default_ac_val = 8'h72;
+                8'd36:  default_ac_val = 8'h82;
+                8'd37:  default_ac_val = 8'h09;
+                8'd38:  default_ac_val = 8'h0a;
+                8'd39:  default_ac_val = 8'h16;
+                8'd40:  default_ac_val = 8'h17;
+                8'd41:  default_ac_val = 8'h18;
+                8'd42:  default_ac_val = 8'h19;
+                8'd43:  default_ac_val = 8'h1a;
+                8'd44:  default_ac_val = 8'h25;
+                8'd45:  default_ac_val = 8'h26;
+                8'd46:  default_ac_val = 8'h27;
+                8'd47:  default_ac_val = 8'h28;
+                8'd48:  default_ac_val = 8'h29;
+                8'd49:  default_ac_val = 8'h2a;
+                8'd50:  default_ac_val = 8'h34;
+                8'd51:  default_ac_val = 8'h35;
+                8'd52:  default_ac_val = 8'h36;
+                8'd53:  default_ac_val = 8'h37;
+                8'd54:  default_ac_val = 8'h38;
+                8'd55:  default_ac_val = 8'h39;
+                8'd56:  default_ac_val = 8'h3a;
+                8'd57:  default_ac_val = 8'h43;
+                8'd58:  default_ac_val = 8'h44;
+                8'd59:  default_ac_val = 8'h45;
+                8'd60:  default_ac_val = 8'h46;
+                8'd61:  default_ac_val = 8'h47;
+                8'd62:  default_ac_val = 8'h48;
+                8'd63:  default_ac_val = 8'h49;
+                8'd64:  default_ac_val = 8'h4a;
+                8'd65:  default_ac_val = 8'h53;
+                8'd66:  default_ac_val = 8'h54;
+                8'd67:  default_ac_val = 8'h55;
+                8'd68:  default_ac_val = 8'h56;
+                8'd69:  default_ac_val = 8'h57;
+                8'd70:  default_ac_val = 8'h58;
+                8'd71:  default_ac_val = 8'h59;
+                8'd72:  default_ac_val = 8'h5a;
+                8'd73:  default_ac_val = 8'h63;
+                8'd74:  default_ac_val = 8'h64;
+                8'd75:  default_ac_val = 8'h65;
+                8'd76:  default_ac_val = 8'h66;
+                8'd77:  default_ac_val = 8'h67;
+                8'd78:  default_ac_val = 8'h68;
+                8'd79:  default_ac_val = 8'h69;
+                8'd80:  default_ac_val = 8'h6a;
+                8'd81:  default_ac_val = 8'h73;
+                8'd82:  default_ac_val = 8'h74;
+                8'd83:  default_ac_val = 8'h75;
+                8'd84:  default_ac_val = 8'h76;
+                8'd85:  default_ac_val = 8'h77;
+                8'd86:  default_ac_val = 8'h78;
+                8'd87:  default_ac_val = 8'h79;
+                8'd88:  default_ac_val = 8'h7a;
+                8'd89:  default_ac_val = 8'h83;
+                8'd90:  default_ac_val = 8'h84;
+                8'd91:  default_ac_val = 8'h85;
+                8'd92:  default_ac_val = 8'h86;
+                8'd93:  default_ac_val = 8'h87;
+                8'd94:  default_ac_val = 8'h88;
+                8'd95:  default_ac_val = 8'h89;
+                8'd96:  default_ac_val = 8'h8a;
+                8'd97:  default_ac_val = 8'h92;
+                8'd98:  default_ac_val = 8'h93;
+                8'd99:  default_ac_val = 8'h94;
+                8'd100: default_ac_val = 8'h95;
+                8'd101: default_ac_val = 8'h96;
+                8'd102: default_ac_val = 8'h97;
+                8'd103: default_ac_val = 8'h98;
+                8'd104: default_ac_val = 8'h99;
+                8'd105: default_ac_val = 8'h9a;
+                8'd106: default_ac_val = 8'ha2;
+                8'd107: default_ac_val = 8'ha3;
+                8'd108: default_ac_val = 8'ha4;
+                8'd109: default_ac_val = 8'ha5;
+                8'd110: default_ac_val = 8'ha6;
+                8'd111: default_ac_val = 8'ha7;
+                8'd112: default_ac_val = 8'ha8;
+                8'd113: default_ac_val = 8'ha9;
+                8'd114: default_ac_val = 8'haa;
+                8'd115: default_ac_val = 8'hb2;
+                8'd116: default_ac_val = 8'hb3;
+                8'd117: default_ac_val = 8'hb4;
+                8'd118: default_ac_val = 8'hb5;
+                8'd119: default_ac_val = 8'hb6;
+                8'd120: default_ac_val = 8'hb7;
+                8'd121: default_ac_val = 8'hb8;
+                8'd122: default_ac_val = 8'hb9;
+                8'd123: default_ac_val = 8'hba;
+                8'd124: default_ac_val = 8'hc2;
+                8'd125: default_ac_val = 8'hc3;
+                8'd126: default_ac_val = 8'hc4;
+                8'd127: default_ac_val = 8'hc5;
+                8'd128: default_ac_val = 8'hc6;
+                8'd129: default_ac_val = 8'hc7;
+                8'd130: default_ac_val = 8'hc8;
+                8'd131: default_ac_val = 8'hc9;
+                8'd132: default_ac_val = 8'hca;
+                8'd133: default_ac_val = 8'hd2;
+                8'd134: default_ac_val = 8'hd3;
+                8'd135: default_ac_val = 8'hd4;
+                8'd136: default_ac_val = 8'hd5;
+                8'd137: default_ac_val = 8'hd6;
+                8'd138: default_ac_val = 8'hd7;
+                8'd139: default_ac_val = 8'hd8;
+                8'd140: default_ac_val = 8'hd9;
+                8'd141: default_ac_val = 8'hda;
+                8'd142: default_ac_val = 8'he1;
+                8'd143: default_ac_val = 8'he2;
+                8'd144: default_ac_val = 8'he3;
+                8'd145: default_ac_val = 8'he4;
+                8'd146: default_ac_val = 8'he5;
+                8'd147: default_ac_val = 8'he6;
+                8'd148: default_ac_val = 8'he7;
+                8'd149: default_ac_val = 8'he8;
+                8'd150: default_ac_val = 8'he9;
+                8'd151: default_ac_val = 8'hea;
+                8'd152: default_ac_val = 8'hf1;
+                8'd153: default_ac_val = 8'hf2;
+                8'd154: default_ac_val = 8'hf3;
+                8'd155: default_ac_val = 8'hf4;
+                8'd156: default_ac_val = 8'hf5;
+                8'd157: default_ac_val = 8'hf6;
+                8'd158: default_ac_val = 8'hf7;
+                8'd159: default_ac_val = 8'hf8;
+                8'd160: default_ac_val = 8'hf9;
+                8'd161: default_ac_val = 8'hfa;
+                default: default_ac_val = 8'h00;
+            endcase
+        end
+    endfunction
+
+    integer i;
+    initial begin
+        for (i = 0; i < 256; i = i + 1) begin
+            mem[i] = 8'h00;
+        end
+
+        if (ac) begin
+            for (i = 0; i < 16; i = i + 1) begin
+                mem[i] = default_ac_bits(i);
+            end
+            for (i = 0; i < 162; i = i + 1) begin
+                mem[16 + i] = default_ac_val(i);
+            end
+        end else begin
+            for (i = 0; i < 16; i = i + 1) begin
+                mem[i] = default_dc_bits(i);
+            end
+            for (i = 0; i < 12; i = i + 1) begin
+                mem[16 + i] = i;
+            end
+        end
+    end
+endmodule
+
+/**
+ * This turns a table specification in a huffman_spec_ram into the { bitlen - 1, code } entries
+ * that huffman_table_ram holds, with the procedure from section C.2 of the spec. It's the huffman
+ * table version of quant_reciprocal_builder: it starts by itself coming out of reset, and starts
+ * over whenever start is pulsed, so a host can pulse start after every byte it writes and the last
+ * build will see the whole specification.
+ *
+ * Every entry of the table is first written with the "no code" value { 4'hf, 16'h0000 }, which
+ * takes table_size cycles, and then every value in HUFFVAL takes 2 cycles. The standard AC table
+ * takes a bit over 600 cycles.
+ *
+ * num_values is the number of values in HUFFVAL. It's only meaningful while busy is low.
+ */
+module huffman_table_builder(input                 clock,
+                             input                 nreset,
+
+                             input                 start,
+
+                             // huffman_spec_ram read port; data is expected 1 cycle after the
+                             // address.
+                             output reg [7:0]      spec_addr,
+                             input      [7:0]      spec_data,
+
+                             // huffman_table_ram write port
+                             output reg            table_wren,
+                             output reg [7:0]      table_waddr,
+                             output reg [19:0]     table_wdata,
+
+                             output     [7:0]      num_values,
+                             output                busy);
+    parameter table_size = 256;
+
+`define HUFFMAN_BUILDER_STATE_IDLE 3'h0
+`define HUFFMAN_BUILDER_STATE_CLEAR 3'h1
+`define HUFFMAN_BUILDER_STATE_BITS_FETCH 3'h2
+`define HUFFMAN_BUILDER_STATE_BITS_LOAD 3'h3
+`define HUFFMAN_BUILDER_STATE_VAL_FETCH 3'h4
+`define HUFFMAN_BUILDER_STATE_VAL_WRITE 3'h5
+    reg  [2:0] state;
+
+    // code length that's being handed out, minus 1.
+    reg  [3:0] length_minus_1;
+    reg [15:0] code;
+
+    // number of codes of this length still to be handed out.
+    reg  [7:0] codes_left;
+
+    // address of the next HUFFVAL entry
+    reg  [7:0] value_index;
+
+    assign num_values = value_index - 8'd16;
+    assign busy = (state != `HUFFMAN_BUILDER_STATE_IDLE);
+
+    always @* begin
+        if (state == `HUFFMAN_BUILDER_STATE_BITS_FETCH) begin
+            spec_addr = { 4'h0, length_minus_1 };
+        end else begin
+            spec_addr = value_index;
+        end
+    end
+
+    always @(posedge clock) begin
+        if (nreset && start) begin
+            table_wren <= 1'b0;
+            table_waddr <= 8'h00;
+            state <= `HUFFMAN_BUILDER_STATE_CLEAR;
+        end else if (nreset) begin
+            case (state)
+                `HUFFMAN_BUILDER_STATE_IDLE: begin
+                    table_wren <= 1'b0;
+                    state <= `HUFFMAN_BUILDER_STATE_IDLE;
+                end
+
+                // table_waddr goes through every entry, starting from 0.
+                `HUFFMAN_BUILDER_STATE_CLEAR: begin
+                    table_wren <= 1'b1;
+                    table_waddr <= table_wren ? (table_waddr + 8'h01) : 8'h00;
+                    table_wdata <= { 4'hf, 16'h0000 };
+
+                    length_minus_1 <= 4'h0;
+                    code <= 16'h0000;
+                    value_index <= 8'd16;
+                    if (table_wren && (table_waddr == (table_size - 2))) begin
+                        state <= `HUFFMAN_BUILDER_STATE_BITS_FETCH;
+                    end else begin
+                        state <= `HUFFMAN_BUILDER_STATE_CLEAR;
+                    end
+                end
+
+                // spec_addr is BITS[length_minus_1] on this cycle.
+                `HUFFMAN_BUILDER_STATE_BITS_FETCH: begin
+                    table_wren <= 1'b0;
+                    state <= `HUFFMAN_BUILDER_STATE_BITS_LOAD;
+                end
+
+                `HUFFMAN_BUILDER_STATE_BITS_LOAD: begin
+                    table_wren <= 1'b0;
+                    codes_left <= spec_data;
+                    if (spec_data != 8'h00) begin
+                        state <= `HUFFMAN_BUILDER_STATE_VAL_FETCH;
+                    end else if (length_minus_1 == 4'hf) begin
+                        state <= `HUFFMAN_BUILDER_STATE_IDLE;
+                    end else begin
+                        length_minus_1 <= length_minus_1 + 4'h1;
+                        code <= code << 1;
+                        state <= `HUFFMAN_BUILDER_STATE_BITS_FETCH;
+                    end
+                end
+
+                // spec_addr is HUFFVAL[value_index - 16] on this cycle.
+                `HUFFMAN_BUILDER_STATE_VAL_FETCH: begin
+                    table_wren <= 1'b0;
+                    state <= `HUFFMAN_BUILDER_STATE_VAL_WRITE;
+                end
+
+                `HUFFMAN_BUILDER_STATE_VAL_WRITE: begin
+                    table_wren <= 1'b1;
+                    table_waddr <= spec_data;
+                    table_wdata <= { length_minus_1, code };
+
+                    codes_left <= codes_left - 8'h01;
+                    value_index <= value_index + 8'h01;
+                    if (value_index == 8'hff) begin
+                        // the spec ran off the end of the memory; it isn't a valid table anyways.
+                        state <= `HUFFMAN_BUILDER_STATE_IDLE;
+                    end else if (codes_left != 8'h01) begin
+                        code <= code + 16'h0001;
+                        state <= `HUFFMAN_BUILDER_STATE_VAL_FETCH;
+                    end else if (length_minus_1 == 4'hf) begin
+                        state <= `HUFFMAN_BUILDER_STATE_IDLE;
+                    end else begin
+                        length_minus_1 <= length_minus_1 + 4'h1;
+                        code <= (code + 16'h0001) << 1;
+                        state <= `HUFFMAN_BUILDER_STATE_BITS_FETCH;
+                    end
+                end
+
+                default: begin
+                    table_wren <= 1'b0;
+                    state <= `HUFFMAN_BUILDER_STATE_IDLE;
+                end
+            endcase
+        end else begin
+            // build the table as soon as we come out of reset.
+            state <= `HUFFMAN_BUILDER_STATE_CLEAR;
+            table_wren <= 1'b0;
+            table_waddr <= 8'h00;
+            table_wdata <= 20'h00000;
+            value_index <= 8'd16;
+        end
+    end
+endmodule
+
+`endif
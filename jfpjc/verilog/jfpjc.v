@@ -5,9 +5,50 @@
  * which represent a jpeg image.
  *
  * The image is first pulled into a double-buffered bank of iCE40 EBRs, with each bank consisting
- * of 5 EBRs. The input buffer therefore requires 10 EBRs in total.
+ * of num_ingester_ebrs EBRs. Each bank holds one MCU row, so at 320 pixels wide with 5 EBRs per
+ * bank, the input buffer requires 10 EBRs in total. Wider frames need more memory per bank; yosys
+ * will build each one out of however many EBRs it takes.
  *
- * After this, a configurable number of DCT engines read from each of the EBRs in sequence
+ * After this, num_dcts DCT engines take the MCUs in each row num_dcts at a time; dct_input_router
+ * hooks each one up to whichever EBR its MCU is in. num_dcts can't be more than num_ingester_ebrs.
+ * Fewer DCT engines take less logic but need a slower pixel clock to keep up.
+ *
+ * width_pix and height_pix set the frame size. Both need to be multiples of 8; width_pix doesn't
+ * need to be a multiple of 40.
+ *
+ * What comes out of data_out while hsync is high is a complete JFIF file for every frame:
+ * jpeg_header_generator puts out SOI through SOS when the camera starts a frame, then the
+ * entropy-coded data comes out of the bytestuffer, then jpeg_header_generator puts out EOI. vsync
+ * is high from the first byte of the header until the EOI.
+ *
+ * If the restart interval isn't 0, an RSTn marker goes into the entropy-coded data after every
+ * restart_interval MCUs (except after the last one in the frame), and a DRI segment goes into the
+ * header. At each one, the huffman encoder's DC prediction starts over, the bitpacker pads out to
+ * a byte with 1's, and the marker goes through the bytestuffer without being stuffed. The marker
+ * is preceded by up to 5 0xff fill bytes, which the spec allows in front of any marker. The
+ * restart interval comes up as the restart_interval parameter.
+ *
+ * The quantization and huffman tables can be rewritten at runtime through the cfg_* port, which
+ * is a plain parallel register interface; an SPI slave or a wishbone bridge can sit in front of it.
+ * On every clock cycle where cfg_wren is high, cfg_wdata is written to the byte picked by
+ * cfg_addr:
+ *
+ *     cfg_addr[9:8] == 2'b00    quantization table entry cfg_addr[5:0], in zig-zag order
+ *     cfg_addr[9:8] == 2'b01    byte cfg_addr[7:0] of the DC huffman table specification
+ *     cfg_addr[9:8] == 2'b10    byte cfg_addr[7:0] of the AC huffman table specification
+ *     cfg_addr[9:8] == 2'b11    control registers:
+ *                                   8'h00    restart interval in MCUs [7:0]
+ *                                   8'h01    restart interval in MCUs [15:8]
+ *
+ * Huffman table specifications are laid out the way they are in a DHT segment: 16 bytes of BITS
+ * followed by HUFFVAL (see huffman_spec_ram). Every write kicks off a rebuild of the table that
+ * the hardware actually uses (the reciprocal table or the huffman code table), which takes up to
+ * about 1000 cycles after the last write. The DQT and DHT segments are read straight out of the
+ * same memories, so the header always matches the tables that the frame was compressed with.
+ *
+ * Tables and control registers should only be written between frames: after vsync falls and
+ * before the camera starts the next frame. Otherwise, one frame will be compressed with a mix of
+ * the old and new settings.
  */
 
 `timescale 1ns/100ps
@@ -20,17 +61,50 @@ module jfpjc(input                      nreset,
              input                      hm01b0_hsync,
              input                      hm01b0_vsync,
 
+             input                      cfg_wren,
+             input [9:0]                cfg_addr,
+             input [7:0]                cfg_wdata,
+
              output                     hsync,
              output reg                 vsync,
              output     [7:0]           data_out);
     parameter quant_table_file = "";
+    parameter width_pix = 320, height_pix = 240;
+    parameter restart_interval = 0;
+
+    localparam width_mcu = (width_pix / 8), height_mcu = (height_pix / 8);
+    localparam mcus_per_frame = width_mcu * height_mcu;
+
+    parameter num_ingester_ebrs = 5, num_dcts = 5;
+
+    // The MCUs in each MCU row are dealt out round-robin between the ingester EBRs; see
+    // camera_ingester. Each EBR holds ingester_slots_per_ebr MCUs.
+    localparam ingester_slots_per_ebr = (width_mcu + num_ingester_ebrs - 1) / num_ingester_ebrs;
+    localparam ingester_slot_width = (ingester_slots_per_ebr > 1) ? $clog2(ingester_slots_per_ebr) : 1;
+    localparam ingester_ebr_addr_width = ingester_slot_width + 6;
+    localparam ingester_ebr_select_width = (num_ingester_ebrs > 1) ? $clog2(num_ingester_ebrs) : 1;
+
+    // The DCT engines go through each MCU row num_dcts MCUs at a time.
+    localparam mcu_groups_per_row = (width_mcu + num_dcts - 1) / num_dcts;
+    localparam mcu_group_width = (mcu_groups_per_row > 1) ? $clog2(mcu_groups_per_row) : 1;
+    localparam dct_index_width = (num_dcts > 1) ? $clog2(num_dcts) : 1;
+
+`ifndef YOSYS
+    initial begin
+        if (num_dcts > num_ingester_ebrs) begin
+            $display("jfpjc: num_dcts (%0d) can't be more than num_ingester_ebrs (%0d)",
+                     num_dcts, num_ingester_ebrs);
+            $finish;
+        end
+    end
+`endif
 
 
     ////////////////////////////////////////////////////////////////
     // ingester and ingester buffers
-    wire [2:0] ingester_output_block_select;
+    wire [(ingester_ebr_select_width - 1):0] ingester_output_block_select;
     wire       ingester_frontbuffer_select;
-    wire [8:0] ingester_output_write_addr;
+    wire [(ingester_ebr_addr_width - 1):0] ingester_output_write_addr;
     wire [7:0] ingester_output_pixval;
     wire       ingester_wren;
 
@@ -39,7 +113,7 @@ module jfpjc(input                      nreset,
     // int8 on [-128, 128)
     wire [7:0] adjusted_ingester_output_pixval = ingester_output_pixval + 8'h80;
 
-    reg [8:0] dct_buffer_fetch_addr [0:4];
+    wire [((num_ingester_ebrs * ingester_ebr_addr_width) - 1):0] dct_buffer_fetch_addrs;
 
     camera_ingester ingester(.nreset(nreset),
                              .clock(clock),
@@ -54,23 +128,33 @@ module jfpjc(input                      nreset,
                              .output_write_addr(ingester_output_write_addr),
                              .output_pixval(ingester_output_pixval),
                              .wren(ingester_wren));
+    defparam ingester.width_pix = width_pix;
+    defparam ingester.height_pix = height_pix;
+    defparam ingester.num_ebr = num_ingester_ebrs;
 
-    // 10x EBR
+    // 2 * num_ingester_ebrs EBRs
     genvar ingester_ebrs_gi;
 
     integer ingester_ebrs_gj;
-    wire [7:0] ingester_block_dout [0:9];
-    wire ingester_block_wren[0:9];
+    wire [7:0] ingester_block_dout [0:((2 * num_ingester_ebrs) - 1)];
+    wire ingester_block_wren[0:((2 * num_ingester_ebrs) - 1)];
+
+    // whichever bank the ingester isn't writing to, flattened for dct_input_router.
+    wire [((num_ingester_ebrs * 8) - 1):0] ingester_backbuffer_dout;
     generate
-        for (ingester_ebrs_gi = 0; ingester_ebrs_gi < 10; ingester_ebrs_gi = ingester_ebrs_gi + 1) begin: ebrs
-            if (ingester_ebrs_gi < 5) begin
+        for (ingester_ebrs_gi = 0; ingester_ebrs_gi < (2 * num_ingester_ebrs); ingester_ebrs_gi = ingester_ebrs_gi + 1) begin: ebrs
+            if (ingester_ebrs_gi < num_ingester_ebrs) begin
                 assign ingester_block_wren[ingester_ebrs_gi] =
-                    ((ingester_output_block_select == (ingester_ebrs_gi % 5)) &&
+                    ((ingester_output_block_select == (ingester_ebrs_gi % num_ingester_ebrs)) &&
                      (ingester_wren) &&
                      (ingester_frontbuffer_select == 1'h0));
+                assign ingester_backbuffer_dout[(ingester_ebrs_gi * 8) +: 8] =
+                    ((ingester_frontbuffer_select + 1'h1) == 1'h0) ?
+                    ingester_block_dout[ingester_ebrs_gi] :
+                    ingester_block_dout[ingester_ebrs_gi + num_ingester_ebrs];
             end else begin
                 assign ingester_block_wren[ingester_ebrs_gi] =
-                    ((ingester_output_block_select == (ingester_ebrs_gi % 5)) &&
+                    ((ingester_output_block_select == (ingester_ebrs_gi % num_ingester_ebrs)) &&
                      (ingester_wren) &&
                      (ingester_frontbuffer_select == 1'h1));
             end
@@ -78,18 +162,19 @@ module jfpjc(input                      nreset,
             // The camera values are uint8 on [0, 256), so we subtract 128 from each value to
             // int8 on [-128, 128)
 
-            ice40_ebr jpeg_buffer(.din(adjusted_ingester_output_pixval),
-                                  .write_en(ingester_block_wren[ingester_ebrs_gi]),
-                                  .waddr(ingester_output_write_addr),
-                                  .wclk(clock),
-                                  .raddr(dct_buffer_fetch_addr[ingester_ebrs_gi % 5]),
-                                  .rclk(clock),
-                                  .dout(ingester_block_dout[ingester_ebrs_gi]));
+            ice40_ebr #(.addr_width(ingester_ebr_addr_width), .data_width(8))
+                jpeg_buffer(.din(adjusted_ingester_output_pixval),
+                            .write_en(ingester_block_wren[ingester_ebrs_gi]),
+                            .waddr(ingester_output_write_addr),
+                            .wclk(clock),
+                            .raddr(dct_buffer_fetch_addrs[((ingester_ebrs_gi % num_ingester_ebrs) * ingester_ebr_addr_width) +: ingester_ebr_addr_width]),
+                            .rclk(clock),
+                            .dout(ingester_block_dout[ingester_ebrs_gi]));
 
             // zero buffer
 `ifndef YOSYS
             initial begin
-                for (ingester_ebrs_gj = 0; ingester_ebrs_gj < 512; ingester_ebrs_gj = ingester_ebrs_gj + 1) begin
+                for (ingester_ebrs_gj = 0; ingester_ebrs_gj < (1 << ingester_ebr_addr_width); ingester_ebrs_gj = ingester_ebrs_gj + 1) begin
                     jpeg_buffer.mem[ingester_ebrs_gj] = 'h0;
                 end
             end
@@ -99,27 +184,34 @@ module jfpjc(input                      nreset,
 
     ////////////////////////////////////////////////////////////////
     // DCT engines
-    // Note that the 5 EBRs here make a special case where I can just have 1 DCT engine per EBR. In
-    // other cases, I'd need a routing network between the EBRs and the DCT engines to correctly
-    // distribute N EBRs worth of data over M DCT engines.
     wire [1:0] dcts_frontbuffer;
     wire       dct_nreset;
-    wire [5:0] dct_fetch_addr [0:4];
-    wire [4:0] dcts_finished;
-    wire [2:0] mcu_groups_processed;
+    wire [5:0] dct_fetch_addr [0:(num_dcts - 1)];
+    wire [(num_dcts - 1):0] dcts_finished;
+    wire [(mcu_group_width - 1):0] mcu_groups_processed;
     wire [7:0] dct_output_read_addr;
-    wire signed [15:0] dct_output_read_data [0:4];
-
-    // 5 * (1 + 1) ebr (10x ebr)
+    wire signed [15:0] dct_output_read_data [0:(num_dcts - 1)];
+    wire [((num_dcts * 8) - 1):0] dct_src_data;
+
+    // The DCT engines all run in lockstep, so engine 0's fetch address is everyone's.
+    dct_input_router router(.clock(clock),
+                            .mcu_group(mcu_groups_processed),
+                            .fetch_addr(dct_fetch_addr[0]),
+                            .ebr_read_addrs(dct_buffer_fetch_addrs),
+                            .ebr_data(ingester_backbuffer_dout),
+                            .dct_data(dct_src_data));
+    defparam router.num_ebrs = num_ingester_ebrs;
+    defparam router.num_dcts = num_dcts;
+    defparam router.mcus_per_row = width_mcu;
+
+    // num_dcts * (1 + 1) ebr
     genvar dcts_i;
     generate
-        for (dcts_i = 0; dcts_i < 5; dcts_i = dcts_i + 1) begin: dcts
+        for (dcts_i = 0; dcts_i < num_dcts; dcts_i = dcts_i + 1) begin: dcts
             wire [5:0] dct_result_write_addr;
             wire       dct_result_wren;
             wire signed [7:0] src_data_in;
-            assign src_data_in = ((ingester_frontbuffer_select + 1'h1) == 1'h0) ?
-                                 ingester_block_dout[dcts_i] :
-                                 ingester_block_dout[dcts_i + 5];
+            assign src_data_in = dct_src_data[(dcts_i * 8) +: 8];
 
             wire signed [15:0] dct_result_out;
             loeffler_dct_88 dct(.clock(clock),
@@ -149,12 +241,6 @@ module jfpjc(input                      nreset,
                                                                         .rclk(clock),
                                                                         .dout(dct_output_read_data[dcts_i]));
         end
-
-        for (dcts_i = 0; dcts_i < 5; dcts_i = dcts_i + 1) begin: dct_addrs
-            always @* begin
-                dct_buffer_fetch_addr[dcts_i] = { mcu_groups_processed, dct_fetch_addr[dcts_i] };
-            end
-        end
     endgenerate
 
     ////////////////////////////////////////////////////////////////
@@ -166,13 +252,14 @@ module jfpjc(input                      nreset,
                                   .mcu_groups_processed(mcu_groups_processed),
                                   .dcts_frontbuffer(dcts_frontbuffer),
                                   .dct_nreset(dct_nreset));
+    defparam dct_manager.mcu_groups_per_row = mcu_groups_per_row;
 
     ////////////////////////////////////////////////////////////////
     // quantizer
     wire [1:0] quantizer_readbuf;
     wire [5:0] coefficient_index;
     reg [5:0] coefficient_index_delay;
-    wire [2:0] ebr_index;
+    wire [(dct_index_width - 1):0] ebr_index;
     wire [1:0] quantizer_output_buffer;
     wire dividend_divisor_valid;
     always @(posedge clock) coefficient_index_delay <= coefficient_index;
@@ -184,9 +271,11 @@ module jfpjc(input                      nreset,
                                             .ebr_index(ebr_index),
                                             .quantizer_output_buffer(quantizer_output_buffer),
                                             .dividend_divisor_valid(dividend_divisor_valid));
+    defparam quantizer_manager.num_dcts = num_dcts;
+    defparam quantizer_manager.mcus_per_row = width_mcu;
 
     wire signed [15:0] dividend;
-    wire        [7:0] divisor;
+    wire       [15:0] reciprocal;
     reg         [7:0] quotient_tag_in;
 
     wire [5:0] zigzagged_coefficient_index;
@@ -195,18 +284,54 @@ module jfpjc(input                      nreset,
     assign dct_output_read_addr = { quantizer_readbuf, zigzagged_coefficient_index };
     assign dividend = dct_output_read_data[ebr_index];
 
-    // entries in the quantization table shall be stored in zig-zag order.
-    // 1 EBR
-    ice40_ebr #(.addr_width(9), .data_width(8)) quantization_table_ebr(.din(8'h00),
-                                                                       .write_en(1'b0),
-                                                                       .waddr(9'h00),
-                                                                       .wclk(1'b0),
+    // jpeg_header_generator reads the tables while it's putting out the header; the table
+    // builders get them the rest of the time.
+    wire [7:0] header_table_addr;
+    wire       header_generator_busy;
 
-                                                                       .raddr({ 3'h0, coefficient_index }),
+    // entries in the quantization table shall be stored in zig-zag order.
+    // The quantizer doesn't read it directly; it gets turned into a table of reciprocals (see
+    // reciprocal_quantizer.v) right after reset and after every write over the cfg port.
+    // 2 EBR
+    wire       quant_table_wren = cfg_wren && (cfg_addr[9:8] == 2'b00);
+    wire [5:0] quant_table_read_addr;
+    wire [5:0] reciprocal_builder_read_addr;
+    wire [7:0] quant_table_read_data;
+    assign quant_table_read_addr = header_generator_busy ? header_table_addr[5:0] :
+                                                           reciprocal_builder_read_addr;
+    ice40_ebr #(.addr_width(9), .data_width(8)) quantization_table_ebr(.din(cfg_wdata[7:0]),
+                                                                       .write_en(quant_table_wren),
+                                                                       .waddr({ 3'h0, cfg_addr[5:0] }),
+                                                                       .wclk(clock),
+
+                                                                       .raddr({ 3'h0, quant_table_read_addr }),
                                                                        .rclk(clock),
-                                                                       .dout(divisor));
+                                                                       .dout(quant_table_read_data));
     defparam quantization_table_ebr.init_file = quant_table_file;
 
+    wire        reciprocal_wren;
+    wire  [5:0] reciprocal_waddr;
+    wire [15:0] reciprocal_wdata;
+    wire        reciprocal_builder_busy;
+    quant_reciprocal_builder reciprocal_builder(.clock(clock),
+                                                .nreset(nreset),
+                                                .start(quant_table_wren),
+                                                .quant_table_addr(reciprocal_builder_read_addr),
+                                                .quant_table_data(quant_table_read_data),
+                                                .reciprocal_wren(reciprocal_wren),
+                                                .reciprocal_waddr(reciprocal_waddr),
+                                                .reciprocal_data(reciprocal_wdata),
+                                                .busy(reciprocal_builder_busy));
+
+    ice40_ebr #(.addr_width(8), .data_width(16)) reciprocal_table_ebr(.din(reciprocal_wdata),
+                                                                      .write_en(reciprocal_wren),
+                                                                      .waddr({ 2'h0, reciprocal_waddr }),
+                                                                      .wclk(clock),
+
+                                                                      .raddr({ 2'h0, coefficient_index }),
+                                                                      .rclk(clock),
+                                                                      .dout(reciprocal));
+
 //`define SHIFT_INSTEAD_OF_DIVIDE
 `ifdef SHIFT_INSTEAD_OF_DIVIDE
     reg signed [15:0] quotient;
@@ -233,36 +358,135 @@ module jfpjc(input                      nreset,
     wire signed [15:0] quotient;
     wire         [7:0] quotient_tag;
     wire               quotient_valid;
-    pipelined_divider divider(.nreset(nreset),
-                              .clock(clock),
-
-                              .dividend(dividend),
-                              .divisor(divisor),
-                              .tag({ quantizer_output_buffer, coefficient_index_delay }),
-                              .input_valid(dividend_divisor_valid),
-
-                              .quotient(quotient),
-                              .tag_out(quotient_tag),
-                              .output_valid(quotient_valid));
-    defparam divider.dividend_width = 16;
-    defparam divider.divisor_width  = 8;
+    reciprocal_quantizer quantizer(.nreset(nreset),
+                                   .clock(clock),
+
+                                   .dividend(dividend),
+                                   .reciprocal(reciprocal),
+                                   .tag({ quantizer_output_buffer, coefficient_index_delay }),
+                                   .input_valid(dividend_divisor_valid),
+
+                                   .quotient(quotient),
+                                   .tag_out(quotient_tag),
+                                   .output_valid(quotient_valid));
 `endif
 
+    // The huffman encoder reads 2 coefficients a cycle, so there are 2 copies of the quotient
+    // buffer that always get written together.
     reg [1:0] huffman_encoder_buffer_sel;
-    wire [5:0] huffman_encoder_fetch_addr;
-    wire [15:0] huffman_encoder_src_data_in;
+    wire [5:0] huffman_encoder_fetch_addr_0, huffman_encoder_fetch_addr_1;
+    wire [15:0] huffman_encoder_src_data_in_0, huffman_encoder_src_data_in_1;
     ice40_ebr #(.addr_width(8), .data_width(16))
-        quotient_output_mem(.din(quotient),
-                            .write_en(quotient_valid),
-                            .waddr(quotient_tag),
-                            .wclk(clock),
-                            .raddr({ huffman_encoder_buffer_sel, huffman_encoder_fetch_addr }),
-                            .rclk(clock),
-                            .dout(huffman_encoder_src_data_in));
+        quotient_output_mem_0(.din(quotient),
+                              .write_en(quotient_valid),
+                              .waddr(quotient_tag),
+                              .wclk(clock),
+                              .raddr({ huffman_encoder_buffer_sel, huffman_encoder_fetch_addr_0 }),
+                              .rclk(clock),
+                              .dout(huffman_encoder_src_data_in_0));
+
+    ice40_ebr #(.addr_width(8), .data_width(16))
+        quotient_output_mem_1(.din(quotient),
+                              .write_en(quotient_valid),
+                              .waddr(quotient_tag),
+                              .wclk(clock),
+                              .raddr({ huffman_encoder_buffer_sel, huffman_encoder_fetch_addr_1 }),
+                              .rclk(clock),
+                              .dout(huffman_encoder_src_data_in_1));
+
+    // One bit per coefficient in each quotient buffer saying whether it's got a nonzero coded
+    // value, so the encoder can skip straight over runs of zeros. Every bit of a buffer gets
+    // written again when the quantizer fills it, so these never need to be cleared.
+    reg [255:0] quotient_nonzero;
+    always @(posedge clock) begin
+        if (quotient_valid) begin
+            quotient_nonzero[quotient_tag] <= ((quotient != 16'sh0000) && (quotient != 16'sh8000));
+        end
+    end
+
 
+    ////////////////////////////////////////////////////////////////
+    // huffman tables
+    //
+    // The cfg port writes DHT-style table specifications; huffman_table_builders turn them into
+    // the code tables inside the encoder.
+    wire       dc_spec_wren = cfg_wren && (cfg_addr[9:8] == 2'b01);
+    wire       ac_spec_wren = cfg_wren && (cfg_addr[9:8] == 2'b10);
+    wire [7:0] dc_spec_builder_addr, ac_spec_builder_addr;
+    wire [7:0] dc_spec_read_data, ac_spec_read_data;
+    huffman_spec_ram dc_spec(.clock(clock),
+                             .wren(dc_spec_wren),
+                             .waddr(cfg_addr[7:0]),
+                             .wdata(cfg_wdata),
+                             .raddr(header_generator_busy ? header_table_addr : dc_spec_builder_addr),
+                             .rdata(dc_spec_read_data));
+    defparam dc_spec.ac = 0;
+
+    huffman_spec_ram ac_spec(.clock(clock),
+                             .wren(ac_spec_wren),
+                             .waddr(cfg_addr[7:0]),
+                             .wdata(cfg_wdata),
+                             .raddr(header_generator_busy ? header_table_addr : ac_spec_builder_addr),
+                             .rdata(ac_spec_read_data));
+    defparam ac_spec.ac = 1;
+
+    wire        dc_table_wren, ac_table_wren;
+    wire  [7:0] dc_table_waddr, ac_table_waddr;
+    wire [19:0] dc_table_wdata, ac_table_wdata;
+    wire  [7:0] dc_num_values, ac_num_values;
+    wire        dc_builder_busy, ac_builder_busy;
+    huffman_table_builder dc_builder(.clock(clock),
+                                     .nreset(nreset),
+                                     .start(dc_spec_wren),
+                                     .spec_addr(dc_spec_builder_addr),
+                                     .spec_data(dc_spec_read_data),
+                                     .table_wren(dc_table_wren),
+                                     .table_waddr(dc_table_waddr),
+                                     .table_wdata(dc_table_wdata),
+                                     .num_values(dc_num_values),
+                                     .busy(dc_builder_busy));
+    defparam dc_builder.table_size = 16;
+
+    huffman_table_builder ac_builder(.clock(clock),
+                                     .nreset(nreset),
+                                     .start(ac_spec_wren),
+                                     .spec_addr(ac_spec_builder_addr),
+                                     .spec_data(ac_spec_read_data),
+                                     .table_wren(ac_table_wren),
+                                     .table_waddr(ac_table_waddr),
+                                     .table_wdata(ac_table_wdata),
+                                     .num_values(ac_num_values),
+                                     .busy(ac_builder_busy));
+    defparam ac_builder.table_size = 256;
+
+    ////////////////////////////////////////////////////////////////
+    // control registers
+    reg [15:0] restart_interval_mcus;
+    always @(posedge clock) begin
+        if (nreset) begin
+            if (cfg_wren && (cfg_addr == 10'h300)) begin
+                restart_interval_mcus <= { restart_interval_mcus[15:8], cfg_wdata };
+            end else if (cfg_wren && (cfg_addr == 10'h301)) begin
+                restart_interval_mcus <= { cfg_wdata, restart_interval_mcus[7:0] };
+            end else begin
+                restart_interval_mcus <= restart_interval_mcus;
+            end
+        end else begin
+            restart_interval_mcus <= restart_interval;
+        end
+    end
 
-    reg [10 : 0] num_mcus_encoded_this_frame;
-    wire huffman_encoder_done_this_frame = (num_mcus_encoded_this_frame >= 1200);
+    ////////////////////////////////////////////////////////////////
+    // huffman encoder
+    reg [$clog2(mcus_per_frame + 1) - 1 : 0] num_mcus_encoded_this_frame;
+
+    // MCUs encoded since the last restart marker. When there's a restart marker to put in,
+    // restart_pending holds off the next MCU until the bitpacker flush FSM has written it.
+    reg [15:0] mcus_since_restart;
+    reg        restart_pending;
+    wire       restart_marker_written;
+    wire       restart_enabled = (restart_interval_mcus != 16'h0000);
+    wire huffman_encoder_done_this_frame = (num_mcus_encoded_this_frame >= mcus_per_frame);
     wire huffman_encoder_output_wren;
     wire [31:0] huffman_encoder_output_data;
     wire [5:0] huffman_encoder_output_length;
@@ -271,9 +495,20 @@ module jfpjc(input                      nreset,
     jpeg_huffman_encode encoder(.clock(clock),
                                 .nreset(nreset && (!huffman_encoder_done_this_frame)),
                                 .start(huffman_encoder_start),
+                                .reset_prediction(restart_enabled && (mcus_since_restart == 16'h0000)),
 
-                                .fetch_addr(huffman_encoder_fetch_addr),
-                                .src_data_in(huffman_encoder_src_data_in),
+                                .fetch_addr_0(huffman_encoder_fetch_addr_0),
+                                .fetch_addr_1(huffman_encoder_fetch_addr_1),
+                                .src_data_in_0(huffman_encoder_src_data_in_0),
+                                .src_data_in_1(huffman_encoder_src_data_in_1),
+                                .nonzero(quotient_nonzero[{ huffman_encoder_buffer_sel, 6'h00 } +: 64]),
+
+                                .dc_table_wren(dc_table_wren),
+                                .dc_table_waddr(dc_table_waddr[3:0]),
+                                .dc_table_wdata(dc_table_wdata),
+                                .ac_table_wren(ac_table_wren),
+                                .ac_table_waddr(ac_table_waddr),
+                                .ac_table_wdata(ac_table_wdata),
 
                                 .output_wren(huffman_encoder_output_wren),
                                 .output_length(huffman_encoder_output_length),
@@ -303,6 +538,26 @@ module jfpjc(input                      nreset,
                 num_mcus_encoded_this_frame <= num_mcus_encoded_this_frame;
             end
 
+            // there's no restart marker after the last MCU in the frame; EOI takes its place.
+            if ((!vsync_prev[2] && vsync_prev[1]) || !restart_enabled) begin
+                mcus_since_restart <= 16'h0000;
+                restart_pending <= 1'b0;
+            end else if (!huffman_encoder_busy && huffman_encoder_busy_delay) begin
+                if ((mcus_since_restart + 16'h0001) == restart_interval_mcus) begin
+                    mcus_since_restart <= 16'h0000;
+                    restart_pending <= ((num_mcus_encoded_this_frame + 'h1) < mcus_per_frame);
+                end else begin
+                    mcus_since_restart <= mcus_since_restart + 16'h0001;
+                    restart_pending <= restart_pending;
+                end
+            end else if (restart_marker_written) begin
+                mcus_since_restart <= mcus_since_restart;
+                restart_pending <= 1'b0;
+            end else begin
+                mcus_since_restart <= mcus_since_restart;
+                restart_pending <= restart_pending;
+            end
+
             if (quotient_valid) begin
                 quotient_tag_next <= quotient_tag + 8'h1;
             end else begin
@@ -314,7 +569,8 @@ module jfpjc(input                      nreset,
             // "quotient_tag_next" to be
             if ((huffman_encoder_buffer_sel != (quotient_tag_next[7:6])) &&
                 (!huffman_encoder_busy_delay) &&
-                !huffman_encoder_done_this_frame) begin
+                !huffman_encoder_done_this_frame &&
+                !restart_pending) begin
                 huffman_encoder_start <= 1'b1;
             end else begin
                 huffman_encoder_start <= 1'b0;
@@ -325,20 +581,30 @@ module jfpjc(input                      nreset,
             quotient_tag_next <= 8'h0;
             huffman_encoder_start <= 1'b0;
             num_mcus_encoded_this_frame <= 'h0;
+            mcus_since_restart <= 16'h0000;
+            restart_pending <= 1'b0;
             { vsync_prev[2], vsync_prev[1], vsync_prev[0] } <= { hm01b0_vsync, hm01b0_vsync, hm01b0_vsync };
         end
     end
 
-    // flush remaining bits in bitpacker out once encoder is finished.
-`define BIT_PACKER_FLUSH_STATE_IDLE 2'b00
-`define BIT_PACKER_FLUSH_STATE_FLUSH 2'b01
-`define BIT_PACKER_FLUSH_STATE_RESET 2'b10
-    reg  [1:0] bit_packer_flush_state;
+    // flush remaining bits in bitpacker out once encoder is finished, and put restart markers in
+    // between restart intervals.
+`define BIT_PACKER_FLUSH_STATE_IDLE 3'b000
+`define BIT_PACKER_FLUSH_STATE_FLUSH 3'b001
+`define BIT_PACKER_FLUSH_STATE_RESET 3'b010
+`define BIT_PACKER_FLUSH_STATE_RESTART_PAD 3'b011
+`define BIT_PACKER_FLUSH_STATE_RESTART_MARKER 3'b100
+    reg  [2:0] bit_packer_flush_state;
     reg        bit_packer_data_in_wren;
     reg  [5:0] bit_packer_data_in_length;
     reg [31:0] bit_packer_data_in;
+    reg        bit_packer_data_in_marker;
+    reg        bit_packer_pad;
     reg        bit_packer_force_reset;
-    reg  [1:0] bit_packer_flush_state_next;
+    reg  [2:0] bit_packer_flush_state_next;
+
+    // RSTn markers count 0 - 7 over and over, starting from RST0 each frame.
+    reg  [2:0] restart_marker_index;
 
     always @* begin
         if (nreset) begin
@@ -347,15 +613,27 @@ module jfpjc(input                      nreset,
                     bit_packer_data_in_wren = huffman_encoder_output_wren;
                     bit_packer_data_in_length = huffman_encoder_output_length;
                     bit_packer_data_in = huffman_encoder_output_data;
+                    bit_packer_data_in_marker = 1'b0;
+                    bit_packer_pad = 1'b0;
                     bit_packer_force_reset = 1'b0;
-                    bit_packer_flush_state_next = huffman_encoder_done_this_frame ?
-                                                  `BIT_PACKER_FLUSH_STATE_FLUSH : `BIT_PACKER_FLUSH_STATE_IDLE;
+                    if (huffman_encoder_done_this_frame) begin
+                        bit_packer_flush_state_next = `BIT_PACKER_FLUSH_STATE_FLUSH;
+                    end else if (restart_pending) begin
+                        bit_packer_flush_state_next = `BIT_PACKER_FLUSH_STATE_RESTART_PAD;
+                    end else begin
+                        bit_packer_flush_state_next = `BIT_PACKER_FLUSH_STATE_IDLE;
+                    end
                 end
 
+                // Same pad as before a restart marker: the last bits get padded out with 1's and the
+                // rest of the word is unstuffed 0xff fill bytes, which are allowed in front of EOI.
+                // If the frame ended on a word boundary, nothing goes out at all.
                 `BIT_PACKER_FLUSH_STATE_FLUSH: begin
-                    bit_packer_data_in_wren = 1'b1;
-                    bit_packer_data_in_length = 'd32;
-                    bit_packer_data_in = 32'hffff_ffff;
+                    bit_packer_data_in_wren = 1'b0;
+                    bit_packer_data_in_length = 'd0;
+                    bit_packer_data_in = 32'hxxxx_xxxx;
+                    bit_packer_data_in_marker = 1'b0;
+                    bit_packer_pad = 1'b1;
                     bit_packer_force_reset = 1'b0;
                     bit_packer_flush_state_next = `BIT_PACKER_FLUSH_STATE_RESET;
                 end
@@ -364,15 +642,42 @@ module jfpjc(input                      nreset,
                     bit_packer_data_in_wren = 1'b0;
                     bit_packer_data_in_length = 'd0;
                     bit_packer_data_in = 32'hxxxx_xxxx;
+                    bit_packer_data_in_marker = 1'b0;
+                    bit_packer_pad = 1'b0;
                     bit_packer_force_reset = 1'b1;
                     bit_packer_flush_state_next = huffman_encoder_done_this_frame ?
                                                   `BIT_PACKER_FLUSH_STATE_RESET : `BIT_PACKER_FLUSH_STATE_IDLE;
                 end
 
+                // The huffman encoder is held off by restart_pending, so nothing else is coming
+                // into the bitpacker during these two.
+                `BIT_PACKER_FLUSH_STATE_RESTART_PAD: begin
+                    bit_packer_data_in_wren = 1'b0;
+                    bit_packer_data_in_length = 'd0;
+                    bit_packer_data_in = 32'hxxxx_xxxx;
+                    bit_packer_data_in_marker = 1'b0;
+                    bit_packer_pad = 1'b1;
+                    bit_packer_force_reset = 1'b0;
+                    bit_packer_flush_state_next = `BIT_PACKER_FLUSH_STATE_RESTART_MARKER;
+                end
+
+                `BIT_PACKER_FLUSH_STATE_RESTART_MARKER: begin
+                    // 2 fill bytes and then RSTn
+                    bit_packer_data_in_wren = 1'b1;
+                    bit_packer_data_in_length = 'd32;
+                    bit_packer_data_in = { 24'hff_ffff, 5'b11010, restart_marker_index };
+                    bit_packer_data_in_marker = 1'b1;
+                    bit_packer_pad = 1'b0;
+                    bit_packer_force_reset = 1'b0;
+                    bit_packer_flush_state_next = `BIT_PACKER_FLUSH_STATE_IDLE;
+                end
+
                 default: begin
                     bit_packer_data_in_wren = 1'bx;
                     bit_packer_data_in_length = 'hx;
                     bit_packer_data_in = 32'hxxxx_xxxx;
+                    bit_packer_data_in_marker = 1'bx;
+                    bit_packer_pad = 1'bx;
                     bit_packer_force_reset = 1'b0;
                     bit_packer_flush_state_next = 'hx;
                 end
@@ -381,6 +686,8 @@ module jfpjc(input                      nreset,
             bit_packer_data_in_wren = 1'bx;
             bit_packer_data_in_length = 'hx;
             bit_packer_data_in = 32'hxxxx_xxxx;
+            bit_packer_data_in_marker = 1'bx;
+            bit_packer_pad = 1'bx;
             bit_packer_force_reset = 1'b0;
             bit_packer_flush_state_next = `BIT_PACKER_FLUSH_STATE_IDLE;
         end
@@ -388,23 +695,49 @@ module jfpjc(input                      nreset,
 
     always @(posedge clock) bit_packer_flush_state <= bit_packer_flush_state_next;
 
+    assign restart_marker_written = (bit_packer_flush_state == `BIT_PACKER_FLUSH_STATE_RESTART_MARKER);
+    always @(posedge clock) begin
+        if (nreset) begin
+            if (!vsync_prev[2] && vsync_prev[1]) begin
+                restart_marker_index <= 3'h0;
+            end else if (restart_marker_written) begin
+                restart_marker_index <= restart_marker_index + 3'h1;
+            end else begin
+                restart_marker_index <= restart_marker_index;
+            end
+        end else begin
+            restart_marker_index <= 3'h0;
+        end
+    end
+
     wire bit_packer_data_out_valid;
     wire [31:0] bit_packer_data_out;
+    wire  [3:0] bit_packer_data_out_marker;
     bitpacker packer(.clock(clock),
                      .nreset(nreset && !bit_packer_force_reset),
 
                      .data_in_valid(bit_packer_data_in_wren),
                      .data_in(bit_packer_data_in),
                      .input_length(bit_packer_data_in_length),
+                     .data_in_marker(bit_packer_data_in_marker),
+
+                     .pad(bit_packer_pad),
 
                      .data_out_valid(bit_packer_data_out_valid),
-                     .data_out(bit_packer_data_out));
+                     .data_out(bit_packer_data_out),
+                     .data_out_marker(bit_packer_data_out_marker));
 
 
-    wire [31:0] bit_packer_le;
+    // Each byte travels through the width adapter with its marker bit on top, so the width adapter
+    // works in 9-bit slices. That takes 3 EBRs instead of 2.
+    wire [35:0] bit_packer_le;
     wire        wab_data_out_valid;
-    wire  [7:0] wab_data_out;
-    assign bit_packer_le = {bit_packer_data_out[0 +: 8], bit_packer_data_out[8 +: 8], bit_packer_data_out[16 +: 8], bit_packer_data_out[24 +: 8]};
+    wire        wab_idle;
+    wire  [8:0] wab_data_out;
+    assign bit_packer_le = {bit_packer_data_out_marker[0], bit_packer_data_out[0 +: 8],
+                            bit_packer_data_out_marker[1], bit_packer_data_out[8 +: 8],
+                            bit_packer_data_out_marker[2], bit_packer_data_out[16 +: 8],
+                            bit_packer_data_out_marker[3], bit_packer_data_out[24 +: 8]};
     width_adapter_buffer wab(.clock(clock),
                              .nreset(nreset),
 
@@ -412,49 +745,148 @@ module jfpjc(input                      nreset,
                              .data_in(bit_packer_le),
 
                              .data_out_valid(wab_data_out_valid),
-                             .data_out(wab_data_out));
-    defparam wab.input_width = 32;
-    defparam wab.output_width = 8;
-
+                             .data_out(wab_data_out),
+                             .idle(wab_idle));
+    defparam wab.input_width = 36;
+    defparam wab.output_width = 9;
+    defparam wab.buffer_width = 12;
+
+    wire bytestuffer_data_out_valid;
+    wire [7:0] bytestuffer_data_out;
+    reg  bytestuffer_hold;
+    wire bytestuffer_idle;
     bytestuffer bytestuffer(.clock(clock),
                             .nreset(nreset),
                             .data_in_valid(wab_data_out_valid),
-                            .data_in(wab_data_out),
-                            .data_out_valid(hsync),
-                            .data_out(data_out));
+                            .data_in(wab_data_out[7:0]),
+                            .data_in_marker(wab_data_out[8]),
+                            .hold(bytestuffer_hold),
+                            .data_out_valid(bytestuffer_data_out_valid),
+                            .data_out(bytestuffer_data_out),
+                            .idle(bytestuffer_idle));
+
+    ////////////////////////////////////////////////////////////////
+    // JFIF framing
+    reg  header_start;
+    reg  eoi_start;
+    wire header_generator_data_out_valid;
+    wire [7:0] header_generator_data_out;
+    jpeg_header_generator header_generator(.clock(clock),
+                                           .nreset(nreset),
+
+                                           .start_header(header_start),
+                                           .start_eoi(eoi_start),
+
+                                           .table_addr(header_table_addr),
+                                           .quant_table_data(quant_table_read_data),
+                                           .dc_spec_data(dc_spec_read_data),
+                                           .ac_spec_data(ac_spec_read_data),
+                                           .dc_num_values(dc_num_values),
+                                           .ac_num_values(ac_num_values),
+                                           .restart_interval(restart_interval_mcus),
+
+                                           .data_out_valid(header_generator_data_out_valid),
+                                           .data_out(header_generator_data_out),
+                                           .busy(header_generator_busy));
+    defparam header_generator.width_pix = width_pix;
+    defparam header_generator.height_pix = height_pix;
+
+    // The bytestuffer is held off whenever the header or EOI might be going out, so the two are
+    // never valid at the same time.
+    assign hsync = header_generator_data_out_valid || bytestuffer_data_out_valid;
+    assign data_out = header_generator_data_out_valid ? header_generator_data_out : bytestuffer_data_out;
 
     // VSYNC has to stay high until all data for the current frame has been evacuated from the
-    // pipeline. Until we get to the end of the huffman encoder, it's easy to keep track of whether
-    // this is still a halfway-processed frame working its way through the pipeline. After the
-    // huffman encoder, we still have bitpacking and ff 00 bytestuffing to do; it would take
-    // some revisions to the hardware to figure out whether those parts of the pipeline are fully
-    // evacuated or not.
-    //
-    // This is a gross hack: we count the number of clock cycles after the huffman encoder has
-    // finished the last MCU in the frame. Because of the buffer sizes in the post-huffman encoder
-    // output chain, here's an upper bound for how long data can live in the pipeline after
-    // that before it's all evacuated.
-    localparam [15:0] max_output_pipeline_lifetime = 16'd256;
-    reg [15:0] huffman_finished_counter;
+    // pipeline. Once the huffman encoder has finished the last MCU and the flush FSM has padded
+    // out the last word in the bitpacker, the frame is done as soon as the bitpacker, the width
+    // adapter and the bytestuffer are all empty. The next frame can't put anything into them
+    // before the huffman encoder starts on it, which clears huffman_encoder_done_this_frame.
+    wire output_pipeline_drained = (huffman_encoder_done_this_frame &&
+                                    (bit_packer_flush_state == `BIT_PACKER_FLUSH_STATE_RESET) &&
+                                    !bit_packer_data_out_valid && wab_idle && bytestuffer_idle);
+
+    // Each frame goes header, then entropy-coded data, then EOI. The header goes out as soon as the
+    // camera starts a frame; the first entropy-coded data can't come out until a whole MCU row
+    // later. If the tables are still being rebuilt, the header waits for them.
+`define FRAMING_STATE_IDLE 2'h0
+`define FRAMING_STATE_HEADER 2'h1
+`define FRAMING_STATE_SCAN 2'h2
+`define FRAMING_STATE_EOI 2'h3
+    reg [1:0] framing_state;
+    reg       header_pending;
+    wire      tables_busy = reciprocal_builder_busy || dc_builder_busy || ac_builder_busy;
     always @(posedge clock) begin
         if (nreset) begin
-            if (huffman_encoder_done_this_frame) begin
-                huffman_finished_counter <= (huffman_finished_counter == max_output_pipeline_lifetime) ?
-                                            huffman_finished_counter : (huffman_finished_counter + 16'h0001);
+            if (!vsync_prev[2] && vsync_prev[1]) begin
+                header_pending <= 1'b1;
+            end else if (header_start) begin
+                header_pending <= 1'b0;
             end else begin
-                huffman_finished_counter <= 16'h0000;
+                header_pending <= header_pending;
             end
 
-            if (bit_packer_data_out_valid) begin
-                vsync <= 1'b1;
-            end else if (huffman_finished_counter >= max_output_pipeline_lifetime) begin
-                vsync <= 1'b0;
-            end else begin
-                vsync <= vsync;
-            end
+            case (framing_state)
+                `FRAMING_STATE_IDLE: begin
+                    eoi_start <= 1'b0;
+                    bytestuffer_hold <= 1'b1;
+                    if (header_pending && !tables_busy && !header_generator_busy) begin
+                        header_start <= 1'b1;
+                        vsync <= 1'b1;
+                        framing_state <= `FRAMING_STATE_HEADER;
+                    end else begin
+                        header_start <= 1'b0;
+                        vsync <= 1'b0;
+                        framing_state <= `FRAMING_STATE_IDLE;
+                    end
+                end
+
+                `FRAMING_STATE_HEADER: begin
+                    header_start <= 1'b0;
+                    eoi_start <= 1'b0;
+                    vsync <= 1'b1;
+                    if (!header_start && !header_generator_busy) begin
+                        bytestuffer_hold <= 1'b0;
+                        framing_state <= `FRAMING_STATE_SCAN;
+                    end else begin
+                        bytestuffer_hold <= 1'b1;
+                        framing_state <= `FRAMING_STATE_HEADER;
+                    end
+                end
+
+                `FRAMING_STATE_SCAN: begin
+                    header_start <= 1'b0;
+                    vsync <= 1'b1;
+                    if (output_pipeline_drained) begin
+                        eoi_start <= 1'b1;
+                        bytestuffer_hold <= 1'b1;
+                        framing_state <= `FRAMING_STATE_EOI;
+                    end else begin
+                        eoi_start <= 1'b0;
+                        bytestuffer_hold <= 1'b0;
+                        framing_state <= `FRAMING_STATE_SCAN;
+                    end
+                end
+
+                `FRAMING_STATE_EOI: begin
+                    header_start <= 1'b0;
+                    eoi_start <= 1'b0;
+                    bytestuffer_hold <= 1'b1;
+                    if (!eoi_start && !header_generator_busy) begin
+                        vsync <= 1'b0;
+                        framing_state <= `FRAMING_STATE_IDLE;
+                    end else begin
+                        vsync <= 1'b1;
+                        framing_state <= `FRAMING_STATE_EOI;
+                    end
+                end
+            endcase
         end else begin
-            huffman_finished_counter <= 8'h00;
+            header_pending <= 1'b0;
+            header_start <= 1'b0;
+            eoi_start <= 1'b0;
+            bytestuffer_hold <= 1'b1;
             vsync <= 1'b0;
+            framing_state <= `FRAMING_STATE_IDLE;
         end
     end
 endmodule
@@ -0,0 +1,296 @@
+`ifndef JPEG_HEADER_GENERATOR_V
+`define JPEG_HEADER_GENERATOR_V
+
+`timescale 1ns/100ps
+
+/**
+ * This puts out everything in a JFIF file that isn't entropy-coded data, so that what comes out of
+ * jfpjc is a complete jpeg and nobody has to stitch one together afterwards.
+ *
+ * When start_header is pulsed, it puts out these segments, one byte per clock cycle:
+ *     SOI
+ *     APP0     JFIF 1.1, no thumbnail, 1:1 pixel aspect ratio
+ *     DQT      table 0, 8-bit precision, read out of the quantization table EBR (which already
+ *              holds it in zig-zag order)
+ *     DHT      DC table 0, read out of the DC huffman_spec_ram
+ *     DHT      AC table 0, read out of the AC huffman_spec_ram
+ *     DRI      only if restart_interval isn't 0
+ *     SOF0     8-bit precision, height_pix x width_pix, 1 component with 1x1 sampling
+ *     SOS      1 component using huffman tables 0 / 0, spectral selection 0 - 63
+ * and when start_eoi is pulsed, it puts out an EOI.
+ *
+ * None of this goes through the bytestuffer. Nothing in a header segment needs to be stuffed, and
+ * the markers can't be.
+ *
+ * The tables are read through table_addr: the quantization table gets table_addr[5:0] and the
+ * huffman specs get all 8 bits. They have to hold still from start_header until busy falls, so
+ * the table builders shouldn't be running during that time. dc_num_values and ac_num_values come
+ * from the huffman_table_builders and give the lengths of the DHT segments. restart_interval is in
+ * MCUs and also has to hold still.
+ *
+ * data_out_valid and data_out work like the bytestuffer's outputs. busy is high from the cycle
+ * that start_header or start_eoi is pulsed until the last byte has been put out.
+ */
+module jpeg_header_generator(input                clock,
+                             input                nreset,
+
+                             input                start_header,
+                             input                start_eoi,
+
+                             output reg [7:0]     table_addr,
+                             input      [7:0]     quant_table_data,
+                             input      [7:0]     dc_spec_data,
+                             input      [7:0]     ac_spec_data,
+                             input      [7:0]     dc_num_values,
+                             input      [7:0]     ac_num_values,
+                             input      [15:0]    restart_interval,
+
+                             output reg           data_out_valid,
+                             output reg [7:0]     data_out,
+                             output               busy);
+    parameter width_pix = 320, height_pix = 240;
+    localparam [15:0] width = width_pix, height = height_pix;
+
+`define HEADER_SEGMENT_IDLE 4'h0
+`define HEADER_SEGMENT_PREFIX 4'h1
+`define HEADER_SEGMENT_DQT_TABLE 4'h2
+`define HEADER_SEGMENT_DHT_DC 4'h3
+`define HEADER_SEGMENT_DHT_DC_TABLE 4'h4
+`define HEADER_SEGMENT_DHT_AC 4'h5
+`define HEADER_SEGMENT_DHT_AC_TABLE 4'h6
+`define HEADER_SEGMENT_DRI 4'h7
+`define HEADER_SEGMENT_FRAME 4'h8
+`define HEADER_SEGMENT_EOI 4'h9
+
+    // where each byte comes from
+`define HEADER_SOURCE_FIXED 2'h0
+`define HEADER_SOURCE_QUANT 2'h1
+`define HEADER_SOURCE_DC_SPEC 2'h2
+`define HEADER_SOURCE_AC_SPEC 2'h3
+
+    reg  [3:0] segment;
+    reg  [7:0] index;
+
+    // DHT lengths are Lh (2 bytes) + Tc / Th + 16 bytes of BITS + HUFFVAL.
+    wire [15:0] dc_dht_length = 16'd19 + dc_num_values;
+    wire [15:0] ac_dht_length = 16'd19 + ac_num_values;
+
+    // SOI, APP0, and the DQT segment up until the table.
+    function [7:0] prefix_byte;
+        input [7:0] i;
+        begin
+            case (i)
+                8'd0:  prefix_byte = 8'hff;
+                8'd1:  prefix_byte = 8'hd8;
+
+                8'd2:  prefix_byte = 8'hff;
+                8'd3:  prefix_byte = 8'he0;
+                8'd4:  prefix_byte = 8'h00;
+                8'd5:  prefix_byte = 8'h10;
+                8'd6:  prefix_byte = 8'h4a;     // "JFIF\0"
+                8'd7:  prefix_byte = 8'h46;
+                8'd8:  prefix_byte = 8'h49;
+                8'd9:  prefix_byte = 8'h46;
+                8'd10: prefix_byte = 8'h00;
+                8'd11: prefix_byte = 8'h01;     // version 1.1
+                8'd12: prefix_byte = 8'h01;
+                8'd13: prefix_byte = 8'h00;     // no units
+                8'd14: prefix_byte = 8'h00;     // 1:1 density
+                8'd15: prefix_byte = 8'h01;
+                8'd16: prefix_byte = 8'h00;
+                8'd17: prefix_byte = 8'h01;
+                8'd18: prefix_byte = 8'h00;     // no thumbnail
+                8'd19: prefix_byte = 8'h00;
+
+                8'd20: prefix_byte = 8'hff;
+                8'd21: prefix_byte = 8'hdb;
+                8'd22: prefix_byte = 8'h00;
+                8'd23: prefix_byte = 8'h43;
+                8'd24: prefix_byte = 8'h00;
+                default: prefix_byte = 8'hxx;
+            endcase
+        end
+    endfunction
+    localparam [7:0] prefix_length = 8'd25;
+
+    // SOF0 and SOS.
+    function [7:0] frame_byte;
+        input [7:0] i;
+        begin
+            case (i)
+                8'd0:  frame_byte = 8'hff;
+                8'd1:  frame_byte = 8'hc0;
+                8'd2:  frame_byte = 8'h00;
+                8'd3:  frame_byte = 8'h0b;
+                8'd4:  frame_byte = 8'h08;
+                8'd5:  frame_byte = height[15:8];
+                8'd6:  frame_byte = height[7:0];
+                8'd7:  frame_byte = width[15:8];
+                8'd8:  frame_byte = width[7:0];
+                8'd9:  frame_byte = 8'h01;
+                8'd10: frame_byte = 8'h00;
+                8'd11: frame_byte = 8'h11;
+                8'd12: frame_byte = 8'h00;
+
+                8'd13: frame_byte = 8'hff;
+                8'd14: frame_byte = 8'hda;
+                8'd15: frame_byte = 8'h00;
+                8'd16: frame_byte = 8'h08;
+                8'd17: frame_byte = 8'h01;
+                8'd18: frame_byte = 8'h00;
+                8'd19: frame_byte = 8'h00;
+                8'd20: frame_byte = 8'h00;
+                8'd21: frame_byte = 8'h3f;
+                8'd22: frame_byte = 8'h00;
+                default: frame_byte = 8'hxx;
+            endcase
+        end
+    endfunction
+    localparam [7:0] frame_length = 8'd23;
+
+    // For each byte: where it comes from, what it is if it's fixed, and whether it's the last one
+    // in its segment.
+    reg  [1:0] source;
+    reg  [7:0] fixed_byte;
+    reg        last;
+    always @* begin
+        table_addr = index;
+        case (segment)
+            `HEADER_SEGMENT_PREFIX: begin
+                source = `HEADER_SOURCE_FIXED;
+                fixed_byte = prefix_byte(index);
+                last = (index == (prefix_length - 8'd1));
+            end
+
+            `HEADER_SEGMENT_DQT_TABLE: begin
+                source = `HEADER_SOURCE_QUANT;
+                fixed_byte = 8'hxx;
+                last = (index == 8'd63);
+            end
+
+            `HEADER_SEGMENT_DHT_DC, `HEADER_SEGMENT_DHT_AC: begin
+                source = `HEADER_SOURCE_FIXED;
+                case (index)
+                    8'd0: fixed_byte = 8'hff;
+                    8'd1: fixed_byte = 8'hc4;
+                    8'd2: fixed_byte = (segment == `HEADER_SEGMENT_DHT_DC) ? dc_dht_length[15:8] :
+                                                                              ac_dht_length[15:8];
+                    8'd3: fixed_byte = (segment == `HEADER_SEGMENT_DHT_DC) ? dc_dht_length[7:0] :
+                                                                              ac_dht_length[7:0];
+                    8'd4: fixed_byte = (segment == `HEADER_SEGMENT_DHT_DC) ? 8'h00 : 8'h10;
+                    default: fixed_byte = 8'hxx;
+                endcase
+                last = (index == 8'd4);
+            end
+
+            `HEADER_SEGMENT_DHT_DC_TABLE: begin
+                source = `HEADER_SOURCE_DC_SPEC;
+                fixed_byte = 8'hxx;
+                last = (index == (dc_num_values + 8'd15));
+            end
+
+            `HEADER_SEGMENT_DHT_AC_TABLE: begin
+                source = `HEADER_SOURCE_AC_SPEC;
+                fixed_byte = 8'hxx;
+                last = (index == (ac_num_values + 8'd15));
+            end
+
+            `HEADER_SEGMENT_DRI: begin
+                source = `HEADER_SOURCE_FIXED;
+                case (index)
+                    8'd0: fixed_byte = 8'hff;
+                    8'd1: fixed_byte = 8'hdd;
+                    8'd2: fixed_byte = 8'h00;
+                    8'd3: fixed_byte = 8'h04;
+                    8'd4: fixed_byte = restart_interval[15:8];
+                    8'd5: fixed_byte = restart_interval[7:0];
+                    default: fixed_byte = 8'hxx;
+                endcase
+                last = (index == 8'd5);
+            end
+
+            `HEADER_SEGMENT_FRAME: begin
+                source = `HEADER_SOURCE_FIXED;
+                fixed_byte = frame_byte(index);
+                last = (index == (frame_length - 8'd1));
+            end
+
+            `HEADER_SEGMENT_EOI: begin
+                source = `HEADER_SOURCE_FIXED;
+                fixed_byte = (index == 8'd0) ? 8'hff : 8'hd9;
+                last = (index == 8'd1);
+            end
+
+            default: begin
+                source = `HEADER_SOURCE_FIXED;
+                fixed_byte = 8'hxx;
+                last = 1'b0;
+            end
+        endcase
+    end
+
+    always @(posedge clock) begin
+        if (nreset) begin
+            if (start_header) begin
+                segment <= `HEADER_SEGMENT_PREFIX;
+                index <= 8'h00;
+            end else if (start_eoi) begin
+                segment <= `HEADER_SEGMENT_EOI;
+                index <= 8'h00;
+            end else if ((segment != `HEADER_SEGMENT_IDLE) && last) begin
+                // the segments come one after the other, except EOI, which is on its own, and DRI,
+                // which is skipped if there aren't any restart intervals.
+                if ((segment == `HEADER_SEGMENT_FRAME) || (segment == `HEADER_SEGMENT_EOI)) begin
+                    segment <= `HEADER_SEGMENT_IDLE;
+                end else if ((segment == `HEADER_SEGMENT_DHT_AC_TABLE) &&
+                             (restart_interval == 16'h0000)) begin
+                    segment <= `HEADER_SEGMENT_FRAME;
+                end else begin
+                    segment <= segment + 4'h1;
+                end
+                index <= 8'h00;
+            end else if (segment != `HEADER_SEGMENT_IDLE) begin
+                segment <= segment;
+                index <= index + 8'h01;
+            end else begin
+                segment <= segment;
+                index <= 8'h00;
+            end
+        end else begin
+            segment <= `HEADER_SEGMENT_IDLE;
+            index <= 8'h00;
+        end
+    end
+
+    // The tables take a cycle to read, so everything else waits a cycle for them.
+    reg        byte_valid;
+    reg  [1:0] byte_source;
+    reg  [7:0] byte_fixed;
+    always @(posedge clock) begin
+        if (nreset) begin
+            byte_valid <= (segment != `HEADER_SEGMENT_IDLE);
+            byte_source <= source;
+            byte_fixed <= fixed_byte;
+
+            data_out_valid <= byte_valid;
+            case (byte_source)
+                `HEADER_SOURCE_FIXED:   data_out <= byte_fixed;
+                `HEADER_SOURCE_QUANT:   data_out <= quant_table_data;
+                `HEADER_SOURCE_DC_SPEC: data_out <= dc_spec_data;
+                `HEADER_SOURCE_AC_SPEC: data_out <= ac_spec_data;
+            endcase
+        end else begin
+            byte_valid <= 1'b0;
+            byte_source <= 2'hx;
+            byte_fixed <= 8'hxx;
+
+            data_out_valid <= 1'b0;
+            data_out <= 8'hxx;
+        end
+    end
+
+    assign busy = (start_header || start_eoi || (segment != `HEADER_SEGMENT_IDLE) ||
+                   byte_valid || data_out_valid);
+endmodule
+
+`endif
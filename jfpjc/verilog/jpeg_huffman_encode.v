@@ -1,238 +1,237 @@
 `timescale 1ns/100ps
 
 /**
- * ultimately, I plan to put these values in 2 EBRs. Unfortunately, because we need 4 + 16 = 20 bit
- * wide data and our EBRs are all 1, 2, 4, 8, or 16 bits wide, a lot of one EBR will be wasted.
+ * The huffman tables live in memories that can be written at runtime, so that a host can load
+ * its own tables between frames. Each entry is { bitlen[3:0], code[15:0] }, where bitlen is one
+ * less than the actual length of the code; we will never have a huffman code of length 0, so this
+ * saves a bit. An entry of code = 0x0000 and bitlen = 0xf marks an (rrrr, ssss) or ssss value that
+ * the table doesn't have a code for.
  *
- * I suppose that, if we wanted to be able to select from 4 different tables, we could use 5EBRs,
- * where 4 of the EBRs hold huffman code values and 1 holds lengths for the 4 different tables. meh.
+ * 20 bit wide data doesn't fit our EBRs very well (they're 1, 2, 4, 8, or 16 bits wide), so the
+ * AC table takes 2 EBRs and a lot of the second one gets wasted. The DC table only has 12 entries
+ * and is small enough that yosys can put it wherever it likes.
  *
- * This test huffman table mimics the EBRs in the sense that it takes one clock cycle to read.
+ * Like an EBR, reads take one clock cycle.
  *
- * These are ac and dc luminance tables taken from jmcujc.c. I used gdb to halt the program after
- * huffman reverse lookup tables were constructed and then used a bit of low-grade gdb-fu to
- * generate the verilog found below. Note that the stored huffman_bitlen is one less than the
- * actual bitlen, this is to avoid storing an unnecessary bit; we will never have a huffman code
- * of length 0.
- *
- * The following lines can be used in GDB to harvest the data from the huffman reverse lookup
- * tables. Some lines with invalid huffman codes will need to be picked out, you can tell which
- * ones those are because the bit_length - 1 will cause the uint32_t to roll over to ffffffff.
- *
- * (gdb) set $loop = 0
- * (gdb) while $loop < 256
- * (gdb) printf "8'h%02x: huffman_code <= 16'h%04x; huffman_bitlen <= 4'h%x; huffman_valid <= 1'b1\n",$loop,params->dc_hrlts[0].entries[$loop].value,params->dc_hrlts[0].entries[$loop].bit_length-1
- * (gdb) set $loop = $loop + 1
- * (gdb) end
+ * Coming out of configuration, the tables hold the standard luminance tables from sections K.3 and
+ * K.5 of the JPEG spec (the same ones that jmcujc.c uses).
  */
-module test_huffman_table_dc(input clock,
-                             input [7:0] addr,
+module huffman_table_ram(input                            clock,
 
-                             output reg [15:0] huffman_code,
-                             output reg  [3:0] huffman_bitlen,
+                         input                            wren,
+                         input      [(addr_width - 1):0]  waddr,
+                         input      [19:0]                wdata,
 
-                             // this one is just here for debugging purposes... we should remove it
-                             // for deployed hardware. Anyways, we could have
-                             // huffman code = 0x0000 and bitlen = 15 be our code for "this one's bad".
-                             output reg  [0:0] huffman_valid);
+                         input      [(addr_width - 1):0]  addr,
+                         output reg [15:0]                huffman_code,
+                         output reg  [3:0]                huffman_bitlen);
+    parameter addr_width = 8;
+    parameter ac = 1;
+
+    reg [19:0] mem [0:((1 << addr_width) - 1)];
 
     always @(posedge clock) begin
-        case(addr)
-            8'h00: begin huffman_code <= 16'h0000; huffman_bitlen <= 4'h1; huffman_valid <= 1'b1; end
-            8'h01: begin huffman_code <= 16'h0002; huffman_bitlen <= 4'h2; huffman_valid <= 1'b1; end
-            8'h02: begin huffman_code <= 16'h0003; huffman_bitlen <= 4'h2; huffman_valid <= 1'b1; end
-            8'h03: begin huffman_code <= 16'h0004; huffman_bitlen <= 4'h2; huffman_valid <= 1'b1; end
-            8'h04: begin huffman_code <= 16'h0005; huffman_bitlen <= 4'h2; huffman_valid <= 1'b1; end
-            8'h05: begin huffman_code <= 16'h0006; huffman_bitlen <= 4'h2; huffman_valid <= 1'b1; end
-            8'h06: begin huffman_code <= 16'h000e; huffman_bitlen <= 4'h3; huffman_valid <= 1'b1; end
-            8'h07: begin huffman_code <= 16'h001e; huffman_bitlen <= 4'h4; huffman_valid <= 1'b1; end
-            8'h08: begin huffman_code <= 16'h003e; huffman_bitlen <= 4'h5; huffman_valid <= 1'b1; end
-            8'h09: begin huffman_code <= 16'h007e; huffman_bitlen <= 4'h6; huffman_valid <= 1'b1; end
-            8'h0a: begin huffman_code <= 16'h00fe; huffman_bitlen <= 4'h7; huffman_valid <= 1'b1; end
-            8'h0b: begin huffman_code <= 16'h01fe; huffman_bitlen <= 4'h8; huffman_valid <= 1'b1; end
-            default: begin huffman_code <= 16'h0000; huffman_bitlen <= 4'hf; huffman_valid <= 1'b0; end
-        endcase
+        if (wren) mem[waddr] <= wdata;
+        { huffman_bitlen, huffman_code } <= mem[addr];
     end
-endmodule // test_huffman_table_dc
-
-module test_huffman_table_ac(input clock,
-                             input [7:0] addr,
 
-                             output reg [15:0] huffman_code,
-                             output reg  [3:0] huffman_bitlen,
-
-                             // this one is just here for debugging purposes... we should remove it
-                             // for deployed hardware. Anyways, we could have
-                             // huffman code = 0x0000 and bitlen = 15 be our code for "this one's bad".
-                             output reg  [0:0] huffman_valid);
-
-    always @(posedge clock) begin
-        case(addr)
-            8'h00: begin huffman_code <= 16'h000a; huffman_bitlen <= 4'h3; huffman_valid <= 1'b1; end
-            8'h01: begin huffman_code <= 16'h0000; huffman_bitlen <= 4'h1; huffman_valid <= 1'b1; end
-            8'h02: begin huffman_code <= 16'h0001; huffman_bitlen <= 4'h1; huffman_valid <= 1'b1; end
-            8'h03: begin huffman_code <= 16'h0004; huffman_bitlen <= 4'h2; huffman_valid <= 1'b1; end
-            8'h04: begin huffman_code <= 16'h000b; huffman_bitlen <= 4'h3; huffman_valid <= 1'b1; end
-            8'h05: begin huffman_code <= 16'h001a; huffman_bitlen <= 4'h4; huffman_valid <= 1'b1; end
-            8'h06: begin huffman_code <= 16'h0078; huffman_bitlen <= 4'h6; huffman_valid <= 1'b1; end
-            8'h07: begin huffman_code <= 16'h00f8; huffman_bitlen <= 4'h7; huffman_valid <= 1'b1; end
-            8'h08: begin huffman_code <= 16'h03f6; huffman_bitlen <= 4'h9; huffman_valid <= 1'b1; end
-            8'h09: begin huffman_code <= 16'hff82; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h0a: begin huffman_code <= 16'hff83; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h11: begin huffman_code <= 16'h000c; huffman_bitlen <= 4'h3; huffman_valid <= 1'b1; end
-            8'h12: begin huffman_code <= 16'h001b; huffman_bitlen <= 4'h4; huffman_valid <= 1'b1; end
-            8'h13: begin huffman_code <= 16'h0079; huffman_bitlen <= 4'h6; huffman_valid <= 1'b1; end
-            8'h14: begin huffman_code <= 16'h01f6; huffman_bitlen <= 4'h8; huffman_valid <= 1'b1; end
-            8'h15: begin huffman_code <= 16'h07f6; huffman_bitlen <= 4'ha; huffman_valid <= 1'b1; end
-            8'h16: begin huffman_code <= 16'hff84; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h17: begin huffman_code <= 16'hff85; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h18: begin huffman_code <= 16'hff86; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h19: begin huffman_code <= 16'hff87; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h1a: begin huffman_code <= 16'hff88; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h21: begin huffman_code <= 16'h001c; huffman_bitlen <= 4'h4; huffman_valid <= 1'b1; end
-            8'h22: begin huffman_code <= 16'h00f9; huffman_bitlen <= 4'h7; huffman_valid <= 1'b1; end
-            8'h23: begin huffman_code <= 16'h03f7; huffman_bitlen <= 4'h9; huffman_valid <= 1'b1; end
-            8'h24: begin huffman_code <= 16'h0ff4; huffman_bitlen <= 4'hb; huffman_valid <= 1'b1; end
-            8'h25: begin huffman_code <= 16'hff89; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h26: begin huffman_code <= 16'hff8a; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h27: begin huffman_code <= 16'hff8b; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h28: begin huffman_code <= 16'hff8c; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h29: begin huffman_code <= 16'hff8d; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h2a: begin huffman_code <= 16'hff8e; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h31: begin huffman_code <= 16'h003a; huffman_bitlen <= 4'h5; huffman_valid <= 1'b1; end
-            8'h32: begin huffman_code <= 16'h01f7; huffman_bitlen <= 4'h8; huffman_valid <= 1'b1; end
-            8'h33: begin huffman_code <= 16'h0ff5; huffman_bitlen <= 4'hb; huffman_valid <= 1'b1; end
-            8'h34: begin huffman_code <= 16'hff8f; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h35: begin huffman_code <= 16'hff90; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h36: begin huffman_code <= 16'hff91; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h37: begin huffman_code <= 16'hff92; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h38: begin huffman_code <= 16'hff93; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h39: begin huffman_code <= 16'hff94; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h3a: begin huffman_code <= 16'hff95; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h41: begin huffman_code <= 16'h003b; huffman_bitlen <= 4'h5; huffman_valid <= 1'b1; end
-            8'h42: begin huffman_code <= 16'h03f8; huffman_bitlen <= 4'h9; huffman_valid <= 1'b1; end
-            8'h43: begin huffman_code <= 16'hff96; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h44: begin huffman_code <= 16'hff97; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h45: begin huffman_code <= 16'hff98; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h46: begin huffman_code <= 16'hff99; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h47: begin huffman_code <= 16'hff9a; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h48: begin huffman_code <= 16'hff9b; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h49: begin huffman_code <= 16'hff9c; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h4a: begin huffman_code <= 16'hff9d; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h51: begin huffman_code <= 16'h007a; huffman_bitlen <= 4'h6; huffman_valid <= 1'b1; end
-            8'h52: begin huffman_code <= 16'h07f7; huffman_bitlen <= 4'ha; huffman_valid <= 1'b1; end
-            8'h53: begin huffman_code <= 16'hff9e; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h54: begin huffman_code <= 16'hff9f; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h55: begin huffman_code <= 16'hffa0; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h56: begin huffman_code <= 16'hffa1; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h57: begin huffman_code <= 16'hffa2; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h58: begin huffman_code <= 16'hffa3; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h59: begin huffman_code <= 16'hffa4; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h5a: begin huffman_code <= 16'hffa5; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h61: begin huffman_code <= 16'h007b; huffman_bitlen <= 4'h6; huffman_valid <= 1'b1; end
-            8'h62: begin huffman_code <= 16'h0ff6; huffman_bitlen <= 4'hb; huffman_valid <= 1'b1; end
-            8'h63: begin huffman_code <= 16'hffa6; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h64: begin huffman_code <= 16'hffa7; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h65: begin huffman_code <= 16'hffa8; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h66: begin huffman_code <= 16'hffa9; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h67: begin huffman_code <= 16'hffaa; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h68: begin huffman_code <= 16'hffab; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h69: begin huffman_code <= 16'hffac; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h6a: begin huffman_code <= 16'hffad; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h71: begin huffman_code <= 16'h00fa; huffman_bitlen <= 4'h7; huffman_valid <= 1'b1; end
-            8'h72: begin huffman_code <= 16'h0ff7; huffman_bitlen <= 4'hb; huffman_valid <= 1'b1; end
-            8'h73: begin huffman_code <= 16'hffae; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h74: begin huffman_code <= 16'hffaf; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h75: begin huffman_code <= 16'hffb0; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h76: begin huffman_code <= 16'hffb1; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h77: begin huffman_code <= 16'hffb2; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h78: begin huffman_code <= 16'hffb3; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h79: begin huffman_code <= 16'hffb4; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h7a: begin huffman_code <= 16'hffb5; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h81: begin huffman_code <= 16'h01f8; huffman_bitlen <= 4'h8; huffman_valid <= 1'b1; end
-            8'h82: begin huffman_code <= 16'h7fc0; huffman_bitlen <= 4'he; huffman_valid <= 1'b1; end
-            8'h83: begin huffman_code <= 16'hffb6; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h84: begin huffman_code <= 16'hffb7; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h85: begin huffman_code <= 16'hffb8; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h86: begin huffman_code <= 16'hffb9; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h87: begin huffman_code <= 16'hffba; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h88: begin huffman_code <= 16'hffbb; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h89: begin huffman_code <= 16'hffbc; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h8a: begin huffman_code <= 16'hffbd; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h91: begin huffman_code <= 16'h01f9; huffman_bitlen <= 4'h8; huffman_valid <= 1'b1; end
-            8'h92: begin huffman_code <= 16'hffbe; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h93: begin huffman_code <= 16'hffbf; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h94: begin huffman_code <= 16'hffc0; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h95: begin huffman_code <= 16'hffc1; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h96: begin huffman_code <= 16'hffc2; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h97: begin huffman_code <= 16'hffc3; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h98: begin huffman_code <= 16'hffc4; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h99: begin huffman_code <= 16'hffc5; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'h9a: begin huffman_code <= 16'hffc6; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha1: begin huffman_code <= 16'h01fa; huffman_bitlen <= 4'h8; huffman_valid <= 1'b1; end
-            8'ha2: begin huffman_code <= 16'hffc7; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha3: begin huffman_code <= 16'hffc8; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha4: begin huffman_code <= 16'hffc9; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha5: begin huffman_code <= 16'hffca; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha6: begin huffman_code <= 16'hffcb; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha7: begin huffman_code <= 16'hffcc; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha8: begin huffman_code <= 16'hffcd; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'ha9: begin huffman_code <= 16'hffce; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'haa: begin huffman_code <= 16'hffcf; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb1: begin huffman_code <= 16'h03f9; huffman_bitlen <= 4'h9; huffman_valid <= 1'b1; end
-            8'hb2: begin huffman_code <= 16'hffd0; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb3: begin huffman_code <= 16'hffd1; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb4: begin huffman_code <= 16'hffd2; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb5: begin huffman_code <= 16'hffd3; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb6: begin huffman_code <= 16'hffd4; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb7: begin huffman_code <= 16'hffd5; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb8: begin huffman_code <= 16'hffd6; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hb9: begin huffman_code <= 16'hffd7; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hba: begin huffman_code <= 16'hffd8; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc1: begin huffman_code <= 16'h03fa; huffman_bitlen <= 4'h9; huffman_valid <= 1'b1; end
-            8'hc2: begin huffman_code <= 16'hffd9; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc3: begin huffman_code <= 16'hffda; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc4: begin huffman_code <= 16'hffdb; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc5: begin huffman_code <= 16'hffdc; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc6: begin huffman_code <= 16'hffdd; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc7: begin huffman_code <= 16'hffde; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc8: begin huffman_code <= 16'hffdf; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hc9: begin huffman_code <= 16'hffe0; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hca: begin huffman_code <= 16'hffe1; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd1: begin huffman_code <= 16'h07f8; huffman_bitlen <= 4'ha; huffman_valid <= 1'b1; end
-            8'hd2: begin huffman_code <= 16'hffe2; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd3: begin huffman_code <= 16'hffe3; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd4: begin huffman_code <= 16'hffe4; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd5: begin huffman_code <= 16'hffe5; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd6: begin huffman_code <= 16'hffe6; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd7: begin huffman_code <= 16'hffe7; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd8: begin huffman_code <= 16'hffe8; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hd9: begin huffman_code <= 16'hffe9; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hda: begin huffman_code <= 16'hffea; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he1: begin huffman_code <= 16'hffeb; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he2: begin huffman_code <= 16'hffec; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he3: begin huffman_code <= 16'hffed; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he4: begin huffman_code <= 16'hffee; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he5: begin huffman_code <= 16'hffef; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he6: begin huffman_code <= 16'hfff0; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he7: begin huffman_code <= 16'hfff1; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he8: begin huffman_code <= 16'hfff2; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'he9: begin huffman_code <= 16'hfff3; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hea: begin huffman_code <= 16'hfff4; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf0: begin huffman_code <= 16'h07f9; huffman_bitlen <= 4'ha; huffman_valid <= 1'b1; end
-            8'hf1: begin huffman_code <= 16'hfff5; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf2: begin huffman_code <= 16'hfff6; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf3: begin huffman_code <= 16'hfff7; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf4: begin huffman_code <= 16'hfff8; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf5: begin huffman_code <= 16'hfff9; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf6: begin huffman_code <= 16'hfffa; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf7: begin huffman_code <= 16'hfffb; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf8: begin huffman_code <= 16'hfffc; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hf9: begin huffman_code <= 16'hfffd; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            8'hfa: begin huffman_code <= 16'hfffe; huffman_bitlen <= 4'hf; huffman_valid <= 1'b1; end
-            default: begin huffman_code <= 16'h0000; huffman_bitlen <= 4'hf; huffman_valid <= 1'b0; end
-        endcase
+    function [19:0] default_huffman_dc;
+        input [7:0] addr;
+        begin
+            case (addr)
+                8'h00: default_huffman_dc = { 4'h1, 16'h0000 };
+                8'h01: default_huffman_dc = { 4'h2, 16'h0002 };
+                8'h02: default_huffman_dc = { 4'h2, 16'h0003 };
+                8'h03: default_huffman_dc = { 4'h2, 16'h0004 };
+                8'h04: default_huffman_dc = { 4'h2, 16'h0005 };
+                8'h05: default_huffman_dc = { 4'h2, 16'h0006 };
+                8'h06: default_huffman_dc = { 4'h3, 16'h000e };
+                8'h07: default_huffman_dc = { 4'h4, 16'h001e };
+                8'h08: default_huffman_dc = { 4'h5, 16'h003e };
+                8'h09: default_huffman_dc = { 4'h6, 16'h007e };
+                8'h0a: default_huffman_dc = { 4'h7, 16'h00fe };
+                8'h0b: default_huffman_dc = { 4'h8, 16'h01fe };
+                default: default_huffman_dc = { 4'hf, 16'h0000 };
+            endcase
+        end
+    endfunction
+
+    function [19:0] default_huffman_ac;
+        input [7:0] addr;
+        begin
+            case (addr)
+                8'h00: default_huffman_ac = { 4'h3, 16'h000a };
+                8'h01: default_huffman_ac = { 4'h1, 16'h0000 };
+                8'h02: default_huffman_ac = { 4'h1, 16'h0001 };
+                8'h03: default_huffman_ac = { 4'h2, 16'h0004 };
+                8'h04: default_huffman_ac = { 4'h3, 16'h000b };
+                8'h05: default_huffman_ac = { 4'h4, 16'h001a };
+                8'h06: default_huffman_ac = { 4'h6, 16'h0078 };
+                8'h07: default_huffman_ac = { 4'h7, 16'h00f8 };
+                8'h08: default_huffman_ac = { 4'h9, 16'h03f6 };
+                8'h09: default_huffman_ac = { 4'hf, 16'hff82 };
+                8'h0a: default_huffman_ac = { 4'hf, 16'hff83 };
+                8'h11: default_huffman_ac = { 4'h3, 16'h000c };
+                8'h12: default_huffman_ac = { 4'h4, 16'h001b };
+                8'h13: default_huffman_ac = { 4'h6, 16'h0079 };
+                8'h14: default_huffman_ac = { 4'h8, 16'h01f6 };
+                8'h15: default_huffman_ac = { 4'ha, 16'h07f6 };
+                8'h16: default_huffman_ac = { 4'hf, 16'hff84 };
+                8'h17: default_huffman_ac = { 4'hf, 16'hff85 };
+                8'h18: default_huffman_ac = { 4'hf, 16'hff86 };
+                8'h19: default_huffman_ac = { 4'hf, 16'hff87 };
+                8'h1a: default_huffman_ac = { 4'hf, 16'hff88 };
+                8'h21: default_huffman_ac = { 4'h4, 16'h001c };
+                8'h22: default_huffman_ac = { 4'h7, 16'h00f9 };
+                8'h23: default_huffman_ac = { 4'h9, 16'h03f7 };
+                8'h24: default_huffman_ac = { 4'hb, 16'h0ff4 };
+                8'h25: default_huffman_ac = { 4'hf, 16'hff89 };
+                8'h26: default_huffman_ac = { 4'hf, 16'hff8a };
+                8'h27: default_huffman_ac = { 4'hf, 16'hff8b };
+                8'h28: default_huffman_ac = { 4'hf, 16'hff8c };
+                8'h29: default_huffman_ac = { 4'hf, 16'hff8d };
+                8'h2a: default_huffman_ac = { 4'hf, 16'hff8e };
+                8'h31: default_huffman_ac = { 4'h5, 16'h003a };
+                8'h32: default_huffman_ac = { 4'h8, 16'h01f7 };
+                8'h33: default_huffman_ac = { 4'hb, 16'h0ff5 };
+                8'h34: default_huffman_ac = { 4'hf, 16'hff8f };
+                8'h35: default_huffman_ac = { 4'hf, 16'hff90 };
+                8'h36: default_huffman_ac = { 4'hf, 16'hff91 };
+                8'h37: default_huffman_ac = { 4'hf, 16'hff92 };
+                8'h38: default_huffman_ac = { 4'hf, 16'hff93 };
+                8'h39: default_huffman_ac = { 4'hf, 16'hff94 };
+                8'h3a: default_huffman_ac = { 4'hf, 16'hff95 };
+                8'h41: default_huffman_ac = { 4'h5, 16'h003b };
+                8'h42: default_huffman_ac = { 4'h9, 16'h03f8 };
+                8'h43: default_huffman_ac = { 4'hf, 16'hff96 };
+                8'h44: default_huffman_ac = { 4'hf, 16'hff97 };
+                8'h45: default_huffman_ac = { 4'hf, 16'hff98 };
+                8'h46: default_huffman_ac = { 4'hf, 16'hff99 };
+                8'h47: default_huffman_ac = { 4'hf, 16'hff9a };
+                8'h48: default_huffman_ac = { 4'hf, 16'hff9b };
+                8'h49: default_huffman_ac = { 4'hf, 16'hff9c };
+                8'h4a: default_huffman_ac = { 4'hf, 16'hff9d };
+                8'h51: default_huffman_ac = { 4'h6, 16'h007a };
+                8'h52: default_huffman_ac = { 4'ha, 16'h07f7 };
+                8'h53: default_huffman_ac = { 4'hf, 16'hff9e };
+                8'h54: default_huffman_ac = { 4'hf, 16'hff9f };
+                8'h55: default_huffman_ac = { 4'hf, 16'hffa0 };
+                8'h56: default_huffman_ac = { 4'hf, 16'hffa1 };
+                8'h57: default_huffman_ac = { 4'hf, 16'hffa2 };
+                8'h58: default_huffman_ac = { 4'hf, 16'hffa3 };
+                8'h59: default_huffman_ac = { 4'hf, 16'hffa4 };
+                8'h5a: default_huffman_ac = { 4'hf, 16'hffa5 };
+                8'h61: default_huffman_ac = { 4'h6, 16'h007b };
+                8'h62: default_huffman_ac = { 4'hb, 16'h0ff6 };
+                8'h63: default_huffman_ac = { 4'hf, 16'hffa6 };
+                8'h64: default_huffman_ac = { 4'hf, 16'hffa7 };
+                8'h65: default_huffman_ac = { 4'hf, 16'hffa8 };
+                8'h66: default_huffman_ac = { 4'hf, 16'hffa9 };
+                8'h67: default_huffman_ac = { 4'hf, 16'hffaa };
+                8'h68: default_huffman_ac = { 4'hf, 16'hffab };
+                8'h69: default_huffman_ac = { 4'hf, 16'hffac };
+                8'h6a: default_huffman_ac = { 4'hf, 16'hffad };
+                8'h71: default_huffman_ac = { 4'h7, 16'h00fa };
+                8'h72: default_huffman_ac = { 4'hb, 16'h0ff7 };
+                8'h73: default_huffman_ac = { 4'hf, 16'hffae };
+                8'h74: default_huffman_ac = { 4'hf, 16'hffaf };
+                8'h75: default_huffman_ac = { 4'hf, 16'hffb0 };
+                8'h76: default_huffman_ac = { 4'hf, 16'hffb1 };
+                8'h77: default_huffman_ac = { 4'hf, 16'hffb2 };
+                8'h78: default_huffman_ac = { 4'hf, 16'hffb3 };
+                8'h79: default_huffman_ac = { 4'hf, 16'hffb4 };
+                8'h7a: default_huffman_ac = { 4'hf, 16'hffb5 };
+                8'h81: default_huffman_ac = { 4'h8, 16'h01f8 };
+                8'h82: default_huffman_ac = { 4'he, 16'h7fc0 };
+                8'h83: default_huffman_ac = { 4'hf, 16'hffb6 };
+                8'h84: default_huffman_ac = { 4'hf, 16'hffb7 };
+                8'h85: default_huffman_ac = { 4'hf, 16'hffb8 };
+                8'h86: default_huffman_ac = { 4'hf, 16'hffb9 };
+                8'h87: default_huffman_ac = { 4'hf, 16'hffba };
+                8'h88: default_huffman_ac = { 4'hf, 16'hffbb };
+                8'h89: default_huffman_ac = { 4'hf, 16'hffbc };
+                8'h8a: default_huffman_ac = { 4'hf, 16'hffbd };
+                8'h91: default_huffman_ac = { 4'h8, 16'h01f9 };
+                8'h92: default_huffman_ac = { 4'hf, 16'hffbe };
+                8'h93: default_huffman_ac = { 4'hf, 16'hffbf };
+                8'h94: default_huffman_ac = { 4'hf, 16'hffc0 };
+                8'h95: default_huffman_ac = { 4'hf, 16'hffc1 };
+                8'h96: default_huffman_ac = { 4'hf, 16'hffc2 };
+                8'h97: default_huffman_ac = { 4'hf, 16'hffc3 };
+                8'h98: default_huffman_ac = { 4'hf, 16'hffc4 };
+                8'h99: default_huffman_ac = { 4'hf, 16'hffc5 };
+                8'h9a: default_huffman_ac = { 4'hf, 16'hffc6 };
+                8'ha1: default_huffman_ac = { 4'h8, 16'h01fa };
+                8'ha2: default_huffman_ac = { 4'hf, 16'hffc7 };
+                8'ha3: default_huffman_ac = { 4'hf, 16'hffc8 };
+                8'ha4: default_huffman_ac = { 4'hf, 16'hffc9 };
+                8'ha5: default_huffman_ac = { 4'hf, 16'hffca };
+                8'ha6: default_huffman_ac = { 4'hf, 16'hffcb };
+                8'ha7: default_huffman_ac = { 4'hf, 16'hffcc };
+                8'ha8: default_huffman_ac = { 4'hf, 16'hffcd };
+                8'ha9: default_huffman_ac = { 4'hf, 16'hffce };
+                8'haa: default_huffman_ac = { 4'hf, 16'hffcf };
+                8'hb1: default_huffman_ac = { 4'h9, 16'h03f9 };
+                8'hb2: default_huffman_ac = { 4'hf, 16'hffd0 };
+                8'hb3: default_huffman_ac = { 4'hf, 16'hffd1 };
+                8'hb4: default_huffman_ac = { 4'hf, 16'hffd2 };
+                8'hb5: default_huffman_ac = { 4'hf, 16'hffd3 };
+                8'hb6: default_huffman_ac = { 4'hf, 16'hffd4 };
+                8'hb7: default_huffman_ac = { 4'hf, 16'hffd5 };
+                8'hb8: default_huffman_ac = { 4'hf, 16'hffd6 };
+                8'hb9: default_huffman_ac = { 4'hf, 16'hffd7 };
+                8'hba: default_huffman_ac = { 4'hf, 16'hffd8 };
+                8'hc1: default_huffman_ac = { 4'h9, 16'h03fa };
+                8'hc2: default_huffman_ac = { 4'hf, 16'hffd9 };
+                8'hc3: default_huffman_ac = { 4'hf, 16'hffda };
+                8'hc4: default_huffman_ac = { 4'hf, 16'hffdb };
+                8'hc5: default_huffman_ac = { 4'hf, 16'hffdc };
+                8'hc6: default_huffman_ac = { 4'hf, 16'hffdd };
+                8'hc7: default_huffman_ac = { 4'hf, 16'hffde };
+                8'hc8: default_huffman_ac = { 4'hf, 16'hffdf };
+                8'hc9: default_huffman_ac = { 4'hf, 16'hffe0 };
+                8'hca: default_huffman_ac = { 4'hf, 16'hffe1 };
+                8'hd1: default_huffman_ac = { 4'ha, 16'h07f8 };
+                8'hd2: default_huffman_ac = { 4'hf, 16'hffe2 };
+                8'hd3: default_huffman_ac = { 4'hf, 16'hffe3 };
+                8'hd4: default_huffman_ac = { 4'hf, 16'hffe4 };
+                8'hd5: default_huffman_ac = { 4'hf, 16'hffe5 };
+                8'hd6: default_huffman_ac = { 4'hf, 16'hffe6 };
+                8'hd7: default_huffman_ac = { 4'hf, 16'hffe7 };
+                8'hd8: default_huffman_ac = { 4'hf, 16'hffe8 };
+                8'hd9: default_huffman_ac = { 4'hf, 16'hffe9 };
+                8'hda: default_huffman_ac = { 4'hf, 16'hffea };
+                8'he1: default_huffman_ac = { 4'hf, 16'hffeb };
+                8'he2: default_huffman_ac = { 4'hf, 16'hffec };
+                8'he3: default_huffman_ac = { 4'hf, 16'hffed };
+                8'he4: default_huffman_ac = { 4'hf, 16'hffee };
+                8'he5: default_huffman_ac = { 4'hf, 16'hffef };
+                8'he6: default_huffman_ac = { 4'hf, 16'hfff0 };
+                8'he7: default_huffman_ac = { 4'hf, 16'hfff1 };
+                8'he8: default_huffman_ac = { 4'hf, 16'hfff2 };
+                8'he9: default_huffman_ac = { 4'hf, 16'hfff3 };
+                8'hea: default_huffman_ac = { 4'hf, 16'hfff4 };
+                8'hf0: default_huffman_ac = { 4'ha, 16'h07f9 };
+                8'hf1: default_huffman_ac = { 4'hf, 16'hfff5 };
+                8'hf2: default_huffman_ac = { 4'hf, 16'hfff6 };
+                8'hf3: default_huffman_ac = { 4'hf, 16'hfff7 };
+                8'hf4: default_huffman_ac = { 4'hf, 16'hfff8 };
+                8'hf5: default_huffman_ac = { 4'hf, 16'hfff9 };
+                8'hf6: default_huffman_ac = { 4'hf, 16'hfffa };
+                8'hf7: default_huffman_ac = { 4'hf, 16'hfffb };
+                8'hf8: default_huffman_ac = { 4'hf, 16'hfffc };
+                8'hf9: default_huffman_ac = { 4'hf, 16'hfffd };
+                8'hfa: default_huffman_ac = { 4'hf, 16'hfffe };
+                default: default_huffman_ac = { 4'hf, 16'h0000 };
+            endcase
+        end
+    endfunction
 
+    integer i;
+    initial begin
+        for (i = 0; i < (1 << addr_width); i = i + 1) begin
+            mem[i] = ac ? default_huffman_ac(i) : default_huffman_dc(i);
+        end
     end
 endmodule
 
@@ -269,50 +268,67 @@ endmodule
 /**
  * This module expects data to be fed into it with the zig-zag pattern.
  *
+ * It works a symbol at a time instead of a coefficient at a time, and it does up to 2 symbols
+ * every clock cycle. A symbol is anything that gets its own huffman code: the DC difference, a
+ * nonzero AC coefficient along with the run of zeros in front of it, a ZRL (16 zeros), or an EOB.
+ * Zeros never get fetched at all; the 'nonzero' bitmap says where the nonzero coefficients are,
+ * and a priority encoder finds the next one. A block with n symbols takes about n / 2 cycles, and
+ * a run of 16+ zeros just turns into ZRL symbols, so there's no rollback anymore.
+ *
  * input nreset         should be strobed for at least one clock cycle at the start of every new image
- * input input_valid    On every clock rising edge input_valid is high, jpeg_huffman_encode will
- *                      huffman encode the data in src_data_in and put it in the output stream. Some
- *                      pipelining may be necessary, so you shouldn't assume that the data will be
- *                      written to the output stream on the very same rising edge... In other words,
- *                      the output isn't just a combinational result of the module's internal state
- *                      and the input.
- * input src_data_in    This should be an integer in [-1024, 1023] containing the DCT input values.
+ * input start          Pulse this for a cycle to start encoding a block. 'busy' goes high right after.
+ * input reset_prediction  If this is high when start is pulsed, the block's DC coefficient is coded
+ *                      against 0 instead of against the last block's, like at the start of an
+ *                      image. This is what restart intervals need.
+ * output fetch_addr_*  Zig-zag indices of the coefficients that src_data_in_0 and src_data_in_1
+ *                      should hold on the next cycle, exactly like an EBR's raddr and dout. During
+ *                      a stall, the same addresses get read again.
+ * input src_data_in_*  These should be integers in [-1024, 1023] containing the DCT input values.
  *                      These values should NOT be differentially coded, and need to be the same
  *                      scale as the input pixels; if extra LSB padding was added to allow for
  *                      higher-precision fixed point calculations, it should be trimmed off.
+ * input nonzero        Bit i is set if coefficient i (zig-zag order) of the block has a nonzero
+ *                      coded value, that is, if it isn't 0 or 0x8000. It has to hold still while
+ *                      busy is high. Bit 0 (DC) isn't looked at; DC is always coded.
  *
- *  huffman_read_addr and huffman_read_data should be connected to an EBR
+ * input *_table_*      Write ports for the DC and AC huffman tables; see huffman_table_ram for the
+ *                      format. The tables come up holding the standard luminance tables. In jfpjc,
+ *                      huffman_table_builders write them. There are 2 copies of the AC table, one
+ *                      for each symbol slot, and they both get written from the same port.
  *
  * output output_wren   On every clock cycle that this is high, the output contains a new piece of
  *                      data with length 'output_length' bits that should be appended. This data
  *                      is not padded or bytestuffed; another hardware module needs to do that.
  *
- *
- * Each cycle, we might need to pack a maximum of 2 values. This will require a barrel shifter, which
- * requires O(n * lg2(m)) 1-bit multiplexers where n is the bit width of the input value and m is the
- * highest amount that we might want to shift by. In this case, n is 32 (because we need to shift
- * into a 32-bit number) and m is 16, giving us a requirement of 128 muxes and therefore an upper
- * bound of 128 logic elements. Not too bad, and I bet that Lattice's tools can shrink that down a
- * good bit.
- *
- * I suppose that the other option is to have a read or write fifo, or guarantee that the input is
- * fed in at a slower rate.
+ * The pipeline has 3 stages:
+ *     scan     pick the next 2 symbols out of the bitmap and fetch their coefficients
+ *     encode   DC differential coding, coefficient_encoders, and huffman table lookups
+ *     pack     stick the huffman codes and coded values for both symbols together
+ * 2 symbols can be up to 2 * (16 + 11) bits long, but the bitpacker only takes 32 bits a cycle.
+ * When a pair doesn't fit, the first symbol goes out by itself, the second one waits in a holding
+ * register, and the whole pipeline stalls for one cycle while the second one goes out. With real
+ * images that's pretty rare.
  */
 module jpeg_huffman_encode(input clock,
                            input nreset,
                            input start,
+                           input reset_prediction,
 
-                           output reg [5:0] fetch_addr,
-                           input signed [15:0] src_data_in,
+                           output reg [5:0] fetch_addr_0,
+                           output reg [5:0] fetch_addr_1,
+                           input signed [15:0] src_data_in_0,
+                           input signed [15:0] src_data_in_1,
+                           input [63:0] nonzero,
 
-                           // someday, if we want to use external EBRs
-                           //output reg [7:0] dc_huffman_read_addr,
-                           //input     [15:0] dc_huffman_read_code,
-                           //input      [3:0] dc_huffman_read_bitlen,
+                           // huffman table write ports; see huffman_table_ram. Tables should
+                           // only be written while the encoder isn't busy.
+                           input             dc_table_wren,
+                           input      [3:0]  dc_table_waddr,
+                           input      [19:0] dc_table_wdata,
 
-                           //output reg [7:0] ac_huffman_read_addr,
-                           //input     [15:0] ac_huffman_read_code,
-                           //input      [3:0] ac_huffman_read_bitlen,
+                           input             ac_table_wren,
+                           input      [7:0]  ac_table_waddr,
+                           input      [19:0] ac_table_wdata,
 
                            output reg [0:0]  output_wren,
                            output reg [5:0]  output_length,
@@ -320,287 +336,391 @@ module jpeg_huffman_encode(input clock,
 
                            output reg [0:0]  busy);
 
-    ////////////////////////////////////////////////////////////
-    // Registers shared over pipeline stages
-    reg  [5:0] ac_consecutive_zeros_count;
-    reg        do_rollback [0:1];
+`define HUFFMAN_SYMBOL_DC  2'h0
+`define HUFFMAN_SYMBOL_AC  2'h1
+`define HUFFMAN_SYMBOL_ZRL 2'h2
+`define HUFFMAN_SYMBOL_EOB 2'h3
+
+    // Returns the index of the lowest set bit in 'bits'. Bit 6 of the result is set if there
+    // isn't one.
+    function [6:0] lowest_set_bit;
+        input [63:0] bits;
+        integer i;
+        begin
+            lowest_set_bit = 7'h40;
+            for (i = 63; i >= 0; i = i - 1) begin
+                if (bits[i]) lowest_set_bit = i;
+            end
+        end
+    endfunction
+
+    wire stall;
 
     ////////////////////////////////////////////////////////////
-    // Pipeline fetch stage
-    reg  [5:0] rollback_distance;
-    reg  [5:0] index [0:3];
-    reg        valid [0:3];
-    reg        fetch_stage_active;
-    always @(posedge clock) begin
-        if (nreset) begin
-            if (do_rollback[0]) begin
-                index[0] <= (index[2] - rollback_distance);
-            end else if (fetch_stage_active) begin
-                index[0] <= index[0] + 6'h01;
+    // Scan stage
+    //
+    // Pick the next 2 symbols and fetch their coefficients.
+    reg        scan_active;
+    reg        scan_first;
+    reg  [5:0] scan_covered;
+
+    // A symbol is { kind[1:0], run[3:0], position[5:0], covered[5:0] }, where 'position' is the
+    // coefficient that needs to be fetched and 'covered' is the last coefficient that the symbol
+    // takes care of. The block is done once covered is 63.
+    //
+    // Both symbols come out of the same mask: p0 is the first nonzero coefficient after
+    // scan_covered and p1 is the one after that. The 2 priority encoders look at 'above' side by
+    // side, so finding the second symbol doesn't have to wait on the first one; chaining them put
+    // 2 64-bit priority encoders in a row in front of the EBR raddrs.
+    reg [63:0] scan_above;
+    reg  [6:0] scan_p0;
+    reg  [6:0] scan_p1;
+    reg  [6:0] scan_run_a;
+    reg  [6:0] scan_run_b;
+    reg [17:0] symbol_a;
+    reg [17:0] symbol_b;
+
+    reg [17:0] symbol [0:1];
+    reg        symbol_valid_1;
+    reg        scan_last;
+    always @* begin
+        // bit 6 of p0 and p1 is set if there isn't one.
+        scan_above = nonzero & ~((64'h2 << scan_covered) - 64'h1);
+        scan_p0 = lowest_set_bit(scan_above);
+        scan_p1 = lowest_set_bit(scan_above & (scan_above - 64'h1));
+
+        // symbol_a is the one right after scan_covered.
+        scan_run_a = scan_p0 - { 1'b0, scan_covered } - 7'h1;
+        if (scan_p0[6]) begin
+            symbol_a = { `HUFFMAN_SYMBOL_EOB, 4'h0, 6'h00, 6'd63 };
+        end else if (scan_run_a >= 7'h10) begin
+            symbol_a = { `HUFFMAN_SYMBOL_ZRL, 4'hf, 6'h00, scan_covered + 6'h10 };
+        end else begin
+            symbol_a = { `HUFFMAN_SYMBOL_AC, scan_run_a[3:0], scan_p0[5:0], scan_p0[5:0] };
+        end
+
+        // symbol_b is the one after symbol_a. After a ZRL, we're still headed for p0; after an AC,
+        // it's p1's turn.
+        if (symbol_a[5:0] == 6'd63) begin
+            // symbol_a was an EOB, or coefficient 63 is the one it just did. Either way the block
+            // is done, and there's no EOB after it.
+            scan_run_b = 'hx;
+            symbol_b = { `HUFFMAN_SYMBOL_EOB, 4'h0, 6'h00, 6'd63 };
+        end else if (symbol_a[17:16] == `HUFFMAN_SYMBOL_ZRL) begin
+            scan_run_b = scan_run_a - 7'h10;
+            if (scan_run_b >= 7'h10) begin
+                symbol_b = { `HUFFMAN_SYMBOL_ZRL, 4'hf, 6'h00, scan_covered + 6'h20 };
+            end else begin
+                symbol_b = { `HUFFMAN_SYMBOL_AC, scan_run_b[3:0], scan_p0[5:0], scan_p0[5:0] };
+            end
+        end else begin
+            scan_run_b = scan_p1 - scan_p0 - 7'h1;
+            if (scan_p1[6]) begin
+                symbol_b = { `HUFFMAN_SYMBOL_EOB, 4'h0, 6'h00, 6'd63 };
+            end else if (scan_run_b >= 7'h10) begin
+                symbol_b = { `HUFFMAN_SYMBOL_ZRL, 4'hf, 6'h00, scan_p0[5:0] + 6'h10 };
             end else begin
-                index[0] <= 6'h0;
+                symbol_b = { `HUFFMAN_SYMBOL_AC, scan_run_b[3:0], scan_p1[5:0], scan_p1[5:0] };
             end
+        end
 
+        // scan_covered is still 0 on the first cycle, so symbol_a is the one after DC.
+        if (scan_first) begin
+            symbol[0] = { `HUFFMAN_SYMBOL_DC, 4'h0, 6'h00, 6'h00 };
+            symbol[1] = symbol_a;
+        end else begin
+            symbol[0] = symbol_a;
+            symbol[1] = symbol_b;
+        end
+
+        symbol_valid_1 = (symbol[0][5:0] != 6'd63);
+        scan_last = (symbol[0][5:0] == 6'd63) || (symbol[1][5:0] == 6'd63);
+    end
+
+    always @(posedge clock) begin
+        if (nreset) begin
             if (start) begin
-                fetch_stage_active <= 1'b1;
-            end else if (do_rollback[0]) begin
-                fetch_stage_active <= 1'b1;
-            end else if (index[0] == 6'h3f) begin
-                fetch_stage_active <= 1'b0;
+                scan_active <= 1'b1;
+                scan_first <= 1'b1;
+                scan_covered <= 6'h00;
+            end else if (stall || !scan_active) begin
+                scan_active <= scan_active;
+                scan_first <= scan_first;
+                scan_covered <= scan_covered;
             end else begin
-                fetch_stage_active <= fetch_stage_active;
+                scan_active <= !scan_last;
+                scan_first <= 1'b0;
+                scan_covered <= symbol_valid_1 ? symbol[1][5:0] : symbol[0][5:0];
             end
-
         end else begin
-            index[0] <= 6'h0;
             if (start) begin
-                fetch_stage_active <= 1'b1;
+                scan_active <= 1'b1;
             end else begin
-                fetch_stage_active <= 1'b0;
+                scan_active <= 1'b0;
             end
+            scan_first <= 1'b1;
+            scan_covered <= 6'h00;
         end
     end
 
-    always @* begin
-        rollback_distance = ac_consecutive_zeros_count - 6'h10;
-        fetch_addr = index[0];
-        valid[0] = fetch_stage_active;
-    end
-
     ////////////////////////////////////////////////////////////
-    // Pipeline stage 1
+    // Encode stage
     //
-    // Keep track of DC differential coding
-    // Truncate coeffecient value to coded value
-    reg signed [15:0] dc_prev;
-
-    reg signed [15:0] coefficient_to_encode;
-    wire       [15:0] coded_coefficient;
-    wire        [3:0] coded_coefficient_length;
-    coefficient_encoder coefficient_encoder(.coefficient(coefficient_to_encode),
-                                            .coded_value(coded_coefficient),
-                                            .coded_value_length(coded_coefficient_length));
-
+    // Keep track of DC differential coding, truncate coefficient values to coded values, and look
+    // up huffman codes.
+    reg        encode_valid [0:1];
+    reg        encode_last;
+    reg  [1:0] encode_kind [0:1];
+    reg  [3:0] encode_run [0:1];
+    reg  [5:0] encode_position [0:1];
     always @(posedge clock) begin
         if (nreset) begin
-            if ((index[1] == 6'h00) && (valid[1])) begin
-                dc_prev <= src_data_in;
-            end else begin
-                dc_prev <= dc_prev;
-            end
-
-            index[1] <= index[0];
-            if (do_rollback[0]) begin
-                valid[1] <= 1'b0;
-            end else begin
-                valid[1] <= valid[0];
+            if (!stall) begin
+                encode_valid[0] <= scan_active;
+                encode_valid[1] <= scan_active && symbol_valid_1;
+                encode_last <= scan_active && scan_last;
+                { encode_kind[0], encode_run[0], encode_position[0] } <= symbol[0][17:6];
+                { encode_kind[1], encode_run[1], encode_position[1] } <= symbol[1][17:6];
             end
         end else begin
-            dc_prev  <= 16'h0000;
-            index[1] <= 6'hx;
-            valid[1] <= 1'b0;
+            encode_valid[0] <= 1'b0;
+            encode_valid[1] <= 1'b0;
+            encode_last <= 1'b0;
         end
     end
 
+    // While stalled, the fetches for the symbols that are waiting in the encode stage need to
+    // be done over again.
     always @* begin
+        if (stall) begin
+            fetch_addr_0 = encode_position[0];
+            fetch_addr_1 = encode_position[1];
+        end else begin
+            fetch_addr_0 = symbol[0][11:6];
+            fetch_addr_1 = symbol[1][11:6];
+        end
+    end
+
+    reg signed [15:0] dc_prev;
+    always @(posedge clock) begin
         if (nreset) begin
-            if (index[1] == 6'h0) begin
-                coefficient_to_encode = src_data_in - dc_prev;
+            if (encode_valid[0] && (encode_kind[0] == `HUFFMAN_SYMBOL_DC) && !stall) begin
+                dc_prev <= src_data_in_0;
+            end else if (start && reset_prediction) begin
+                dc_prev <= 16'h0000;
             end else begin
-                coefficient_to_encode = src_data_in;
+                dc_prev <= dc_prev;
             end
         end else begin
-            coefficient_to_encode = 16'hxxxx;
+            dc_prev <= 16'h0000;
         end
     end
 
-    ////////////////////////////////////////////////////////////
-    // Pipeline stage 2
-    //
-    // AC run-length encoding and Huffman lookup
-    wire final_cycle;
-    assign final_cycle = ((index[3] == 6'd63) && (!do_rollback[1]));
+    reg signed [15:0] coefficient_to_encode_0;
+    always @* begin
+        if (encode_kind[0] == `HUFFMAN_SYMBOL_DC) begin
+            coefficient_to_encode_0 = src_data_in_0 - dc_prev;
+        end else begin
+            coefficient_to_encode_0 = src_data_in_0;
+        end
+    end
 
-    reg [15:0] coded_coefficient_reg [0:1];
-    reg  [3:0] coded_coefficient_length_reg [0:1];
-    reg  [7:0] ac_rrrrssss;
+    wire [15:0] coded_coefficient [0:1];
+    wire  [3:0] coded_coefficient_length [0:1];
+    coefficient_encoder coefficient_encoder_0(.coefficient(coefficient_to_encode_0),
+                                              .coded_value(coded_coefficient[0]),
+                                              .coded_value_length(coded_coefficient_length[0]));
+    coefficient_encoder coefficient_encoder_1(.coefficient(src_data_in_1),
+                                              .coded_value(coded_coefficient[1]),
+                                              .coded_value_length(coded_coefficient_length[1]));
+
+    // ZRLs and EOBs don't have a coded value, so whatever got fetched for them is ignored.
+    reg  [3:0] value_length [0:1];
+    reg  [7:0] ac_rrrrssss [0:1];
+    integer s;
+    always @* begin
+        for (s = 0; s < 2; s = s + 1) begin
+            case (encode_kind[s])
+                `HUFFMAN_SYMBOL_DC: begin
+                    value_length[s] = coded_coefficient_length[s];
+                    ac_rrrrssss[s] = 8'hxx;
+                end
+                `HUFFMAN_SYMBOL_AC: begin
+                    value_length[s] = coded_coefficient_length[s];
+                    ac_rrrrssss[s] = { encode_run[s], coded_coefficient_length[s] };
+                end
+                `HUFFMAN_SYMBOL_ZRL: begin
+                    value_length[s] = 4'h0;
+                    ac_rrrrssss[s] = 8'hf0;
+                end
+                `HUFFMAN_SYMBOL_EOB: begin
+                    value_length[s] = 4'h0;
+                    ac_rrrrssss[s] = 8'h00;
+                end
+            endcase
+        end
+    end
 
     wire [15:0] dc_coefficient_length_huffman_code;
     wire  [3:0] dc_coefficient_length_huffman_length;
-    test_huffman_table_dc dc_huffman_table(.clock(clock),
-                                           .addr({4'h0, coded_coefficient_length_reg[0]}),
-                                           .huffman_code(dc_coefficient_length_huffman_code),
-                                           .huffman_bitlen(dc_coefficient_length_huffman_length),
-                                           .huffman_valid());
-
-    wire [15:0] ac_rrrrssss_huffman_code;
-    wire  [3:0] ac_rrrrssss_huffman_length;
-    test_huffman_table_ac ac_huffman_table(.clock(clock),
-                                           .addr(ac_rrrrssss),
-                                           .huffman_code(ac_rrrrssss_huffman_code),
-                                           .huffman_bitlen(ac_rrrrssss_huffman_length),
-                                           .huffman_valid());
-
-    // TODO: still need to cover special EOB case
+    huffman_table_ram dc_huffman_table(.clock(clock),
+                                       .wren(dc_table_wren),
+                                       .waddr(dc_table_waddr),
+                                       .wdata(dc_table_wdata),
+                                       .addr(coded_coefficient_length[0]),
+                                       .huffman_code(dc_coefficient_length_huffman_code),
+                                       .huffman_bitlen(dc_coefficient_length_huffman_length));
+    defparam dc_huffman_table.addr_width = 4;
+    defparam dc_huffman_table.ac = 0;
+
+    wire [15:0] ac_rrrrssss_huffman_code [0:1];
+    wire  [3:0] ac_rrrrssss_huffman_length [0:1];
+    huffman_table_ram ac_huffman_table_0(.clock(clock),
+                                         .wren(ac_table_wren),
+                                         .waddr(ac_table_waddr),
+                                         .wdata(ac_table_wdata),
+                                         .addr(ac_rrrrssss[0]),
+                                         .huffman_code(ac_rrrrssss_huffman_code[0]),
+                                         .huffman_bitlen(ac_rrrrssss_huffman_length[0]));
+    defparam ac_huffman_table_0.addr_width = 8;
+    defparam ac_huffman_table_0.ac = 1;
+
+    huffman_table_ram ac_huffman_table_1(.clock(clock),
+                                         .wren(ac_table_wren),
+                                         .waddr(ac_table_waddr),
+                                         .wdata(ac_table_wdata),
+                                         .addr(ac_rrrrssss[1]),
+                                         .huffman_code(ac_rrrrssss_huffman_code[1]),
+                                         .huffman_bitlen(ac_rrrrssss_huffman_length[1]));
+    defparam ac_huffman_table_1.addr_width = 8;
+    defparam ac_huffman_table_1.ac = 1;
+
+    ////////////////////////////////////////////////////////////
+    // Pack stage
+    //
+    // The huffman codes show up this cycle. The table addresses come from the encode stage, which
+    // doesn't move during a stall, so the codes still line up with the pack stage afterwards.
+    reg        pack_valid [0:1];
+    reg        pack_last;
+    reg        pack_dc;
+    reg [15:0] pack_value [0:1];
+    reg  [3:0] pack_value_length [0:1];
     always @(posedge clock) begin
         if (nreset) begin
-            if (valid[1]) begin
-                coded_coefficient_reg[0] <= coded_coefficient;
-                coded_coefficient_length_reg[0] <= coded_coefficient_length;
-            end else begin
-                coded_coefficient_reg[0] <= 16'hx;
-                coded_coefficient_length_reg[0] <= 4'h0;
-            end
-
-            if (final_cycle) begin
-                ac_consecutive_zeros_count <= 6'h0;
-            end else if (valid[2] == 1'b0) begin
-                ac_consecutive_zeros_count <= ac_consecutive_zeros_count;
-            end else if (do_rollback[0]) begin
-                ac_consecutive_zeros_count <= 6'h00;
-            end else if (index[2] == 6'h00) begin
-                ac_consecutive_zeros_count <= 6'h00;
-            end else if (coded_coefficient_length_reg[0] != 4'h0) begin
-                ac_consecutive_zeros_count <= 6'h00;
-            end else begin
-                ac_consecutive_zeros_count <= ac_consecutive_zeros_count + 6'h01;
-            end
-
-            index[2] <= index[1];
-
-            if (do_rollback[0]) begin
-                valid[2] <= 1'b0;
-            end else begin
-                valid[2] <= valid[1];
+            if (!stall) begin
+                pack_valid[0] <= encode_valid[0];
+                pack_valid[1] <= encode_valid[1];
+                pack_last <= encode_last;
+                pack_dc <= (encode_kind[0] == `HUFFMAN_SYMBOL_DC);
+                pack_value[0] <= coded_coefficient[0];
+                pack_value[1] <= coded_coefficient[1];
+                pack_value_length[0] <= value_length[0];
+                pack_value_length[1] <= value_length[1];
             end
         end else begin
-            coded_coefficient_reg[0] <= 16'hxxxx;
-            coded_coefficient_length_reg[0] <= 4'h0;
-
-            ac_consecutive_zeros_count <= 6'h00;
-
-            index[2] <= 6'hx;
-            valid[2] <= 1'b0;
+            pack_valid[0] <= 1'b0;
+            pack_valid[1] <= 1'b0;
+            pack_last <= 1'b0;
         end
     end
 
+    reg [15:0] bit_concatenator_data0;
+    reg  [4:0] bit_concatenator_length0;
     always @* begin
-        // If we have 16 consecutive 0's followed by a nonzero, we don't REALLY need to roll
-        // anything back, but we need to stall the huffman lookup pipeline by one stage and
-        // emit an rrrrssss = 0xf0. So to keep things simple, we MIGHT as WELL roll back and let
-        // the following value, which will be the first nonzero value after a run of 16 zeros,
-        // re-flow through the pipeline. This just wastes an extra cycle in a rare edge case
-        // (that we need to make sure to exericise in unit tests) and saves a bunch of logic.
-        //
-        // If we were to add the stall, we would have
-        //     (ac_consecutive_zeros_count > 6'h10)
-        // instead of
-        //     (ac_consecutive_zeros_count > 6'h0f)
-        do_rollback[0] = ((coded_coefficient_length_reg[0] != 4'h0) &&
-                          (ac_consecutive_zeros_count > 6'h0f));
-
-        if (do_rollback[0]) begin
-            ac_rrrrssss = 8'hf0;
-        end else if ((index[2] == 6'd63) && (coded_coefficient_length_reg[0] == 'h0)) begin
-            // EOB reached.
-            ac_rrrrssss = 8'h0;
+        if (pack_dc) begin
+            bit_concatenator_data0 = dc_coefficient_length_huffman_code;
+            bit_concatenator_length0 = dc_coefficient_length_huffman_length + 5'h1;
         end else begin
-            ac_rrrrssss = { ac_consecutive_zeros_count, coded_coefficient_length_reg[0] };
+            bit_concatenator_data0 = ac_rrrrssss_huffman_code[0];
+            bit_concatenator_length0 = ac_rrrrssss_huffman_length[0] + 5'h1;
         end
     end
 
-    ////////////////////////////////////////////////////////////
-    // Pipeline stage 3
-    //
-    // writeback
-    reg [15:0] bit_concatenator_data0;
-    reg [15:0] bit_concatenator_data1;
-    reg  [4:0] bit_concatenator_length0;
-    reg  [4:0] bit_concatenator_length1;
+    wire [31:0] symbol_data [0:1];
+    wire  [5:0] symbol_length [0:1];
+    double_bit_concatenator concat_0(.data_0(bit_concatenator_data0),
+                                     .data_1(pack_value[0]),
+                                     .length_0(bit_concatenator_length0),
+                                     .length_1({ 1'b0, pack_value_length[0] }),
+
+                                     .data_out(symbol_data[0]),
+                                     .length_out(symbol_length[0]));
+
+    double_bit_concatenator concat_1(.data_0(ac_rrrrssss_huffman_code[1]),
+                                     .data_1(pack_value[1]),
+                                     .length_0(ac_rrrrssss_huffman_length[1] + 5'h1),
+                                     .length_1({ 1'b0, pack_value_length[1] }),
+
+                                     .data_out(symbol_data[1]),
+                                     .length_out(symbol_length[1]));
+
+    reg [6:0] pair_length;
+    reg       pair_fits;
+    always @* begin
+        pair_length = symbol_length[0] + symbol_length[1];
+        pair_fits = !pack_valid[1] || (pair_length <= 7'd32);
+    end
+
+    // if the second symbol is waiting in here, it goes out this cycle and nothing else moves.
+    reg        held_valid;
+    reg        held_last;
+    reg [31:0] held_data;
+    reg  [5:0] held_length;
+    assign stall = pack_valid[0] && !held_valid && !pair_fits;
+
+    reg output_last;
     always @(posedge clock) begin
         if (nreset) begin
-            do_rollback[1] <= do_rollback[0];
-            index[3] <= index[2];
-            valid[3] <= do_rollback[0] ? 1'b0 : valid[2];
-
-            if (index[2] == 6'h00) begin
-                output_wren <= valid[2];
-            end else begin
-                if (valid[2]) begin
-                    if (do_rollback[0]) begin
-                        // if we are rolling back, there is an rrrrssss = 0xf0 that needs to be output.
-                        output_wren <= 1'b1;
-                    end else if (coded_coefficient_length_reg[0] != 4'h0) begin
-                        // If the previous stage has found a nonzero coefficient, we have something
-                        // to output. Note that this condition is implied by do_rollback, but this
-                        // condition does not necessarily imply do_rollback[0]
-                        output_wren <= 1'b1;
-                    end else if (index[2] == 6'd63) begin
-                        // if we didn't rollback and we don't have a nonzero coefficient, the index
-                        // being 63 means that we reached the EOB.
-                        output_wren <= 1'b1;
-                    end else begin
-                        output_wren <= 1'b0;
-                    end
+            if (held_valid) begin
+                output_wren <= 1'b1;
+                output_data <= held_data;
+                output_length <= held_length;
+                output_last <= held_last;
+                held_valid <= 1'b0;
+            end else if (pack_valid[0] && pair_fits) begin
+                output_wren <= 1'b1;
+                if (pack_valid[1]) begin
+                    output_data <= symbol_data[0] | (symbol_data[1] >> symbol_length[0]);
+                    output_length <= pair_length[5:0];
                 end else begin
-                    output_wren <= 1'b0;
+                    output_data <= symbol_data[0];
+                    output_length <= symbol_length[0];
                 end
+                output_last <= pack_last;
+                held_valid <= 1'b0;
+            end else if (pack_valid[0]) begin
+                // doesn't fit; split it.
+                output_wren <= 1'b1;
+                output_data <= symbol_data[0];
+                output_length <= symbol_length[0];
+                output_last <= 1'b0;
+                held_valid <= 1'b1;
+            end else begin
+                output_wren <= 1'b0;
+                output_data <= 32'hxxxx_xxxx;
+                output_length <= 6'h00;
+                output_last <= 1'b0;
+                held_valid <= 1'b0;
             end
 
-            if ((index[3] == 6'd63) && (!do_rollback[1]) && valid[3]) begin
+            held_data <= symbol_data[1];
+            held_length <= symbol_length[1];
+            held_last <= pack_last;
+
+            if (output_wren && output_last) begin
                 busy <= 1'b0;
             end else if (start) begin
                 busy <= 1'b1;
             end else begin
                 busy <= busy;
             end
-
-            if (do_rollback[0]) begin
-                coded_coefficient_reg[1] <= 16'hxxxx;
-                coded_coefficient_length_reg[1] <= 5'h0;
-            end else begin
-                coded_coefficient_reg[1] <= coded_coefficient_reg[0];
-                coded_coefficient_length_reg[1] <= coded_coefficient_length_reg[0];
-            end
-        end else begin // if (nreset)
-            index[3] <= 6'hxx;
-            valid[3] <= 1'h0;
-
-            coded_coefficient_reg[1] <= 16'hxxxx;
-            coded_coefficient_length_reg[1] <= 4'hx;
-            busy <= 1'b0;
-            do_rollback[1] <= 1'b0;
-            output_wren <= 1'b0;
-        end
-    end
-
-    always @* begin
-        if (index[3] == 6'h00) begin
-            bit_concatenator_data0 = dc_coefficient_length_huffman_code;
-            bit_concatenator_length0 = dc_coefficient_length_huffman_length + 5'h1;
-            bit_concatenator_data1 = coded_coefficient_reg[1];
-            bit_concatenator_length1 = coded_coefficient_length_reg[1];
         end else begin
-            bit_concatenator_data0 = ac_rrrrssss_huffman_code;
-            bit_concatenator_length0 = ac_rrrrssss_huffman_length + 5'h1;
-            bit_concatenator_data1 = coded_coefficient_reg[1];
-            bit_concatenator_length1 = coded_coefficient_length_reg[1];
+            output_wren <= 1'b0;
+            output_data <= 32'hxxxx_xxxx;
+            output_length <= 6'h00;
+            output_last <= 1'b0;
+            held_valid <= 1'b0;
+            busy <= 1'b0;
         end
     end
-
-    wire [5:0] output_length_wire;
-    wire [31:0] output_data_wire;
-    double_bit_concatenator concat(.data_0(bit_concatenator_data0),
-                                   .data_1(bit_concatenator_data1),
-                                   .length_0(bit_concatenator_length0),
-                                   .length_1(bit_concatenator_length1),
-
-                                   .data_out(output_data_wire),
-                                   .length_out(output_length_wire));
-
-    always @* begin
-        output_data = output_data_wire;
-        output_length = output_length_wire;
-    end
-
 endmodule
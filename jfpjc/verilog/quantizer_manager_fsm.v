@@ -3,6 +3,10 @@
 /**
  * This FSM monitors the quantizer's progress and feeds in new buffers from the dct output stage
  * when the quantizer is ready and when there is more data ready in the dct output stage buffers.
+ *
+ * If an MCU row doesn't divide evenly between the DCT engines, the DCT engines with nothing to do
+ * on the last run of a row still run on whatever was left in their EBRs; the quantizer skips their
+ * results.
  */
 module quantizer_manager_fsm(input                   clock,
                              input                   nreset,
@@ -11,18 +15,30 @@ module quantizer_manager_fsm(input                   clock,
 
                              output reg [1:0]            quantizer_readbuf,
                              output reg [5:0]        coefficient_index,
-                             output [2:0]            ebr_index,
+                             output [(dct_index_width - 1):0] ebr_index,
                              output [1:0]            quantizer_output_buffer,
                              output reg              dividend_divisor_valid);
+    parameter num_dcts = 5, mcus_per_row = 40;
+    localparam dct_index_width = (num_dcts > 1) ? $clog2(num_dcts) : 1;
+    localparam mcu_groups_per_row = (mcus_per_row + num_dcts - 1) / num_dcts;
+    localparam mcu_group_width = (mcu_groups_per_row > 1) ? $clog2(mcu_groups_per_row) : 1;
+    localparam [(dct_index_width - 1):0] last_group_last_ebr =
+        mcus_per_row - ((mcu_groups_per_row - 1) * num_dcts) - 1;
+
     reg [0:0] quantizer_state;
 `define QUANTIZER_STATE_WAIT 1'h0
 `define QUANTIZER_STATE_QUANTIZE 1'h1
-    reg [2:0] ebr_index_internal [0:1];
+    reg [(dct_index_width - 1):0] ebr_index_internal [0:1];
     reg [1:0] quantizer_output_buffer_internal [0:1];
 
     assign ebr_index = ebr_index_internal[1];
     assign quantizer_output_buffer = quantizer_output_buffer_internal[1];
 
+    // which run of the DCT engines in the current MCU row is being quantized.
+    reg [(mcu_group_width - 1):0] mcu_group;
+    wire [(dct_index_width - 1):0] last_ebr_index = (mcu_group == (mcu_groups_per_row - 1)) ?
+                                last_group_last_ebr : (num_dcts - 1);
+
     always @(posedge clock) begin
         if (nreset) begin
             ebr_index_internal[1] <= ebr_index_internal[0];
@@ -47,10 +63,12 @@ module quantizer_manager_fsm(input                   clock,
                     if (coefficient_index == 'h3f) begin
                         quantizer_output_buffer_internal[0] <= quantizer_output_buffer_internal[0] + 'h1;
 
-                        if (ebr_index_internal[0] == 3'h4) begin
+                        if (ebr_index_internal[0] == last_ebr_index) begin
                             quantizer_state <= `QUANTIZER_STATE_WAIT;
                             quantizer_readbuf <= quantizer_readbuf + 'h1;
                             ebr_index_internal[0] <= 'h0;
+                            mcu_group <= (mcu_group == (mcu_groups_per_row - 1)) ?
+                                         'h0 : (mcu_group + 'h1);
                         end else begin
                             quantizer_state <= `QUANTIZER_STATE_QUANTIZE;
                             quantizer_readbuf <= quantizer_readbuf;
@@ -71,6 +89,7 @@ module quantizer_manager_fsm(input                   clock,
             coefficient_index <= 'h0;
             ebr_index_internal[0] <= 'h0;
             ebr_index_internal[1] <= 'h0;
+            mcu_group <= 'h0;
             dividend_divisor_valid <= 'h0;
         end
     end
@@ -0,0 +1,244 @@
+`ifndef RECIPROCAL_QUANTIZER_V
+`define RECIPROCAL_QUANTIZER_V
+
+`timescale 1ns/100ps
+
+/**
+ * Quantization by multiplying by a reciprocal instead of dividing.
+ *
+ * Every quantization table entry Q gets a 16-bit reciprocal { e[2:0], M[12:0] }, where
+ *     e = floor(log2(Q - 1))      (0 for Q = 1 or 2)
+ *     M = min(ceil(2^(13 + e) / Q), 8191)
+ * and the quotient's magnitude is
+ *     ((|dividend| * M) + 2^(12 + e)) >> (13 + e)
+ * For every Q from 1 to 255 and every |dividend| <= 2048, which is everything the 7q8 DCT output
+ * can hold, that's exactly (|dividend| + (Q / 2)) / Q: the quotient rounded to nearest, with
+ * halves rounded away from 0. I checked every combination with a script. A Q of 0 gets a
+ * reciprocal of 0, so everything quantizes to 0.
+ *
+ * M always has bit 12 set, so it's precise enough to get this right with a 16x16 multiply. e
+ * picks which bits of the product are the answer.
+ */
+
+/**
+ * This fills the reciprocal table from the quantization table, one entry at a time, with a small
+ * shift-and-subtract divider. It starts by itself coming out of reset, and starts over from the
+ * first entry whenever start is pulsed, even if it's in the middle of a table. That way, a host
+ * can write the quantization table one entry at a time and pulse start after every write; the
+ * last rebuild will see the whole table. Each entry takes 17 cycles, so the whole table takes a
+ * bit over 1000 cycles, which is a lot less time than it takes the ingester to fill its first MCU
+ * row.
+ */
+module quant_reciprocal_builder(input                 clock,
+                                input                 nreset,
+
+                                input                 start,
+
+                                // quantization table EBR read port; data is expected 1 cycle
+                                // after the address.
+                                output     [5:0]      quant_table_addr,
+                                input      [7:0]      quant_table_data,
+
+                                // reciprocal table EBR write port
+                                output reg            reciprocal_wren,
+                                output reg [5:0]      reciprocal_waddr,
+                                output reg [15:0]     reciprocal_data,
+
+                                output                busy);
+`define RECIPROCAL_BUILDER_STATE_IDLE 3'h0
+`define RECIPROCAL_BUILDER_STATE_FETCH 3'h1
+`define RECIPROCAL_BUILDER_STATE_LOAD 3'h2
+`define RECIPROCAL_BUILDER_STATE_DIVIDE 3'h3
+`define RECIPROCAL_BUILDER_STATE_WRITE 3'h4
+    reg [2:0] state;
+    reg [5:0] index;
+
+    reg  [7:0] Q;
+    reg  [2:0] e;
+    reg [20:0] remainder;
+    reg [20:0] divisor;
+    reg [13:0] quotient;
+    reg  [3:0] bits_left;
+
+    assign quant_table_addr = index;
+    assign busy = (state != `RECIPROCAL_BUILDER_STATE_IDLE);
+
+    function [2:0] floor_log2;
+        input [7:0] x;
+        integer i;
+        begin
+            floor_log2 = 3'h0;
+            for (i = 1; i < 8; i = i + 1) begin
+                if (x[i]) floor_log2 = i;
+            end
+        end
+    endfunction
+
+    wire [2:0] next_e = floor_log2(quant_table_data - 8'h1);
+
+    always @(posedge clock) begin
+        if (nreset && start) begin
+            reciprocal_wren <= 1'b0;
+            index <= 6'h0;
+            state <= `RECIPROCAL_BUILDER_STATE_FETCH;
+        end else if (nreset) begin
+            case (state)
+                `RECIPROCAL_BUILDER_STATE_IDLE: begin
+                    reciprocal_wren <= 1'b0;
+                    index <= 6'h0;
+                    state <= `RECIPROCAL_BUILDER_STATE_IDLE;
+                end
+
+                // the quantization table EBR is reading index on this cycle.
+                `RECIPROCAL_BUILDER_STATE_FETCH: begin
+                    reciprocal_wren <= 1'b0;
+                    state <= `RECIPROCAL_BUILDER_STATE_LOAD;
+                end
+
+                // ceil(2^(13 + e) / Q) == floor((2^(13 + e) + Q - 1) / Q), which is less than
+                // 2^14, so 14 steps of long division starting from (Q << 13) cover it.
+                `RECIPROCAL_BUILDER_STATE_LOAD: begin
+                    Q <= quant_table_data;
+                    e <= (quant_table_data <= 8'h2) ? 3'h0 : next_e;
+                    remainder <= (21'h1 << (13 + ((quant_table_data <= 8'h2) ? 3'h0 : next_e))) +
+                                 quant_table_data - 21'h1;
+                    divisor <= { quant_table_data, 13'h0 };
+                    quotient <= 14'h0;
+                    bits_left <= 4'd14;
+                    state <= `RECIPROCAL_BUILDER_STATE_DIVIDE;
+                end
+
+                `RECIPROCAL_BUILDER_STATE_DIVIDE: begin
+                    if (remainder >= divisor) begin
+                        remainder <= remainder - divisor;
+                        quotient <= { quotient[12:0], 1'b1 };
+                    end else begin
+                        quotient <= { quotient[12:0], 1'b0 };
+                    end
+                    divisor <= divisor >> 1;
+                    bits_left <= bits_left - 4'h1;
+                    state <= (bits_left == 4'h1) ? `RECIPROCAL_BUILDER_STATE_WRITE :
+                                                   `RECIPROCAL_BUILDER_STATE_DIVIDE;
+                end
+
+                `RECIPROCAL_BUILDER_STATE_WRITE: begin
+                    reciprocal_wren <= 1'b1;
+                    reciprocal_waddr <= index;
+                    if (Q == 8'h0) begin
+                        reciprocal_data <= 16'h0000;
+                    end else if (quotient[13]) begin
+                        reciprocal_data <= { e, 13'h1fff };
+                    end else begin
+                        reciprocal_data <= { e, quotient[12:0] };
+                    end
+
+                    index <= index + 6'h1;
+                    state <= (index == 6'h3f) ? `RECIPROCAL_BUILDER_STATE_IDLE :
+                                                `RECIPROCAL_BUILDER_STATE_FETCH;
+                end
+
+                default: begin
+                    reciprocal_wren <= 1'b0;
+                    state <= `RECIPROCAL_BUILDER_STATE_IDLE;
+                end
+            endcase
+        end else begin
+            // build the table as soon as we come out of reset.
+            state <= `RECIPROCAL_BUILDER_STATE_FETCH;
+            index <= 6'h0;
+            reciprocal_wren <= 1'b0;
+            reciprocal_waddr <= 6'h0;
+            reciprocal_data <= 16'h0000;
+        end
+    end
+endmodule
+
+/**
+ * Drop-in replacement for pipelined_divider: 4 cycles from input to output instead of 18, and the
+ * multiply goes in a DSP instead of 17 stages of subtractors.
+ */
+module reciprocal_quantizer(input                     nreset,
+                            input                     clock,
+
+                            input                     input_valid,
+                            input              [7:0]  tag,
+                            input              [15:0] reciprocal,
+                            input       signed [15:0] dividend,
+
+                            output reg                output_valid,
+                            output reg         [7:0]  tag_out,
+                            output reg  signed [15:0] quotient);
+    localparam multiplier_latency = 2;
+
+    // stage 0: take the magnitude.
+    reg signed [15:0] magnitude;
+    reg        [15:0] stage0_reciprocal;
+    reg               stage0_neg;
+    reg               stage0_valid;
+    reg         [7:0] stage0_tag;
+    always @(posedge clock) begin
+        if (nreset) begin
+            magnitude <= dividend[15] ? -dividend : dividend;
+            stage0_reciprocal <= reciprocal;
+            stage0_neg <= dividend[15];
+            stage0_valid <= input_valid;
+            stage0_tag <= tag;
+        end else begin
+            magnitude <= 'hxx;
+            stage0_reciprocal <= 'hxx;
+            stage0_neg <= 1'bx;
+            stage0_valid <= 1'b0;
+            stage0_tag <= 'hxx;
+        end
+    end
+
+    // stages 1 and 2: multiply by M. Everything else waits alongside.
+    wire signed [31:0] product;
+    pipelined_multiplier mul(.clock(clock),
+                             .nreset(nreset),
+                             .a(magnitude),
+                             .b({ 3'h0, stage0_reciprocal[12:0] }),
+                             .out(product));
+
+    reg  [2:0] e_delay     [0:(multiplier_latency - 1)];
+    reg        neg_delay   [0:(multiplier_latency - 1)];
+    reg        valid_delay [0:(multiplier_latency - 1)];
+    reg  [7:0] tag_delay   [0:(multiplier_latency - 1)];
+    integer i;
+    always @(posedge clock) begin
+        if (nreset) begin
+            e_delay[0] <= stage0_reciprocal[15:13];
+            neg_delay[0] <= stage0_neg;
+            valid_delay[0] <= stage0_valid;
+            tag_delay[0] <= stage0_tag;
+            for (i = 1; i < multiplier_latency; i = i + 1) begin
+                e_delay[i] <= e_delay[i - 1];
+                neg_delay[i] <= neg_delay[i - 1];
+                valid_delay[i] <= valid_delay[i - 1];
+                tag_delay[i] <= tag_delay[i - 1];
+            end
+        end else begin
+            for (i = 0; i < multiplier_latency; i = i + 1) begin
+                valid_delay[i] <= 1'b0;
+            end
+        end
+    end
+
+    // stage 3: round, pick out the right bits, and put the sign back.
+    wire  [2:0] e = e_delay[multiplier_latency - 1];
+    wire [31:0] rounded = product + (32'h0000_1000 << e);
+    wire [15:0] rounded_magnitude = rounded >> (13 + e);
+    always @(posedge clock) begin
+        if (nreset) begin
+            quotient <= neg_delay[multiplier_latency - 1] ? -rounded_magnitude : rounded_magnitude;
+            output_valid <= valid_delay[multiplier_latency - 1];
+            tag_out <= tag_delay[multiplier_latency - 1];
+        end else begin
+            quotient <= 'hxx;
+            output_valid <= 1'b0;
+            tag_out <= 'hxx;
+        end
+    end
+endmodule
+
+`endif
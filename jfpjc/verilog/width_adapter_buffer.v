@@ -21,6 +21,8 @@
  *
  * If we find that it ever happens, we can just clock the output buffers twice as fast as the
  * rest of the circuitry, and it will be fine.
+ *
+ * idle is high when every word that came in has been put out all the way.
  */
 
 `timescale 1ns/100ps
@@ -32,7 +34,8 @@ module width_adapter_buffer(input                      clock,
                             input [input_width - 1:0]  data_in,
 
                             output reg                 data_out_valid,
-                            output reg [output_width - 1:0] data_out);
+                            output reg [output_width - 1:0] data_out,
+                            output                     idle);
     // input_width must be equal to k * output_width for some k > 1.
     // buffer_depth must be a power of 2.
     parameter integer input_width = 32, output_width = 8, buffer_width = 16, buffer_depth = 256;
@@ -114,4 +117,6 @@ module width_adapter_buffer(input                      clock,
             data_out_latch_slice_select <= 'h0;
         end
     end
+
+    assign idle = ((data_in_ptr == data_out_ptr) && !data_out_latch_valid && !data_out_valid);
 endmodule
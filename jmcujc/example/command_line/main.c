@@ -1,13 +1,36 @@
 /**
  * Copyright February 2020, John Mamish
+ *
+ * Command line front end for jmcujc.
+ *
+ *     jfpjc_c [-p | -a] [-t] <image name> <output file name>
+ *     jfpjc_c [-p | -a] [-t] [-j threads] -o <output directory> <inputs...>
+ *
+ * The second form is batch mode. Inputs can be files, directories (every file in them), glob
+ * patterns (quoted, for when there are too many files for the shell), or "@list" files with one
+ * path per line. Every frame gets written to the output directory with its extension swapped for
+ * ".jpg".
+ *
+ * Batch mode encodes frames on a pool of worker threads, each with its own encoder state. Inputs are
+ * mmap'd and the frame a worker is going to do next gets prefetched while it's compressing the
+ * current one. Outputs are written by a separate thread out of two buffers per worker, so a worker
+ * can start on its next frame while the last one is still being written.
  */
 
+#define _POSIX_C_SOURCE 200809L
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
 #include <math.h>
-#include <pam.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "jmcujc.h"
 #include "jmcujc_image_util.h"
@@ -20,6 +43,7 @@ static jmcujc_bytearray_t* jmcujc_bytearray_create(int size)
 {
     jmcujc_bytearray_t* ret = calloc(1, sizeof(jmcujc_bytearray_t));
     ret->base               = calloc(1, size);
+    ret->len                = size;
     ret->index              = 0;
 
     return ret;
@@ -56,53 +80,615 @@ static void print_component(const jmcujc_component_t* c)
     }
 }
 
-int main(int argc, char** argv)
+typedef struct encode_options
+{
+    // '-p' makes a progressive jpeg and '-a' makes an arithmetic-coded one instead of a baseline
+    // huffman-coded one. '-t' embeds a 1/8th scale thumbnail.
+    bool progressive;
+    bool arithmetic;
+    bool thumbnail;
+} encode_options_t;
+
+/**
+ * Everything that one encoder needs between frames. jmcujc keeps all of its state in the params
+ * struct, so every thread having its own one of these is enough for them to run side-by-side.
+ */
+typedef struct encoder
+{
+    jmcujc_jpeg_params_t params;
+
+    // component samples, grown as needed.
+    float* component_buf;
+    int component_buf_size;
+} encoder_t;
+
+/**
+ * Room for the compressed frame. Even white noise comes out to less than a byte per pixel at our
+ * quant tables, so 2 bytes per pixel is plenty.
+ */
+static int output_size_bound(int width, int height)
+{
+    return (2 * (((width + 7) & ~7) * ((height + 7) & ~7))) + (1 << 16);
+}
+
+/**
+ * Compresses one grayscale frame into 'data', which needs to hold output_size_bound() bytes.
+ *
+ * jmcujc's bit packer ORs bits into the bytestream, so it has to start out zeroed. 'data' can be
+ * reused from the last frame as long as its index wasn't touched; only the part that the last
+ * frame used gets cleared.
+ *
+ * @return  returns 0 on success, < 0 on failure.
+ */
+static int encode_frame(encoder_t* encoder,
+                        const encode_options_t* options,
+                        const jmcujc_source_image_slice_t* image_slice,
+                        jmcujc_bytearray_t* data)
 {
-    if (argc != 3) {
-        printf("Usage: %s <image name> <output file name>\r\n", argv[0]);
+    int retval = 0;
+    float* scratch = NULL;
+    jmcujc_bytearray_t* thumbnail_data = NULL;
+    jmcujc_jpeg_params_t* params = &encoder->params;
+
+    if (((image_slice->width % 8) != 0) || ((image_slice->height % 8) != 0)) {
+        printf("jmcujc only works on images with width and height that are multiples of 8; this "
+               "one is %ix%i\n", image_slice->width, image_slice->height);
         return -1;
     }
 
-    jmcujc_source_image_slice_t* image_slice = grayscale_source_image_from_pam(argv[1], argv[0]);
-
+    const int component_size = image_slice->width * image_slice->height;
+    if (component_size > encoder->component_buf_size) {
+        free(encoder->component_buf);
+        encoder->component_buf = calloc(component_size, sizeof(float));
+        encoder->component_buf_size = component_size;
+    }
 
-    jmcujc_bytearray_t* data = jmcujc_bytearray_create((1 << 18));
     jmcujc_component_t component;
-    const int component_size = image_slice->width * image_slice->height;
-    float* component_buf = calloc(component_size, sizeof(float));
     jmcujc_component_initialize_from_source_image_slice(&component,
                                                         image_slice,
-                                                        component_buf,
+                                                        encoder->component_buf,
                                                         0,
                                                         image_slice->height);
 
-    jmcujc_jpeg_params_t bw_params;
-    memcpy(&bw_params, &bw_defaults, sizeof(bw_params));
-    bw_params.jpeg_quantization_tables[0] = &lum_quant_table_medium;
-    bw_params.width = image_slice->width;
-    bw_params.height = image_slice->height;
-    jmcujc_write_headers(&component, 1, &bw_params, data);
-    jmcujc_compress_component_to_bytestream(&component, &bw_params, data);
-    jmcujc_add_eoi_marker(&bw_params, data);
+    memcpy(params, &bw_defaults, sizeof(jmcujc_jpeg_params_t));
+    params->jpeg_quantization_tables[0] = &lum_quant_table_medium;
+    params->width = image_slice->width;
+    params->height = image_slice->height;
+    if (options->progressive) {
+        params->progressive_script = &progressive_script_default;
+    }
+    if (options->arithmetic) {
+        params->entropy_backend = &jmcujc_entropy_arithmetic;
+    }
+    if (options->thumbnail) {
+        params->thumbnail = calloc(jmcujc_thumbnail_width(params) *
+                                   jmcujc_thumbnail_height(params), 1);
+    }
+
+    // the bit packer can touch a few bytes past the index.
+    const int dirty = ((data->index + 8) < data->len) ? (data->index + 8) : data->len;
+    memset(data->base, 0, dirty);
+    data->index = 0;
+    if ((retval = jmcujc_write_headers(&component, 1, params, data)) ||
+        (retval = jmcujc_compress_component_to_bytestream(&component, params, data)) ||
+        (retval = jmcujc_add_eoi_marker(params, data))) {
+        goto _end;
+    }
+
+    if (options->thumbnail) {
+        const int scratch_size = (((jmcujc_thumbnail_width(params) + 7) & ~7) *
+                                  ((jmcujc_thumbnail_height(params) + 7) & ~7));
+        scratch = calloc(scratch_size, sizeof(float));
+        // jmcujc's bit packer doesn't check bounds, so this needs to be big enough for whatever the
+        // thumbnail compresses to; jmcujc_embed_thumbnail is what enforces the 64k segment limit.
+        thumbnail_data = jmcujc_bytearray_create(output_size_bound(jmcujc_thumbnail_width(params),
+                                                                   jmcujc_thumbnail_height(params)));
+        if ((retval = jmcujc_encode_thumbnail(params, scratch, thumbnail_data)) ||
+            (retval = jmcujc_embed_thumbnail(thumbnail_data, data))) {
+            printf("failed to add thumbnail (%i)\n", retval);
+        }
+    }
+
+_end:
+    if (retval) {
+        // no telling how much of it got used.
+        data->index = data->len;
+    }
+    if (thumbnail_data != NULL) {
+        jmcujc_bytearray_destroy(thumbnail_data);
+    }
+    free(scratch);
+    free(params->thumbnail);
+    params->thumbnail = NULL;
+    return retval;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+// ======= batch mode =======
+typedef struct frame
+{
+    char* input_path;
+    char* output_path;
+
+    int retval;
+    long raster_bytes;
+    long jpeg_bytes;
+} frame_t;
+
+typedef struct output_buffer
+{
+    jmcujc_bytearray_t* data;
+    frame_t* frame;
+
+    // true from when the buffer gets queued until the writer is done with it.
+    bool busy;
+} output_buffer_t;
+
+/**
+ * The writer thread takes finished frames off of a queue and writes them out. It's the only thing
+ * that writes files, so the workers never wait on the disk unless both of their buffers are still
+ * waiting to be written.
+ */
+typedef struct writer
+{
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t written;
+
+    output_buffer_t** queue;
+    int capacity;
+    int head;
+    int count;
+
+    bool done;
+} writer_t;
+
+typedef struct batch_state
+{
+    frame_t* frames;
+    int nframes;
+    int nworkers;
+    const encode_options_t* options;
+
+    pthread_mutex_t lock;
+    int next_frame;
+
+    writer_t writer;
+} batch_state_t;
+
+static void* writer_run(void* arg)
+{
+    writer_t* writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while ((writer->count == 0) && !writer->done) {
+            pthread_cond_wait(&writer->queued, &writer->lock);
+        }
+        if (writer->count == 0) {
+            break;
+        }
+
+        output_buffer_t* buffer = writer->queue[writer->head];
+        writer->head = (writer->head + 1) % writer->capacity;
+        writer->count--;
+        pthread_mutex_unlock(&writer->lock);
+
+        frame_t* frame = buffer->frame;
+        FILE* outfile = fopen(frame->output_path, "wb");
+        if ((outfile == NULL) || (fwrite(buffer->data->base, buffer->data->index, 1, outfile) != 1)) {
+            frame->retval = -1;
+        }
+        if (outfile != NULL) {
+            fclose(outfile);
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        buffer->busy = false;
+        pthread_cond_broadcast(&writer->written);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+static void writer_enqueue(writer_t* writer, output_buffer_t* buffer)
+{
+    pthread_mutex_lock(&writer->lock);
+    buffer->busy = true;
+    writer->queue[(writer->head + writer->count) % writer->capacity] = buffer;
+    writer->count++;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+static void writer_wait_for(writer_t* writer, output_buffer_t* buffer)
+{
+    pthread_mutex_lock(&writer->lock);
+    while (buffer->busy) {
+        pthread_cond_wait(&writer->written, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/**
+ * Asks the kernel to start reading a file in the background.
+ */
+static void prefetch_file(const char* path)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+static void* worker_run(void* arg)
+{
+    batch_state_t* state = arg;
+    encoder_t encoder = { .component_buf = NULL, .component_buf_size = 0 };
+    output_buffer_t buffers[2] = { { 0 } };
+    int next_buffer = 0;
+
+    while (1) {
+        pthread_mutex_lock(&state->lock);
+        const int i = state->next_frame++;
+        pthread_mutex_unlock(&state->lock);
+
+        if (i >= state->nframes) {
+            break;
+        }
+
+        // Frames get handed out in order, so this worker's next one is probably nworkers from now.
+        if ((i + state->nworkers) < state->nframes) {
+            prefetch_file(state->frames[i + state->nworkers].input_path);
+        }
+
+        frame_t* frame = &state->frames[i];
+        pnm_image_t pnm;
+        jmcujc_source_image_slice_t image_slice;
+        if ((frame->retval = grayscale_source_image_from_pam(frame->input_path, &pnm, &image_slice))) {
+            continue;
+        }
+
+        // the buffer's last frame has to be written before it can be reused.
+        output_buffer_t* buffer = &buffers[next_buffer];
+        next_buffer ^= 1;
+        writer_wait_for(&state->writer, buffer);
+
+        const int size = output_size_bound(image_slice.width, image_slice.height);
+        if ((buffer->data == NULL) || (buffer->data->len < size)) {
+            if (buffer->data != NULL) {
+                jmcujc_bytearray_destroy(buffer->data);
+            }
+            buffer->data = jmcujc_bytearray_create(size);
+        }
+
+        frame->retval = encode_frame(&encoder, state->options, &image_slice, buffer->data);
+        frame->raster_bytes = (long)image_slice.width * image_slice.height;
+        pnm_image_unmap(&pnm);
+
+        if (frame->retval == 0) {
+            frame->jpeg_bytes = buffer->data->index;
+            buffer->frame = frame;
+            writer_enqueue(&state->writer, buffer);
+        }
+    }
+
+    for (int b = 0; b < 2; b++) {
+        writer_wait_for(&state->writer, &buffers[b]);
+        if (buffers[b].data != NULL) {
+            jmcujc_bytearray_destroy(buffers[b].data);
+        }
+    }
+    free(encoder.component_buf);
+
+    return NULL;
+}
+
+static bool is_directory(const char* path)
+{
+    struct stat st;
+    return (stat(path, &st) == 0) && S_ISDIR(st.st_mode);
+}
+
+static char* join_path(const char* dir, const char* name)
+{
+    char* path = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+typedef struct path_list
+{
+    char** paths;
+    int count;
+    int capacity;
+} path_list_t;
+
+static void path_list_add(path_list_t* list, char* path)
+{
+    if (list->count == list->capacity) {
+        list->capacity = (list->capacity == 0) ? 64 : (list->capacity * 2);
+        list->paths = realloc(list->paths, list->capacity * sizeof(char*));
+    }
+    list->paths[list->count++] = path;
+}
+
+/**
+ * Adds the regular files in a directory, sorted by name.
+ */
+static int add_directory(path_list_t* list, const char* path)
+{
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    const int first = list->count;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* full_path = join_path(path, entry->d_name);
+        struct stat st;
+        if ((stat(full_path, &st) == 0) && S_ISREG(st.st_mode)) {
+            path_list_add(list, full_path);
+        } else {
+            free(full_path);
+        }
+    }
+    closedir(dir);
+
+    qsort(&list->paths[first], list->count - first, sizeof(char*), compare_strings);
+    return 0;
+}
+
+static int add_list_file(path_list_t* list, const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') {
+            path_list_add(list, strdup(line));
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int add_input(path_list_t* list, const char* arg)
+{
+    if (arg[0] == '@') {
+        return add_list_file(list, arg + 1);
+    } else if (is_directory(arg)) {
+        return add_directory(list, arg);
+    } else if (strpbrk(arg, "*?[") != NULL) {
+        glob_t g;
+        if (glob(arg, 0, NULL, &g) != 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < g.gl_pathc; i++) {
+            path_list_add(list, strdup(g.gl_pathv[i]));
+        }
+        globfree(&g);
+        return 0;
+    } else {
+        path_list_add(list, strdup(arg));
+        return 0;
+    }
+}
+
+/**
+ * output_dir/<input's filename with its extension replaced by .jpg>
+ */
+static char* output_path_for(const char* output_dir, const char* input_path)
+{
+    const char* slash = strrchr(input_path, '/');
+    const char* name = (slash == NULL) ? input_path : (slash + 1);
+    const char* dot = strrchr(name, '.');
+    const size_t stem_len = ((dot == NULL) || (dot == name)) ? strlen(name) : (size_t)(dot - name);
+
+    char* path = malloc(strlen(output_dir) + stem_len + 6);
+    sprintf(path, "%s/%.*s.jpg", output_dir, (int)stem_len, name);
+    return path;
+}
+
+static int run_batch(const path_list_t* inputs,
+                     const char* output_dir,
+                     int nthreads,
+                     const encode_options_t* options)
+{
+    batch_state_t state = { .nframes = inputs->count, .options = options, .next_frame = 0 };
+    state.frames = calloc(inputs->count, sizeof(frame_t));
+    for (int i = 0; i < inputs->count; i++) {
+        state.frames[i].input_path = inputs->paths[i];
+        state.frames[i].output_path = output_path_for(output_dir, inputs->paths[i]);
+    }
+    state.nworkers = (inputs->count < nthreads) ? inputs->count : nthreads;
+    state.nworkers = (state.nworkers < 1) ? 1 : state.nworkers;
+    pthread_mutex_init(&state.lock, NULL);
+
+    writer_t* writer = &state.writer;
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->queued, NULL);
+    pthread_cond_init(&writer->written, NULL);
+    writer->capacity = 2 * state.nworkers;
+    writer->queue = calloc(writer->capacity, sizeof(output_buffer_t*));
+    writer->head = writer->count = 0;
+    writer->done = false;
+
+    const double start = now();
+    pthread_t writer_thread;
+    pthread_create(&writer_thread, NULL, writer_run, writer);
+    pthread_t* workers = calloc(state.nworkers, sizeof(pthread_t));
+    for (int i = 1; i < state.nworkers; i++) {
+        pthread_create(&workers[i], NULL, worker_run, &state);
+    }
+    worker_run(&state);
+    for (int i = 1; i < state.nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->done = true;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer_thread, NULL);
+    const double elapsed = now() - start;
+
+    int nfailed = 0;
+    long raster_bytes = 0, jpeg_bytes = 0;
+    for (int i = 0; i < state.nframes; i++) {
+        const frame_t* frame = &state.frames[i];
+        if (frame->retval) {
+            fprintf(stderr, "failed to encode %s to %s (error %i)\n", frame->input_path,
+                    frame->output_path, frame->retval);
+            nfailed++;
+            continue;
+        }
+        raster_bytes += frame->raster_bytes;
+        jpeg_bytes += frame->jpeg_bytes;
+    }
+
+    const int nencoded = state.nframes - nfailed;
+    printf("%i frames in %.3f s on %i threads: %.1f frames/s, %.1f MB/s in, %.1f MB/s out\n",
+           nencoded, elapsed, state.nworkers, nencoded / elapsed, (raster_bytes / elapsed) * 1e-6,
+           (jpeg_bytes / elapsed) * 1e-6);
+
+    pthread_mutex_destroy(&state.lock);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->queued);
+    pthread_cond_destroy(&writer->written);
+    free(writer->queue);
+    free(workers);
+    for (int i = 0; i < state.nframes; i++) {
+        free(state.frames[i].output_path);
+    }
+    free(state.frames);
+
+    return nfailed ? -1 : 0;
+}
+
+// ======= single file mode =======
+static int run_single(const char* infile_name, const char* outfile_name, const encode_options_t* options)
+{
+    pnm_image_t pnm;
+    jmcujc_source_image_slice_t image_slice;
+    if (grayscale_source_image_from_pam(infile_name, &pnm, &image_slice)) {
+        return -1;
+    }
+
+    int retval = 0;
+    encoder_t encoder = { .component_buf = NULL, .component_buf_size = 0 };
+    jmcujc_bytearray_t* data =
+        jmcujc_bytearray_create(output_size_bound(image_slice.width, image_slice.height));
+    if (encode_frame(&encoder, options, &image_slice, data)) {
+        printf("failed to encode %s\n", infile_name);
+        retval = -1;
+        goto _end;
+    }
 
     //print_component(&component);
 
-    FILE* outfile = fopen(argv[2], "wb");
+    FILE* outfile = fopen(outfile_name, "wb");
     if (outfile == NULL) {
-        printf("failed to open %s for writing\n", argv[2]);
-        return -1;
+        printf("failed to open %s for writing\n", outfile_name);
+        retval = -1;
+        goto _end;
     }
-    printf("writing %i bytes to file %s... ", data->index, argv[2]);
+    printf("writing %i bytes to file %s... ", data->index, outfile_name);
     if (fwrite(data->base, data->index, 1, outfile) != 1) {
         printf("failed.\n");
-        return -1;
+        retval = -1;
     } else {
         printf("done.\n");
     }
 
     fclose(outfile);
 
+_end:
     jmcujc_bytearray_destroy(data);
+    free(encoder.component_buf);
+    pnm_image_unmap(&pnm);
 
-    return -1;
+    return retval;
+}
+
+static void usage(const char* argv0)
+{
+    printf("Usage: %s [-p | -a] [-t] <image name> <output file name>\r\n", argv0);
+    printf("       %s [-p | -a] [-t] [-j threads] -o <output directory> <inputs...>\r\n", argv0);
+    printf("inputs can be files, directories, quoted glob patterns, or @files listing one path per "
+           "line.\r\n");
+}
+
+int main(int argc, char** argv)
+{
+    encode_options_t options = { .progressive = false, .arithmetic = false, .thumbnail = false };
+    const char* output_dir = NULL;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int argi;
+    for (argi = 1; (argi < argc) && (argv[argi][0] == '-'); argi++) {
+        if (strcmp(argv[argi], "-p") == 0) {
+            options.progressive = true;
+        } else if (strcmp(argv[argi], "-a") == 0) {
+            options.arithmetic = true;
+        } else if (strcmp(argv[argi], "-t") == 0) {
+            options.thumbnail = true;
+        } else if ((strcmp(argv[argi], "-j") == 0) && ((argi + 1) < argc)) {
+            nthreads = atoi(argv[++argi]);
+        } else if ((strcmp(argv[argi], "-o") == 0) && ((argi + 1) < argc)) {
+            output_dir = argv[++argi];
+        } else {
+            break;
+        }
+    }
+    nthreads = (nthreads < 1) ? 1 : nthreads;
+
+    if (options.progressive && options.arithmetic) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (output_dir == NULL) {
+        if ((argc - argi) != 2) {
+            usage(argv[0]);
+            return -1;
+        }
+        return run_single(argv[argi], argv[argi + 1], &options);
+    }
+
+    if (argi == argc) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    path_list_t inputs = { .paths = NULL, .count = 0, .capacity = 0 };
+    for (; argi < argc; argi++) {
+        if (add_input(&inputs, argv[argi])) {
+            fprintf(stderr, "couldn't find any inputs in %s\n", argv[argi]);
+        }
+    }
+
+    const int retval = run_batch(&inputs, output_dir, nthreads, &options);
+
+    for (int i = 0; i < inputs.count; i++) {
+        free(inputs.paths[i]);
+    }
+    free(inputs.paths);
+    return retval;
 }
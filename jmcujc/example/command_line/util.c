@@ -1,54 +1,29 @@
-#include <pam.h>
 #include "util.h"
 
-#include <math.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
-jmcujc_source_image_slice_t* grayscale_source_image_from_pam(const char* file, const char* argv0)
+int grayscale_source_image_from_pam(const char* file,
+                                    pnm_image_t* pnm,
+                                    jmcujc_source_image_slice_t* slice)
 {
-    jmcujc_source_image_slice_t* result = calloc(1, sizeof(jmcujc_source_image_slice_t));
-
-    pm_init(argv0, 0);
-
-    struct pam image;
-    tuple * tuplerow;
-    unsigned int row;
+    int retval = pnm_image_map(file, pnm);
+    if (retval) {
+        printf("failed to load %s as a PGM / PAM image (error %i)\n", file, retval);
+        return retval;
+    }
 
-    FILE* fp = fopen(file, "r");
-    pnm_readpaminit(fp, &image, PAM_STRUCT_SIZE(tuple_type));
-    if (image.depth != 1) {
+    if (pnm->depth != 1) {
         printf("PAM image depth is not 1; not a grayscale image. This example only works with "
                "grayscale images.\n");
-        goto _fail_cleanup1;
+        pnm_image_unmap(pnm);
+        return PNM_ERR_UNSUPPORTED;
     }
 
-    result->height = image.height;
-    result->width  = image.width;
-    result->yoffset = 0;
-
-    result->pixels = calloc(result->height * result->width, sizeof(uint8_t));
-    tuplerow = pnm_allocpamrow(&image);
-    for (row = 0; row < image.height; row++) {
-        unsigned int column;
-        pnm_readpamrow(&image, tuplerow);
-        for (column = 0; column < image.width; ++column) {
-            unsigned int plane;
-            for (plane = 0; plane < image.depth; ++plane) {
-                result->pixels[(row * result->width) + column] = tuplerow[column][plane];
-            }
-        }
-    }
-    pnm_freepamrow(tuplerow);
-
-    return result;
-
-//_fail_cleanup0:
-//    free(result->);
-//    pnm_freepamrow(tuplerow);
+    slice->pixels = pnm->pixels;
+    slice->width = pnm->width;
+    slice->height = pnm->height;
+    slice->yoffset = 0;
 
-_fail_cleanup1:
-    free(result);
-    return NULL;
+    return 0;
 }
@@ -1,23 +1,20 @@
 #ifndef _JMCUJC_CLI_EXAMPLE_UTIL_H
 #define _JMCUJC_CLI_EXAMPLE_UTIL_H
 
-#include <pam.h>
-
 #include "jmcujc.h"
 #include "jmcujc_utils.h"
+#include "jmcujc_image_util.h"
 
-#define PAM_MEMBER_OFFSET(mbrname)                    \
-    ((unsigned long int)(char*)&((struct pam *)0)->mbrname)
-#define PAM_MEMBER_SIZE(mbrname) \
-    sizeof(((struct pam *)0)->mbrname)
-#define PAM_STRUCT_SIZE(mbrname) \
-    (PAM_MEMBER_OFFSET(mbrname) + PAM_MEMBER_SIZE(mbrname))
-
-
+#include "pnm.h"
 
 /**
- * This utility function reads in an entire PAM image and stores it as a jmcujc image slice.
+ * This utility function maps in an entire PGM / PAM image and wraps it in a jmcujc image slice.
+ *
+ * The slice's pixels point straight into the mapped file, so nothing gets copied; 'pnm' has to
+ * stay around for as long as the slice is used, and gets pnm_image_unmap()'d afterwards.
  */
-jmcujc_source_image_slice_t* grayscale_source_image_from_pam(const char* file, const char* argv0);
+int grayscale_source_image_from_pam(const char* file,
+                                    pnm_image_t* pnm,
+                                    jmcujc_source_image_slice_t* slice);
 
 #endif
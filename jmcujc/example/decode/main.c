@@ -0,0 +1,78 @@
+/**
+ * Decodes a baseline jpeg with jmcujd and writes it out as a pgm (grayscale) or ppm (color).
+ *
+ * netpbm files are simple enough that they're just written by hand here.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "jmcujd.h"
+
+static uint8_t* read_file(const char* name, int* len)
+{
+    FILE* fp = fopen(name, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t* data = malloc(*len);
+    if ((data != NULL) && (fread(data, 1, *len, fp) != (size_t)*len)) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(fp);
+    return data;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        printf("usage: %s <infile.jpg> <outfile.pnm>\n", argv[0]);
+        return -1;
+    }
+
+    int len;
+    uint8_t* data = read_file(argv[1], &len);
+    if (data == NULL) {
+        fprintf(stderr, "couldn't read %s\n", argv[1]);
+        return -1;
+    }
+
+    jmcujd_image_t image;
+    int retval = jmcujd_decode(data, len, &image);
+    free(data);
+    if (retval) {
+        fprintf(stderr, "failed to decode %s: error %i\n", argv[1], retval);
+        return -1;
+    }
+
+    uint8_t* pixels = malloc(image.width * image.height * 3);
+    const int bpp = jmcujd_image_to_pixels(&image, pixels);
+    if (bpp < 0) {
+        fprintf(stderr, "can't convert a %i component image to pixels\n", image.ncomponents);
+        retval = -1;
+        goto _end;
+    }
+
+    FILE* outfile = fopen(argv[2], "wb");
+    if (outfile == NULL) {
+        fprintf(stderr, "couldn't open %s\n", argv[2]);
+        retval = -1;
+        goto _end;
+    }
+    fprintf(outfile, "P%i\n%i %i\n255\n", (bpp == 1) ? 5 : 6, image.width, image.height);
+    fwrite(pixels, bpp, image.width * image.height, outfile);
+    fclose(outfile);
+
+_end:
+    free(pixels);
+    jmcujd_image_free(&image);
+    return retval;
+}
@@ -0,0 +1,297 @@
+/**
+ * Accuracy test and benchmark for jmcujd's IDCTs.
+ *
+ * The accuracy test follows IEEE 1180-1990: random blocks of samples go through a double-precision
+ * forward DCT, get rounded to integer coefficients, and then each IDCT's output is compared against
+ * a double-precision IDCT of the same coefficients. Our IDCTs only produce 8-bit samples though, so
+ * the reference output is clamped to [-128, 127] instead of [-256, 255] before comparing.
+ *
+ * The benchmark just runs each IDCT over the same set of blocks for a while and reports blocks/s.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jmcujd_idct.h"
+
+#define PI (3.14159265358979323846)
+
+#define BLOCKS_PER_TEST (10000)
+#define BENCH_BLOCKS (4096)
+
+typedef struct idct_variant
+{
+    const char* name;
+    jmcujd_idct_fn_t fn;
+    bool supported;
+} idct_variant_t;
+
+/**
+ * This is the random number generator from IEEE 1180; it returns integers in [-L, H]. The standard
+ * assumes a 32-bit long, so randx is explicitly 32 bits here.
+ */
+static uint32_t ieee_randx = 1;
+
+static long ieee_rand(long L, long H)
+{
+    static const double z = (double)0x7fffffff;
+
+    ieee_randx = (ieee_randx * 1103515245u) + 12345u;
+    const long i = ieee_randx & 0x7ffffffe;
+    double x = ((double)i) / z;
+    x *= (L + H + 1);
+    const long j = x;
+    return j - L;
+}
+
+static double c_table[8][8];
+
+static void init_c_table(void)
+{
+    for (int u = 0; u < 8; u++) {
+        const double cu = (u == 0) ? sqrt(0.125) : 0.5;
+        for (int x = 0; x < 8; x++) {
+            c_table[u][x] = cu * cos(((2 * x) + 1) * u * PI / 16.);
+        }
+    }
+}
+
+static void reference_fdct(const double* in, double* out)
+{
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            double sum = 0.;
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    sum += c_table[v][y] * c_table[u][x] * in[(y * 8) + x];
+                }
+            }
+            out[(v * 8) + u] = sum;
+        }
+    }
+}
+
+static void reference_idct(const double* in, double* out)
+{
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            double sum = 0.;
+            for (int v = 0; v < 8; v++) {
+                for (int u = 0; u < 8; u++) {
+                    sum += c_table[v][y] * c_table[u][x] * in[(v * 8) + u];
+                }
+            }
+            out[(y * 8) + x] = sum;
+        }
+    }
+}
+
+static double clamp_d(double v, double lo, double hi)
+{
+    return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+/**
+ * Makes one IEEE 1180 test block: integer coefficients along with the reference output.
+ */
+static void make_test_block(long L, long H, int sign, int32_t* coefficients, int* reference)
+{
+    double samples[64], dct[64], idct[64], rounded[64];
+
+    for (int i = 0; i < 64; i++) {
+        samples[i] = sign * ieee_rand(L, H);
+    }
+
+    reference_fdct(samples, dct);
+    for (int i = 0; i < 64; i++) {
+        rounded[i] = clamp_d(floor(dct[i] + 0.5), -2048., 2047.);
+        coefficients[i] = rounded[i];
+    }
+
+    reference_idct(rounded, idct);
+    for (int i = 0; i < 64; i++) {
+        reference[i] = clamp_d(floor(idct[i] + 0.5), -128., 127.);
+    }
+}
+
+/**
+ * Runs one IEEE 1180 test (one range, one sign) on an IDCT. Prints the statistics and returns
+ * whether they're in bounds.
+ */
+static bool accuracy_test(const idct_variant_t* variant, long L, long H, int sign)
+{
+    int64_t total_error[64] = { 0 };
+    int64_t total_squared_error[64] = { 0 };
+    int peak_error = 0;
+
+    ieee_randx = 1;
+    for (int block = 0; block < BLOCKS_PER_TEST; block++) {
+        int32_t coefficients[64];
+        int reference[64];
+        uint8_t out[64];
+        make_test_block(L, H, sign, coefficients, reference);
+        variant->fn(coefficients, out, 8);
+
+        for (int i = 0; i < 64; i++) {
+            const int error = ((int)out[i] - 128) - reference[i];
+            total_error[i] += error;
+            total_squared_error[i] += error * error;
+            if (abs(error) > peak_error) {
+                peak_error = abs(error);
+            }
+        }
+    }
+
+    double worst_pmse = 0., worst_pme = 0., omse = 0., ome = 0.;
+    for (int i = 0; i < 64; i++) {
+        const double pmse = (double)total_squared_error[i] / BLOCKS_PER_TEST;
+        const double pme = fabs((double)total_error[i] / BLOCKS_PER_TEST);
+        worst_pmse = (pmse > worst_pmse) ? pmse : worst_pmse;
+        worst_pme = (pme > worst_pme) ? pme : worst_pme;
+        omse += total_squared_error[i];
+        ome += total_error[i];
+    }
+    omse /= (64. * BLOCKS_PER_TEST);
+    ome = fabs(ome / (64. * BLOCKS_PER_TEST));
+
+    const bool pass = ((peak_error <= 1) && (worst_pmse <= 0.06) && (omse <= 0.02) &&
+                       (worst_pme <= 0.015) && (ome <= 0.0015));
+    printf("    %-6s [-%3li, %3li] sign %+i: peak %i, pmse %.4f, omse %.4f, pme %.4f, ome %.5f  %s\n",
+           variant->name, L, H, sign, peak_error, worst_pmse, omse, worst_pme, ome,
+           pass ? "ok" : "FAIL");
+    return pass;
+}
+
+/**
+ * IEEE 1180 also wants all-zero input to give all-zero output.
+ */
+static bool zero_test(const idct_variant_t* variant)
+{
+    int32_t coefficients[64] = { 0 };
+    uint8_t out[64];
+    variant->fn(coefficients, out, 8);
+    for (int i = 0; i < 64; i++) {
+        if (out[i] != 128) {
+            printf("    %-6s zero input: FAIL\n", variant->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Checks that a variant matches the C version exactly, including on inputs at the edges of the
+ * 16-bit range.
+ */
+static bool exactness_test(const idct_variant_t* variant)
+{
+    ieee_randx = 12345;
+    for (int block = 0; block < 100000; block++) {
+        int32_t coefficients[64];
+        uint8_t expected[64], out[64];
+        const long range = (block % 3 == 0) ? 32767 : ((block % 3 == 1) ? 2047 : 63);
+        for (int i = 0; i < 64; i++) {
+            coefficients[i] = ieee_rand(range, range);
+        }
+
+        jmcujd_idct_8x8_c(coefficients, expected, 8);
+        variant->fn(coefficients, out, 8);
+        if (memcmp(expected, out, 64) != 0) {
+            printf("    %-6s doesn't match the C version on block %i: FAIL\n", variant->name, block);
+            return false;
+        }
+    }
+
+    printf("    %-6s matches the C version on 100000 blocks\n", variant->name);
+    return true;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static void benchmark(const idct_variant_t* variant, const int32_t* coefficients)
+{
+    static uint8_t out[BENCH_BLOCKS * 64];
+
+    // run until a second has gone by.
+    int64_t blocks = 0;
+    const double start = now();
+    double elapsed;
+    do {
+        for (int i = 0; i < BENCH_BLOCKS; i++) {
+            variant->fn(&coefficients[i * 64], &out[i * 64], 8);
+        }
+        blocks += BENCH_BLOCKS;
+        elapsed = now() - start;
+    } while (elapsed < 1.);
+
+    printf("    %-6s %8.2f Mblocks/s (%.1f ns/block)\n", variant->name,
+           (blocks / elapsed) * 1e-6, (elapsed / blocks) * 1e9);
+}
+
+int main(int argc, char** argv)
+{
+    idct_variant_t variants[] = {
+        { .name = "c",    .fn = jmcujd_idct_8x8_c,    .supported = true },
+#if JMCUJD_IDCT_X86
+        { .name = "sse2", .fn = jmcujd_idct_8x8_sse2, .supported = __builtin_cpu_supports("sse2") },
+        { .name = "avx2", .fn = jmcujd_idct_8x8_avx2, .supported = __builtin_cpu_supports("avx2") },
+#endif
+    };
+    const int nvariants = sizeof(variants) / sizeof(variants[0]);
+
+    init_c_table();
+
+    bool pass = true;
+    printf("IEEE 1180 accuracy:\n");
+    for (int i = 0; i < nvariants; i++) {
+        if (!variants[i].supported) {
+            printf("    %-6s not supported on this CPU\n", variants[i].name);
+            continue;
+        }
+
+        const long ranges[3][2] = { { 256, 255 }, { 5, 5 }, { 300, 300 } };
+        for (int r = 0; r < 3; r++) {
+            pass &= accuracy_test(&variants[i], ranges[r][0], ranges[r][1], 1);
+            pass &= accuracy_test(&variants[i], ranges[r][0], ranges[r][1], -1);
+        }
+        pass &= zero_test(&variants[i]);
+    }
+
+    printf("\nbit-exactness:\n");
+    for (int i = 1; i < nvariants; i++) {
+        if (variants[i].supported) {
+            pass &= exactness_test(&variants[i]);
+        }
+    }
+
+    // Benchmark on blocks from the [-256, 255] test; they've got lots of nonzero coefficients, so
+    // this is about the worst case for a decoder.
+    static int32_t coefficients[BENCH_BLOCKS * 64];
+    ieee_randx = 1;
+    for (int i = 0; i < BENCH_BLOCKS; i++) {
+        int reference[64];
+        make_test_block(256, 255, 1, &coefficients[i * 64], reference);
+    }
+
+    printf("\nthroughput:\n");
+    for (int i = 0; i < nvariants; i++) {
+        if (variants[i].supported) {
+            benchmark(&variants[i], coefficients);
+        }
+    }
+
+    printf("\n%s\n", pass ? "all tests passed" : "SOME TESTS FAILED");
+    return pass ? 0 : -1;
+}
@@ -14,7 +14,7 @@
  */
 static void loeffler_fdct_horizontal_inplace(float* data_in, float* data_out)
 {
-    static float stages[4][8];
+    float stages[4][8];
 
     stages[0][0] = (data_in[0] + data_in[7]);
     stages[0][1] = (data_in[1] + data_in[6]);
@@ -57,7 +57,7 @@ static void loeffler_fdct_horizontal_inplace(float* data_in, float* data_out)
 
 static void loeffler_fdct_vertical_inplace(float* data_in, float* data_out)
 {
-    static float stages[4][8];
+    float stages[4][8];
 
     stages[0][0] = (data_in[0 * 8] + data_in[7 * 8]);
     stages[0][1] = (data_in[1 * 8] + data_in[6 * 8]);
@@ -100,8 +100,7 @@ static void loeffler_fdct_vertical_inplace(float* data_in, float* data_out)
 
 static void loeffler_fdct_8x8_inplace(float* data)
 {
-    // TODO: can this static array be removed? I think so.
-    static float data_f[64];
+    float data_f[64];
     for (int i = 0; i < 64; i++)
         data_f[i] = (float)data[i];
 
@@ -120,6 +119,76 @@ static void loeffler_fdct_8x8_inplace(float* data)
     }
 }
 
+/**
+ * Same as the 1-D transforms above, but only computes the first n outputs, where n is 2 or 4. The
+ * rest of the outputs aren't touched. stride is the distance between successive samples; 1 for
+ * rows, 8 for columns.
+ */
+static void loeffler_fdct_low(const float* data_in, float* data_out, int stride, int n)
+{
+    float stages[3][8];
+
+    stages[0][0] = (data_in[0 * stride] + data_in[7 * stride]);
+    stages[0][1] = (data_in[1 * stride] + data_in[6 * stride]);
+    stages[0][2] = (data_in[2 * stride] + data_in[5 * stride]);
+    stages[0][3] = (data_in[3 * stride] + data_in[4 * stride]);
+    stages[0][4] = (data_in[3 * stride] - data_in[4 * stride]);
+    stages[0][5] = (data_in[2 * stride] - data_in[5 * stride]);
+    stages[0][6] = (data_in[1 * stride] - data_in[6 * stride]);
+    stages[0][7] = (data_in[0 * stride] - data_in[7 * stride]);
+
+    const float block_1c3_cos = 0.8314696123 * 0.35355339059;     // k * cos((n * pi) / 16) for 1c3
+    const float block_1c3_sin = 0.5555702330 * 0.35355339059;     // k * sin((n * pi) / 16) for 1c3
+    const float block_1c1_cos = 0.9807852804 * 0.35355339059;     // k * cos((n * pi) / 16) for 1c1
+    const float block_1c1_sin = 0.1950903220 * 0.35355339059;     // k * sin((n * pi) / 16) for 1c1
+    stages[1][0] = stages[0][0] + stages[0][3];
+    stages[1][1] = stages[0][1] + stages[0][2];
+    stages[1][4] =  stages[0][4] * block_1c3_cos + stages[0][7] * block_1c3_sin;      // 1c3
+    stages[1][7] = -stages[0][4] * block_1c3_sin + stages[0][7] * block_1c3_cos;
+    stages[1][5] =  stages[0][5] * block_1c1_cos + stages[0][6] * block_1c1_sin;      // 1c1
+    stages[1][6] = -stages[0][5] * block_1c1_sin + stages[0][6] * block_1c1_cos;
+
+    // outputs 4 - 7 and stage 2 line 6 are never needed.
+    data_out[0 * stride] = (stages[1][0] + stages[1][1]) * 0.25 * 1.41421356237;
+    stages[2][4] = stages[1][4] + stages[1][6];
+    stages[2][7] = stages[1][5] + stages[1][7];
+    data_out[1 * stride] = stages[2][4] + stages[2][7];
+
+    if (n > 2) {
+        const float block_r2c1_cos = 0.54119610014 * 0.35355339059;   // k * cos((n * pi) / 16) for sqrt(2)c1
+        const float block_r2c1_sin = 1.30656296488 * 0.35355339059;   // k * sin((n * pi) / 16) for sqrt(2)c1
+        stages[1][2] = stages[0][1] - stages[0][2];
+        stages[1][3] = stages[0][0] - stages[0][3];
+        data_out[2 * stride] = stages[1][2] * block_r2c1_cos + stages[1][3] * block_r2c1_sin;   // sqrt2 c6
+
+        stages[2][5] = -stages[1][5] + stages[1][7];
+        data_out[3 * stride] = 1.41421356237f * stages[2][5];
+    }
+}
+
+/**
+ * Only computes the top-left nxn corner of the DCT; everything else is set to 0. All 8 rows still
+ * need a (partial) horizontal pass, but only n columns need a vertical pass.
+ */
+static void loeffler_fdct_8x8_low_inplace(float* data, int n)
+{
+    for (int i = 0; i < 8; i++) {
+        loeffler_fdct_low(&data[i * 8], &data[i * 8], 1, n);
+    }
+
+    for (int i = 0; i < n; i++) {
+        loeffler_fdct_low(&data[i], &data[i], 8, n);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            if ((i >= n) || (j >= n)) {
+                data[(i * 8) + j] = 0.f;
+            }
+        }
+    }
+}
+
 static void huffman_reverse_lookup_table_init(const jmcujc_huffman_table_t* t,
                                               huffman_reverse_lookup_table_t* hrlt)
 {
@@ -138,20 +207,188 @@ static void huffman_reverse_lookup_table_init(const jmcujc_huffman_table_t* t,
 }
 
 
+/**
+ * Before doing a full DCT on a block, we check to see whether the quantizer is going to throw most
+ * of it away anyways. The checks are exact; they never change the quantized output (up to float
+ * rounding).
+ *
+ * Since the DCT is orthonormal, the sum of the squares of the AC coefficients is the same as the
+ * sum of (x - mean)^2 over the block. If that's smaller than (q / 2)^2 for the smallest AC
+ * quantizer q, every AC coefficient rounds to 0 and the block only needs its DC coefficient.
+ *
+ * The DCT basis vectors are also eigenvectors of the "sum of squared neighbor differences" operator
+ * with eigenvalues 4 * sin^2(pi * u / 16). That means that for horizontal frequencies u >= n, the
+ * sum of squared coefficients is at most (sum of squared horizontal differences) / (4 * sin^2(pi *
+ * n / 16)). Same thing vertically. If both are small enough, only the top-left nxn coefficients can
+ * survive quantization.
+ */
+typedef enum dct_block_class
+{
+    DCT_BLOCK_FLAT,
+    DCT_BLOCK_LOW2,
+    DCT_BLOCK_LOW4,
+    DCT_BLOCK_FULL
+} dct_block_class_t;
+
+/**
+ * Largest possible |F(u, v)| for an AC coefficient, given that the block's samples all fit in a
+ * range of 'range' counts. The basis function for an AC coefficient sums to 0, so the worst case
+ * is the top of the range wherever the basis is positive and the bottom wherever it's negative.
+ */
+static float dct_max_ac_coefficient(int u, int v, int range)
+{
+    float sum_abs_u = 0.f, sum_abs_v = 0.f;
+    for (int x = 0; x < 8; x++) {
+        sum_abs_u += fabsf(cosf(((2 * x + 1) * u * 3.14159265f) / 16.f));
+        sum_abs_v += fabsf(cosf(((2 * x + 1) * v * 3.14159265f) / 16.f));
+    }
+    const float cu = (u == 0) ? 0.70710678f : 1.f;
+    const float cv = (v == 0) ? 0.70710678f : 1.f;
+
+    return 0.25f * cu * cv * sum_abs_u * sum_abs_v * (range / 2.f);
+}
+
+static void dct_plan_init(const jmcujc_quantization_table_t* qt,
+                          int input_bit_depth,
+                          jmcujc_dct_plan_t* plan)
+{
+    if ((input_bit_depth <= 0) || (input_bit_depth > 8)) {
+        input_bit_depth = 8;
+    }
+    const int range = (1 << input_bit_depth) - 1;
+
+    // qmin[n][0] is the smallest quantizer with u >= n, qmin[n][1] is the same for v >= n.
+    int qmin_ac = 255;
+    int qmin[5][2] = { { 255, 255 }, { 255, 255 }, { 255, 255 }, { 255, 255 }, { 255, 255 } };
+
+    // static analysis: could any coefficient outside of the nxn corner ever survive?
+    bool can_survive[5] = { false };
+
+    for (int i = 1; i < 64; i++) {
+        const int u = i % 8, v = i / 8;
+        const int q = qt->values[i];
+        if (q < qmin_ac) qmin_ac = q;
+
+        // a little bit of slack for float error.
+        const bool survives = ((2.f * dct_max_ac_coefficient(u, v, range) * 1.001f) >= q);
+
+        for (int n = 2; n <= 4; n += 2) {
+            if ((u >= n) && (q < qmin[n][0])) qmin[n][0] = q;
+            if ((v >= n) && (q < qmin[n][1])) qmin[n][1] = q;
+            if (((u >= n) || (v >= n)) && survives) can_survive[n] = true;
+        }
+    }
+
+    plan->kernel_size = !can_survive[2] ? 2 : (!can_survive[4] ? 4 : 8);
+
+    plan->flat_energy = (qmin_ac * qmin_ac) / 4.f;
+
+    // sin^2(pi / 8) and sin^2(pi / 4)
+    plan->low2_horizontal = 0.14644661f * qmin[2][0] * qmin[2][0];
+    plan->low2_vertical   = 0.14644661f * qmin[2][1] * qmin[2][1];
+    plan->low4_horizontal = 0.5f * qmin[4][0] * qmin[4][0];
+    plan->low4_vertical   = 0.5f * qmin[4][1] * qmin[4][1];
+}
+
+static dct_block_class_t dct_block_classify(const float* block,
+                                            const jmcujc_dct_plan_t* plan,
+                                            float* sum_out)
+{
+    float sum = 0.f, sum_sq = 0.f;
+    for (int i = 0; i < 64; i++) {
+        sum += block[i];
+        sum_sq += block[i] * block[i];
+    }
+    *sum_out = sum;
+
+    const float energy = sum_sq - ((sum * sum) / 64.f);
+    if (energy < plan->flat_energy) {
+        return DCT_BLOCK_FLAT;
+    }
+
+    // if the quant table already guarantees a small kernel, don't bother looking any closer.
+    if (plan->kernel_size == 2) {
+        return DCT_BLOCK_LOW2;
+    }
+
+    float horizontal = 0.f, vertical = 0.f;
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 7; j++) {
+            const float dh = block[(i * 8) + j + 1] - block[(i * 8) + j];
+            const float dv = block[((j + 1) * 8) + i] - block[(j * 8) + i];
+            horizontal += dh * dh;
+            vertical += dv * dv;
+        }
+    }
+
+    if ((horizontal < plan->low2_horizontal) && (vertical < plan->low2_vertical)) {
+        return DCT_BLOCK_LOW2;
+    }
+
+    if ((plan->kernel_size == 4) ||
+        ((horizontal < plan->low4_horizontal) && (vertical < plan->low4_vertical))) {
+        return DCT_BLOCK_LOW4;
+    }
+
+    return DCT_BLOCK_FULL;
+}
+
 /**
  * This function takes a jpeg component and overwrites the data in it with its DCT.
  */
 static void jpeg_component_DCT(jmcujc_jpeg_params_t* params, jmcujc_component_t* component)
 {
     const int qt = params->component_quant_table_selectors[0];
+    const jmcujc_quantization_table_t* quant_table = params->jpeg_quantization_tables[qt];
+
+    // normally jmcujc_write_headers makes the plan.
+    if (params->_dct_plan.kernel_size == 0) {
+        dct_plan_init(quant_table, params->input_bit_depth, &params->_dct_plan);
+    }
+    const jmcujc_dct_plan_t* plan = &params->_dct_plan;
+    const int thumbnail_len = jmcujc_thumbnail_width(params) * jmcujc_thumbnail_height(params);
+
     for (int MCU_idx = 0; MCU_idx < ((component->width / 8) * (component->height / 8)); MCU_idx++) {
-        loeffler_fdct_8x8_inplace(component->samples + (MCU_idx * 64));
+        float* block = component->samples + (MCU_idx * 64);
+
+        float sum;
+        const dct_block_class_t block_class = dct_block_classify(block, plan, &sum);
+
+        // the mean of each block is a free 1/8th scale thumbnail pixel.
+        if ((params->thumbnail != NULL) && (params->_thumbnail_idx < thumbnail_len)) {
+            const float pixel = roundf((sum / 64.f) + 128.f);
+            params->thumbnail[params->_thumbnail_idx++] =
+                (pixel < 0.f) ? 0 : ((pixel > 255.f) ? 255 : (uint8_t)pixel);
+        }
+
+        int n = 8;
+        switch (block_class) {
+            case DCT_BLOCK_FLAT: {
+                // DC-only; the huffman coder will just see a DC difference and an EOB. No need to
+                // zig-zag a block that's all 0's except for [0].
+                memset(block, 0, 64 * sizeof(float));
+                block[0] = (sum * 0.125f) / quant_table->values[0];
+                continue;
+            }
+
+            case DCT_BLOCK_LOW2: n = 2; break;
+            case DCT_BLOCK_LOW4: n = 4; break;
+            case DCT_BLOCK_FULL: n = 8; break;
+        }
 
-        for (int j = 0; j < 64; j++) {
-            component->samples[(MCU_idx * 64) + j] /= params->jpeg_quantization_tables[qt]->values[j];
+        if (n == 8) {
+            loeffler_fdct_8x8_inplace(block);
+        } else {
+            loeffler_fdct_8x8_low_inplace(block, n);
         }
 
-        jmcujc_util_zigzag_data_inplace_f32(component->samples + (MCU_idx * 64));
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                block[(i * 8) + j] /= quant_table->values[(i * 8) + j];
+            }
+        }
+
+        jmcujc_util_zigzag_data_inplace_f32(block);
     }
 }
 
@@ -184,44 +421,15 @@ static void jpeg_write_sof_component_specification_parameters(const jmcujc_compo
     bytearray_add_bytes(ba, (uint8_t[]) {params->component_quant_table_selectors[identifier]}, 1);
 }
 
-int jmcujc_write_headers(jmcujc_component_t* components,
-                         int ncomponents,
-                         jmcujc_jpeg_params_t* params,
-                         jmcujc_bytearray_t* ba)
+int jmcujc_write_frame_header(jmcujc_component_t* components,
+                              int ncomponents,
+                              jmcujc_jpeg_params_t* params,
+                              uint8_t sof_marker,
+                              jmcujc_bytearray_t* ba)
 {
-    // ======= SOI / JFIF =======
-    bytearray_add_bytes(ba, (const uint8_t[]){ 0xff, 0xd8 }, 2);
-    const char* jfifseg = "\xff\xe0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00";
-    bytearray_add_bytes(ba, (const uint8_t*)jfifseg, 18);
-
-    // ======= quant tables =======
-    bytearray_add_bytes(ba, (const uint8_t[]) { 0xff, 0xdb }, 2);
-    uint16_t qtLs = 65 * (params->num_quantization_tables) + 2;
-    bytearray_add_bytes(ba, (const uint8_t[]) { ((qtLs >> 8) & 0xff), qtLs & 0xff }, 2);
-
-    for (int i = 0; i < params->num_quantization_tables; i++) {
-        const uint8_t pq_tq = i;
-        bytearray_add_bytes(ba, &pq_tq, 1);
-
-        // need to zig-zag quant table
-        static uint8_t temp[64];
-        memcpy(temp, (&params->jpeg_quantization_tables[i]->values), 64);
-        jmcujc_util_zigzag_data_inplace_u8(temp);
-        bytearray_add_bytes(ba, (const uint8_t*)(&temp), 64);
-    }
-
-    // ======== huff tables ========
-    for (int i = 0; i < params->num_dc_huffman_tables; i++) {
-        jpeg_write_huffman_table(params->dc_huffman_tables[i], ba);
-    }
-    for (int i = 0; i < params->num_ac_huffman_tables; i++) {
-        jpeg_write_huffman_table(params->ac_huffman_tables[i], ba);
-    }
-
-    // ======= SOF =======
     // quantization table is selected here.
     int SOF_len = 8 + (3 * ncomponents);
-    bytearray_add_bytes(ba, (const uint8_t[]){ 0xff, 0xc0, 0x00, SOF_len, 0x08 }, 5);
+    bytearray_add_bytes(ba, (const uint8_t[]){ 0xff, sof_marker, 0x00, SOF_len, 0x08 }, 5);
     bytearray_add_bytes_reverse(ba, (const uint8_t*)(&params->height), 2);
     bytearray_add_bytes_reverse(ba, (const uint8_t*)(&params->width), 2);
     bytearray_add_bytes(ba, (const uint8_t[]){ ncomponents }, 1);
@@ -229,7 +437,13 @@ int jmcujc_write_headers(jmcujc_component_t* components,
         jpeg_write_sof_component_specification_parameters(&components[i], i, params, ba);
     }
 
-    // ======= SOS =======
+    return 0;
+}
+
+int jmcujc_write_scan_header(int ncomponents,
+                             jmcujc_jpeg_params_t* params,
+                             jmcujc_bytearray_t* ba)
+{
     int SOS_len = 6 + (2 * ncomponents);
     bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xda, 0x00, SOS_len }, 4);
     bytearray_add_bytes(ba, (uint8_t[]){ ncomponents }, 1);
@@ -237,6 +451,7 @@ int jmcujc_write_headers(jmcujc_component_t* components,
         bytearray_add_bytes(ba, (uint8_t[]){ i }, 1);
         // assuming that both DC and AC Huffman coding tables are the same index, for instance if
         // this component uses DC Huffman table #0, we would assume that it also uses AC table #0.
+        // Arithmetic coding uses the same selectors to pick its conditioning tables.
         uint8_t ect_sel = (params->component_huffman_table_selectors[i] |
                            (params->component_huffman_table_selectors[i] << 4));
         bytearray_add_bytes(ba, (uint8_t[]){ ect_sel }, 1);
@@ -248,16 +463,56 @@ int jmcujc_write_headers(jmcujc_component_t* components,
     // doing sequential, not progressive, this stays at 0.
     bytearray_add_bytes(ba, (uint8_t[]){ 0 }, 1);
 
+    return 0;
+}
 
-    // initialize jpeg params's bit packer.
-    // probably would be better if we just used the bit packer directly instead of maintaining a
-    // byte array and a bitpacker, but here we are.
-    params->bp.data = ba->base;
-    params->bp.bitcount = 0;
-    params->bp.datalen = ba->len;
-    params->bp.idx = ba->index;
+/**
+ * Falls back to huffman coding if the params don't say otherwise, so that params which were
+ * memcpy'd from the defaults keep working.
+ */
+static const jmcujc_entropy_backend_t* entropy_backend(const jmcujc_jpeg_params_t* params)
+{
+    return (params->entropy_backend != NULL) ? params->entropy_backend : &jmcujc_entropy_huffman;
+}
 
-    return 0;
+int jmcujc_write_headers(jmcujc_component_t* components,
+                         int ncomponents,
+                         jmcujc_jpeg_params_t* params,
+                         jmcujc_bytearray_t* ba)
+{
+    // ======= SOI / JFIF =======
+    bytearray_add_bytes(ba, (const uint8_t[]){ 0xff, 0xd8 }, 2);
+    const char* jfifseg = "\xff\xe0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00";
+    bytearray_add_bytes(ba, (const uint8_t*)jfifseg, 18);
+
+    // ======= quant tables =======
+    bytearray_add_bytes(ba, (const uint8_t[]) { 0xff, 0xdb }, 2);
+    uint16_t qtLs = 65 * (params->num_quantization_tables) + 2;
+    bytearray_add_bytes(ba, (const uint8_t[]) { ((qtLs >> 8) & 0xff), qtLs & 0xff }, 2);
+
+    for (int i = 0; i < params->num_quantization_tables; i++) {
+        const uint8_t pq_tq = i;
+        bytearray_add_bytes(ba, &pq_tq, 1);
+
+        // need to zig-zag quant table
+        uint8_t temp[64];
+        memcpy(temp, (&params->jpeg_quantization_tables[i]->values), 64);
+        jmcujc_util_zigzag_data_inplace_u8(temp);
+        bytearray_add_bytes(ba, (const uint8_t*)(&temp), 64);
+    }
+
+    // a new image means a new thumbnail
+    params->_thumbnail_idx = 0;
+
+    // ======= DCT plan =======
+    // figure out which DCT kernels are worth it for this quant table; see jpeg_component_DCT.
+    const int qt = params->component_quant_table_selectors[0];
+    dct_plan_init(params->jpeg_quantization_tables[qt], params->input_bit_depth,
+                  &params->_dct_plan);
+
+    // ======= entropy coding tables, SOF and SOS =======
+    // These depend on which entropy coder we're using.
+    return entropy_backend(params)->write_headers(components, ncomponents, params, ba);
 }
 
 /**
@@ -346,27 +601,35 @@ static int huffman_encode_component(jmcujc_component_t* component,
         // ======= AC coefficients =======
         unsigned int ac_coeff_idx = 1;
 
-        static int16_t source_block_i16[64];
+        // keep track of where the last non-zero coefficient is so that we can go straight to the
+        // EOB after it. For flat blocks, that's right after the DC coefficient.
+        int16_t source_block_i16[64];
+        unsigned int last_nonzero = 0;
         for (int i = 1; i < 64; i++) {
             source_block_i16[i] = (int)roundf(source_block[i]);
+            if (source_block_i16[i] != 0) {
+                last_nonzero = i;
+            }
         }
         while (ac_coeff_idx < 64) {
-            // find next non-zero coefficient
-            // I wonder if theres a more optimized way to do this?
-            unsigned int l;
-            for (l = ac_coeff_idx; (source_block_i16[l] == 0) && (l < 64); l++);
-
-            int zeroes_to_rle = l - ac_coeff_idx;
-
-            if (l == 64) {
-                // we made it all the way to the end; slap an EOB in there.
+            if (ac_coeff_idx > last_nonzero) {
+                // we made it past the last coefficient; slap an EOB in there.
                 const huffman_reverse_lookup_entry_t* huffman_code = &ac_hrlt->entries[0];
                 if (huffman_code->bit_length == 0) {
                     retval = -4;
                     goto _end;
                 }
                 bit_packer_pack_u16(&params->bp, huffman_code->value, huffman_code->bit_length);
-            } else if ((zeroes_to_rle >= 0) && (zeroes_to_rle < 16)) {
+                break;
+            }
+
+            // find next non-zero coefficient; there's always one at or before last_nonzero.
+            unsigned int l;
+            for (l = ac_coeff_idx; source_block_i16[l] == 0; l++);
+
+            int zeroes_to_rle = l - ac_coeff_idx;
+
+            if ((zeroes_to_rle >= 0) && (zeroes_to_rle < 16)) {
                 // pack AC coefficient normally
                 int cidx = ac_coeff_idx + zeroes_to_rle;
                 int ac_raw_length;
@@ -411,16 +674,387 @@ _end:
     return retval;
 }
 
-int jmcujc_compress_component_to_bytestream(jmcujc_component_t* component,
-                                            jmcujc_jpeg_params_t* params,
-                                            jmcujc_bytearray_t* bytestream)
+/**
+ * Builds an optimal huffman table for the given symbol frequencies, as described in section K.2 of
+ * T.81. This is what progressive mode uses, because the example tables in Annex K don't have codes
+ * for the EOBRUN symbols.
+ *
+ * @param[in]     freq      How many times each symbol was used. At least one should be non-zero.
+ * @param[in]     tc_td     Table class and destination for the generated table.
+ * @param[out]    table
+ * @return  returns 0 on success, < 0 on failure.
+ */
+static int huffman_table_generate_optimal(const uint32_t* freq_in,
+                                          uint8_t tc_td,
+                                          jmcujc_huffman_table_t* table)
 {
-    /*
-    for (int i = 0; i < ncomponents; i++) {
-        jpeg_component_DCT(&components[i]);
+    // symbol 256 is reserved so that no code ends up being all 1's.
+    uint32_t freq[257];
+    int codesize[257];
+    int others[257];
+    int bits[33] = { 0 };
+
+    memcpy(freq, freq_in, 256 * sizeof(uint32_t));
+    freq[256] = 1;
+    for (int i = 0; i < 257; i++) {
+        codesize[i] = 0;
+        others[i] = -1;
     }
-    */
-    jpeg_component_DCT(params, component);
+
+    // Figure K.1: repeatedly merge the two least-frequent trees.
+    while (1) {
+        int v1 = -1;
+        for (int i = 0; i < 257; i++) {
+            if (freq[i] && ((v1 < 0) || (freq[i] <= freq[v1]))) {
+                v1 = i;
+            }
+        }
+
+        int v2 = -1;
+        for (int i = 0; i < 257; i++) {
+            if (freq[i] && (i != v1) && ((v2 < 0) || (freq[i] <= freq[v2]))) {
+                v2 = i;
+            }
+        }
+
+        if (v2 < 0) {
+            break;
+        }
+
+        freq[v1] += freq[v2];
+        freq[v2] = 0;
+
+        codesize[v1]++;
+        while (others[v1] >= 0) {
+            v1 = others[v1];
+            codesize[v1]++;
+        }
+        others[v1] = v2;
+
+        codesize[v2]++;
+        while (others[v2] >= 0) {
+            v2 = others[v2];
+            codesize[v2]++;
+        }
+    }
+
+    // Figure K.2
+    for (int i = 0; i < 257; i++) {
+        if (codesize[i]) {
+            if (codesize[i] > 32) {
+                return -1;
+            }
+            bits[codesize[i]]++;
+        }
+    }
+
+    // Figure K.3: no codes are allowed to be longer than 16 bits.
+    for (int i = 32; i > 16; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) {
+                j--;
+            }
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+
+    // get rid of the reserved code point, it's the longest one.
+    int i = 16;
+    while ((i > 0) && (bits[i] == 0)) {
+        i--;
+    }
+    if (i == 0) {
+        return -2;
+    }
+    bits[i]--;
+
+    // Figure K.4: symbols are listed in order of code length.
+    int nsymbols = 0;
+    for (int len = 1; len <= 32; len++) {
+        for (int sym = 0; sym < 256; sym++) {
+            if (codesize[sym] == len) {
+                table->huffman_codes[nsymbols++] = sym;
+            }
+        }
+    }
+
+    table->tc_td = tc_td;
+    for (int len = 0; len < 16; len++) {
+        table->number_of_codes_with_length[len] = bits[len + 1];
+    }
+    table->Ls = 2 + 1 + 16 + nsymbols;
+
+    return 0;
+}
+
+/**
+ * Progressive scans get encoded twice: once to count how often each huffman symbol shows up so
+ * that an optimal table can be made, and then again for real. If freq is non-NULL, symbols are
+ * counted into it and nothing is written to the bit packer.
+ */
+typedef struct progressive_scan_state
+{
+    uint32_t* freq;
+    const huffman_reverse_lookup_table_t* hrlt;
+    bit_packer_t* bp;
+
+    // how many blocks in a row have had nothing but zeros in this scan's band.
+    int eobrun;
+} progressive_scan_state_t;
+
+static int progressive_emit_symbol(progressive_scan_state_t* s, uint8_t symbol)
+{
+    if (s->freq) {
+        s->freq[symbol]++;
+        return 0;
+    }
+
+    const huffman_reverse_lookup_entry_t* huffman_code = &s->hrlt->entries[symbol];
+    if (huffman_code->bit_length == 0) {
+        return -1;
+    }
+    bit_packer_pack_u16(s->bp, huffman_code->value, huffman_code->bit_length);
+    return 0;
+}
+
+static void progressive_emit_bits(progressive_scan_state_t* s, uint16_t value, int nbits)
+{
+    if (!s->freq && (nbits > 0)) {
+        bit_packer_pack_u16(s->bp, value, nbits);
+    }
+}
+
+/**
+ * EOBRUN is coded as a symbol saying how many bits long the run length is (see table G.1), followed
+ * by all of the bits of the run length except for the leading 1.
+ */
+static int progressive_flush_eobrun(progressive_scan_state_t* s)
+{
+    if (s->eobrun == 0) {
+        return 0;
+    }
+
+    int nbits = 0;
+    while ((s->eobrun >> (nbits + 1)) != 0) {
+        nbits++;
+    }
+
+    int retval = progressive_emit_symbol(s, nbits << 4);
+    progressive_emit_bits(s, s->eobrun & ((1 << nbits) - 1), nbits);
+    s->eobrun = 0;
+
+    return retval;
+}
+
+static int progressive_encode_scan(const jmcujc_component_t* component,
+                                   const jmcujc_spectral_band_t* band,
+                                   progressive_scan_state_t* s)
+{
+    int retval = 0;
+    int dc_prev = 0;
+    s->eobrun = 0;
+
+    const int num_mcus = (component->width * component->height) / 64;
+    for (int i = 0; i < num_mcus; i++) {
+        const float* source_block = component->samples + (i * 64);
+
+        if (band->Ss == 0) {
+            // ======= DC scan; coded just like the DC coefficient in sequential mode =======
+            int dc = (int)roundf(source_block[0]);
+            int dc_raw_length;
+            uint16_t coded_coefficient_value =
+                coefficient_value_to_coded_value(dc - dc_prev, &dc_raw_length);
+            dc_prev = dc;
+
+            if ((dc_raw_length < 0) || (dc_raw_length > 11)) {
+                retval = -1;
+                goto _end;
+            }
+
+            if (progressive_emit_symbol(s, dc_raw_length)) {
+                retval = -2;
+                goto _end;
+            }
+            progressive_emit_bits(s, coded_coefficient_value, dc_raw_length);
+            continue;
+        }
+
+        // ======= AC band =======
+        int zeroes_to_rle = 0;
+        for (int k = band->Ss; k <= band->Se; k++) {
+            int16_t coefficient = (int16_t)roundf(source_block[k]);
+            if (coefficient == 0) {
+                zeroes_to_rle++;
+                continue;
+            }
+
+            // a non-zero coefficient ends the run of empty blocks
+            if (progressive_flush_eobrun(s)) {
+                retval = -4;
+                goto _end;
+            }
+
+            while (zeroes_to_rle >= 16) {
+                if (progressive_emit_symbol(s, 0xf0)) {
+                    retval = -4;
+                    goto _end;
+                }
+                zeroes_to_rle -= 16;
+            }
+
+            int ac_raw_length;
+            uint16_t coded_coefficient_value =
+                coefficient_value_to_coded_value(coefficient, &ac_raw_length);
+            if ((ac_raw_length < 0) || (ac_raw_length > 10)) {
+                retval = -3;
+                goto _end;
+            }
+
+            if (progressive_emit_symbol(s, (zeroes_to_rle << 4) | ac_raw_length)) {
+                retval = -4;
+                goto _end;
+            }
+            progressive_emit_bits(s, coded_coefficient_value, ac_raw_length);
+            zeroes_to_rle = 0;
+        }
+
+        // rest of the band was empty. Instead of an EOB for every block, we just count them up.
+        if (zeroes_to_rle > 0) {
+            s->eobrun++;
+            if (s->eobrun == 0x7fff) {
+                if (progressive_flush_eobrun(s)) {
+                    retval = -4;
+                    goto _end;
+                }
+            }
+        }
+    }
+
+    if (progressive_flush_eobrun(s)) {
+        retval = -4;
+    }
+
+_end:
+    return retval;
+}
+
+/**
+ * Writes a whole progressive image; a DHT, SOS, and scan for each band in the params' progressive
+ * script. The component has to have already been run through the DCT and quantizer.
+ */
+static int progressive_encode_component(jmcujc_component_t* component,
+                                        jmcujc_jpeg_params_t* params,
+                                        jmcujc_bytearray_t* ba)
+{
+    const jmcujc_progressive_script_t* script = params->progressive_script;
+
+    if ((component->height < params->height) || (component->width < params->width)) {
+        return -5;
+    }
+
+    if ((script->num_scans < 1) || (script->scans[0].Ss != 0) || (script->scans[0].Se != 0)) {
+        return -6;
+    }
+
+    for (int scan = 0; scan < script->num_scans; scan++) {
+        const jmcujc_spectral_band_t* band = &script->scans[scan];
+        const bool dc_scan = (band->Ss == 0);
+        if ((scan > 0) && (dc_scan || (band->Se > 63) || (band->Ss > band->Se))) {
+            return -6;
+        }
+
+        // first pass: gather statistics for the huffman table
+        uint32_t freq[256] = { 0 };
+        progressive_scan_state_t s = { .freq = freq };
+        int retval = progressive_encode_scan(component, band, &s);
+        if (retval) {
+            return retval;
+        }
+
+        jmcujc_huffman_table_t table;
+        if (huffman_table_generate_optimal(freq, dc_scan ? 0x00 : 0x10, &table)) {
+            return -7;
+        }
+
+        // the bit packer is always byte-aligned between scans, so we can go back to writing
+        // markers through the byte array.
+        ba->index = params->bp.idx;
+        jpeg_write_huffman_table(&table, ba);
+
+        // ======= SOS =======
+        // one component, using DC / AC table 0. No successive approximation.
+        bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xda, 0x00, 8, 1, 0, 0x00 }, 7);
+        bytearray_add_bytes(ba, (uint8_t[]){ band->Ss, band->Se, 0 }, 3);
+        params->bp.idx = ba->index;
+        params->bp.bitcount = 0;
+
+        // second pass: actually encode the scan
+        huffman_reverse_lookup_table_t hrlt;
+        memset(&hrlt, 0, sizeof(hrlt));
+        huffman_reverse_lookup_table_init(&table, &hrlt);
+
+        s = (progressive_scan_state_t){ .hrlt = &hrlt, .bp = &params->bp };
+        retval = progressive_encode_scan(component, band, &s);
+        if (retval) {
+            return retval;
+        }
+
+        // every scan has to end on a byte boundary.
+        bit_packer_pad_end(&params->bp, 1);
+    }
+
+    ba->index = params->bp.idx;
+
+    return 0;
+}
+
+// ======= huffman backend =======
+static int huffman_write_headers(jmcujc_component_t* components,
+                                 int ncomponents,
+                                 jmcujc_jpeg_params_t* params,
+                                 jmcujc_bytearray_t* ba)
+{
+    // progressive files get their huffman tables and SOS right before each scan.
+    const bool progressive = (params->progressive_script != NULL);
+
+    if (!progressive) {
+        for (int i = 0; i < params->num_dc_huffman_tables; i++) {
+            jpeg_write_huffman_table(params->dc_huffman_tables[i], ba);
+        }
+        for (int i = 0; i < params->num_ac_huffman_tables; i++) {
+            jpeg_write_huffman_table(params->ac_huffman_tables[i], ba);
+        }
+    }
+
+    jmcujc_write_frame_header(components, ncomponents, params, progressive ? 0xc2 : 0xc0, ba);
+
+    if (!progressive) {
+        jmcujc_write_scan_header(ncomponents, params, ba);
+    }
+
+    // initialize jpeg params's bit packer.
+    // probably would be better if we just used the bit packer directly instead of maintaining a
+    // byte array and a bitpacker, but here we are.
+    params->bp.data = ba->base;
+    params->bp.bitcount = 0;
+    params->bp.datalen = ba->len;
+    params->bp.idx = ba->index;
+
+    return 0;
+}
+
+static int huffman_encode(jmcujc_component_t* component,
+                          jmcujc_jpeg_params_t* params,
+                          jmcujc_bytearray_t* bytestream)
+{
+    if (params->progressive_script != NULL) {
+        return progressive_encode_component(component, params, bytestream);
+    }
+
     // check and see if reverse huffman lookup tables have been initialized.
     if (!params->_hrlt_valid) {
         for (int i = 0; i < params->num_dc_huffman_tables; i++) {
@@ -433,19 +1067,43 @@ int jmcujc_compress_component_to_bytestream(jmcujc_component_t* component,
         }
     }
 
-    //huffman_encode_component(&components[0], params, bytestream);
-    huffman_encode_component(component, params, bytestream);
+    return huffman_encode_component(component, params, bytestream);
+}
 
+static int huffman_finish(jmcujc_jpeg_params_t* params, jmcujc_bytearray_t* ba)
+{
+    bit_packer_pad_end(&params->bp, 1);
+    ba->index = params->bp.idx;
     return 0;
 }
 
+const jmcujc_entropy_backend_t jmcujc_entropy_huffman =
+{
+    .write_headers = huffman_write_headers,
+    .encode_component = huffman_encode,
+    .finish = huffman_finish
+};
+
+int jmcujc_compress_component_to_bytestream(jmcujc_component_t* component,
+                                            jmcujc_jpeg_params_t* params,
+                                            jmcujc_bytearray_t* bytestream)
+{
+    /*
+    for (int i = 0; i < ncomponents; i++) {
+        jpeg_component_DCT(&components[i]);
+    }
+    */
+    jpeg_component_DCT(params, component);
+
+    return entropy_backend(params)->encode_component(component, params, bytestream);
+}
+
 int jmcujc_add_eoi_marker(jmcujc_jpeg_params_t* params,
                           jmcujc_bytearray_t* ba)
 {
-    bit_packer_pad_end(&params->bp, 1);
-    ba->index = params->bp.idx;
+    int retval = entropy_backend(params)->finish(params, ba);
     bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xd9 }, 2);
-    return 0;
+    return retval;
 }
 
 const jmcujc_huffman_table_t lum_dc_huffman_table =
@@ -665,6 +1323,12 @@ const jmcujc_quantization_table_t chrom_quant_table_low =
     }
 };
 
+const jmcujc_progressive_script_t progressive_script_default =
+{
+    .num_scans = 3,
+    .scans = { {0, 0}, {1, 5}, {6, 63} }
+};
+
 const jmcujc_jpeg_params_t bw_defaults =
 {
     .num_dc_huffman_tables = 1,
@@ -5,11 +5,13 @@
 #include <stdint.h>
 
 typedef struct jmcujc_component jmcujc_component_t;
+typedef struct jmcujc_jpeg_params jmcujc_jpeg_params_t;
 
 #include "jmcujc_image_util.h"
 #include "jmcujc_utils.h"
 
 #include "bit_dispenser.h"
+#include "jmcujc_arithmetic.h"
 
 
 typedef struct jmcujc_subsampling_factors
@@ -95,6 +97,72 @@ typedef struct jmcujc_quantization_table
     uint8_t values[64];
 } jmcujc_quantization_table_t;
 
+/**
+ * A progressive "script" lists the spectral bands that get their own scan, in the order that
+ * they're sent. Coefficient indices are in zig-zag order, so scans[0] should always be {0, 0} (the
+ * DC scan) and the rest of them should cover [1, 63] somehow. Sending the low frequencies first
+ * means that a decoder can show a blurry version of the whole image before the rest of it arrives.
+ *
+ * Only spectral selection is supported; successive approximation (Ah / Al) always stays at 0.
+ */
+typedef struct jmcujc_spectral_band
+{
+    uint8_t Ss;
+    uint8_t Se;
+} jmcujc_spectral_band_t;
+
+typedef struct jmcujc_progressive_script
+{
+    int num_scans;
+    jmcujc_spectral_band_t scans[8];
+} jmcujc_progressive_script_t;
+
+/**
+ * jmcujc_write_headers works this out from the quant table so that the DCT can skip computing
+ * coefficients that are going to get quantized to 0 anyways.
+ */
+typedef struct jmcujc_dct_plan
+{
+    // 2, 4 or 8. No coefficient outside of the top-left kernel_size x kernel_size corner can
+    // survive quantization, no matter what's in the block.
+    int kernel_size;
+
+    // per-block thresholds; a block whose AC energy or neighbor-difference energy is under these
+    // can use a smaller kernel.
+    float flat_energy;
+    float low2_horizontal;
+    float low2_vertical;
+    float low4_horizontal;
+    float low4_vertical;
+} jmcujc_dct_plan_t;
+
+/**
+ * An entropy backend turns the DCT'd and quantized blocks of a component into an entropy-coded
+ * segment. Each backend is responsible for everything between the quantization tables and the EOI
+ * marker: its own tables (DHT / DAC), the frame header (the SOF marker says which coder was used),
+ * the scan header(s), and the coded data itself.
+ *
+ * All of these return 0 on success, < 0 on failure.
+ */
+typedef struct jmcujc_entropy_backend
+{
+    // writes tables, SOF, and (if there's only one scan) SOS.
+    int (*write_headers)(jmcujc_component_t* components,
+                         int ncomponents,
+                         jmcujc_jpeg_params_t* params,
+                         jmcujc_bytearray_t* bytestream);
+
+    // codes one component that's already been through the DCT and quantizer.
+    int (*encode_component)(jmcujc_component_t* component,
+                            jmcujc_jpeg_params_t* params,
+                            jmcujc_bytearray_t* bytestream);
+
+    // flushes any bits that the coder is holding onto. After this, bytestream->index should point
+    // right after the end of the entropy-coded segment.
+    int (*finish)(jmcujc_jpeg_params_t* params,
+                  jmcujc_bytearray_t* bytestream);
+} jmcujc_entropy_backend_t;
+
 /**
  * jmcujc_jpeg_params contains all of the options and tables needed to compress image components
  * into a jpeg bytestream. These parameters are also used to generate jpeg headers.
@@ -102,7 +170,7 @@ typedef struct jmcujc_quantization_table
 ' *
  * For most users, one of the preset defaults will work best.
  */
-typedef struct jmcujc_jpeg_params
+struct jmcujc_jpeg_params
 {
     // TODO: these could be const, just not doing it right now for sake of development time.
     bool _hrlt_valid;
@@ -127,6 +195,11 @@ typedef struct jmcujc_jpeg_params
     int width;
     int height;
 
+    // How many bits of each input sample are actually used. Sensors that only give 4 or 6 bits of
+    // dynamic range let the DCT skip more coefficients. 0 means 8.
+    int input_bit_depth;
+    jmcujc_dct_plan_t _dct_plan;
+
     // These table selectors map sequentially to components. selector #0 is used for
     // component 0, selector #1 is used for component 1, etc.
     // These arrays need to be filled out with valid values for as many components as there are.
@@ -138,7 +211,25 @@ typedef struct jmcujc_jpeg_params
 
     // holds the previous DC value for each of the components for differential coding
     float dc_prev[4];
-} jmcujc_jpeg_params_t;
+
+    // If this is NULL, a baseline sequential (SOF0) file is made. Otherwise, a progressive (SOF2)
+    // file is made with one scan per band in the script. Huffman tables for progressive files are
+    // generated per-scan from the coefficient statistics, so the huffman tables above are ignored.
+    const jmcujc_progressive_script_t* progressive_script;
+
+    // If this isn't NULL, the mean of each block gets saved here as it goes through the DCT,
+    // which makes a 1/8th scale grayscale thumbnail in raster order. It needs to hold
+    // jmcujc_thumbnail_width(params) * jmcujc_thumbnail_height(params) bytes. See
+    // jmcujc_encode_thumbnail.
+    uint8_t* thumbnail;
+    int _thumbnail_idx;
+
+    // Which entropy coder to use. NULL means huffman coding.
+    const jmcujc_entropy_backend_t* entropy_backend;
+
+    // working state for the arithmetic coder; only used by jmcujc_entropy_arithmetic.
+    jmcujc_arithmetic_coder_t arith;
+};
 
 // constants
 // --------------------------------
@@ -160,6 +251,14 @@ const extern jmcujc_quantization_table_t chrom_quant_table_medium;
 const extern jmcujc_quantization_table_t chrom_quant_table_low;
 //const extern jmcujc_quantization_table_t chrom_quant_table_lowest;
 
+const extern jmcujc_progressive_script_t progressive_script_default;
+
+// Huffman coding; baseline (SOF0) or progressive (SOF2), depending on params->progressive_script.
+const extern jmcujc_entropy_backend_t jmcujc_entropy_huffman;
+
+// Sequential arithmetic coding with the QM-coder (SOF9). Progressive scripts aren't supported.
+const extern jmcujc_entropy_backend_t jmcujc_entropy_arithmetic;
+
 const extern jmcujc_jpeg_params_t bw_defaults;
 
 const extern jmcujc_jpeg_params_t rgb_defaults;
@@ -192,11 +291,28 @@ int jmcujc_write_headers(jmcujc_component_t* components,
  * @param[in]     params        Contains huffman and quantization tables to use.
  * @param[out]    bytestream
  * @return  returns 0 on success, < 0 on failure.
+ *
+ * NB: in progressive mode, every scan needs every block of the image, so the component has to hold
+ * the whole image; this function should only be called once per image.
  */
 int jmcujc_compress_component_to_bytestream(jmcujc_component_t* component,
                                             jmcujc_jpeg_params_t* params,
                                             jmcujc_bytearray_t* bytestream);
 
+/**
+ * Helpers for entropy backends. These write the SOF and the single sequential SOS for the given
+ * components.
+ */
+int jmcujc_write_frame_header(jmcujc_component_t* components,
+                              int ncomponents,
+                              jmcujc_jpeg_params_t* params,
+                              uint8_t sof_marker,
+                              jmcujc_bytearray_t* bytestream);
+
+int jmcujc_write_scan_header(int ncomponents,
+                             jmcujc_jpeg_params_t* params,
+                             jmcujc_bytearray_t* bytestream);
+
 /**
  * This function adds the final EOI marker to a bytestream holding compressed
  * image components, thereby "finishing" it.
@@ -204,5 +320,47 @@ int jmcujc_compress_component_to_bytestream(jmcujc_component_t* component,
 int jmcujc_add_eoi_marker(jmcujc_jpeg_params_t* params,
                           jmcujc_bytearray_t* bytestream);
 
+/**
+ * Size of the DC thumbnail in pixels; one pixel per 8x8 block of the full-size image. This assumes
+ * that components are only padded out to the next multiple of 8.
+ */
+static inline int jmcujc_thumbnail_width(const jmcujc_jpeg_params_t* params)
+{
+    return (params->width + 7) / 8;
+}
+
+static inline int jmcujc_thumbnail_height(const jmcujc_jpeg_params_t* params)
+{
+    return (params->height + 7) / 8;
+}
+
+/**
+ * Once a whole image has been compressed with params->thumbnail set, this compresses the collected
+ * thumbnail into its own baseline jpeg using the same quantization and huffman tables. That's a lot
+ * cheaper than downscaling the source image and compressing it again.
+ *
+ * @param[in]     params        Params that the full-size image was compressed with.
+ * @param[in]     scratch       Working space for the thumbnail's component. It needs to hold
+ *                              (thumbnail width rounded up to 8) * (thumbnail height rounded up to
+ *                              8) floats.
+ * @param[out]    thumbnail     Gets a complete jpeg, SOI through EOI. Like any other bytestream,
+ *                              it needs room for the whole compressed thumbnail; size it from the
+ *                              thumbnail's dimensions.
+ * @return  returns 0 on success, < 0 on failure.
+ */
+int jmcujc_encode_thumbnail(const jmcujc_jpeg_params_t* params,
+                            float* scratch,
+                            jmcujc_bytearray_t* thumbnail);
+
+/**
+ * Puts a thumbnail from jmcujc_encode_thumbnail into a finished image as a JFIF extension (APP0
+ * "JFXX") segment right after the JFIF APP0 segment. Everything after it gets moved down, so the
+ * bytestream needs len to be set and to have room for the thumbnail plus 10 bytes.
+ *
+ * @return  returns 0 on success, < 0 on failure.
+ */
+int jmcujc_embed_thumbnail(const jmcujc_bytearray_t* thumbnail,
+                           jmcujc_bytearray_t* bytestream);
+
 
 #endif
@@ -0,0 +1,478 @@
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "jmcujc.h"
+#include "jmcujc_utils.h"
+
+/**
+ * This file implements sequential arithmetic coding (SOF9) as described in Annex D and section F.1.4
+ * of T.81. It usually gets files 5-10% smaller than huffman coding does with the example tables,
+ * and there aren't any tables to transmit; the coder adapts to the image as it goes.
+ *
+ * Default conditioning is used for everything (L = 0, U = 1, Kx = 5), so no DAC marker is written.
+ */
+
+typedef struct qe_table_entry
+{
+    uint16_t qe;
+    uint8_t next_index_lps;
+    uint8_t next_index_mps;
+    uint8_t switch_mps;
+} qe_table_entry_t;
+
+// Table D.3 of T.81
+static const qe_table_entry_t qe_table[114] =
+{
+    { 0x5a1d,   1,   1, 1 },   //   0
+    { 0x2586,  14,   2, 0 },   //   1
+    { 0x1114,  16,   3, 0 },   //   2
+    { 0x080b,  18,   4, 0 },   //   3
+    { 0x03d8,  20,   5, 0 },   //   4
+    { 0x01da,  23,   6, 0 },   //   5
+    { 0x00e5,  25,   7, 0 },   //   6
+    { 0x006f,  28,   8, 0 },   //   7
+    { 0x0036,  30,   9, 0 },   //   8
+    { 0x001a,  33,  10, 0 },   //   9
+    { 0x000d,  35,  11, 0 },   //  10
+    { 0x0006,   9,  12, 0 },   //  11
+    { 0x0003,  10,  13, 0 },   //  12
+    { 0x0001,  12,  13, 0 },   //  13
+    { 0x5a7f,  15,  15, 1 },   //  14
+    { 0x3f25,  36,  16, 0 },   //  15
+    { 0x2cf2,  38,  17, 0 },   //  16
+    { 0x207c,  39,  18, 0 },   //  17
+    { 0x17b9,  40,  19, 0 },   //  18
+    { 0x1182,  42,  20, 0 },   //  19
+    { 0x0cef,  43,  21, 0 },   //  20
+    { 0x09a1,  45,  22, 0 },   //  21
+    { 0x072f,  46,  23, 0 },   //  22
+    { 0x055c,  48,  24, 0 },   //  23
+    { 0x0406,  49,  25, 0 },   //  24
+    { 0x0303,  51,  26, 0 },   //  25
+    { 0x0240,  52,  27, 0 },   //  26
+    { 0x01b1,  54,  28, 0 },   //  27
+    { 0x0144,  56,  29, 0 },   //  28
+    { 0x00f5,  57,  30, 0 },   //  29
+    { 0x00b7,  59,  31, 0 },   //  30
+    { 0x008a,  60,  32, 0 },   //  31
+    { 0x0068,  62,  33, 0 },   //  32
+    { 0x004e,  63,  34, 0 },   //  33
+    { 0x003b,  32,  35, 0 },   //  34
+    { 0x002c,  33,   9, 0 },   //  35
+    { 0x5ae1,  37,  37, 1 },   //  36
+    { 0x484c,  64,  38, 0 },   //  37
+    { 0x3a0d,  65,  39, 0 },   //  38
+    { 0x2ef1,  67,  40, 0 },   //  39
+    { 0x261f,  68,  41, 0 },   //  40
+    { 0x1f33,  69,  42, 0 },   //  41
+    { 0x19a8,  70,  43, 0 },   //  42
+    { 0x1518,  72,  44, 0 },   //  43
+    { 0x1177,  73,  45, 0 },   //  44
+    { 0x0e74,  74,  46, 0 },   //  45
+    { 0x0bfb,  75,  47, 0 },   //  46
+    { 0x09f8,  77,  48, 0 },   //  47
+    { 0x0861,  78,  49, 0 },   //  48
+    { 0x0706,  79,  50, 0 },   //  49
+    { 0x05cd,  48,  51, 0 },   //  50
+    { 0x04de,  50,  52, 0 },   //  51
+    { 0x040f,  50,  53, 0 },   //  52
+    { 0x0363,  51,  54, 0 },   //  53
+    { 0x02d4,  52,  55, 0 },   //  54
+    { 0x025c,  53,  56, 0 },   //  55
+    { 0x01f8,  54,  57, 0 },   //  56
+    { 0x01a4,  55,  58, 0 },   //  57
+    { 0x0160,  56,  59, 0 },   //  58
+    { 0x0125,  57,  60, 0 },   //  59
+    { 0x00f6,  58,  61, 0 },   //  60
+    { 0x00cb,  59,  62, 0 },   //  61
+    { 0x00ab,  61,  63, 0 },   //  62
+    { 0x008f,  61,  32, 0 },   //  63
+    { 0x5b12,  65,  65, 1 },   //  64
+    { 0x4d04,  80,  66, 0 },   //  65
+    { 0x412c,  81,  67, 0 },   //  66
+    { 0x37d8,  82,  68, 0 },   //  67
+    { 0x2fe8,  83,  69, 0 },   //  68
+    { 0x293c,  84,  70, 0 },   //  69
+    { 0x2379,  86,  71, 0 },   //  70
+    { 0x1edf,  87,  72, 0 },   //  71
+    { 0x1aa9,  87,  73, 0 },   //  72
+    { 0x174e,  72,  74, 0 },   //  73
+    { 0x1424,  72,  75, 0 },   //  74
+    { 0x119c,  74,  76, 0 },   //  75
+    { 0x0f6b,  74,  77, 0 },   //  76
+    { 0x0d51,  75,  78, 0 },   //  77
+    { 0x0bb6,  77,  79, 0 },   //  78
+    { 0x0a40,  77,  48, 0 },   //  79
+    { 0x5832,  80,  81, 1 },   //  80
+    { 0x4d1c,  88,  82, 0 },   //  81
+    { 0x438e,  89,  83, 0 },   //  82
+    { 0x3bdd,  90,  84, 0 },   //  83
+    { 0x34ee,  91,  85, 0 },   //  84
+    { 0x2eae,  92,  86, 0 },   //  85
+    { 0x299a,  93,  87, 0 },   //  86
+    { 0x2516,  86,  71, 0 },   //  87
+    { 0x5570,  88,  89, 1 },   //  88
+    { 0x4ca9,  95,  90, 0 },   //  89
+    { 0x44d9,  96,  91, 0 },   //  90
+    { 0x3e22,  97,  92, 0 },   //  91
+    { 0x3824,  99,  93, 0 },   //  92
+    { 0x32b4,  99,  94, 0 },   //  93
+    { 0x2e17,  93,  86, 0 },   //  94
+    { 0x56a8,  95,  96, 1 },   //  95
+    { 0x4f46, 101,  97, 0 },   //  96
+    { 0x47e5, 102,  98, 0 },   //  97
+    { 0x41cf, 103,  99, 0 },   //  98
+    { 0x3c3d, 104, 100, 0 },   //  99
+    { 0x375e,  99,  93, 0 },   // 100
+    { 0x5231, 105, 102, 0 },   // 101
+    { 0x4c0f, 106, 103, 0 },   // 102
+    { 0x4639, 107, 104, 0 },   // 103
+    { 0x415e, 103,  99, 0 },   // 104
+    { 0x5627, 105, 106, 1 },   // 105
+    { 0x50e7, 108, 107, 0 },   // 106
+    { 0x4b85, 109, 103, 0 },   // 107
+    { 0x5597, 110, 109, 0 },   // 108
+    { 0x504f, 111, 107, 0 },   // 109
+    { 0x5a10, 110, 111, 1 },   // 110
+    { 0x5522, 112, 109, 0 },   // 111
+    { 0x59eb, 112, 111, 1 },   // 112
+    { 0x5a1d, 113, 113, 0 }    // 113: not in T.81; fixed 0.5 probability for AC signs
+};
+
+#define ARITH_FIXED_BIN_STATE (113)
+
+// default conditioning parameters; see section F.1.4.4.
+#define ARITH_DC_L (0)
+#define ARITH_DC_U (1)
+#define ARITH_AC_KX (5)
+
+static void emit_byte(jmcujc_bytearray_t* ba, int byte)
+{
+    bytearray_add_byte(ba, (uint8_t)byte);
+}
+
+static void emit_zeros(jmcujc_arithmetic_coder_t* e, jmcujc_bytearray_t* ba)
+{
+    for (; e->zc > 0; e->zc--) {
+        emit_byte(ba, 0x00);
+    }
+}
+
+/**
+ * Called whenever a byte falls out of the top of the C register. Because a later carry can ripple
+ * up through any number of 0xff bytes, 0xff's are counted instead of written until we know that
+ * they're safe. Zero bytes are held back too, because trailing zeros can be dropped at the end.
+ */
+static void arith_byte_out(jmcujc_arithmetic_coder_t* e, jmcujc_bytearray_t* ba)
+{
+    uint32_t temp = e->c >> 19;
+
+    if (temp > 0xff) {
+        // carry; propagates into the buffered byte and turns all of the stacked 0xff's into 0x00's
+        if (e->buffer >= 0) {
+            emit_zeros(e, ba);
+            emit_byte(ba, e->buffer + 1);
+            if ((e->buffer + 1) == 0xff) {
+                emit_byte(ba, 0x00);
+            }
+        }
+        e->zc += e->sc;
+        e->sc = 0;
+
+        // the spacer bits in C mean that this can't be 0xff
+        e->buffer = temp & 0xff;
+    } else if (temp == 0xff) {
+        e->sc++;
+    } else {
+        // no carry can reach the buffered byte or the stacked 0xff's any more.
+        if (e->buffer == 0) {
+            e->zc++;
+        } else if (e->buffer >= 0) {
+            emit_zeros(e, ba);
+            emit_byte(ba, e->buffer);
+        }
+        if (e->sc) {
+            emit_zeros(e, ba);
+            for (; e->sc > 0; e->sc--) {
+                emit_byte(ba, 0xff);
+                emit_byte(ba, 0x00);
+            }
+        }
+        e->buffer = temp & 0xff;
+    }
+
+    e->c &= 0x7ffff;
+    e->ct += 8;
+}
+
+/**
+ * Codes one binary decision with the statistics bin st, per sections D.1.4 through D.1.6.
+ */
+static void arith_encode(jmcujc_arithmetic_coder_t* e,
+                         jmcujc_bytearray_t* ba,
+                         uint8_t* st,
+                         int val)
+{
+    const int sv = *st;
+    const qe_table_entry_t* q = &qe_table[sv & 0x7f];
+    const uint32_t qe = q->qe;
+
+    e->a -= qe;
+    if (val != (sv >> 7)) {
+        // less probable symbol. If the LPS interval is bigger than the MPS interval, the two are
+        // swapped (conditional exchange).
+        if (e->a >= qe) {
+            e->c += e->a;
+            e->a = qe;
+        }
+        *st = (sv & 0x80) ^ (q->switch_mps << 7) ^ q->next_index_lps;
+    } else {
+        // more probable symbol.
+        if (e->a >= 0x8000) {
+            return;
+        }
+        if (e->a < qe) {
+            e->c += e->a;
+            e->a = qe;
+        }
+        *st = (sv & 0x80) ^ q->next_index_mps;
+    }
+
+    // renormalize
+    do {
+        e->a <<= 1;
+        e->c <<= 1;
+        if (--e->ct == 0) {
+            arith_byte_out(e, ba);
+        }
+    } while (e->a < 0x8000);
+}
+
+/**
+ * Figures F.8 and F.9; codes the magnitude category and then the low bits of v, where v is the
+ * absolute value of a coefficient minus one. The first category decision goes in st, the second in
+ * x1, and the rest in x2, x2 + 1, ... . The magnitude bits go 14 bins past the last category bin.
+ *
+ * @return  the magnitude category as a power of 2; 0 if v was 0.
+ */
+static int arith_encode_magnitude(jmcujc_arithmetic_coder_t* e,
+                                  jmcujc_bytearray_t* ba,
+                                  uint8_t* st,
+                                  uint8_t* x1,
+                                  uint8_t* x2,
+                                  int v)
+{
+    int m = 0;
+    if (v) {
+        arith_encode(e, ba, st, 1);
+        m = 1;
+        st = x1;
+
+        int v2 = v >> 1;
+        if (v2) {
+            arith_encode(e, ba, st, 1);
+            m <<= 1;
+            st = x2;
+            while (v2 >>= 1) {
+                arith_encode(e, ba, st, 1);
+                m <<= 1;
+                st++;
+            }
+        }
+    }
+    arith_encode(e, ba, st, 0);
+
+    const int category = m;
+    st += 14;
+    while (m >>= 1) {
+        arith_encode(e, ba, st, (m & v) ? 1 : 0);
+    }
+
+    return category;
+}
+
+static int arithmetic_write_headers(jmcujc_component_t* components,
+                                    int ncomponents,
+                                    jmcujc_jpeg_params_t* params,
+                                    jmcujc_bytearray_t* ba)
+{
+    if (params->progressive_script != NULL) {
+        return -1;
+    }
+
+    jmcujc_write_frame_header(components, ncomponents, params, 0xc9, ba);
+    jmcujc_write_scan_header(ncomponents, params, ba);
+
+    // section D.1.7: initialization of the encoder
+    jmcujc_arithmetic_coder_t* e = &params->arith;
+    memset(e, 0, sizeof(jmcujc_arithmetic_coder_t));
+    e->a = 0x10000;
+    e->ct = 11;
+    e->buffer = -1;
+    e->fixed_bin = ARITH_FIXED_BIN_STATE;
+
+    return 0;
+}
+
+static int arithmetic_encode_component(jmcujc_component_t* component,
+                                       jmcujc_jpeg_params_t* params,
+                                       jmcujc_bytearray_t* ba)
+{
+    jmcujc_arithmetic_coder_t* e = &params->arith;
+
+    // temp code for monochrome images
+    const int component_num = 0;
+    const int tbl = params->component_huffman_table_selectors[component_num];
+    if ((tbl < 0) || (tbl > 1)) {
+        return -1;
+    }
+
+    const int num_mcus = (component->width * component->height) / 64;
+    for (int i = 0; i < num_mcus; i++) {
+        // samples are already in zig-zag order, so k indexes straight into the block.
+        const float* source_block = component->samples + (i * 64);
+        int block[64];
+        for (int k = 0; k < 64; k++) {
+            block[k] = (int)roundf(source_block[k]);
+        }
+
+        // ======= DC coefficient; sections F.1.4.1 and F.1.4.4.1 =======
+        uint8_t* st = &e->dc_stats[tbl][e->dc_context[component_num]];
+        int v = block[0] - e->last_dc[component_num];
+        if (v == 0) {
+            arith_encode(e, ba, st, 0);
+            e->dc_context[component_num] = 0;
+        } else {
+            e->last_dc[component_num] = block[0];
+            arith_encode(e, ba, st, 1);
+
+            // sign; table F.4
+            if (v > 0) {
+                arith_encode(e, ba, st + 1, 0);
+                st += 2;
+                e->dc_context[component_num] = 4;
+            } else {
+                v = -v;
+                arith_encode(e, ba, st + 1, 1);
+                st += 3;
+                e->dc_context[component_num] = 8;
+            }
+
+            int m = arith_encode_magnitude(e, ba, st,
+                                           &e->dc_stats[tbl][20], &e->dc_stats[tbl][21], v - 1);
+
+            // conditioning category for the next block's DC
+            if (m < ((1 << ARITH_DC_L) >> 1)) {
+                e->dc_context[component_num] = 0;
+            } else if (m > ((1 << ARITH_DC_U) >> 1)) {
+                e->dc_context[component_num] += 8;
+            }
+        }
+
+        // ======= AC coefficients; sections F.1.4.2 and F.1.4.4.2 =======
+        int eob;
+        for (eob = 63; (eob > 0) && (block[eob] == 0); eob--);
+
+        int k;
+        for (k = 1; k <= eob; k++) {
+            st = &e->ac_stats[tbl][3 * (k - 1)];
+            arith_encode(e, ba, st, 0);              // not EOB yet
+            while (block[k] == 0) {
+                arith_encode(e, ba, st + 1, 0);      // zero coefficient
+                st += 3;
+                k++;
+            }
+            arith_encode(e, ba, st + 1, 1);          // non-zero coefficient
+
+            v = block[k];
+            if (v > 0) {
+                arith_encode(e, ba, &e->fixed_bin, 0);
+            } else {
+                v = -v;
+                arith_encode(e, ba, &e->fixed_bin, 1);
+            }
+
+            // past the second category decision, AC magnitude categories go in one of two sets of
+            // bins depending on which side of Kx the coefficient is on.
+            st += 2;
+            uint8_t* x2 = &e->ac_stats[tbl][(k <= ARITH_AC_KX) ? 189 : 217];
+            arith_encode_magnitude(e, ba, st, st, x2, v - 1);
+        }
+
+        // EOB is implied if the last coefficient was non-zero
+        if (k <= 63) {
+            st = &e->ac_stats[tbl][3 * (k - 1)];
+            arith_encode(e, ba, st, 1);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Section D.1.8: Termination of encoding. Picks the value in the final interval with the most
+ * trailing zero bits, and drops any trailing zero bytes.
+ */
+static int arithmetic_finish(jmcujc_jpeg_params_t* params, jmcujc_bytearray_t* ba)
+{
+    jmcujc_arithmetic_coder_t* e = &params->arith;
+
+    uint32_t temp = (e->a - 1 + e->c) & 0xffff0000;
+    if (temp < e->c) {
+        e->c = temp + 0x8000;
+    } else {
+        e->c = temp;
+    }
+
+    e->c <<= e->ct;
+    if (e->c & 0xf8000000) {
+        // final carry
+        if (e->buffer >= 0) {
+            emit_zeros(e, ba);
+            emit_byte(ba, e->buffer + 1);
+            if ((e->buffer + 1) == 0xff) {
+                emit_byte(ba, 0x00);
+            }
+        }
+        e->zc += e->sc;
+        e->sc = 0;
+    } else {
+        if (e->buffer == 0) {
+            e->zc++;
+        } else if (e->buffer >= 0) {
+            emit_zeros(e, ba);
+            emit_byte(ba, e->buffer);
+        }
+        if (e->sc) {
+            emit_zeros(e, ba);
+            for (; e->sc > 0; e->sc--) {
+                emit_byte(ba, 0xff);
+                emit_byte(ba, 0x00);
+            }
+        }
+    }
+
+    if (e->c & 0x7fff800) {
+        emit_zeros(e, ba);
+        emit_byte(ba, (e->c >> 19) & 0xff);
+        if (((e->c >> 19) & 0xff) == 0xff) {
+            emit_byte(ba, 0x00);
+        }
+        if (e->c & 0x7f800) {
+            emit_byte(ba, (e->c >> 11) & 0xff);
+            if (((e->c >> 11) & 0xff) == 0xff) {
+                emit_byte(ba, 0x00);
+            }
+        }
+    }
+
+    return 0;
+}
+
+const jmcujc_entropy_backend_t jmcujc_entropy_arithmetic =
+{
+    .write_headers = arithmetic_write_headers,
+    .encode_component = arithmetic_encode_component,
+    .finish = arithmetic_finish
+};
@@ -0,0 +1,43 @@
+#ifndef _JMCUJC_ARITHMETIC_H
+#define _JMCUJC_ARITHMETIC_H
+
+#include <stdint.h>
+
+/**
+ * Registers for the QM-coder described in Annex D of T.81, along with the statistics areas for the
+ * DC and AC coefficient models from section F.1.4.
+ *
+ * Every statistics bin is one byte: the low 7 bits are an index into the Qe table (table D.3) and
+ * the top bit is the current more-probable-symbol. Bins all start out at 0.
+ */
+typedef struct jmcujc_arithmetic_coder
+{
+    // C and A registers. C has 3 "spacer" bits above the byte that's about to come out of it so
+    // that carries can be caught.
+    uint32_t c;
+    uint32_t a;
+
+    // how many more shifts until the next byte comes out of C.
+    int ct;
+
+    // Output bytes are held back because a carry might still change them. buffer is the most
+    // recent byte (-1 if there isn't one yet), sc is how many 0xff's are stacked after it, and zc
+    // is how many 0x00's are waiting to be written before it.
+    int buffer;
+    int sc;
+    int zc;
+
+    // These are indexed by the component's huffman table selector; the same selector picks the
+    // arithmetic conditioning table.
+    uint8_t dc_stats[2][64];
+    uint8_t ac_stats[2][256];
+
+    // fixed 0.5 probability bin for AC coefficient signs.
+    uint8_t fixed_bin;
+
+    // per-component DC state; see section F.1.4.4.1.2.
+    int dc_context[4];
+    int last_dc[4];
+} jmcujc_arithmetic_coder_t;
+
+#endif
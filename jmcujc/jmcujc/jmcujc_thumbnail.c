@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "jmcujc.h"
+#include "jmcujc_utils.h"
+
+/**
+ * Every block's DC coefficient is already an 8x downscaled copy of the image, so the thumbnail
+ * comes for free while the full-size image is going through the DCT (see jpeg_component_DCT). This
+ * file just turns those pixels into a small jpeg and tucks it into the big one.
+ */
+
+int jmcujc_encode_thumbnail(const jmcujc_jpeg_params_t* params,
+                            float* scratch,
+                            jmcujc_bytearray_t* thumbnail)
+{
+    const int width = jmcujc_thumbnail_width(params);
+    const int height = jmcujc_thumbnail_height(params);
+
+    if ((params->thumbnail == NULL) || (params->_thumbnail_idx != (width * height))) {
+        return -1;
+    }
+
+    // The thumbnail's component needs to be a multiple of 8 in both directions, so the edge
+    // pixels get repeated out to the padding.
+    jmcujc_component_t component;
+    component.samples = scratch;
+    component.width = (width + 7) & ~7;
+    component.height = (height + 7) & ~7;
+    component.subsampling_factors.horizontal_sampling_factor = 1;
+    component.subsampling_factors.vertical_sampling_factor = 1;
+    component._dirty = false;
+
+    const int width_in_MCUs = component.width / 8;
+    int idx = 0;
+    for (int MCU_idx = 0; MCU_idx < (width_in_MCUs * (component.height / 8)); MCU_idx++) {
+        const int MCU_x = MCU_idx % width_in_MCUs;
+        const int MCU_y = MCU_idx / width_in_MCUs;
+        for (int block_y = 0; block_y < 8; block_y++) {
+            int y = (MCU_y * 8) + block_y;
+            y = (y < height) ? y : (height - 1);
+            for (int block_x = 0; block_x < 8; block_x++) {
+                int x = (MCU_x * 8) + block_x;
+                x = (x < width) ? x : (width - 1);
+                scratch[idx++] = ((int)params->thumbnail[(y * width) + x]) - 128;
+            }
+        }
+    }
+
+    // Thumbnails have to be baseline, and they obviously don't get thumbnails of their own.
+    jmcujc_jpeg_params_t thumbnail_params;
+    memcpy(&thumbnail_params, params, sizeof(thumbnail_params));
+    thumbnail_params._hrlt_valid = false;
+    thumbnail_params.width = width;
+    thumbnail_params.height = height;
+    thumbnail_params.thumbnail = NULL;
+    thumbnail_params.progressive_script = NULL;
+    thumbnail_params.entropy_backend = NULL;
+    memset(thumbnail_params.dc_prev, 0, sizeof(thumbnail_params.dc_prev));
+
+    int retval;
+    if ((retval = jmcujc_write_headers(&component, 1, &thumbnail_params, thumbnail))) {
+        return retval;
+    }
+    if ((retval = jmcujc_compress_component_to_bytestream(&component, &thumbnail_params,
+                                                          thumbnail))) {
+        return retval;
+    }
+    return jmcujc_add_eoi_marker(&thumbnail_params, thumbnail);
+}
+
+/**
+ * Returns the length of the APP0 segment that starts at data[2] if it's a JFIF segment, 0 if not.
+ */
+static int jfif_segment_length(const uint8_t* data, int len)
+{
+    if ((len < 11) || (data[2] != 0xff) || (data[3] != 0xe0) ||
+        (memcmp(&data[6], "JFIF\0", 5) != 0)) {
+        return 0;
+    }
+
+    return 2 + ((data[4] << 8) | data[5]);
+}
+
+int jmcujc_embed_thumbnail(const jmcujc_bytearray_t* thumbnail,
+                           jmcujc_bytearray_t* ba)
+{
+    // The thumbnail isn't allowed to have its own JFIF segment, so that gets dropped.
+    const int thumbnail_jfif_len = jfif_segment_length(thumbnail->base, thumbnail->index);
+    const int thumbnail_len = thumbnail->index - thumbnail_jfif_len;
+
+    // JFIF extension segment: marker, length, "JFXX\0", extension code, thumbnail data
+    const int segment_len = 2 + 2 + 5 + 1 + thumbnail_len;
+    if ((segment_len - 2) > 0xffff) {
+        return -1;
+    }
+
+    const int insert_at = 2 + jfif_segment_length(ba->base, ba->index);
+    if (insert_at == 2) {
+        return -2;
+    }
+
+    if ((ba->index + segment_len) > ba->len) {
+        return -3;
+    }
+
+    memmove(ba->base + insert_at + segment_len, ba->base + insert_at, ba->index - insert_at);
+
+    // JFIF extensions need version 1.02
+    ba->base[12] = 0x02;
+
+    const int Lp = segment_len - 2;
+    jmcujc_bytearray_t segment = { .base = ba->base + insert_at, .len = segment_len, .index = 0 };
+    bytearray_add_bytes(&segment, (const uint8_t[]){ 0xff, 0xe0, (Lp >> 8) & 0xff, Lp & 0xff }, 4);
+    bytearray_add_bytes(&segment, (const uint8_t*)"JFXX\0", 5);
+
+    // 0x10: thumbnail coded using JPEG
+    bytearray_add_byte(&segment, 0x10);
+
+    // SOI, then everything after the JFIF segment
+    bytearray_add_bytes(&segment, thumbnail->base, 2);
+    bytearray_add_bytes(&segment, thumbnail->base + 2 + thumbnail_jfif_len, thumbnail_len - 2);
+
+    ba->index += segment_len;
+
+    return 0;
+}
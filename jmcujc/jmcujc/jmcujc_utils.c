@@ -23,7 +23,7 @@ void bytearray_add_bytes_reverse(jmcujc_bytearray_t* arr, const uint8_t* bytes,
 
 void jmcujc_util_zigzag_data_inplace_u8(uint8_t* data)
 {
-    static uint8_t temp[64];
+    uint8_t temp[64];
     memcpy(temp, data, sizeof(temp));
 
     // zigzag starts on [1, 0] and moves in the downwards direction
@@ -66,7 +66,7 @@ void jmcujc_util_zigzag_data_inplace_u8(uint8_t* data)
 
 void jmcujc_util_zigzag_data_inplace_f32(float* data)
 {
-    static float temp[64];
+    float temp[64];
     memcpy(temp, data, sizeof(temp));
 
     // zigzag starts on [1, 0] and moves in the downwards direction
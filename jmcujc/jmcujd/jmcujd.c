@@ -0,0 +1,628 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jmcujd.h"
+
+#include "bit_dispenser.h"
+
+// natural_order[k] is the row-major index of the k-th coefficient in zig-zag order.
+static const uint8_t natural_order[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/**
+ * Holds the state of the decoder while it works its way through the file. The bit dispenser can't
+ * deal with byte stuffing or markers, so each entropy-coded segment gets copied into 'unstuffed'
+ * with the stuffed 0x00's taken out before the dispenser sees it.
+ */
+typedef struct jmcujd_decoder
+{
+    const uint8_t* data;
+    int len;
+    int idx;
+
+    uint8_t* unstuffed;
+    bit_dispenser_t bd;
+
+    jmcujd_idct_fn_t idct;
+} jmcujd_decoder_t;
+
+static int read_u16(jmcujd_decoder_t* d)
+{
+    int retval = (d->data[d->idx] << 8) | d->data[d->idx + 1];
+    d->idx += 2;
+    return retval;
+}
+
+// ======= huffman decoding =======
+static int huffman_table_init(jmcujd_huffman_table_t* t,
+                              const uint8_t* bits,
+                              const uint8_t* values,
+                              int nvalues)
+{
+    memset(t, 0, sizeof(jmcujd_huffman_table_t));
+    memcpy(t->values, values, nvalues);
+
+    int code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        t->valptr[l] = k;
+        t->mincode[l] = code;
+        for (int i = 0; i < bits[l - 1]; i++, k++, code++) {
+            if (l <= JMCUJD_LOOKAHEAD_BITS) {
+                // every lookahead value that starts with this code decodes to it.
+                const int shift = JMCUJD_LOOKAHEAD_BITS - l;
+                for (int j = 0; j < (1 << shift); j++) {
+                    t->lookup[(code << shift) | j] = (l << 8) | values[k];
+                }
+            }
+        }
+        t->maxcode[l] = bits[l - 1] ? (code - 1) : -1;
+
+        // codes can't be all 1's.
+        if (code > (1 << l)) {
+            return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+        }
+        code <<= 1;
+    }
+
+    t->valid = true;
+    return 0;
+}
+
+static inline int huffman_decode(bit_dispenser_t* bd, const jmcujd_huffman_table_t* t)
+{
+    const uint16_t peek = bit_dispenser_peek_u16(bd);
+    const uint16_t entry = t->lookup[peek >> (16 - JMCUJD_LOOKAHEAD_BITS)];
+    if (entry >> 8) {
+        bit_dispenser_advance(bd, entry >> 8);
+        return entry & 0xff;
+    }
+
+    // slow path for long codes.
+    for (int l = JMCUJD_LOOKAHEAD_BITS + 1; l <= 16; l++) {
+        const int code = peek >> (16 - l);
+        if (code <= t->maxcode[l]) {
+            bit_dispenser_advance(bd, l);
+            return t->values[t->valptr[l] + code - t->mincode[l]];
+        }
+    }
+
+    return JMCUJD_ERR_BAD_HUFFMAN_CODE;
+}
+
+/**
+ * Reads an s-bit coded value and turns it back into a coefficient; see figure F.12 of T.81.
+ */
+static inline int receive_extend(bit_dispenser_t* bd, int s)
+{
+    if (s == 0) {
+        return 0;
+    }
+
+    int v = bit_dispenser_dispense_bits(bd, s);
+    if (v < (1 << (s - 1))) {
+        v += 1 - (1 << s);
+    }
+    return v;
+}
+
+static inline int32_t clamp_i32(int32_t v, int32_t max)
+{
+    return (v < -max) ? -max : ((v > max) ? max : v);
+}
+
+// ======= marker segments =======
+static int parse_dqt(jmcujd_decoder_t* d, jmcujd_image_t* image, int end)
+{
+    while (d->idx < end) {
+        const int pq = d->data[d->idx] >> 4;
+        const int tq = d->data[d->idx] & 0x0f;
+        d->idx++;
+        if ((tq > 3) || (pq > 1) || ((d->idx + (64 << pq)) > end)) {
+            return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+        }
+
+        for (int k = 0; k < 64; k++) {
+            const int q = pq ? read_u16(d) : d->data[d->idx++];
+            image->quant_tables[tq][natural_order[k]] = q;
+        }
+        image->quant_table_valid[tq] = true;
+    }
+
+    return 0;
+}
+
+static int parse_dht(jmcujd_decoder_t* d, jmcujd_image_t* image, int end)
+{
+    while (d->idx < end) {
+        if ((d->idx + 17) > end) {
+            return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+        }
+        const int tc = d->data[d->idx] >> 4;
+        const int th = d->data[d->idx] & 0x0f;
+        const uint8_t* bits = &d->data[d->idx + 1];
+        d->idx += 17;
+
+        int nvalues = 0;
+        for (int i = 0; i < 16; i++) {
+            nvalues += bits[i];
+        }
+        if ((tc > 1) || (th > 3) || (nvalues > 256) || ((d->idx + nvalues) > end)) {
+            return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+        }
+
+        jmcujd_huffman_table_t* t = tc ? &image->ac_huffman_tables[th] :
+                                         &image->dc_huffman_tables[th];
+        int retval = huffman_table_init(t, bits, &d->data[d->idx], nvalues);
+        if (retval) {
+            return retval;
+        }
+        d->idx += nvalues;
+    }
+
+    return 0;
+}
+
+static int parse_sof(jmcujd_decoder_t* d, jmcujd_image_t* image, int end)
+{
+    if ((end - d->idx) < 6) {
+        return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+    }
+
+    const int precision = d->data[d->idx++];
+    image->height = read_u16(d);
+    image->width = read_u16(d);
+    image->ncomponents = d->data[d->idx++];
+
+    if (precision != 8) {
+        return JMCUJD_ERR_UNSUPPORTED;
+    }
+
+    // height of 0 means that it comes later in a DNL marker, which isn't supported.
+    if ((image->width == 0) || (image->height == 0) ||
+        (image->ncomponents < 1) || (image->ncomponents > 4) ||
+        ((d->idx + (3 * image->ncomponents)) > end)) {
+        return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+    }
+
+    image->max_horizontal_sampling_factor = 1;
+    image->max_vertical_sampling_factor = 1;
+    for (int i = 0; i < image->ncomponents; i++) {
+        jmcujd_component_t* c = &image->components[i];
+        c->id = d->data[d->idx];
+        c->horizontal_sampling_factor = d->data[d->idx + 1] >> 4;
+        c->vertical_sampling_factor = d->data[d->idx + 1] & 0x0f;
+        c->quant_table_selector = d->data[d->idx + 2];
+        d->idx += 3;
+
+        if ((c->horizontal_sampling_factor < 1) || (c->horizontal_sampling_factor > 4) ||
+            (c->vertical_sampling_factor < 1) || (c->vertical_sampling_factor > 4) ||
+            (c->quant_table_selector > 3)) {
+            return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+        }
+
+        if (c->horizontal_sampling_factor > image->max_horizontal_sampling_factor) {
+            image->max_horizontal_sampling_factor = c->horizontal_sampling_factor;
+        }
+        if (c->vertical_sampling_factor > image->max_vertical_sampling_factor) {
+            image->max_vertical_sampling_factor = c->vertical_sampling_factor;
+        }
+    }
+
+    const int hmax = image->max_horizontal_sampling_factor;
+    const int vmax = image->max_vertical_sampling_factor;
+    image->mcus_across = (image->width + (8 * hmax) - 1) / (8 * hmax);
+    image->mcus_down = (image->height + (8 * vmax) - 1) / (8 * vmax);
+
+    for (int i = 0; i < image->ncomponents; i++) {
+        jmcujd_component_t* c = &image->components[i];
+        c->width = ((image->width * c->horizontal_sampling_factor) + hmax - 1) / hmax;
+        c->height = ((image->height * c->vertical_sampling_factor) + vmax - 1) / vmax;
+        c->width_in_blocks = image->mcus_across * c->horizontal_sampling_factor;
+        c->height_in_blocks = image->mcus_down * c->vertical_sampling_factor;
+        c->stride = c->width_in_blocks * 8;
+        c->samples = calloc(c->stride * c->height_in_blocks * 8, 1);
+        if (c->samples == NULL) {
+            return JMCUJD_ERR_OUT_OF_MEMORY;
+        }
+    }
+
+    return 0;
+}
+
+// ======= entropy-coded data =======
+/**
+ * Copies entropy-coded data from the current position into the unstuffed buffer until a marker
+ * shows up, and points the bit dispenser at it. Afterwards, d->idx points at the marker.
+ */
+static void unstuff_segment(jmcujd_decoder_t* d)
+{
+    int n = 0;
+    while (d->idx < d->len) {
+        const uint8_t b = d->data[d->idx];
+        if (b != 0xff) {
+            d->unstuffed[n++] = b;
+            d->idx++;
+            continue;
+        }
+
+        // skip over any fill bytes
+        int next = d->idx + 1;
+        while ((next < d->len) && (d->data[next] == 0xff)) {
+            next++;
+        }
+
+        if ((next < d->len) && (d->data[next] == 0x00)) {
+            d->unstuffed[n++] = 0xff;
+            d->idx = next + 1;
+        } else {
+            d->idx = next - 1;
+            break;
+        }
+    }
+
+    // Zeros past the end keep the dispenser's 32-bit reads inside the buffer.
+    memset(&d->unstuffed[n], 0, 8);
+
+    d->bd.data = d->unstuffed;
+    d->bd.datalen = n;
+    d->bd.idx = 0;
+    d->bd.bitcount = 0;
+}
+
+static int decode_block(jmcujd_decoder_t* d,
+                        jmcujd_image_t* image,
+                        jmcujd_component_t* c,
+                        int block_x,
+                        int block_y)
+{
+    const jmcujd_huffman_table_t* dc_table = &image->dc_huffman_tables[c->dc_table_selector];
+    const jmcujd_huffman_table_t* ac_table = &image->ac_huffman_tables[c->ac_table_selector];
+    const uint16_t* q = image->quant_tables[c->quant_table_selector];
+    bit_dispenser_t* bd = &d->bd;
+
+    int32_t coefficients[64] = { 0 };
+
+    // ======= DC =======
+    int s = huffman_decode(bd, dc_table);
+    if ((s < 0) || (s > 11)) {
+        return JMCUJD_ERR_BAD_HUFFMAN_CODE;
+    }
+    c->dc_pred = clamp_i32(c->dc_pred + receive_extend(bd, s), 32767);
+    coefficients[0] = clamp_i32(c->dc_pred * q[0], 32767);
+
+    // ======= AC =======
+    for (int k = 1; k < 64; k++) {
+        const int rs = huffman_decode(bd, ac_table);
+        if (rs < 0) {
+            return JMCUJD_ERR_BAD_HUFFMAN_CODE;
+        }
+
+        const int r = rs >> 4;
+        s = rs & 0x0f;
+        if (s == 0) {
+            if (r != 15) {
+                // EOB
+                break;
+            }
+            // ZRL; 16 zeros
+            k += 15;
+            continue;
+        }
+
+        k += r;
+        if (k > 63) {
+            return JMCUJD_ERR_BAD_HUFFMAN_CODE;
+        }
+        const int zz = natural_order[k];
+        coefficients[zz] = clamp_i32(receive_extend(bd, s) * q[zz], 32767);
+    }
+
+    // if we've read past the end of the data, the file is broken.
+    if (bd->idx > bd->datalen) {
+        return JMCUJD_ERR_TRUNCATED;
+    }
+
+    if ((block_x < c->width_in_blocks) && (block_y < c->height_in_blocks)) {
+        d->idct(coefficients, &c->samples[(block_y * 8 * c->stride) + (block_x * 8)],
+                        c->stride);
+    }
+
+    return 0;
+}
+
+/**
+ * Handles the end of a restart interval: the next thing in the file needs to be the right RSTn
+ * marker, and then the DC predictions start over.
+ */
+static int process_restart(jmcujd_decoder_t* d,
+                           jmcujd_image_t* image,
+                           jmcujd_component_t** scan_components,
+                           int ns,
+                           int* expected_rst)
+{
+    if (((d->idx + 1) >= d->len) || (d->data[d->idx] != 0xff) ||
+        (d->data[d->idx + 1] != (0xd0 + *expected_rst))) {
+        return JMCUJD_ERR_BAD_RESTART;
+    }
+    d->idx += 2;
+    *expected_rst = (*expected_rst + 1) & 0x07;
+
+    for (int i = 0; i < ns; i++) {
+        scan_components[i]->dc_pred = 0;
+    }
+
+    unstuff_segment(d);
+    return 0;
+}
+
+static int decode_scan(jmcujd_decoder_t* d, jmcujd_image_t* image, int end)
+{
+    const int ns = d->data[d->idx++];
+    if ((ns < 1) || (ns > image->ncomponents) || ((d->idx + (2 * ns) + 3) > end)) {
+        return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+    }
+
+    jmcujd_component_t* scan_components[4];
+    for (int i = 0; i < ns; i++) {
+        const int id = d->data[d->idx];
+        const int td_ta = d->data[d->idx + 1];
+        d->idx += 2;
+
+        scan_components[i] = NULL;
+        for (int j = 0; j < image->ncomponents; j++) {
+            if (image->components[j].id == id) {
+                scan_components[i] = &image->components[j];
+            }
+        }
+        if (scan_components[i] == NULL) {
+            return JMCUJD_ERR_BAD_MARKER_SEGMENT;
+        }
+
+        jmcujd_component_t* c = scan_components[i];
+        c->dc_table_selector = td_ta >> 4;
+        c->ac_table_selector = td_ta & 0x0f;
+        c->dc_pred = 0;
+        if ((c->dc_table_selector > 3) || (c->ac_table_selector > 3) ||
+            !image->dc_huffman_tables[c->dc_table_selector].valid ||
+            !image->ac_huffman_tables[c->ac_table_selector].valid ||
+            !image->quant_table_valid[c->quant_table_selector]) {
+            return JMCUJD_ERR_MISSING_TABLE;
+        }
+    }
+
+    // Ss, Se, Ah / Al are fixed for baseline.
+    if ((d->data[d->idx] != 0) || (d->data[d->idx + 1] != 63) || (d->data[d->idx + 2] != 0)) {
+        return JMCUJD_ERR_UNSUPPORTED;
+    }
+    d->idx = end;
+
+    unstuff_segment(d);
+
+    int retval = 0;
+    int expected_rst = 0;
+    if (ns == 1) {
+        // Non-interleaved scans go through the blocks of the component in raster order, and only
+        // cover the blocks that have part of the image in them.
+        jmcujd_component_t* c = scan_components[0];
+        const int blocks_across = (c->width + 7) / 8;
+        const int blocks_down = (c->height + 7) / 8;
+        for (int i = 0; i < (blocks_across * blocks_down); i++) {
+            if (image->restart_interval && i && ((i % image->restart_interval) == 0)) {
+                if ((retval = process_restart(d, image, scan_components, ns, &expected_rst))) {
+                    return retval;
+                }
+            }
+            if ((retval = decode_block(d, image, c, i % blocks_across, i / blocks_across))) {
+                return retval;
+            }
+        }
+    } else {
+        const int nmcus = image->mcus_across * image->mcus_down;
+        for (int mcu = 0; mcu < nmcus; mcu++) {
+            if (image->restart_interval && mcu && ((mcu % image->restart_interval) == 0)) {
+                if ((retval = process_restart(d, image, scan_components, ns, &expected_rst))) {
+                    return retval;
+                }
+            }
+
+            const int mcu_x = mcu % image->mcus_across;
+            const int mcu_y = mcu / image->mcus_across;
+            for (int i = 0; i < ns; i++) {
+                jmcujd_component_t* c = scan_components[i];
+                for (int v = 0; v < c->vertical_sampling_factor; v++) {
+                    for (int h = 0; h < c->horizontal_sampling_factor; h++) {
+                        const int block_x = (mcu_x * c->horizontal_sampling_factor) + h;
+                        const int block_y = (mcu_y * c->vertical_sampling_factor) + v;
+                        if ((retval = decode_block(d, image, c, block_x, block_y))) {
+                            return retval;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int jmcujd_decode(const uint8_t* data, int len, jmcujd_image_t* image)
+{
+    memset(image, 0, sizeof(jmcujd_image_t));
+
+    jmcujd_decoder_t d = { .data = data, .len = len, .idx = 0, .idct = jmcujd_idct_best() };
+    int retval = 0;
+    bool have_frame = false;
+    bool have_scan = false;
+
+    if ((len < 4) || (data[0] != 0xff) || (data[1] != 0xd8)) {
+        return JMCUJD_ERR_NOT_JPEG;
+    }
+    d.idx = 2;
+
+    d.unstuffed = malloc(len + 8);
+    if (d.unstuffed == NULL) {
+        return JMCUJD_ERR_OUT_OF_MEMORY;
+    }
+
+    while (1) {
+        // find the next marker, skipping fill bytes.
+        if (((d.idx + 1) >= len) || (data[d.idx] != 0xff)) {
+            retval = JMCUJD_ERR_TRUNCATED;
+            goto _end;
+        }
+        while (((d.idx + 1) < len) && (data[d.idx + 1] == 0xff)) {
+            d.idx++;
+        }
+        if ((d.idx + 1) >= len) {
+            retval = JMCUJD_ERR_TRUNCATED;
+            goto _end;
+        }
+
+        const uint8_t marker = data[d.idx + 1];
+        d.idx += 2;
+
+        if (marker == 0xd9) {
+            // EOI
+            retval = have_scan ? 0 : JMCUJD_ERR_TRUNCATED;
+            goto _end;
+        }
+
+        // everything else that we expect has a length.
+        if ((d.idx + 2) > len) {
+            retval = JMCUJD_ERR_TRUNCATED;
+            goto _end;
+        }
+        const int segment_len = read_u16(&d);
+        const int end = d.idx + segment_len - 2;
+        if ((segment_len < 2) || (end > len)) {
+            retval = JMCUJD_ERR_TRUNCATED;
+            goto _end;
+        }
+
+        switch (marker) {
+            case 0xc0:
+            case 0xc1: {
+                if (have_frame) {
+                    retval = JMCUJD_ERR_UNSUPPORTED;
+                    goto _end;
+                }
+                retval = parse_sof(&d, image, end);
+                have_frame = true;
+                break;
+            }
+
+            case 0xc4: retval = parse_dht(&d, image, end); break;
+            case 0xdb: retval = parse_dqt(&d, image, end); break;
+
+            case 0xdd: {
+                if (segment_len != 4) {
+                    retval = JMCUJD_ERR_BAD_MARKER_SEGMENT;
+                    goto _end;
+                }
+                image->restart_interval = read_u16(&d);
+                break;
+            }
+
+            case 0xda: {
+                if (!have_frame) {
+                    retval = JMCUJD_ERR_BAD_MARKER_SEGMENT;
+                    goto _end;
+                }
+                retval = decode_scan(&d, image, end);
+                have_scan = true;
+
+                // decode_scan leaves d.idx at the marker after the scan.
+                if (retval) {
+                    goto _end;
+                }
+                continue;
+            }
+
+            default: {
+                // Other SOFn's aren't baseline. Anything else (APPn, COM, ...) gets skipped.
+                if (((marker >= 0xc2) && (marker <= 0xcf) && (marker != 0xc4) && (marker != 0xc8) &&
+                     (marker != 0xcc)) || (marker == 0xdc)) {
+                    retval = JMCUJD_ERR_UNSUPPORTED;
+                }
+                break;
+            }
+        }
+
+        if (retval) {
+            goto _end;
+        }
+        d.idx = end;
+    }
+
+_end:
+    free(d.unstuffed);
+    if (retval) {
+        jmcujd_image_free(image);
+    }
+    return retval;
+}
+
+void jmcujd_image_free(jmcujd_image_t* image)
+{
+    for (int i = 0; i < 4; i++) {
+        free(image->components[i].samples);
+        image->components[i].samples = NULL;
+    }
+}
+
+static inline uint8_t clamp_u8(int32_t v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+int jmcujd_image_to_pixels(const jmcujd_image_t* image, uint8_t* out)
+{
+    if (image->ncomponents == 1) {
+        const jmcujd_component_t* c = &image->components[0];
+        for (int y = 0; y < image->height; y++) {
+            memcpy(&out[y * image->width], &c->samples[y * c->stride], image->width);
+        }
+        return 1;
+    }
+
+    if (image->ncomponents != 3) {
+        return JMCUJD_ERR_UNSUPPORTED;
+    }
+
+    const int hmax = image->max_horizontal_sampling_factor;
+    const int vmax = image->max_vertical_sampling_factor;
+    const jmcujd_component_t* cs = image->components;
+    for (int y = 0; y < image->height; y++) {
+        for (int x = 0; x < image->width; x++) {
+            int yy[3];
+            for (int i = 0; i < 3; i++) {
+                const int cx = (x * cs[i].horizontal_sampling_factor) / hmax;
+                const int cy = (y * cs[i].vertical_sampling_factor) / vmax;
+                yy[i] = cs[i].samples[(cy * cs[i].stride) + cx];
+            }
+
+            // JFIF YCbCr -> RGB, 16 bit fixed point.
+            const int32_t lum = yy[0] << 16;
+            const int32_t cb = yy[1] - 128;
+            const int32_t cr = yy[2] - 128;
+            uint8_t* px = &out[((y * image->width) + x) * 3];
+            px[0] = clamp_u8((lum + (91881 * cr) + (1 << 15)) >> 16);
+            px[1] = clamp_u8((lum - (22554 * cb) - (46802 * cr) + (1 << 15)) >> 16);
+            px[2] = clamp_u8((lum + (116130 * cb) + (1 << 15)) >> 16);
+        }
+    }
+
+    return 3;
+}
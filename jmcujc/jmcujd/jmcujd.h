@@ -0,0 +1,114 @@
+#ifndef _JMCUJD_H
+#define _JMCUJD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jmcujd_idct.h"
+
+/**
+ * JMCUJD - the decoding half of jmcujc.
+ *
+ * This is a baseline (SOF0 / SOF1, 8-bit, huffman-coded, sequential) jpeg decoder. It's meant for
+ * verification and round-trip tooling on a host machine rather than for a microcontroller, so
+ * unlike jmcujc it allocates its own memory.
+ *
+ * It handles any number of components (up to 4) with any sampling factors, interleaved or not, and
+ * restart intervals. Progressive, arithmetic-coded, 12-bit, lossless and hierarchical files are
+ * rejected.
+ */
+
+// how many bits the huffman decoder looks at in one go. Codes that are this long or shorter get
+// decoded with a single table lookup.
+#define JMCUJD_LOOKAHEAD_BITS (9)
+
+// error codes; all functions that return int return 0 on success and one of these on failure.
+#define JMCUJD_ERR_NOT_JPEG            (-1)
+#define JMCUJD_ERR_TRUNCATED           (-2)
+#define JMCUJD_ERR_UNSUPPORTED         (-3)
+#define JMCUJD_ERR_BAD_MARKER_SEGMENT  (-4)
+#define JMCUJD_ERR_BAD_HUFFMAN_CODE    (-5)
+#define JMCUJD_ERR_MISSING_TABLE       (-6)
+#define JMCUJD_ERR_BAD_RESTART         (-7)
+#define JMCUJD_ERR_OUT_OF_MEMORY       (-8)
+
+typedef struct jmcujd_huffman_table
+{
+    bool valid;
+
+    // lookup[next 9 bits] = (code length << 8) | symbol. A code length of 0 means that the code is
+    // longer than JMCUJD_LOOKAHEAD_BITS and the slow path needs to be used.
+    uint16_t lookup[1 << JMCUJD_LOOKAHEAD_BITS];
+
+    // canonical decoding tables for the slow path; see figure F.16 of T.81.
+    int32_t mincode[17];
+    int32_t maxcode[17];
+    int valptr[17];
+    uint8_t values[256];
+} jmcujd_huffman_table_t;
+
+typedef struct jmcujd_component
+{
+    int id;
+    int horizontal_sampling_factor;
+    int vertical_sampling_factor;
+    int quant_table_selector;
+
+    // size of this component in samples, not counting padding.
+    int width;
+    int height;
+
+    // Decoded samples, row-major. The plane is padded out to a whole number of MCUs, so stride is
+    // always a multiple of 8 and can be bigger than width.
+    uint8_t* samples;
+    int stride;
+    int width_in_blocks;
+    int height_in_blocks;
+
+    // scan state
+    int dc_table_selector;
+    int ac_table_selector;
+    int dc_pred;
+} jmcujd_component_t;
+
+typedef struct jmcujd_image
+{
+    int width;
+    int height;
+
+    int ncomponents;
+    jmcujd_component_t components[4];
+
+    int max_horizontal_sampling_factor;
+    int max_vertical_sampling_factor;
+    int mcus_across;
+    int mcus_down;
+
+    // quant tables are stored in natural (row-major) order.
+    bool quant_table_valid[4];
+    uint16_t quant_tables[4][64];
+    jmcujd_huffman_table_t dc_huffman_tables[4];
+    jmcujd_huffman_table_t ac_huffman_tables[4];
+
+    // in MCUs; 0 if there's no restart interval.
+    int restart_interval;
+} jmcujd_image_t;
+
+/**
+ * Decodes a complete jpeg file that's in memory. On success, image->components[i].samples hold
+ * the decoded planes; free them with jmcujd_image_free. On failure, nothing needs to be freed.
+ */
+int jmcujd_decode(const uint8_t* data, int len, jmcujd_image_t* image);
+
+void jmcujd_image_free(jmcujd_image_t* image);
+
+/**
+ * Converts decoded planes to packed pixels. Single-component images come out as 8-bit gray (1 byte
+ * per pixel); 3-component images are treated as JFIF YCbCr, upsampled by replication, and come out
+ * as RGB (3 bytes per pixel). out needs room for width * height * bytes per pixel.
+ *
+ * @return  bytes per pixel on success, < 0 on failure.
+ */
+int jmcujd_image_to_pixels(const jmcujd_image_t* image, uint8_t* out);
+
+#endif
@@ -0,0 +1,361 @@
+#include <stdint.h>
+
+#include "jmcujd_idct.h"
+
+#if JMCUJD_IDCT_X86
+#include <immintrin.h>
+#endif
+
+// This is the Loeffler flowgraph from loeffler_fdct_8x8_inplace run backwards, with 13-bit
+// fractional constants. Intermediate results between the two passes keep 2 extra bits.
+#define IDCT_CONST_BITS (13)
+#define IDCT_PASS1_BITS (2)
+
+// the extra 3 bits in pass 2 are the 1/8 from the two 1/sqrt(8) normalizations.
+#define IDCT_PASS1_SHIFT (IDCT_CONST_BITS - IDCT_PASS1_BITS)
+#define IDCT_PASS2_SHIFT (IDCT_CONST_BITS + IDCT_PASS1_BITS + 3)
+
+#define FIX_0_298631336  ((int32_t)  2446)
+#define FIX_0_390180644  ((int32_t)  3196)
+#define FIX_0_541196100  ((int32_t)  4433)
+#define FIX_0_765366865  ((int32_t)  6270)
+#define FIX_0_899976223  ((int32_t)  7373)
+#define FIX_1_175875602  ((int32_t)  9633)
+#define FIX_1_501321110  ((int32_t) 12299)
+#define FIX_1_847759065  ((int32_t) 15137)
+#define FIX_1_961570560  ((int32_t) 16069)
+#define FIX_2_053119869  ((int32_t) 16819)
+#define FIX_2_562915447  ((int32_t) 20995)
+#define FIX_3_072711026  ((int32_t) 25172)
+
+#define DESCALE(x, n) (((x) + (((int32_t)1) << ((n) - 1))) >> (n))
+
+/**
+ * Worst case, a 1-D pass has a gain of about 61200 on its inputs, so 16-bit inputs are as big as
+ * they can be without overflowing 32 bits. The workspace between passes gets clamped to 16 bits
+ * too so that corrupt files can't overflow the second pass. Real images never get near it.
+ *
+ * Conveniently, this is also exactly what the SIMD versions' saturating packs do.
+ */
+static inline int32_t clamp_i16(int32_t v)
+{
+    return (v < INT16_MIN) ? INT16_MIN : ((v > INT16_MAX) ? INT16_MAX : v);
+}
+
+/**
+ * One 1-D IDCT over 8 values that are 'stride' apart. Results are descaled by 'shift' bits.
+ */
+static inline void idct_1d(const int32_t* in, int32_t* out, int stride, int shift)
+{
+    // even part
+    int32_t z2 = in[2 * stride];
+    int32_t z3 = in[6 * stride];
+    int32_t z1 = (z2 + z3) * FIX_0_541196100;
+    int32_t tmp2 = z1 + (z3 * -FIX_1_847759065);
+    int32_t tmp3 = z1 + (z2 * FIX_0_765366865);
+
+    z2 = in[0 * stride];
+    z3 = in[4 * stride];
+    int32_t tmp0 = (z2 + z3) * (1 << IDCT_CONST_BITS);
+    int32_t tmp1 = (z2 - z3) * (1 << IDCT_CONST_BITS);
+
+    const int32_t tmp10 = tmp0 + tmp3;
+    const int32_t tmp13 = tmp0 - tmp3;
+    const int32_t tmp11 = tmp1 + tmp2;
+    const int32_t tmp12 = tmp1 - tmp2;
+
+    // odd part
+    tmp0 = in[7 * stride];
+    tmp1 = in[5 * stride];
+    tmp2 = in[3 * stride];
+    tmp3 = in[1 * stride];
+
+    z1 = tmp0 + tmp3;
+    z2 = tmp1 + tmp2;
+    z3 = tmp0 + tmp2;
+    int32_t z4 = tmp1 + tmp3;
+    const int32_t z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp0 *= FIX_0_298631336;
+    tmp1 *= FIX_2_053119869;
+    tmp2 *= FIX_3_072711026;
+    tmp3 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 *= -FIX_1_961570560;
+    z4 *= -FIX_0_390180644;
+
+    z3 += z5;
+    z4 += z5;
+
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    out[0 * stride] = DESCALE(tmp10 + tmp3, shift);
+    out[7 * stride] = DESCALE(tmp10 - tmp3, shift);
+    out[1 * stride] = DESCALE(tmp11 + tmp2, shift);
+    out[6 * stride] = DESCALE(tmp11 - tmp2, shift);
+    out[2 * stride] = DESCALE(tmp12 + tmp1, shift);
+    out[5 * stride] = DESCALE(tmp12 - tmp1, shift);
+    out[3 * stride] = DESCALE(tmp13 + tmp0, shift);
+    out[4 * stride] = DESCALE(tmp13 - tmp0, shift);
+}
+
+void jmcujd_idct_8x8_c(const int32_t* coefficients, uint8_t* out, int stride)
+{
+    int32_t workspace[64];
+
+    // columns
+    for (int i = 0; i < 8; i++) {
+        idct_1d(&coefficients[i], &workspace[i], 8, IDCT_PASS1_SHIFT);
+    }
+    for (int i = 0; i < 64; i++) {
+        workspace[i] = clamp_i16(workspace[i]);
+    }
+
+    // rows
+    for (int i = 0; i < 8; i++) {
+        int32_t row[8];
+        idct_1d(&workspace[i * 8], row, 1, IDCT_PASS2_SHIFT);
+        for (int j = 0; j < 8; j++) {
+            const int32_t v = row[j] + 128;
+            out[(i * stride) + j] = (v < 0) ? 0 : ((v > 255) ? 255 : v);
+        }
+    }
+}
+
+#if JMCUJD_IDCT_X86
+/**
+ * The SIMD versions can't do 32-bit multiplies cheaply (SSE2 doesn't have one at all), so they use
+ * pmaddwd instead, which does a*x + b*y on pairs of 16-bit values into a 32-bit result. Every
+ * multiply in idct_1d is a constant times a sum of inputs, so multiplying everything out gives each
+ * output of the even and odd parts as a sum of (input * constant) pairs. Integer math is exact, so
+ * this gives the same results as idct_1d bit-for-bit.
+ *
+ * In the constant names below, MADD_<output>_<inputs> holds the two constants for one pmaddwd.
+ */
+#define PAIR(a, b) ((int32_t)(((uint32_t)(uint16_t)(b) << 16) | (uint16_t)(a)))
+
+// even part: in2 / in6 and in0 / in4
+#define MADD_TMP2_26  PAIR(FIX_0_541196100, FIX_0_541196100 - FIX_1_847759065)
+#define MADD_TMP3_26  PAIR(FIX_0_541196100 + FIX_0_765366865, FIX_0_541196100)
+#define MADD_TMP0_04  PAIR(1 << IDCT_CONST_BITS, 1 << IDCT_CONST_BITS)
+#define MADD_TMP1_04  PAIR(1 << IDCT_CONST_BITS, -(1 << IDCT_CONST_BITS))
+
+// odd part: in7 / in5 and in3 / in1
+#define MADD_TMP0_75  PAIR(FIX_0_298631336 - FIX_0_899976223 - FIX_1_961570560 + FIX_1_175875602, \
+                           FIX_1_175875602)
+#define MADD_TMP0_31  PAIR(FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602 - FIX_0_899976223)
+#define MADD_TMP1_75  PAIR(FIX_1_175875602, \
+                           FIX_2_053119869 - FIX_2_562915447 - FIX_0_390180644 + FIX_1_175875602)
+#define MADD_TMP1_31  PAIR(FIX_1_175875602 - FIX_2_562915447, FIX_1_175875602 - FIX_0_390180644)
+#define MADD_TMP2_75  PAIR(FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602 - FIX_2_562915447)
+#define MADD_TMP2_31  PAIR(FIX_3_072711026 - FIX_2_562915447 - FIX_1_961570560 + FIX_1_175875602, \
+                           FIX_1_175875602)
+#define MADD_TMP3_75  PAIR(FIX_1_175875602 - FIX_0_899976223, FIX_1_175875602 - FIX_0_390180644)
+#define MADD_TMP3_31  PAIR(FIX_1_175875602, \
+                           FIX_1_501321110 - FIX_0_899976223 - FIX_0_390180644 + FIX_1_175875602)
+
+/**
+ * Transposes an 8x8 block of 16-bit values that's held as 8 rows.
+ */
+__attribute__((target("sse2")))
+static inline void transpose_8x8_i16(__m128i* r)
+{
+    const __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    const __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    const __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    const __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    const __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    const __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    const __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    const __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+    const __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    const __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    const __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    const __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    const __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    const __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    const __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    const __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/**
+ * Loads the coefficients as 8 rows of 16-bit values.
+ */
+__attribute__((target("sse2")))
+static inline void load_rows_i16(const int32_t* coefficients, __m128i* r)
+{
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)&coefficients[i * 8]),
+                               _mm_loadu_si128((const __m128i*)&coefficients[(i * 8) + 4]));
+    }
+}
+
+/**
+ * Stores 8 rows of 16-bit samples (already level-shifted) as clamped 8-bit samples.
+ */
+__attribute__((target("sse2")))
+static inline void store_rows_u8(const __m128i* r, uint8_t* out, int stride)
+{
+    for (int i = 0; i < 8; i += 2) {
+        const __m128i packed = _mm_packus_epi16(r[i], r[i + 1]);
+        _mm_storel_epi64((__m128i*)&out[i * stride], packed);
+        _mm_storel_epi64((__m128i*)&out[(i + 1) * stride], _mm_srli_si128(packed, 8));
+    }
+}
+
+/**
+ * 1-D IDCT on as many columns as fit in 'vec'. p26, p04, p75 and p31 hold the inputs interleaved
+ * in pairs: (in2, in6), (in0, in4), (in7, in5) and (in3, in1). The outputs are descaled by 'shift'
+ * after 'bias' is added, and come out as 32-bit values. This is a macro so that the SSE2 and AVX2
+ * versions can share it.
+ */
+#define IDCT_1D_MADD(madd, add, sub, srai, set1, vec, p26, p04, p75, p31, bias, shift, out)   \
+    do {                                                                                     \
+        const vec tmp2 = madd(p26, set1(MADD_TMP2_26));                                      \
+        const vec tmp3 = madd(p26, set1(MADD_TMP3_26));                                      \
+        const vec tmp0 = add(madd(p04, set1(MADD_TMP0_04)), bias);                           \
+        const vec tmp1 = add(madd(p04, set1(MADD_TMP1_04)), bias);                           \
+        const vec tmp10 = add(tmp0, tmp3);                                                   \
+        const vec tmp13 = sub(tmp0, tmp3);                                                   \
+        const vec tmp11 = add(tmp1, tmp2);                                                   \
+        const vec tmp12 = sub(tmp1, tmp2);                                                   \
+                                                                                             \
+        const vec o0 = add(madd(p75, set1(MADD_TMP0_75)), madd(p31, set1(MADD_TMP0_31)));    \
+        const vec o1 = add(madd(p75, set1(MADD_TMP1_75)), madd(p31, set1(MADD_TMP1_31)));    \
+        const vec o2 = add(madd(p75, set1(MADD_TMP2_75)), madd(p31, set1(MADD_TMP2_31)));    \
+        const vec o3 = add(madd(p75, set1(MADD_TMP3_75)), madd(p31, set1(MADD_TMP3_31)));    \
+                                                                                             \
+        out[0] = srai(add(tmp10, o3), shift);                                                \
+        out[7] = srai(sub(tmp10, o3), shift);                                                \
+        out[1] = srai(add(tmp11, o2), shift);                                                \
+        out[6] = srai(sub(tmp11, o2), shift);                                                \
+        out[2] = srai(add(tmp12, o1), shift);                                                \
+        out[5] = srai(sub(tmp12, o1), shift);                                                \
+        out[3] = srai(add(tmp13, o0), shift);                                                \
+        out[4] = srai(sub(tmp13, o0), shift);                                                \
+    } while (0)
+
+/**
+ * 1-D IDCT down the columns of 8 rows of 16-bit values. Results are descaled and saturated back to
+ * 16 bits.
+ */
+__attribute__((target("sse2")))
+static inline void idct_1d_sse2(__m128i* r, const __m128i bias, const int shift)
+{
+    __m128i lo[8], hi[8];
+
+    const __m128i p26_lo = _mm_unpacklo_epi16(r[2], r[6]);
+    const __m128i p26_hi = _mm_unpackhi_epi16(r[2], r[6]);
+    const __m128i p04_lo = _mm_unpacklo_epi16(r[0], r[4]);
+    const __m128i p04_hi = _mm_unpackhi_epi16(r[0], r[4]);
+    const __m128i p75_lo = _mm_unpacklo_epi16(r[7], r[5]);
+    const __m128i p75_hi = _mm_unpackhi_epi16(r[7], r[5]);
+    const __m128i p31_lo = _mm_unpacklo_epi16(r[3], r[1]);
+    const __m128i p31_hi = _mm_unpackhi_epi16(r[3], r[1]);
+
+    IDCT_1D_MADD(_mm_madd_epi16, _mm_add_epi32, _mm_sub_epi32, _mm_srai_epi32, _mm_set1_epi32,
+                 __m128i, p26_lo, p04_lo, p75_lo, p31_lo, bias, shift, lo);
+    IDCT_1D_MADD(_mm_madd_epi16, _mm_add_epi32, _mm_sub_epi32, _mm_srai_epi32, _mm_set1_epi32,
+                 __m128i, p26_hi, p04_hi, p75_hi, p31_hi, bias, shift, hi);
+
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_packs_epi32(lo[i], hi[i]);
+    }
+}
+
+__attribute__((target("sse2")))
+void jmcujd_idct_8x8_sse2(const int32_t* coefficients, uint8_t* out, int stride)
+{
+    __m128i r[8];
+    load_rows_i16(coefficients, r);
+
+    // columns, then rows. The level shift gets folded into the rounding bias for pass 2.
+    idct_1d_sse2(r, _mm_set1_epi32(1 << (IDCT_PASS1_SHIFT - 1)), IDCT_PASS1_SHIFT);
+    transpose_8x8_i16(r);
+    idct_1d_sse2(r, _mm_set1_epi32((1 << (IDCT_PASS2_SHIFT - 1)) + (128 << IDCT_PASS2_SHIFT)),
+                 IDCT_PASS2_SHIFT);
+    transpose_8x8_i16(r);
+
+    store_rows_u8(r, out, stride);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i interleave_i16(__m128i a, __m128i b)
+{
+    return _mm256_set_m128i(_mm_unpackhi_epi16(a, b), _mm_unpacklo_epi16(a, b));
+}
+
+/**
+ * Same as idct_1d_sse2, but with 256-bit registers every pmaddwd covers all 8 columns, so there
+ * are half as many of them.
+ */
+__attribute__((target("avx2")))
+static inline void idct_1d_avx2(__m128i* r, const __m256i bias, const int shift)
+{
+    __m256i o[8];
+
+    const __m256i p26 = interleave_i16(r[2], r[6]);
+    const __m256i p04 = interleave_i16(r[0], r[4]);
+    const __m256i p75 = interleave_i16(r[7], r[5]);
+    const __m256i p31 = interleave_i16(r[3], r[1]);
+
+    IDCT_1D_MADD(_mm256_madd_epi16, _mm256_add_epi32, _mm256_sub_epi32, _mm256_srai_epi32,
+                 _mm256_set1_epi32, __m256i, p26, p04, p75, p31, bias, shift, o);
+
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm_packs_epi32(_mm256_castsi256_si128(o[i]), _mm256_extracti128_si256(o[i], 1));
+    }
+}
+
+__attribute__((target("avx2")))
+void jmcujd_idct_8x8_avx2(const int32_t* coefficients, uint8_t* out, int stride)
+{
+    __m128i r[8];
+    load_rows_i16(coefficients, r);
+
+    idct_1d_avx2(r, _mm256_set1_epi32(1 << (IDCT_PASS1_SHIFT - 1)), IDCT_PASS1_SHIFT);
+    transpose_8x8_i16(r);
+    idct_1d_avx2(r, _mm256_set1_epi32((1 << (IDCT_PASS2_SHIFT - 1)) + (128 << IDCT_PASS2_SHIFT)),
+                 IDCT_PASS2_SHIFT);
+    transpose_8x8_i16(r);
+
+    store_rows_u8(r, out, stride);
+}
+#endif
+
+jmcujd_idct_fn_t jmcujd_idct_best(void)
+{
+#if JMCUJD_IDCT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return jmcujd_idct_8x8_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return jmcujd_idct_8x8_sse2;
+    }
+#endif
+    return jmcujd_idct_8x8_c;
+}
+
+void jmcujd_idct_8x8(const int32_t* coefficients, uint8_t* out, int stride)
+{
+    static jmcujd_idct_fn_t best = NULL;
+    if (best == NULL) {
+        best = jmcujd_idct_best();
+    }
+    best(coefficients, out, stride);
+}
@@ -0,0 +1,39 @@
+#ifndef _JMCUJD_IDCT_H
+#define _JMCUJD_IDCT_H
+
+#include <stdint.h>
+
+/**
+ * Fixed-point inverse DCTs. They all take 64 dequantized coefficients in natural order and write
+ * level-shifted, clamped 8-bit samples into an 8x8 region of a plane with the given stride.
+ *
+ * Coefficients need to fit in 16 bits. Every variant gives exactly the same output as
+ * jmcujd_idct_8x8_c; the SIMD ones are just the same arithmetic done 8 columns at a time.
+ */
+typedef void (*jmcujd_idct_fn_t)(const int32_t* coefficients, uint8_t* out, int stride);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JMCUJD_IDCT_X86 (1)
+#else
+#define JMCUJD_IDCT_X86 (0)
+#endif
+
+void jmcujd_idct_8x8_c(const int32_t* coefficients, uint8_t* out, int stride);
+
+#if JMCUJD_IDCT_X86
+// These can only be called if the CPU supports them; jmcujd_idct_best checks that.
+void jmcujd_idct_8x8_sse2(const int32_t* coefficients, uint8_t* out, int stride);
+void jmcujd_idct_8x8_avx2(const int32_t* coefficients, uint8_t* out, int stride);
+#endif
+
+/**
+ * Returns the fastest IDCT that this CPU can run.
+ */
+jmcujd_idct_fn_t jmcujd_idct_best(void);
+
+/**
+ * Same as calling whatever jmcujd_idct_best returns.
+ */
+void jmcujd_idct_8x8(const int32_t* coefficients, uint8_t* out, int stride);
+
+#endif
@@ -8,7 +8,6 @@ bit_packer_t* bit_packer_create()
 
     bp->capacity = 2048;
     bp->data = calloc(1, bp->capacity);
-    bp->bitcount = 7;
 
     return bp;
 }
@@ -19,79 +18,85 @@ void bit_packer_destroy(bit_packer_t* bp)
     free(bp);
 }
 
-void bit_packer_fill_endbits(bit_packer_t* bp)
+void bit_packer_reset(bit_packer_t* bp)
 {
-    while (bp->bitcount != 7) {
-        bit_packer_pack_u8(0x01, 1, bp);
-    }
+    bp->accum = 0;
+    bp->bitcount = 0;
+    bp->curidx = 0;
 }
 
-static void bit_packer_pack_u1(uint8_t src, bit_packer_t* bp)
+void bit_packer_reserve(bit_packer_t* bp, int nbytes)
 {
-    // src should be either 0 or 1.
-    bp->currval |= (src << bp->bitcount);
-    bp->bitcount -= 1;
-    if (bp->bitcount == -1) {
-        bp->data[bp->curidx] = bp->currval;
-
-        bp->currval = 0;
-        bp->bitcount = 7;
-
-        bp->curidx += 1;
-        if (bp->curidx == bp->capacity) {
+    if ((bp->curidx + nbytes) > bp->capacity) {
+        while ((bp->curidx + nbytes) > bp->capacity) {
             bp->capacity *= 2;
-            bp->data = realloc(bp->data, bp->capacity);
         }
+        bp->data = realloc(bp->data, bp->capacity);
     }
 }
 
-void bit_packer_pack_u8(uint8_t src, int n, bit_packer_t* packer)
+static void bit_packer_put_byte(bit_packer_t* bp, uint8_t byte)
 {
-    // start by left-aligning the data.
-    src <<= (8 - n);
-
-    // pack
-    for (int i = 0; i < n; i++) {
-        if (src & 0x80) {
-            bit_packer_pack_u1(0x01, packer);
-        } else {
-            bit_packer_pack_u1(0x00, packer);
-        }
-
-        src <<= 1;
+    bp->data[bp->curidx++] = byte;
+    if (byte == 0xff) {
+        bp->data[bp->curidx++] = 0x00;
     }
 }
 
-void bit_packer_pack_u16(uint16_t src, int n, bit_packer_t* packer)
+/**
+ * Writes 4 bytes, most significant first. At worst every one of them needs stuffing.
+ */
+static void bit_packer_put_word(bit_packer_t* bp, uint32_t word)
 {
-    // start by left-aligning the data.
-    src <<= (16 - n);
-
-    // pack
-    for (int i = 0; i < n; i++) {
-        if (src & 0x8000) {
-            bit_packer_pack_u1(0x01, packer);
-        } else {
-            bit_packer_pack_u1(0x00, packer);
+    bit_packer_reserve(bp, 8);
+
+    // a byte of word is 0xff exactly when the same byte of ~word is zero, and there's a well-known
+    // trick for finding zero bytes in a word. Most words don't have any 0xff bytes in them.
+    const uint32_t inv = ~word;
+    if (((inv - 0x01010101u) & ~inv & 0x80808080u) == 0) {
+        bp->data[bp->curidx + 0] = (word >> 24) & 0xff;
+        bp->data[bp->curidx + 1] = (word >> 16) & 0xff;
+        bp->data[bp->curidx + 2] = (word >>  8) & 0xff;
+        bp->data[bp->curidx + 3] = (word >>  0) & 0xff;
+        bp->curidx += 4;
+    } else {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            bit_packer_put_byte(bp, (word >> shift) & 0xff);
         }
+    }
+}
 
-        src <<= 1;
+void bit_packer_fill_endbits(bit_packer_t* bp)
+{
+    const int pad = (8 - (bp->bitcount % 8)) % 8;
+    bp->accum = (bp->accum << pad) | ((1u << pad) - 1);
+    bp->bitcount += pad;
+
+    bit_packer_reserve(bp, 8);
+    while (bp->bitcount > 0) {
+        bp->bitcount -= 8;
+        bit_packer_put_byte(bp, (bp->accum >> bp->bitcount) & 0xff);
     }
 }
 
 void bit_packer_pack_u32(uint32_t src, int n, bit_packer_t* packer)
 {
-    // start by left-aligning the data.
-    src <<= (32 - n);
-
-    // pack
-    for (int i = 0; i < n; i++) {
-        if (src & 0x80000000) {
-            bit_packer_pack_u1(0x01, packer);
-        } else {
-            bit_packer_pack_u1(0x00, packer);
-        }
+    // bitcount < 32 on the way in and n <= 32, so everything still fits in the accumulator.
+    packer->accum = (packer->accum << n) | (src & ((((uint64_t)1) << n) - 1));
+    packer->bitcount += n;
 
-        src <<= 1;
+    if (packer->bitcount >= 32) {
+        packer->bitcount -= 32;
+        bit_packer_put_word(packer, (uint32_t)(packer->accum >> packer->bitcount));
     }
 }
+
+void bit_packer_pack_u8(uint8_t src, int n, bit_packer_t* packer)
+{
+    bit_packer_pack_u32(src, n, packer);
+}
+
+void bit_packer_pack_u16(uint16_t src, int n, bit_packer_t* packer)
+{
+    bit_packer_pack_u32(src, n, packer);
+}
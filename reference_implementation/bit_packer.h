@@ -3,6 +3,12 @@
 
 #include <stdint.h>
 
+/**
+ * Bits are collected in a 64-bit accumulator and written out 32 at a time. Output is already
+ * byte-stuffed for a JPEG entropy-coded segment: every 0xff that gets written is followed by a
+ * 0x00, so bp->data can be copied straight into a scan.
+ */
+
 // exposed to make it easier for users to get at the data and length.
 typedef struct bit_packer bit_packer_t;
 struct bit_packer
@@ -10,17 +16,33 @@ struct bit_packer
     int capacity;
     uint8_t* data;
 
-    uint8_t currval;
+    // pending bits that haven't been written to data yet, right-aligned. Only the low 'bitcount'
+    // bits mean anything; bitcount is always less than 32 between calls.
+    uint64_t accum;
     int bitcount;
+
+    // number of bytes written to data so far, stuffing included.
     int curidx;
 };
 
 bit_packer_t* bit_packer_create();
 void bit_packer_destroy(bit_packer_t* bp);
 
+/**
+ * Throws away everything that's been packed so far, so the packer can be used for a new
+ * entropy-coded segment. The buffer is kept.
+ */
+void bit_packer_reset(bit_packer_t* bp);
+
+/**
+ * Makes sure that at least nbytes more bytes can be written without growing the buffer. Callers
+ * that know a worst-case bound for their output should reserve it up front.
+ */
+void bit_packer_reserve(bit_packer_t* bp, int nbytes);
+
 /**
  * If the currently pending byte has unfilled bits, fills it with ones and moves up to the next
- * byte.
+ * byte. Also writes out any whole bytes that are still sitting in the accumulator.
  *
  * Should be called before "harvesting" bp->data.
  */
@@ -51,6 +73,8 @@ void bit_packer_fill_endbits(bit_packer_t* bp);
  * putting them back in after taking them out is a little more complicated because we don't know
  * about bit-alignment before re-packing, so we don't want to go back to front, we still want to
  * go front-to-back.
+ *
+ * n may be anywhere from 0 to the width of src.
  */
 void bit_packer_pack_u8(uint8_t   src, int n, bit_packer_t* packer);
 void bit_packer_pack_u16(uint16_t src, int n, bit_packer_t* packer);
@@ -0,0 +1,68 @@
+#include "fdct.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dct_utils.h"
+#include "util.h"
+
+void fdct_loeffler_float(const int* samples, int* coefficients)
+{
+    float temp[64];
+    for (int i = 0; i < 64; i++)
+        temp[i] = samples[i];
+    loeffler_fdct_8x8_inplace(temp);
+    for (int i = 0; i < 64; i++)
+        coefficients[i] = (int)round(temp[i]);
+}
+
+/**
+ * The same model of the hardware DCT that the verilog testbenches use.
+ */
+static void fdct_loeffler_7q8(const int* samples, int* coefficients)
+{
+    int8_t in[64];
+    int16_t out[64];
+    for (int i = 0; i < 64; i++)
+        in[i] = samples[i];
+    dct88_q8(in, out);
+    for (int i = 0; i < 64; i++)
+        coefficients[i] = out[i];
+}
+
+// mcu_fdct_floats and mcu_fdct_fixedpoint don't take const inputs, so they get a copy.
+static void fdct_naive_float(const int* samples, int* coefficients)
+{
+    int in[64];
+    memcpy(in, samples, sizeof(in));
+    mcu_fdct_floats(in, coefficients);
+}
+
+static void fdct_naive_q7(const int* samples, int* coefficients)
+{
+    int in[64];
+    memcpy(in, samples, sizeof(in));
+    mcu_fdct_fixedpoint(in, coefficients);
+}
+
+const fdct_backend_t fdct_backends[] =
+{
+    { "loeffler_float", "float Loeffler, rounded (what the encoder uses)", fdct_loeffler_float },
+    { "loeffler_7q8",   "fixed-point model of loeffler_dct_88.v",          fdct_loeffler_7q8 },
+    { "naive_float",    "O(n^4) textbook DCT, cos() in the inner loop",    fdct_naive_float },
+    { "naive_q7",       "O(n^4) textbook DCT with q7 cosines",             fdct_naive_q7 },
+};
+
+const int fdct_num_backends = sizeof(fdct_backends) / sizeof(fdct_backends[0]);
+
+const fdct_backend_t* fdct_backend_find(const char* name)
+{
+    for (int i = 0; i < fdct_num_backends; i++) {
+        if (!strcmp(fdct_backends[i].name, name)) {
+            return &fdct_backends[i];
+        }
+    }
+    return NULL;
+}
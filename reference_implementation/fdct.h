@@ -0,0 +1,34 @@
+#ifndef _FDCT_H
+#define _FDCT_H
+
+/**
+ * All of the forward DCTs that we've got lying around, behind one interface so they can be swapped
+ * out and compared against each other (see fdct_bench.c).
+ *
+ * Every one of them takes an 8x8 block of level-shifted samples in [-128, 127], row-major, and
+ * writes 64 coefficients in natural (not zigzag) order, scaled the way a JPEG FDCT's output is.
+ */
+typedef void (*fdct_fn_t)(const int* samples, int* coefficients);
+
+typedef struct fdct_backend
+{
+    const char* name;
+    const char* description;
+    fdct_fn_t fn;
+} fdct_backend_t;
+
+extern const fdct_backend_t fdct_backends[];
+extern const int fdct_num_backends;
+
+/**
+ * Returns NULL if there's no backend with the given name.
+ */
+const fdct_backend_t* fdct_backend_find(const char* name);
+
+/**
+ * Float Loeffler DCT with the results rounded to the nearest integer. This is the one that
+ * uncoded_jpeg_scan_create() uses.
+ */
+void fdct_loeffler_float(const int* samples, int* coefficients);
+
+#endif
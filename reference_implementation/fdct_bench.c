@@ -0,0 +1,318 @@
+/**
+ * Accuracy and throughput benchmark for the forward DCTs in fdct.h.
+ *
+ * Blocks come from the first plane of the given PGM / PPM / PAM images (every full 8x8 block,
+ * level-shifted), or from uniformly random samples if no images are given. Each backend is run over
+ * the whole corpus for a while to get blocks/s, and its coefficients are compared against a
+ * double-precision DCT of the same blocks:
+ *
+ *     max err, mean err    absolute coefficient error against the double-precision DCT.
+ *     psnr                 samples rebuilt from the coefficients with a double-precision IDCT.
+ *     psnr (q)             same, but the coefficients go through the encoder's luma quantization
+ *                          table (lum_quant_table_high) first, the way they would in a real jpeg.
+ *
+ * The "double" row is the double-precision DCT rounded to integers, for comparison.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fdct.h"
+#include "jpeg.h"
+#include "util.h"
+
+#define PI_D (3.14159265358979323846)
+
+typedef struct block_corpus
+{
+    int nblocks;
+    int capacity;
+    int (*blocks)[64];
+} block_corpus_t;
+
+static double c_table[8][8];
+
+static void init_c_table(void)
+{
+    for (int u = 0; u < 8; u++) {
+        const double cu = (u == 0) ? sqrt(0.125) : 0.5;
+        for (int x = 0; x < 8; x++) {
+            c_table[u][x] = cu * cos(((2 * x) + 1) * u * PI_D / 16.);
+        }
+    }
+}
+
+static void reference_fdct(const int* in, double* out)
+{
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            double sum = 0.;
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    sum += c_table[v][y] * c_table[u][x] * in[(y * 8) + x];
+                }
+            }
+            out[(v * 8) + u] = sum;
+        }
+    }
+}
+
+static void reference_idct(const int* in, double* out)
+{
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            double sum = 0.;
+            for (int v = 0; v < 8; v++) {
+                for (int u = 0; u < 8; u++) {
+                    sum += c_table[v][y] * c_table[u][x] * in[(v * 8) + u];
+                }
+            }
+            out[(y * 8) + x] = sum;
+        }
+    }
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static int* corpus_add_block(block_corpus_t* corpus)
+{
+    if (corpus->nblocks == corpus->capacity) {
+        corpus->capacity = (corpus->capacity == 0) ? 1024 : (corpus->capacity * 2);
+        corpus->blocks = realloc(corpus->blocks, corpus->capacity * sizeof(corpus->blocks[0]));
+    }
+    return corpus->blocks[corpus->nblocks++];
+}
+
+static int corpus_add_image(block_corpus_t* corpus, const char* path)
+{
+    image_t* image = image_create_from_pam(path);
+    if (image == NULL) {
+        return -1;
+    }
+    image_level_shift(image);
+
+    for (int y = 0; (y + 8) <= image->height; y += 8) {
+        for (int x = 0; (x + 8) <= image->width; x += 8) {
+            image_copy_mcu_into(image, x, y, corpus_add_block(corpus));
+        }
+    }
+
+    image_destroy(image);
+    return 0;
+}
+
+static void corpus_add_random(block_corpus_t* corpus, int nblocks)
+{
+    srand(1);
+    for (int i = 0; i < nblocks; i++) {
+        int* block = corpus_add_block(corpus);
+        for (int j = 0; j < 64; j++) {
+            block[j] = (rand() % 256) - 128;
+        }
+    }
+}
+
+typedef struct accuracy
+{
+    double max_err;
+    double mean_err;
+    double psnr;
+    double psnr_q;
+} accuracy_t;
+
+static double psnr_from_sse(double sse, long nsamples)
+{
+    if (sse == 0.) {
+        return INFINITY;
+    }
+    return 10. * log10((255. * 255.) / (sse / nsamples));
+}
+
+/**
+ * Rebuilds a block's samples from its coefficients and returns the squared error against the
+ * original samples.
+ */
+static double reconstruction_sse(const int* samples, const int* coefficients)
+{
+    double rebuilt[64];
+    reference_idct(coefficients, rebuilt);
+
+    double sse = 0.;
+    for (int i = 0; i < 64; i++) {
+        double s = floor(rebuilt[i] + 0.5);
+        s = (s < -128.) ? -128. : ((s > 127.) ? 127. : s);
+        sse += (s - samples[i]) * (s - samples[i]);
+    }
+    return sse;
+}
+
+/**
+ * 'coefficients' holds corpus->nblocks blocks of output from whatever DCT is being measured.
+ */
+static accuracy_t measure_accuracy(const block_corpus_t* corpus, const double (*reference)[64],
+                                   const int (*coefficients)[64])
+{
+    accuracy_t acc = { 0 };
+    double sse = 0., sse_q = 0.;
+
+    for (int b = 0; b < corpus->nblocks; b++) {
+        int quantized[64];
+        for (int i = 0; i < 64; i++) {
+            const double err = fabs(coefficients[b][i] - reference[b][i]);
+            acc.max_err = (err > acc.max_err) ? err : acc.max_err;
+            acc.mean_err += err;
+
+            // truncating division, same as uncoded_jpeg_scan_quantize().
+            const int Q = lum_quant_table_high.Q[i];
+            quantized[i] = (coefficients[b][i] / Q) * Q;
+        }
+
+        sse += reconstruction_sse(corpus->blocks[b], coefficients[b]);
+        sse_q += reconstruction_sse(corpus->blocks[b], quantized);
+    }
+
+    const long nsamples = (long)corpus->nblocks * 64;
+    acc.mean_err /= nsamples;
+    acc.psnr = psnr_from_sse(sse, nsamples);
+    acc.psnr_q = psnr_from_sse(sse_q, nsamples);
+    return acc;
+}
+
+/**
+ * Runs the DCT over the whole corpus over and over for at least min_seconds.
+ */
+static double measure_blocks_per_second(const block_corpus_t* corpus, fdct_fn_t fn,
+                                        int (*out)[64], double min_seconds)
+{
+    long blocks_done = 0;
+    const double start = now_seconds();
+    double elapsed;
+    do {
+        for (int b = 0; b < corpus->nblocks; b++) {
+            fn(corpus->blocks[b], out[b]);
+        }
+        blocks_done += corpus->nblocks;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_seconds);
+
+    return blocks_done / elapsed;
+}
+
+static void usage(const char* argv0)
+{
+    printf("Usage: %s [-n random_blocks] [-t seconds] [-b backend] [image ...]\n", argv0);
+    printf("    -n random_blocks   number of random blocks to use if no images are given (4096).\n");
+    printf("    -t seconds         minimum time to spend timing each backend (0.5).\n");
+    printf("    -b backend         only run the named backend. Can be given more than once.\n");
+    printf("backends:\n");
+    for (int i = 0; i < fdct_num_backends; i++) {
+        printf("    %-16s %s\n", fdct_backends[i].name, fdct_backends[i].description);
+    }
+}
+
+static void print_row(const char* name, double blocks_per_second, accuracy_t acc)
+{
+    if (blocks_per_second > 0.) {
+        printf("%-16s %12.0f", name, blocks_per_second);
+    } else {
+        printf("%-16s %12s", name, "-");
+    }
+    printf(" %9.3f %9.4f %9.2f %9.2f\n", acc.max_err, acc.mean_err, acc.psnr, acc.psnr_q);
+}
+
+int main(int argc, char** argv)
+{
+    int nrandom = 4096;
+    double min_seconds = 0.5;
+    const fdct_backend_t* selected[16];
+    int nselected = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:b:")) != -1) {
+        switch (opt) {
+            case 'n': nrandom = atoi(optarg); break;
+            case 't': min_seconds = atof(optarg); break;
+            case 'b':
+                if ((nselected == 16) || ((selected[nselected++] = fdct_backend_find(optarg)) == NULL)) {
+                    printf("unknown backend %s\n", optarg);
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    if ((nrandom <= 0) || (min_seconds < 0.)) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (nselected == 0) {
+        for (int i = 0; (i < fdct_num_backends) && (i < 16); i++) {
+            selected[nselected++] = &fdct_backends[i];
+        }
+    }
+
+    int retval = 0;
+    block_corpus_t corpus = { 0 };
+    double (*reference)[64] = NULL;
+    int (*out)[64] = NULL;
+
+    for (int i = optind; i < argc; i++) {
+        if (corpus_add_image(&corpus, argv[i])) {
+            printf("failed to load %s\n", argv[i]);
+            retval = -1;
+            goto _end;
+        }
+    }
+    if (optind == argc) {
+        corpus_add_random(&corpus, nrandom);
+    }
+    if (corpus.nblocks == 0) {
+        printf("no 8x8 blocks to test with\n");
+        retval = -1;
+        goto _end;
+    }
+
+    init_c_table();
+    reference = malloc(corpus.nblocks * sizeof(reference[0]));
+    out = malloc(corpus.nblocks * sizeof(out[0]));
+    for (int b = 0; b < corpus.nblocks; b++) {
+        reference_fdct(corpus.blocks[b], reference[b]);
+    }
+
+    printf("%i blocks from %s\n\n", corpus.nblocks, (optind == argc) ? "random samples" : "images");
+    printf("%-16s %12s %9s %9s %9s %9s\n", "backend", "blocks/s", "max err", "mean err", "psnr",
+           "psnr (q)");
+
+    for (int b = 0; b < corpus.nblocks; b++) {
+        for (int i = 0; i < 64; i++) {
+            out[b][i] = (int)floor(reference[b][i] + 0.5);
+        }
+    }
+    print_row("double", 0., measure_accuracy(&corpus, (const double (*)[64])reference,
+                                             (const int (*)[64])out));
+
+    for (int i = 0; i < nselected; i++) {
+        const double bps = measure_blocks_per_second(&corpus, selected[i]->fn, out, min_seconds);
+        const accuracy_t acc = measure_accuracy(&corpus, (const double (*)[64])reference,
+                                                (const int (*)[64])out);
+        print_row(selected[i]->name, bps, acc);
+    }
+
+_end:
+    free(out);
+    free(reference);
+    free(corpus.blocks);
+    return retval;
+}
@@ -1,6 +1,9 @@
 #include "./jpeg.h"
 #include "bit_packer.h"
+#include "fdct.h"
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // jpeg util functions
@@ -38,15 +41,28 @@ static void get_sampling_min_max(const component_params_t** params,
 }
 
 
+/**
+ * Number of 8x8 blocks that a component with the given squeeze factors needs.
+ */
+static uint32_t component_num_blocks(const image_t* image, const int HV_squeeze[2])
+{
+    const int pix_per_samp = HV_squeeze[0] * HV_squeeze[1];
+    return ((((image->width + 7) / 8) * ((image->height + 7) / 8)) / pix_per_samp);
+}
+
 /**
  * If HV_squeeze is 1, each pixel is one sample. If one of its elements is 2, the corresponding
  * dimension in the image has 2 pixels per sample.
+ *
+ * The component's blocks aren't allocated here; 'blocks' should point at a slice of the scan's
+ * block arena that's at least component_num_blocks() long.
  */
 static void component_take_dct(jpeg_dct_component_t* component,
                                int component_number,
                                const component_params_t* params,
                                int HV_squeeze[2],
-                               const image_t* image)
+                               const image_t* image,
+                               dct_block_t* blocks)
 {
     int pix_per_samp = HV_squeeze[0] * HV_squeeze[1];
 
@@ -56,8 +72,8 @@ static void component_take_dct(jpeg_dct_component_t* component,
     component->quant_table_selector = params->quant_table_selector;
     component->entropy_coding_table = params->entropy_coding_table;
 
-    component->num_blocks = ((((image->width + 7) / 8) * ((image->height + 7) / 8)) / pix_per_samp);
-    component->blocks = calloc(component->num_blocks, sizeof(dct_block_t));
+    component->num_blocks = component_num_blocks(image, HV_squeeze);
+    component->blocks = blocks;
 
     // run DCT
     int data_in[64];
@@ -71,23 +87,24 @@ static void component_take_dct(jpeg_dct_component_t* component,
     component->mcu_width = image->width / MCU_width_pixels;
     component->mcu_height = image->height / MCU_height_pixels;
 
+    const int16_t* plane = image->planes[component_number];
+    const int stride = image->stride;
     for (int y = 0; y < (image->height / MCU_height_pixels); y++) {
         for (int x = 0; x < (image->width / MCU_width_pixels); x++) {
-            int mcu_idx = (y * MCU_height_pixels * image->width) + (x * MCU_width_pixels);
+            int mcu_idx = (y * MCU_height_pixels * stride) + (x * MCU_width_pixels);
 
             // iterate over 8x8 MCU
             for (int mcu_x = 0; mcu_x < 8; mcu_x++) {
                 for (int mcu_y = 0; mcu_y < 8; mcu_y++) {
-                    int samp_idx = (mcu_idx + (mcu_y * HV_squeeze[1] * image->width)
+                    int samp_idx = (mcu_idx + (mcu_y * HV_squeeze[1] * stride)
                                     + (mcu_x * HV_squeeze[0]));
 
                     // do pixel averaging for blocks with sampling factors.
                     int accum = 0;
                     for (int sample_x = 0; sample_x < HV_squeeze[0]; sample_x++) {
                         for (int sample_y = 0; sample_y < HV_squeeze[1]; sample_y++) {
-                            int idx = samp_idx + sample_y * image->width + sample_x;
-                            //int idx = samp_idx + 0 * image->width + sample_x;
-                            accum += image->components[idx][component_number];
+                            int idx = samp_idx + sample_y * stride + sample_x;
+                            accum += plane[idx];
                         }
                     }
 
@@ -97,12 +114,7 @@ static void component_take_dct(jpeg_dct_component_t* component,
 
             // do DCT
             int outidx = (y * (image->width / MCU_width_pixels)) + x;
-            float temp[64];
-            for (int i = 0; i < 64; i++)
-                temp[i] = data_in[i];
-            loeffler_fdct_8x8_inplace(temp);
-            for (int i = 0; i < 64; i++)
-                component->blocks[outidx].values[i] = (int)round(temp[i]);
+            fdct_loeffler_float(data_in, component->blocks[outidx].values);
             //mcu_fdct_floats(data_in, component->blocks[mcuidx].values);
             //mcu_fdct_fixedpoint(data_in, component->blocks[mcuidx].values);
         }
@@ -214,13 +226,17 @@ static uint16_t coefficient_value_to_coded_value(int16_t coefficient_value, int*
 }
 
 #if 1
-int jpeg_huffman_code(const uncoded_jpeg_scan_t* scan,
-                      const jpeg_huffman_table_t* dc_huffman_tables[2],
-                      const jpeg_huffman_table_t* ac_huffman_tables[2],
-                      uint8_t** result)
+/**
+ * Huffman codes the scan into the given bit packer. The packed bytes are left in bp->data; nothing
+ * is copied out.
+ *
+ * returns the number of packed bytes, or < 0 on error.
+ */
+static int jpeg_huffman_code(const uncoded_jpeg_scan_t* scan,
+                             const jpeg_huffman_table_t* dc_huffman_tables[2],
+                             const jpeg_huffman_table_t* ac_huffman_tables[2],
+                             bit_packer_t* bp)
 {
-    *result = NULL;
-
     // make huffman reverse lookup tables.
     huffman_reverse_lookup_table_t* dc_hrlts[2] = { 0 };
     huffman_reverse_lookup_table_t* ac_hrlts[2] = { 0 };
@@ -240,8 +256,6 @@ int jpeg_huffman_code(const uncoded_jpeg_scan_t* scan,
         }
     }
 
-    bit_packer_t* bp = bit_packer_create();
-
     for (int i = 0; i < num_mcus; i++) {
         for (int j = 0; j < scan->num_components; j++) {
             int blocks_per_line = scan->width / (8);
@@ -290,7 +304,7 @@ int jpeg_huffman_code(const uncoded_jpeg_scan_t* scan,
                     while (ac_coeff_idx < 64) {
                         // find next non-zero coefficient
                         unsigned int l;
-                        for (l = ac_coeff_idx; (source_block[l] == 0) && (l < 64); l++);
+                        for (l = ac_coeff_idx; (l < 64) && (source_block[l] == 0); l++);
 
                         int zeroes_to_rle = l - ac_coeff_idx;
 
@@ -354,12 +368,7 @@ int jpeg_huffman_code(const uncoded_jpeg_scan_t* scan,
     }
 
     bit_packer_fill_endbits(bp);
-
-    *result = malloc(bp->curidx);
     int len = bp->curidx;
-    memcpy(*result, bp->data, bp->curidx);
-
-    bit_packer_destroy(bp);
 
     for (int i = 0; i < 2; i++) {
         free(dc_hrlts[i]);
@@ -423,13 +432,24 @@ uncoded_jpeg_scan_t* uncoded_jpeg_scan_create(const image_t* image,
     int V_ranges[2];
     get_sampling_min_max(params, ncomponents, &H_ranges[0], &H_ranges[1], &V_ranges[0], &V_ranges[1]);
 
+    int HV_squeeze[4][2];
+    uint32_t total_blocks = 0;
     for (int i = 0; i < ncomponents; i++) {
-        int HV_squeeze[2];
-        HV_squeeze[0] = H_ranges[1] / params[i]->H_sample_factor;
-        HV_squeeze[1] = V_ranges[1] / params[i]->V_sample_factor;
+        HV_squeeze[i][0] = H_ranges[1] / params[i]->H_sample_factor;
+        HV_squeeze[i][1] = V_ranges[1] / params[i]->V_sample_factor;
+        total_blocks += component_num_blocks(image, HV_squeeze[i]);
+    }
 
+    // every block for every component comes out of one allocation, laid out component after
+    // component in the same order that the scan header lists them.
+    scan->block_arena = calloc(total_blocks, sizeof(dct_block_t));
+    scan->block_arena_len = total_blocks;
+
+    dct_block_t* next_blocks = scan->block_arena;
+    for (int i = 0; i < ncomponents; i++) {
         // initialize dct component
-        component_take_dct(&scan->components[i], i, params[i], HV_squeeze, image);
+        component_take_dct(&scan->components[i], i, params[i], HV_squeeze[i], image, next_blocks);
+        next_blocks += scan->components[i].num_blocks;
 
         // quantize, zigzag, and differentially encode DC component
         int quant_table = scan->components[i].quant_table_selector;
@@ -442,14 +462,24 @@ uncoded_jpeg_scan_t* uncoded_jpeg_scan_create(const image_t* image,
     return scan;
 }
 
+void uncoded_jpeg_scan_destroy(uncoded_jpeg_scan_t* scan)
+{
+    if (scan == NULL) {
+        return;
+    }
 
-int jpeg_compress(const uncoded_jpeg_scan_t* scan,
-                  const jpeg_huffman_table_t* dc_huffman_tables[2],
-                  const jpeg_huffman_table_t* ac_huffman_tables[2],
-                  const jpeg_quantization_table_t* quant_tables[4],
-                  uint8_t** result)
+    free(scan->block_arena);
+    free(scan);
+}
+
+
+int jpeg_compress_into(const uncoded_jpeg_scan_t* scan,
+                       const jpeg_huffman_table_t* dc_huffman_tables[2],
+                       const jpeg_huffman_table_t* ac_huffman_tables[2],
+                       const jpeg_quantization_table_t* quant_tables[4],
+                       bytearray_t* ba)
 {
-    bytearray_t* ba = bytearray_create();
+    const int start_size = ba->size;
 
     // ======= SOI / JFIF =======
     bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xd8 }, 2);
@@ -519,29 +549,47 @@ int jpeg_compress(const uncoded_jpeg_scan_t* scan,
     bytearray_add_bytes(ba, (uint8_t[]){ 0 }, 1);
 
     // write entropy-coded segment.
-    // in this crappy reference implementation, bitstuffing happens here. However in the "real"
-    // embedded impl (jmcumc), the improved bytepacking code I recently came up with might shift
-    // where I do this.
+    // bitstuffing happens in the bit packer, the same way that it does in jmcujc's bit dispenser.
     //uncoded_jpeg_scan_t* scan = uncoded_jpeg_scan_create(image,
 
-    uint8_t* ecs = NULL;
-    int ecs_len = jpeg_huffman_code(scan, dc_huffman_tables, ac_huffman_tables, &ecs);
-    for (int i = 0; i < ecs_len; i++) {
-        uint8_t writebyte = ecs[i];
-        bytearray_add_bytes(ba, &writebyte, 1);
-
-        if (writebyte == 0xff) {
-            bytearray_add_bytes(ba, (uint8_t[]){ 0 }, 1);
-        }
+    // worst case for one block is the longest DC code + 11 bits, then 63 of the longest AC code +
+    // 10 bits, and every byte of that might need stuffing.
+    const int max_bytes_per_block = 2 * (((16 + 11) + (63 * (16 + 10)) + 7) / 8);
+    bit_packer_t* bp = bit_packer_create();
+    bit_packer_reserve(bp, scan->block_arena_len * max_bytes_per_block);
+    int ecs_len = jpeg_huffman_code(scan, dc_huffman_tables, ac_huffman_tables, bp);
+    if (ecs_len < 0) {
+        bit_packer_destroy(bp);
+        return ecs_len;
     }
 
-    free(ecs);
+    // the bit packer has already done the byte stuffing.
+    bytearray_add_bytes(ba, bp->data, ecs_len);
+
+    bit_packer_destroy(bp);
 
     // write EOI
     bytearray_add_bytes(ba, (uint8_t[]) {0xff, 0xd9}, 2);
 
-    *result = ba->data;
-    int ret = ba->size;
+    return ba->size - start_size;
+}
+
+int jpeg_compress(const uncoded_jpeg_scan_t* scan,
+                  const jpeg_huffman_table_t* dc_huffman_tables[2],
+                  const jpeg_huffman_table_t* ac_huffman_tables[2],
+                  const jpeg_quantization_table_t* quant_tables[4],
+                  uint8_t** result)
+{
+    bytearray_t* ba = bytearray_create();
+    int ret = jpeg_compress_into(scan, dc_huffman_tables, ac_huffman_tables, quant_tables, ba);
+
+    // hand the bytearray's buffer over as-is instead of copying it.
+    if (ret < 0) {
+        free(ba->data);
+        *result = NULL;
+    } else {
+        *result = ba->data;
+    }
     free(ba);
     return ret;
 }
@@ -127,6 +127,11 @@ typedef struct uncoded_jpeg_scan
     // in pixels
     int width;
     int height;
+
+    // One allocation holds the blocks of every component, one component after the other. Each
+    // component's 'blocks' points somewhere in here, so they must not be freed individually.
+    dct_block_t* block_arena;
+    uint32_t block_arena_len;
 } uncoded_jpeg_scan_t;
 
 typedef struct component_params
@@ -139,13 +144,16 @@ typedef struct component_params
 } component_params_t;
 
 /**
- *
+ * Takes the DCT of every component in the image, then quantizes, zigzags, and differentially codes
+ * the results. All of the scan's blocks live in a single arena sized from the image geometry.
  */
 uncoded_jpeg_scan_t* uncoded_jpeg_scan_create(const image_t* image,
                                               const component_params_t** params,
                                               int ncomponents,
                                               const jpeg_quantization_table_t** tables);
 
+void uncoded_jpeg_scan_destroy(uncoded_jpeg_scan_t* scan);
+
 
 /**
  * Compresses a given uncoded jpeg scan into a bytestream. Requires that you provide huffman tables
@@ -155,14 +163,29 @@ uncoded_jpeg_scan_t* uncoded_jpeg_scan_create(const image_t* image,
  * {huffman,quant}_tables[0] are used for the first component, {huffman,quant}_tables[1] are used
  * for all other components. Unused spots for huffman and quant tables should be NULL.
  *
+ * *dest is the output buffer itself (not a copy of it) and should be free()'d by the caller.
+ *
  * returns the length of the bytestream.
  */
 int jpeg_compress(const uncoded_jpeg_scan_t* jpeg,
                   const jpeg_huffman_table_t* dc_huffman_tables[2],
                   const jpeg_huffman_table_t* ac_huffman_tables[2],
-                  const jpeg_quantization_table_t* quant_tables[2],
+                  const jpeg_quantization_table_t* quant_tables[4],
                   uint8_t** dest);
 
+/**
+ * Same as jpeg_compress(), but appends the bytestream to a bytearray that the caller owns. If the
+ * same bytearray is reused from frame to frame (set size back to 0 in between), its buffer only
+ * has to grow once.
+ *
+ * returns the number of bytes appended, or < 0 on error.
+ */
+int jpeg_compress_into(const uncoded_jpeg_scan_t* jpeg,
+                       const jpeg_huffman_table_t* dc_huffman_tables[2],
+                       const jpeg_huffman_table_t* ac_huffman_tables[2],
+                       const jpeg_quantization_table_t* quant_tables[4],
+                       bytearray_t* ba);
+
 
 const extern jpeg_huffman_table_t lum_dc_huffman_table;
 const extern jpeg_huffman_table_t lum_ac_huffman_table;
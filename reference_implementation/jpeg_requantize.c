@@ -0,0 +1,1060 @@
+#include "jpeg_requantize.h"
+#include "bit_packer.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// natural_order[k] is the row-major index of the k-th coefficient in zig-zag order.
+static const uint8_t natural_order[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// ======= decoding =======
+typedef struct huffman_decode_table
+{
+    bool valid;
+
+    // lookup[next 8 bits] = (code length << 8) | symbol; a code length of 0 means the code is longer
+    // than 8 bits.
+    uint16_t lookup[256];
+
+    // canonical decoding tables for longer codes; see figure F.16 of T.81.
+    int32_t mincode[17];
+    int32_t maxcode[17];
+    int valptr[17];
+    uint8_t values[256];
+} huffman_decode_table_t;
+
+/**
+ * Reads bits straight out of the entropy-coded segment, taking out stuffed zeros as it goes. When
+ * it gets to a marker it stops there and starts feeding in zeros; a block that ends up using them
+ * means the file is truncated.
+ */
+typedef struct bit_reader
+{
+    const uint8_t* data;
+    int len;
+    int idx;
+
+    uint32_t buffer;
+    int bits;
+    int fake_bytes;
+} bit_reader_t;
+
+typedef struct decoder
+{
+    const uint8_t* data;
+    int len;
+    int idx;
+
+    huffman_decode_table_t dc_tables[4];
+    huffman_decode_table_t ac_tables[4];
+
+    bit_reader_t br;
+} decoder_t;
+
+static int read_u16(decoder_t* d)
+{
+    int retval = (d->data[d->idx] << 8) | d->data[d->idx + 1];
+    d->idx += 2;
+    return retval;
+}
+
+static void bit_reader_fill(bit_reader_t* br)
+{
+    while (br->bits <= 24) {
+        uint8_t b = 0;
+        if ((br->idx < br->len) && (br->data[br->idx] != 0xff)) {
+            b = br->data[br->idx++];
+        } else if (((br->idx + 1) < br->len) && (br->data[br->idx + 1] == 0x00)) {
+            b = 0xff;
+            br->idx += 2;
+        } else {
+            br->fake_bytes++;
+        }
+
+        br->buffer |= ((uint32_t)b) << (24 - br->bits);
+        br->bits += 8;
+    }
+}
+
+static inline int bit_reader_get(bit_reader_t* br, int n)
+{
+    if (br->bits < n) {
+        bit_reader_fill(br);
+    }
+    const int retval = br->buffer >> (32 - n);
+    br->buffer <<= n;
+    br->bits -= n;
+    return retval;
+}
+
+static void bit_reader_reset(bit_reader_t* br)
+{
+    br->buffer = 0;
+    br->bits = 0;
+    br->fake_bytes = 0;
+}
+
+static int huffman_decode_table_init(const jpeg_huffman_table_t* t, huffman_decode_table_t* dt)
+{
+    memset(dt, 0, sizeof(huffman_decode_table_t));
+
+    int nvalues = 0;
+    for (int i = 0; i < 16; i++) {
+        nvalues += t->number_of_codes_with_length[i];
+    }
+    if (nvalues > 256) {
+        return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+    }
+    memcpy(dt->values, t->huffman_codes, nvalues);
+
+    int code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        dt->valptr[l] = k;
+        dt->mincode[l] = code;
+        for (int i = 0; i < t->number_of_codes_with_length[l - 1]; i++, k++, code++) {
+            if (l <= 8) {
+                for (int j = 0; j < (1 << (8 - l)); j++) {
+                    dt->lookup[(code << (8 - l)) | j] = (l << 8) | t->huffman_codes[k];
+                }
+            }
+        }
+        dt->maxcode[l] = t->number_of_codes_with_length[l - 1] ? (code - 1) : -1;
+        if (code > (1 << l)) {
+            return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+        }
+        code <<= 1;
+    }
+
+    dt->valid = true;
+    return 0;
+}
+
+static inline int huffman_decode(bit_reader_t* br, const huffman_decode_table_t* dt)
+{
+    if (br->bits < 16) {
+        bit_reader_fill(br);
+    }
+
+    const uint16_t entry = dt->lookup[br->buffer >> 24];
+    if (entry >> 8) {
+        br->buffer <<= (entry >> 8);
+        br->bits -= (entry >> 8);
+        return entry & 0xff;
+    }
+
+    for (int l = 9; l <= 16; l++) {
+        const int32_t code = br->buffer >> (32 - l);
+        if (code <= dt->maxcode[l]) {
+            br->buffer <<= l;
+            br->bits -= l;
+            return dt->values[dt->valptr[l] + code - dt->mincode[l]];
+        }
+    }
+
+    return JPEG_REQUANTIZE_ERR_BAD_HUFFMAN_CODE;
+}
+
+/**
+ * Reads an s-bit coded value and turns it back into a coefficient; see figure F.12 of T.81.
+ */
+static inline int receive_extend(bit_reader_t* br, int s)
+{
+    if (s == 0) {
+        return 0;
+    }
+
+    int v = bit_reader_get(br, s);
+    if (v < (1 << (s - 1))) {
+        v += 1 - (1 << s);
+    }
+    return v;
+}
+
+static int parse_dqt(decoder_t* d, jpeg_coefficients_t* coefficients, int end)
+{
+    while (d->idx < end) {
+        const uint8_t pq_tq = d->data[d->idx++];
+        const int tq = pq_tq & 0x0f;
+        if ((pq_tq >> 4) != 0) {
+            // 16-bit tables don't fit in jpeg_quantization_table_t
+            return JPEG_REQUANTIZE_ERR_UNSUPPORTED;
+        }
+        if ((tq > 3) || ((d->idx + 64) > end)) {
+            return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+        }
+
+        coefficients->quant_tables[tq].pq_tq = pq_tq;
+        for (int k = 0; k < 64; k++) {
+            coefficients->quant_tables[tq].Q[natural_order[k]] = d->data[d->idx++];
+        }
+        coefficients->quant_table_valid[tq] = true;
+    }
+
+    return 0;
+}
+
+static int parse_dht(decoder_t* d, int end)
+{
+    while (d->idx < end) {
+        if ((d->idx + 17) > end) {
+            return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+        }
+
+        jpeg_huffman_table_t t;
+        t.tc_td = d->data[d->idx];
+        memcpy(t.number_of_codes_with_length, &d->data[d->idx + 1], 16);
+        d->idx += 17;
+
+        int nvalues = 0;
+        for (int i = 0; i < 16; i++) {
+            nvalues += t.number_of_codes_with_length[i];
+        }
+        if (((t.tc_td >> 4) > 1) || ((t.tc_td & 0x0f) > 3) || (nvalues > 256) ||
+            ((d->idx + nvalues) > end)) {
+            return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+        }
+        memcpy(t.huffman_codes, &d->data[d->idx], nvalues);
+        d->idx += nvalues;
+
+        huffman_decode_table_t* dt = (t.tc_td >> 4) ? &d->ac_tables[t.tc_td & 0x0f] :
+                                                      &d->dc_tables[t.tc_td & 0x0f];
+        int retval = huffman_decode_table_init(&t, dt);
+        if (retval) {
+            return retval;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_sof(decoder_t* d, jpeg_coefficients_t* coefficients, int end)
+{
+    jpeg_frame_header_t* frame = &coefficients->frame;
+    if ((end - d->idx) < 6) {
+        return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+    }
+
+    frame->sample_precision = d->data[d->idx++];
+    frame->number_of_lines = read_u16(d);
+    frame->samples_per_line = read_u16(d);
+    frame->num_components = d->data[d->idx++];
+    frame->csps = coefficients->frame_csps;
+
+    if (frame->sample_precision != 8) {
+        return JPEG_REQUANTIZE_ERR_UNSUPPORTED;
+    }
+    if ((frame->number_of_lines == 0) || (frame->samples_per_line == 0) ||
+        (frame->num_components < 1) || (frame->num_components > 4) ||
+        ((d->idx + (3 * frame->num_components)) > end)) {
+        return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+    }
+
+    int H_max = 1, V_max = 1;
+    for (int i = 0; i < frame->num_components; i++) {
+        frame_component_specification_parameters_t* csp = &frame->csps[i];
+        csp->component_identifier = d->data[d->idx];
+        csp->horizontal_sampling_factor = d->data[d->idx + 1] >> 4;
+        csp->vertical_sampling_factor = d->data[d->idx + 1] & 0x0f;
+        csp->quantization_table_selector = d->data[d->idx + 2];
+        d->idx += 3;
+
+        if ((csp->horizontal_sampling_factor < 1) || (csp->horizontal_sampling_factor > 4) ||
+            (csp->vertical_sampling_factor < 1) || (csp->vertical_sampling_factor > 4) ||
+            (csp->quantization_table_selector > 3)) {
+            return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+        }
+        H_max = (csp->horizontal_sampling_factor > H_max) ? csp->horizontal_sampling_factor : H_max;
+        V_max = (csp->vertical_sampling_factor > V_max) ? csp->vertical_sampling_factor : V_max;
+    }
+
+    const int mcu_width = (frame->samples_per_line + (8 * H_max) - 1) / (8 * H_max);
+    const int mcu_height = (frame->number_of_lines + (8 * V_max) - 1) / (8 * V_max);
+    for (int i = 0; i < frame->num_components; i++) {
+        jpeg_dct_component_t* c = &coefficients->components[i];
+        c->H_sample_factor = frame->csps[i].horizontal_sampling_factor;
+        c->V_sample_factor = frame->csps[i].vertical_sampling_factor;
+        c->quant_table_selector = frame->csps[i].quantization_table_selector;
+        c->mcu_width = mcu_width;
+        c->mcu_height = mcu_height;
+        c->num_blocks = (mcu_width * c->H_sample_factor) * (mcu_height * c->V_sample_factor);
+        c->blocks = calloc(c->num_blocks, sizeof(dct_block_t));
+        if (c->blocks == NULL) {
+            return JPEG_REQUANTIZE_ERR_OUT_OF_RANGE;
+        }
+    }
+
+    return 0;
+}
+
+static int decode_block(decoder_t* d, jpeg_dct_component_t* c, int* dc_pred, dct_block_t* block)
+{
+    const huffman_decode_table_t* dc_table = &d->dc_tables[c->entropy_coding_table >> 4];
+    const huffman_decode_table_t* ac_table = &d->ac_tables[c->entropy_coding_table & 0x0f];
+    bit_reader_t* br = &d->br;
+
+    int s = huffman_decode(br, dc_table);
+    if ((s < 0) || (s > 11)) {
+        return JPEG_REQUANTIZE_ERR_BAD_HUFFMAN_CODE;
+    }
+    *dc_pred += receive_extend(br, s);
+    block->values[0] = *dc_pred;
+
+    for (int k = 1; k < 64; k++) {
+        const int rs = huffman_decode(br, ac_table);
+        if (rs < 0) {
+            return rs;
+        }
+
+        s = rs & 0x0f;
+        if (s == 0) {
+            if ((rs >> 4) != 15) {
+                break;
+            }
+            k += 15;
+            continue;
+        }
+
+        k += (rs >> 4);
+        if (k > 63) {
+            return JPEG_REQUANTIZE_ERR_BAD_HUFFMAN_CODE;
+        }
+        block->values[k] = receive_extend(br, s);
+    }
+
+    // if any of the zeros that were fed in after the end of the data got used, it's truncated.
+    if ((br->fake_bytes * 8) > br->bits) {
+        return JPEG_REQUANTIZE_ERR_TRUNCATED;
+    }
+
+    return 0;
+}
+
+/**
+ * Checks for the expected RSTn marker at the end of a restart interval and resets everything.
+ */
+static int process_restart(decoder_t* d, int* dc_preds, int* expected_rst)
+{
+    bit_reader_t* br = &d->br;
+    while (((br->idx + 1) < br->len) && (br->data[br->idx] == 0xff) &&
+           (br->data[br->idx + 1] == 0xff)) {
+        br->idx++;
+    }
+    if (((br->idx + 1) >= br->len) || (br->data[br->idx] != 0xff) ||
+        (br->data[br->idx + 1] != (0xd0 + *expected_rst))) {
+        return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+    }
+    br->idx += 2;
+    *expected_rst = (*expected_rst + 1) & 0x07;
+
+    bit_reader_reset(br);
+    memset(dc_preds, 0, 4 * sizeof(int));
+    return 0;
+}
+
+static int decode_scan(decoder_t* d, jpeg_coefficients_t* coefficients, int end)
+{
+    if (d->idx >= end) {
+        return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+    }
+
+    jpeg_scan_header_t scan;
+    scan.num_components = d->data[d->idx++];
+    if ((scan.num_components < 1) || (scan.num_components > coefficients->frame.num_components) ||
+        ((d->idx + (2 * scan.num_components) + 3) > end)) {
+        return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+    }
+
+    int component_idx[4];
+    for (int i = 0; i < scan.num_components; i++) {
+        scan.csps[i].scan_component_selector = d->data[d->idx];
+        scan.csps[i].dc_ac_entropy_coding_table = d->data[d->idx + 1];
+        d->idx += 2;
+
+        component_idx[i] = -1;
+        for (int j = 0; j < coefficients->frame.num_components; j++) {
+            if (coefficients->frame.csps[j].component_identifier ==
+                scan.csps[i].scan_component_selector) {
+                component_idx[i] = j;
+            }
+        }
+        if (component_idx[i] < 0) {
+            return JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+        }
+
+        jpeg_dct_component_t* c = &coefficients->components[component_idx[i]];
+        c->entropy_coding_table = scan.csps[i].dc_ac_entropy_coding_table;
+        if (((c->entropy_coding_table >> 4) > 3) || ((c->entropy_coding_table & 0x0f) > 3) ||
+            !d->dc_tables[c->entropy_coding_table >> 4].valid ||
+            !d->ac_tables[c->entropy_coding_table & 0x0f].valid ||
+            !coefficients->quant_table_valid[c->quant_table_selector]) {
+            return JPEG_REQUANTIZE_ERR_MISSING_TABLE;
+        }
+    }
+
+    scan.selection_start = d->data[d->idx];
+    scan.selection_end = d->data[d->idx + 1];
+    scan.approximation_high_approximation_low = d->data[d->idx + 2];
+    if ((scan.selection_start != 0) || (scan.selection_end != 63) ||
+        (scan.approximation_high_approximation_low != 0)) {
+        return JPEG_REQUANTIZE_ERR_UNSUPPORTED;
+    }
+    d->idx = end;
+
+    d->br = (bit_reader_t){ .data = d->data, .len = d->len, .idx = d->idx };
+
+    int dc_preds[4] = { 0 };
+    int expected_rst = 0;
+    int retval;
+    if (scan.num_components == 1) {
+        // non-interleaved scans only cover the blocks that have part of the image in them.
+        jpeg_dct_component_t* c = &coefficients->components[component_idx[0]];
+        int H_max_factor = 1, V_max_factor = 1;
+        for (int j = 0; j < coefficients->frame.num_components; j++) {
+            if (coefficients->components[j].H_sample_factor > H_max_factor)
+                H_max_factor = coefficients->components[j].H_sample_factor;
+            if (coefficients->components[j].V_sample_factor > V_max_factor)
+                V_max_factor = coefficients->components[j].V_sample_factor;
+        }
+        const int width = ((coefficients->frame.samples_per_line * c->H_sample_factor) +
+                           H_max_factor - 1) / H_max_factor;
+        const int height = ((coefficients->frame.number_of_lines * c->V_sample_factor) +
+                            V_max_factor - 1) / V_max_factor;
+        const int blocks_across = (width + 7) / 8;
+        const int blocks_down = (height + 7) / 8;
+        const int stride = c->mcu_width * c->H_sample_factor;
+
+        for (int i = 0; i < (blocks_across * blocks_down); i++) {
+            if (coefficients->restart_interval && i && ((i % coefficients->restart_interval) == 0)) {
+                if ((retval = process_restart(d, dc_preds, &expected_rst))) {
+                    return retval;
+                }
+            }
+            dct_block_t* block = &c->blocks[((i / blocks_across) * stride) + (i % blocks_across)];
+            if ((retval = decode_block(d, c, &dc_preds[0], block))) {
+                return retval;
+            }
+        }
+    } else {
+        const int nmcus = coefficients->components[0].mcu_width *
+                          coefficients->components[0].mcu_height;
+        for (int mcu = 0; mcu < nmcus; mcu++) {
+            if (coefficients->restart_interval && mcu &&
+                ((mcu % coefficients->restart_interval) == 0)) {
+                if ((retval = process_restart(d, dc_preds, &expected_rst))) {
+                    return retval;
+                }
+            }
+
+            for (int i = 0; i < scan.num_components; i++) {
+                jpeg_dct_component_t* c = &coefficients->components[component_idx[i]];
+                const int mcu_x = mcu % c->mcu_width;
+                const int mcu_y = mcu / c->mcu_width;
+                const int stride = c->mcu_width * c->H_sample_factor;
+                for (int v = 0; v < c->V_sample_factor; v++) {
+                    for (int h = 0; h < c->H_sample_factor; h++) {
+                        const int x = (mcu_x * c->H_sample_factor) + h;
+                        const int y = (mcu_y * c->V_sample_factor) + v;
+                        if ((retval = decode_block(d, c, &dc_preds[i], &c->blocks[(y * stride) + x]))) {
+                            return retval;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // pick up at the marker after the scan.
+    d->idx = d->br.idx;
+    return 0;
+}
+
+int jpeg_coefficients_decode(const uint8_t* data, int len, jpeg_coefficients_t* coefficients)
+{
+    memset(coefficients, 0, sizeof(jpeg_coefficients_t));
+
+    if ((len < 4) || (data[0] != 0xff) || (data[1] != 0xd8)) {
+        return JPEG_REQUANTIZE_ERR_NOT_JPEG;
+    }
+
+    decoder_t* d = calloc(1, sizeof(decoder_t));
+    d->data = data;
+    d->len = len;
+    d->idx = 2;
+
+    bytearray_t* extra = bytearray_create();
+    bool have_frame = false;
+    bool have_scan = false;
+    int retval = 0;
+
+    while (1) {
+        // find the next marker, skipping fill bytes and anything else that's in the way.
+        while ((d->idx < len) && (data[d->idx] != 0xff)) {
+            d->idx++;
+        }
+        while (((d->idx + 1) < len) && (data[d->idx + 1] == 0xff)) {
+            d->idx++;
+        }
+        if ((d->idx + 1) >= len) {
+            retval = JPEG_REQUANTIZE_ERR_TRUNCATED;
+            goto _end;
+        }
+
+        const uint8_t marker = data[d->idx + 1];
+        const int marker_idx = d->idx;
+        d->idx += 2;
+
+        if (marker == 0xd9) {
+            retval = have_scan ? 0 : JPEG_REQUANTIZE_ERR_TRUNCATED;
+            goto _end;
+        }
+
+        if ((d->idx + 2) > len) {
+            retval = JPEG_REQUANTIZE_ERR_TRUNCATED;
+            goto _end;
+        }
+        const int segment_len = read_u16(d);
+        const int end = d->idx + segment_len - 2;
+        if ((segment_len < 2) || (end > len)) {
+            retval = JPEG_REQUANTIZE_ERR_TRUNCATED;
+            goto _end;
+        }
+
+        if ((marker == 0xc0) || (marker == 0xc1)) {
+            if (have_frame) {
+                retval = JPEG_REQUANTIZE_ERR_UNSUPPORTED;
+                goto _end;
+            }
+            retval = parse_sof(d, coefficients, end);
+            have_frame = true;
+        } else if (marker == 0xc4) {
+            retval = parse_dht(d, end);
+        } else if (marker == 0xdb) {
+            retval = parse_dqt(d, coefficients, end);
+        } else if (marker == 0xdd) {
+            if ((end - d->idx) < 2) {
+                retval = JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+                goto _end;
+            }
+            coefficients->restart_interval = read_u16(d);
+        } else if (marker == 0xda) {
+            if (!have_frame) {
+                retval = JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT;
+                goto _end;
+            }
+            if ((retval = decode_scan(d, coefficients, end))) {
+                goto _end;
+            }
+            have_scan = true;
+            continue;
+        } else if (((marker >= 0xe0) && (marker <= 0xef)) || (marker == 0xfe)) {
+            // APPn and COM get carried over to the output as-is.
+            bytearray_add_bytes(extra, &data[marker_idx], end - marker_idx);
+        } else if ((marker >= 0xc2) && (marker <= 0xcf) && (marker != 0xc4) && (marker != 0xc8) &&
+                   (marker != 0xcc)) {
+            // progressive, lossless, hierarchical and arithmetic-coded files
+            retval = JPEG_REQUANTIZE_ERR_UNSUPPORTED;
+        }
+
+        if (retval) {
+            goto _end;
+        }
+        d->idx = end;
+    }
+
+_end:
+    coefficients->extra_segments = extra->data;
+    coefficients->extra_segments_len = extra->size;
+    free(extra);
+    free(d);
+    if (retval) {
+        jpeg_coefficients_destroy(coefficients);
+    }
+    return retval;
+}
+
+void jpeg_coefficients_destroy(jpeg_coefficients_t* coefficients)
+{
+    for (int i = 0; i < 4; i++) {
+        free(coefficients->components[i].blocks);
+        coefficients->components[i].blocks = NULL;
+    }
+    free(coefficients->extra_segments);
+    coefficients->extra_segments = NULL;
+}
+
+// ======= requantization =======
+void jpeg_quantization_table_scale(const jpeg_quantization_table_t* in,
+                                   float scale,
+                                   jpeg_quantization_table_t* out)
+{
+    out->pq_tq = in->pq_tq;
+    for (int i = 0; i < 64; i++) {
+        int q = (int)lroundf(in->Q[i] * scale);
+        q = (q < in->Q[i]) ? in->Q[i] : q;
+        out->Q[i] = (q < 1) ? 1 : ((q > 255) ? 255 : q);
+    }
+}
+
+int jpeg_coefficients_requantize(const jpeg_coefficients_t* in,
+                                 const jpeg_quantization_table_t* new_tables[4],
+                                 jpeg_coefficients_t* out)
+{
+    memcpy(out, in, sizeof(jpeg_coefficients_t));
+    out->frame.csps = out->frame_csps;
+    out->extra_segments = malloc(in->extra_segments_len);
+    memcpy(out->extra_segments, in->extra_segments, in->extra_segments_len);
+
+    for (int t = 0; t < 4; t++) {
+        if (new_tables[t] && in->quant_table_valid[t]) {
+            out->quant_tables[t].pq_tq = in->quant_tables[t].pq_tq;
+            memcpy(out->quant_tables[t].Q, new_tables[t]->Q, 64);
+        }
+    }
+
+    for (int i = 0; i < in->frame.num_components; i++) {
+        const jpeg_dct_component_t* c = &in->components[i];
+        out->components[i].blocks = malloc(c->num_blocks * sizeof(dct_block_t));
+        if (out->components[i].blocks == NULL) {
+            jpeg_coefficients_destroy(out);
+            return JPEG_REQUANTIZE_ERR_OUT_OF_RANGE;
+        }
+
+        // Everything's in zig-zag order, so the quantization factors need to be too. c * old / new
+        // is rounded to the nearest integer with ties going towards 0; otherwise doubling a table
+        // would turn every +-1 into +-0.5 and round it right back to +-1.
+        int q_old[64], q_new[64];
+        for (int k = 0; k < 64; k++) {
+            q_old[k] = in->quant_tables[c->quant_table_selector].Q[natural_order[k]];
+            q_new[k] = out->quant_tables[c->quant_table_selector].Q[natural_order[k]];
+        }
+
+        for (uint32_t b = 0; b < c->num_blocks; b++) {
+            const int* src = c->blocks[b].values;
+            int* dst = out->components[i].blocks[b].values;
+            for (int k = 0; k < 64; k++) {
+                const int v = src[k] * q_old[k];
+                const int mag = (((v < 0) ? -v : v) + ((q_new[k] - 1) / 2)) / q_new[k];
+                dst[k] = (v < 0) ? -mag : mag;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// ======= encoding =======
+typedef struct huffman_code_table
+{
+    // size 0 means that there isn't a code for that symbol.
+    uint16_t code[256];
+    uint8_t size[256];
+} huffman_code_table_t;
+
+/**
+ * State for one pass over the coefficients. The first pass only counts symbols (bp == NULL) so
+ * that optimal tables can be made; the second one actually writes them.
+ */
+typedef struct encoder
+{
+    uint32_t dc_freq[2][257];
+    uint32_t ac_freq[2][257];
+
+    huffman_code_table_t dc_codes[2];
+    huffman_code_table_t ac_codes[2];
+
+    bit_packer_t* bp;
+    bytearray_t* ba;
+} encoder_t;
+
+/**
+ * Number of bits needed for a coefficient, and its coded bits; see section F.1.2.1.
+ */
+static inline int coefficient_category(int v, uint16_t* bits)
+{
+    const int mag = (v < 0) ? -v : v;
+    const int category = mag ? (32 - __builtin_clz(mag)) : 0;
+    *bits = (v < 0) ? (v + (1 << category) - 1) : v;
+    return category;
+}
+
+static inline int emit_symbol(encoder_t* e, bool ac, int table, int symbol)
+{
+    if (e->bp == NULL) {
+        (ac ? e->ac_freq : e->dc_freq)[table][symbol]++;
+        return 0;
+    }
+
+    const huffman_code_table_t* codes = ac ? &e->ac_codes[table] : &e->dc_codes[table];
+    if (codes->size[symbol] == 0) {
+        return JPEG_REQUANTIZE_ERR_OUT_OF_RANGE;
+    }
+    bit_packer_pack_u16(codes->code[symbol], codes->size[symbol], e->bp);
+    return 0;
+}
+
+static inline void emit_bits(encoder_t* e, uint16_t bits, int n)
+{
+    if ((e->bp != NULL) && n) {
+        bit_packer_pack_u16(bits, n, e->bp);
+    }
+}
+
+/**
+ * Moves everything that's been packed so far into the output. The bit packer has already stuffed
+ * the 0xff's.
+ */
+static void flush_entropy_coded_segment(encoder_t* e)
+{
+    if (e->bp == NULL) {
+        return;
+    }
+
+    bit_packer_fill_endbits(e->bp);
+    for (int i = 0; i < e->bp->curidx; i++) {
+        bytearray_add_byte(e->ba, e->bp->data[i]);
+    }
+
+    bit_packer_reset(e->bp);
+}
+
+static int encode_block(encoder_t* e, int table, const int* zz, int* dc_pred)
+{
+    int retval;
+    uint16_t bits;
+
+    // DC
+    const int diff = zz[0] - *dc_pred;
+    *dc_pred = zz[0];
+    int s = coefficient_category(diff, &bits);
+    if (s > 11) {
+        return JPEG_REQUANTIZE_ERR_OUT_OF_RANGE;
+    }
+    if ((retval = emit_symbol(e, false, table, s))) {
+        return retval;
+    }
+    emit_bits(e, bits, s);
+
+    // AC
+    int last = 63;
+    while ((last > 0) && (zz[last] == 0)) {
+        last--;
+    }
+
+    int run = 0;
+    for (int k = 1; k <= last; k++) {
+        if (zz[k] == 0) {
+            run++;
+            continue;
+        }
+
+        while (run > 15) {
+            if ((retval = emit_symbol(e, true, table, 0xf0))) {
+                return retval;
+            }
+            run -= 16;
+        }
+
+        s = coefficient_category(zz[k], &bits);
+        if (s > 10) {
+            return JPEG_REQUANTIZE_ERR_OUT_OF_RANGE;
+        }
+        if ((retval = emit_symbol(e, true, table, (run << 4) | s))) {
+            return retval;
+        }
+        emit_bits(e, bits, s);
+        run = 0;
+    }
+
+    if (last < 63) {
+        return emit_symbol(e, true, table, 0x00);
+    }
+    return 0;
+}
+
+/**
+ * Goes through every block in the order they go in the scan. Component 0 uses table 0 and all the
+ * others share table 1, like luma and chroma usually do.
+ */
+static int encode_scan(encoder_t* e, const jpeg_coefficients_t* coefficients)
+{
+    const int ncomponents = coefficients->frame.num_components;
+    const jpeg_dct_component_t* c0 = &coefficients->components[0];
+
+    // A single-component scan is non-interleaved, so it only covers blocks that have part of the
+    // image in them, and every block is its own MCU.
+    int nmcus = c0->mcu_width * c0->mcu_height;
+    int blocks_across = 0;
+    if (ncomponents == 1) {
+        blocks_across = (coefficients->frame.samples_per_line + 7) / 8;
+        nmcus = blocks_across * ((coefficients->frame.number_of_lines + 7) / 8);
+    }
+
+    int dc_preds[4] = { 0 };
+    int rst = 0;
+    int retval;
+    for (int mcu = 0; mcu < nmcus; mcu++) {
+        if (coefficients->restart_interval && mcu && ((mcu % coefficients->restart_interval) == 0)) {
+            flush_entropy_coded_segment(e);
+            if (e->bp != NULL) {
+                bytearray_add_bytes(e->ba, (uint8_t[]){ 0xff, 0xd0 + rst }, 2);
+            }
+            rst = (rst + 1) & 0x07;
+            memset(dc_preds, 0, sizeof(dc_preds));
+        }
+
+        if (ncomponents == 1) {
+            const int stride = c0->mcu_width * c0->H_sample_factor;
+            const dct_block_t* block = &c0->blocks[((mcu / blocks_across) * stride) +
+                                                   (mcu % blocks_across)];
+            if ((retval = encode_block(e, 0, block->values, &dc_preds[0]))) {
+                return retval;
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ncomponents; i++) {
+            const jpeg_dct_component_t* c = &coefficients->components[i];
+            const int mcu_x = mcu % c->mcu_width;
+            const int mcu_y = mcu / c->mcu_width;
+            const int stride = c->mcu_width * c->H_sample_factor;
+            for (int v = 0; v < c->V_sample_factor; v++) {
+                for (int h = 0; h < c->H_sample_factor; h++) {
+                    const int x = (mcu_x * c->H_sample_factor) + h;
+                    const int y = (mcu_y * c->V_sample_factor) + v;
+                    if ((retval = encode_block(e, (i == 0) ? 0 : 1, c->blocks[(y * stride) + x].values,
+                                               &dc_preds[i]))) {
+                        return retval;
+                    }
+                }
+            }
+        }
+    }
+
+    flush_entropy_coded_segment(e);
+    return 0;
+}
+
+/**
+ * Makes an optimal huffman table for the given symbol frequencies; see section K.2 of T.81.
+ * freq[256] gets used for the reserved code point that keeps any code from being all 1's.
+ */
+static void huffman_table_generate_optimal(uint32_t* freq, uint8_t tc_td, jpeg_huffman_table_t* table)
+{
+    int codesize[257] = { 0 };
+    int others[257];
+    int bits[33] = { 0 };
+    for (int i = 0; i < 257; i++) {
+        others[i] = -1;
+    }
+    freq[256] = 1;
+
+    while (1) {
+        // v1 is the least frequent symbol, v2 the next least; ties go to the bigger symbol.
+        int v1 = -1, v2 = -1;
+        for (int i = 0; i < 257; i++) {
+            if (freq[i] && ((v1 < 0) || (freq[i] <= freq[v1]))) {
+                v1 = i;
+            }
+        }
+        for (int i = 0; i < 257; i++) {
+            if (freq[i] && (i != v1) && ((v2 < 0) || (freq[i] <= freq[v2]))) {
+                v2 = i;
+            }
+        }
+        if (v2 < 0) {
+            break;
+        }
+
+        freq[v1] += freq[v2];
+        freq[v2] = 0;
+
+        codesize[v1]++;
+        while (others[v1] >= 0) {
+            v1 = others[v1];
+            codesize[v1]++;
+        }
+        others[v1] = v2;
+
+        codesize[v2]++;
+        while (others[v2] >= 0) {
+            v2 = others[v2];
+            codesize[v2]++;
+        }
+    }
+
+    for (int i = 0; i < 257; i++) {
+        if (codesize[i]) {
+            bits[codesize[i]]++;
+        }
+    }
+
+    // codes can't be longer than 16 bits (figure K.3)
+    for (int i = 32; i > 16; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) {
+                j--;
+            }
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+
+    // take the reserved code point back out
+    int i = 16;
+    while (bits[i] == 0) {
+        i--;
+    }
+    bits[i]--;
+
+    table->tc_td = tc_td;
+    int nvalues = 0;
+    for (int l = 1; l <= 16; l++) {
+        table->number_of_codes_with_length[l - 1] = bits[l];
+    }
+    for (int size = 1; size <= 32; size++) {
+        for (int s = 0; s < 256; s++) {
+            if (codesize[s] == size) {
+                table->huffman_codes[nvalues++] = s;
+            }
+        }
+    }
+    table->header.segment_marker = 0xc4;
+    table->header.Ls = 2 + 1 + 16 + nvalues;
+}
+
+static void huffman_code_table_init(const jpeg_huffman_table_t* t, huffman_code_table_t* codes)
+{
+    memset(codes, 0, sizeof(huffman_code_table_t));
+
+    uint16_t code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        for (int i = 0; i < t->number_of_codes_with_length[l - 1]; i++, k++) {
+            codes->code[t->huffman_codes[k]] = code++;
+            codes->size[t->huffman_codes[k]] = l;
+        }
+        code <<= 1;
+    }
+}
+
+static void write_huffman_table(const jpeg_huffman_table_t* t, bytearray_t* ba)
+{
+    const uint8_t header[] = { 0xff, t->header.segment_marker, t->header.Ls >> 8, t->header.Ls & 0xff,
+                               t->tc_td };
+    bytearray_add_bytes(ba, header, sizeof(header));
+    bytearray_add_bytes(ba, t->number_of_codes_with_length, 16);
+    bytearray_add_bytes(ba, t->huffman_codes, t->header.Ls - 19);
+}
+
+int jpeg_coefficients_encode(const jpeg_coefficients_t* coefficients, uint8_t** dest)
+{
+    *dest = NULL;
+
+    const jpeg_frame_header_t* frame = &coefficients->frame;
+    const int ntables = (frame->num_components > 1) ? 2 : 1;
+    int retval;
+
+    // ======= pass 1: gather statistics for the huffman tables =======
+    encoder_t* e = calloc(1, sizeof(encoder_t));
+    if ((retval = encode_scan(e, coefficients))) {
+        free(e);
+        return retval;
+    }
+
+    jpeg_huffman_table_t dc_tables[2], ac_tables[2];
+    for (int t = 0; t < ntables; t++) {
+        huffman_table_generate_optimal(e->dc_freq[t], 0x00 | t, &dc_tables[t]);
+        huffman_table_generate_optimal(e->ac_freq[t], 0x10 | t, &ac_tables[t]);
+        huffman_code_table_init(&dc_tables[t], &e->dc_codes[t]);
+        huffman_code_table_init(&ac_tables[t], &e->ac_codes[t]);
+    }
+
+    // ======= headers =======
+    bytearray_t* ba = bytearray_create();
+    bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xd8 }, 2);
+    if (coefficients->extra_segments_len) {
+        bytearray_add_bytes(ba, coefficients->extra_segments, coefficients->extra_segments_len);
+    } else {
+        const char* jfifseg = "\xff\xe0\x00\x10JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00";
+        bytearray_add_bytes(ba, (const uint8_t*)jfifseg, 18);
+    }
+
+    for (int t = 0; t < 4; t++) {
+        if (coefficients->quant_table_valid[t]) {
+            bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xdb, 0x00, 67, t }, 5);
+            uint8_t zigged[64];
+            for (int k = 0; k < 64; k++) {
+                zigged[k] = coefficients->quant_tables[t].Q[natural_order[k]];
+            }
+            bytearray_add_bytes(ba, zigged, 64);
+        }
+    }
+
+    const int SOF_len = 8 + (3 * frame->num_components);
+    bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xc0, SOF_len >> 8, SOF_len & 0xff, 8,
+                                         frame->number_of_lines >> 8, frame->number_of_lines & 0xff,
+                                         frame->samples_per_line >> 8, frame->samples_per_line & 0xff,
+                                         frame->num_components }, 10);
+    for (int i = 0; i < frame->num_components; i++) {
+        bytearray_add_bytes(ba, (uint8_t[]){ frame->csps[i].component_identifier,
+                                             (frame->csps[i].horizontal_sampling_factor << 4) |
+                                             frame->csps[i].vertical_sampling_factor,
+                                             frame->csps[i].quantization_table_selector }, 3);
+    }
+
+    for (int t = 0; t < ntables; t++) {
+        write_huffman_table(&dc_tables[t], ba);
+        write_huffman_table(&ac_tables[t], ba);
+    }
+
+    if (coefficients->restart_interval) {
+        bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xdd, 0x00, 0x04,
+                                             coefficients->restart_interval >> 8,
+                                             coefficients->restart_interval & 0xff }, 6);
+    }
+
+    const int SOS_len = 6 + (2 * frame->num_components);
+    bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xda, SOS_len >> 8, SOS_len & 0xff,
+                                         frame->num_components }, 5);
+    for (int i = 0; i < frame->num_components; i++) {
+        const uint8_t table = (i == 0) ? 0x00 : 0x11;
+        bytearray_add_bytes(ba, (uint8_t[]){ frame->csps[i].component_identifier, table }, 2);
+    }
+    bytearray_add_bytes(ba, (uint8_t[]){ 0, 63, 0 }, 3);
+
+    // ======= pass 2: entropy-coded data =======
+    e->bp = bit_packer_create();
+    e->ba = ba;
+    retval = encode_scan(e, coefficients);
+    bit_packer_destroy(e->bp);
+    free(e);
+
+    bytearray_add_bytes(ba, (uint8_t[]){ 0xff, 0xd9 }, 2);
+
+    if (retval) {
+        free(ba->data);
+        free(ba);
+        return retval;
+    }
+
+    *dest = ba->data;
+    const int len = ba->size;
+    free(ba);
+    return len;
+}
@@ -0,0 +1,87 @@
+#ifndef JPEG_REQUANTIZE_H
+#define JPEG_REQUANTIZE_H
+
+#include <stdint.h>
+#include "jpeg.h"
+
+/**
+ * Requantizes baseline jpegs without ever leaving the DCT domain.
+ *
+ * A jpeg's entropy-coded data is just quantized DCT coefficients, so shrinking a jpeg doesn't need
+ * an IDCT and another FDCT: each coefficient c that was quantized with q_old can be turned into
+ * round(c * q_old / q_new) directly. The file gets re-encoded with optimal huffman tables for the
+ * new coefficients.
+ *
+ * Only 8-bit, huffman-coded sequential files (SOF0 / SOF1) with 8-bit quantization tables are
+ * supported, which covers anything that comes out of a camera.
+ */
+
+// error codes
+#define JPEG_REQUANTIZE_ERR_NOT_JPEG            (-1)
+#define JPEG_REQUANTIZE_ERR_TRUNCATED           (-2)
+#define JPEG_REQUANTIZE_ERR_UNSUPPORTED         (-3)
+#define JPEG_REQUANTIZE_ERR_BAD_MARKER_SEGMENT  (-4)
+#define JPEG_REQUANTIZE_ERR_BAD_HUFFMAN_CODE    (-5)
+#define JPEG_REQUANTIZE_ERR_MISSING_TABLE       (-6)
+#define JPEG_REQUANTIZE_ERR_OUT_OF_RANGE        (-7)
+
+typedef struct jpeg_coefficients
+{
+    // frame.csps points at frame_csps.
+    jpeg_frame_header_t frame;
+    frame_component_specification_parameters_t frame_csps[4];
+
+    // Quantization tables, in natural (row-major) order like the ones in jpeg.c. Only the ones that
+    // some component uses are valid.
+    int quant_table_valid[4];
+    jpeg_quantization_table_t quant_tables[4];
+
+    // One per frame component, in the same order as the frame header. blocks[] covers the whole
+    // component padded out to a whole number of MCUs, (mcu_width * H_sample_factor) blocks across
+    // and (mcu_height * V_sample_factor) blocks down. Every block holds quantized coefficients in
+    // zig-zag order, and DC values are absolute, not differences.
+    jpeg_dct_component_t components[4];
+
+    // in MCUs, 0 if there isn't a restart interval.
+    int restart_interval;
+
+    // APPn and COM segments from the original file, markers and all, so that metadata survives.
+    uint8_t* extra_segments;
+    int extra_segments_len;
+} jpeg_coefficients_t;
+
+/**
+ * Parses a jpeg and entropy-decodes it into quantized coefficients.
+ */
+int jpeg_coefficients_decode(const uint8_t* data, int len, jpeg_coefficients_t* coefficients);
+
+void jpeg_coefficients_destroy(jpeg_coefficients_t* coefficients);
+
+/**
+ * Makes a copy of 'in' with every component requantized to the corresponding table in
+ * new_tables[], indexed by quantization table selector. NULL entries leave that table alone.
+ *
+ * New tables that are finer than the original ones are allowed but pointless; they can't bring
+ * back any detail.
+ */
+int jpeg_coefficients_requantize(const jpeg_coefficients_t* in,
+                                 const jpeg_quantization_table_t* new_tables[4],
+                                 jpeg_coefficients_t* out);
+
+/**
+ * Multiplies every entry in a quantization table by 'scale', rounding and clamping to [1, 255].
+ * Entries never get smaller than the original ones.
+ */
+void jpeg_quantization_table_scale(const jpeg_quantization_table_t* in,
+                                   float scale,
+                                   jpeg_quantization_table_t* out);
+
+/**
+ * Re-encodes coefficients as a baseline jpeg with optimal huffman tables. All of the components go
+ * into one scan.
+ *
+ * returns the length of the bytestream, or < 0 on error.
+ */
+int jpeg_coefficients_encode(const jpeg_coefficients_t* coefficients, uint8_t** dest);
+
+#endif
@@ -3,8 +3,8 @@
  */
 
 #include <math.h>
-#include <pam.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -16,8 +16,8 @@ typedef struct image_dct
     int width;
     int height;
 
-    // 8x8 blocks
-    int** blocks;
+    // 8x8 blocks, row-major, all in one allocation.
+    dct_block_t* blocks;
 } image_dct_t;
 
 /**
@@ -28,15 +28,14 @@ image_dct_t* image_dct_create(image_t* image)
     image_dct_t* result = calloc(1, sizeof(image_dct_t));
     result->width  = (image->width + 7)/ 8;
     result->height = (image->height + 7) / 8;
-    result->blocks = calloc(result->width * result->height, sizeof(int*));
+    result->blocks = calloc(result->width * result->height, sizeof(dct_block_t));
 
+    int this_mcu[64];
     for (int block_y = 0; block_y < result->height; block_y++) {
         for (int block_x = 0; block_x < result->width; block_x++) {
             int blockidx = (block_y * result->width) + block_x;
-            int* this_mcu = image_copy_mcu(image, block_x * 8, block_y * 8);
-            result->blocks[blockidx] = calloc(64, sizeof(int));
-            mcu_fdct_floats(this_mcu, result->blocks[blockidx]);
-            free(this_mcu);
+            image_copy_mcu_into(image, block_x * 8, block_y * 8, this_mcu);
+            mcu_fdct_floats(this_mcu, result->blocks[blockidx].values);
         }
     }
 
@@ -45,9 +44,6 @@ image_dct_t* image_dct_create(image_t* image)
 
 void image_dct_destroy(image_dct_t* dct)
 {
-    for (int i = 0; i < dct->height * dct->width; i++) {
-        free(dct->blocks[i]);
-    }
     free(dct->blocks);
     free(dct);
 }
@@ -168,7 +164,11 @@ int main(int argc, char** argv)
         return -1;
     }
 
-    image_t* image = image_create_from_pam(argv[1], argv[0]);
+    image_t* image = image_create_from_pam(argv[1]);
+    if (image == NULL) {
+        printf("failed to load %s\n", argv[1]);
+        return -1;
+    }
     image_level_shift(image);
 
     if (((image->width % 8) != 0) || ((image->height % 8) != 0)) {
@@ -182,12 +182,20 @@ int main(int argc, char** argv)
     const component_params_t chrom_params2 = {1, 1, 1, 1};
     const component_params_t* component_params[] = { &lum_params, &chrom_params1, &chrom_params2 };
 
+    // grayscale images only have one plane, so they get coded as a single un-subsampled component.
+    const component_params_t gray_params = {1, 1, 0, 0};
+    const component_params_t* gray_component_params[] = { &gray_params };
+
     const jpeg_quantization_table_t* quant_tables[] = { &lum_quant_table_high, &chrom_quant_table_medium, NULL, NULL };
 
     uint8_t* jpeg_out;
-    //uncoded_jpeg_scan_t* scan = uncoded_jpeg_scan_create(image, component_params, 1, quant_tables);
-    image_jfif_RGB_to_YCbCr(image);
-    uncoded_jpeg_scan_t* scan = uncoded_jpeg_scan_create(image, component_params, 3, quant_tables);
+    uncoded_jpeg_scan_t* scan;
+    if (image->depth >= 3) {
+        image_jfif_RGB_to_YCbCr(image);
+        scan = uncoded_jpeg_scan_create(image, component_params, 3, quant_tables);
+    } else {
+        scan = uncoded_jpeg_scan_create(image, gray_component_params, 1, quant_tables);
+    }
 
     for (int x = 0; x < 0; x++) {
         printf("MCU (X, Y) (%i, 3) DC diff = %i\n", x,
@@ -218,6 +226,8 @@ int main(int argc, char** argv)
 
     fclose(outfile);
 
+    free(jpeg_out);
+    uncoded_jpeg_scan_destroy(scan);
     image_destroy(image);
 
     return 0;
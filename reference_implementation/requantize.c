@@ -0,0 +1,178 @@
+/**
+ * Copyright 2020, John Mamish
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jpeg_requantize.h"
+
+/**
+ * Requantizes coefficients with every quant table scaled by 'scale' and encodes the result.
+ *
+ * returns the length of the new jpeg, or < 0 on error.
+ */
+static int requantize_with_scale(const jpeg_coefficients_t* original, float scale, uint8_t** dest)
+{
+    *dest = NULL;
+
+    jpeg_quantization_table_t scaled[4];
+    const jpeg_quantization_table_t* new_tables[4] = { NULL };
+    for (int t = 0; t < 4; t++) {
+        if (original->quant_table_valid[t]) {
+            jpeg_quantization_table_scale(&original->quant_tables[t], scale, &scaled[t]);
+            new_tables[t] = &scaled[t];
+        }
+    }
+
+    jpeg_coefficients_t requantized;
+    int retval = jpeg_coefficients_requantize(original, new_tables, &requantized);
+    if (retval) {
+        return retval;
+    }
+
+    retval = jpeg_coefficients_encode(&requantized, dest);
+    jpeg_coefficients_destroy(&requantized);
+    return retval;
+}
+
+static uint8_t* read_file(const char* path, int* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* data = malloc(*len);
+    if (fread(data, *len, 1, f) != 1) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static void usage(const char* argv0)
+{
+    printf("Usage: %s [-s scale | -b max_bytes] <input jpeg> <output jpeg>\n", argv0);
+    printf("    -s scale       multiply every quantization table entry by scale (default 2.0).\n");
+    printf("    -b max_bytes   find the smallest scale that makes the output fit in max_bytes. If\n");
+    printf("                   nothing fits, the smallest output is written and the exit code is\n");
+    printf("                   nonzero.\n");
+}
+
+int main(int argc, char** argv)
+{
+    float scale = 2.f;
+    int max_bytes = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:")) != -1) {
+        switch (opt) {
+            case 's': scale = atof(optarg); break;
+            case 'b': max_bytes = atoi(optarg); break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    if (((argc - optind) != 2) || (scale < 1.f) || (max_bytes < 0)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    int retval = 0;
+    int inlen = 0;
+    uint8_t* indata = NULL;
+    uint8_t* outdata = NULL;
+    jpeg_coefficients_t original;
+    memset(&original, 0, sizeof(original));
+
+    if ((indata = read_file(argv[optind], &inlen)) == NULL) {
+        fprintf(stderr, "failed to read %s\n", argv[optind]);
+        retval = -1;
+        goto _end;
+    }
+
+    if ((retval = jpeg_coefficients_decode(indata, inlen, &original))) {
+        fprintf(stderr, "failed to decode %s (error %i)\n", argv[optind], retval);
+        goto _end;
+    }
+
+    int outlen;
+    bool over_budget = false;
+    if (max_bytes == 0) {
+        outlen = requantize_with_scale(&original, scale, &outdata);
+    } else {
+        // Output size goes down as the scale goes up (almost always; rounding can make it wobble a
+        // tiny bit), so a binary search finds the smallest scale that fits. Every try starts over
+        // from the original coefficients so that rounding errors don't pile up.
+        float lo = 1.f, hi = 1.f;
+        outlen = requantize_with_scale(&original, hi, &outdata);
+        while ((outlen > max_bytes) && (hi < 256.f)) {
+            free(outdata);
+            lo = hi;
+            hi *= 2.f;
+            outlen = requantize_with_scale(&original, hi, &outdata);
+        }
+
+        if ((outlen > max_bytes) || (hi == 1.f)) {
+            scale = hi;
+        } else {
+            for (int i = 0; i < 12; i++) {
+                const float mid = (lo + hi) / 2.f;
+                uint8_t* middata;
+                const int midlen = requantize_with_scale(&original, mid, &middata);
+                if ((midlen > 0) && (midlen <= max_bytes)) {
+                    free(outdata);
+                    outdata = middata;
+                    outlen = midlen;
+                    hi = mid;
+                } else {
+                    free(middata);
+                    lo = mid;
+                }
+            }
+            scale = hi;
+        }
+
+        if (outlen > max_bytes) {
+            fprintf(stderr, "%s can't be made smaller than %i bytes\n", argv[optind], outlen);
+            over_budget = true;
+        }
+    }
+
+    if (outlen < 0) {
+        fprintf(stderr, "failed to re-encode %s (error %i)\n", argv[optind], outlen);
+        retval = outlen;
+        goto _end;
+    }
+
+    FILE* outfile = fopen(argv[optind + 1], "wb");
+    if (outfile == NULL) {
+        fprintf(stderr, "failed to open %s for writing\n", argv[optind + 1]);
+        retval = -1;
+        goto _end;
+    }
+    if (fwrite(outdata, outlen, 1, outfile) != 1) {
+        fprintf(stderr, "failed to write %s\n", argv[optind + 1]);
+        retval = -1;
+    }
+    fclose(outfile);
+
+    printf("%s: %i bytes -> %i bytes (quant tables x%.3f)\n", argv[optind], inlen, outlen, scale);
+    if (over_budget && (retval == 0)) {
+        retval = -1;
+    }
+
+_end:
+    jpeg_coefficients_destroy(&original);
+    free(outdata);
+    free(indata);
+    return retval;
+}
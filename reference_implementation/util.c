@@ -1,4 +1,5 @@
 #include "util.h"
+#include "pnm.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -56,7 +57,9 @@ void bytearray_add_byte(bytearray_t* arr, uint8_t byte)
 void bytearray_add_bytes(bytearray_t* arr, const uint8_t* bytes, int len)
 {
     if ((arr->size + len) > arr->capacity) {
-        arr->capacity *= 2;
+        while ((arr->size + len) > arr->capacity) {
+            arr->capacity *= 2;
+        }
         arr->data = realloc(arr->data, arr->capacity);
     }
 
@@ -64,81 +67,76 @@ void bytearray_add_bytes(bytearray_t* arr, const uint8_t* bytes, int len)
     arr->size += len;
 }
 
-image_t* image_create_from_pam(const char* file, char* argv0)
+image_t* image_create_from_pam(const char* file)
 {
-    image_t* result = calloc(1, sizeof(image_t*));
-
-    pm_init(argv0, 0);
+    pnm_image_t pnm;
+    if (pnm_image_map(file, &pnm)) {
+        return NULL;
+    }
 
-    struct pam image;
-    tuple * tuplerow;
-    unsigned int row;
+    image_t* result = NULL;
+    if (pnm.depth > 4) {
+        goto _end;
+    }
 
-    FILE* fp = fopen(file, "r");
-    pnm_readpaminit(fp, &image, PAM_STRUCT_SIZE(tuple_type));
+    result = calloc(1, sizeof(image_t));
+    result->height = pnm.height;
+    result->width  = pnm.width;
+    result->depth  = pnm.depth;
+    result->stride = ((pnm.width + IMAGE_ROW_ALIGN - 1) / IMAGE_ROW_ALIGN) * IMAGE_ROW_ALIGN;
 
-    result->height = image.height;
-    result->width  = image.width;
-    result->depth  = image.depth;
-    if (result->depth > 4) {
-        goto _fail_cleanup1;
+    const size_t plane_size = (size_t)result->stride * result->height;
+    result->planes[0] = calloc(plane_size * result->depth, sizeof(int16_t));
+    for (int plane = 1; plane < result->depth; plane++) {
+        result->planes[plane] = result->planes[0] + (plane * plane_size);
     }
 
-    result->components = calloc(result->height * result->width, 4 * sizeof(int));
-    tuplerow = pnm_allocpamrow(&image);
-    for (row = 0; row < image.height; row++) {
-        unsigned int column;
-        pnm_readpamrow(&image, tuplerow);
-        for (column = 0; column < image.width; ++column) {
-            unsigned int plane;
-            for (plane = 0; plane < image.depth; ++plane) {
-                result->components[(row * result->width) + column][plane] = tuplerow[column][plane];
+    // de-interleave the raster one row at a time.
+    for (int y = 0; y < result->height; y++) {
+        const uint8_t* src = pnm.pixels + ((size_t)y * pnm.width * pnm.depth);
+        for (int plane = 0; plane < pnm.depth; plane++) {
+            int16_t* dst = result->planes[plane] + ((size_t)y * result->stride);
+            for (int x = 0; x < result->width; x++) {
+                dst[x] = src[(x * pnm.depth) + plane];
             }
         }
     }
-    pnm_freepamrow(tuplerow);
 
+_end:
+    pnm_image_unmap(&pnm);
     return result;
-
-//_fail_cleanup0:
-//    free(result->components);
-//    pnm_freepamrow(tuplerow);
-
-_fail_cleanup1:
-    free(result);
-    return NULL;
 }
 
 void image_destroy(image_t* image)
 {
-    free(image->components);
+    free(image->planes[0]);
     free(image);
 }
 
 void image_jfif_RGB_to_YCbCr(image_t* im)
 {
+    // whole padded rows get converted; the padding is never read, so it doesn't matter what ends
+    // up there, and the loop bound being a multiple of IMAGE_ROW_ALIGN keeps the compiler happy.
     for (int y = 0; y < im->height; y++) {
-        for (int x = 0; x < im->width; x++) {
-            int idx = y * im->width + x;
-
-            int temp[3];
-            memcpy(temp, im->components[idx], 3 * sizeof(int));
-            im->components[idx][0] = ((76 * temp[0]) + (150 * temp[1]) + (29 * temp[2])) / 256;
-            im->components[idx][1] = ((-43 * temp[0]) + (-85 * temp[1]) + (128 * temp[2]) + 128) / 256;
-            im->components[idx][2] = ((128 * temp[0]) + (-107* temp[1]) + (-21 * temp[2]) + 128) / 256;
+        int16_t* restrict r = im->planes[0] + (y * im->stride);
+        int16_t* restrict g = im->planes[1] + (y * im->stride);
+        int16_t* restrict b = im->planes[2] + (y * im->stride);
+        for (int x = 0; x < im->stride; x++) {
+            const int R = r[x], G = g[x], B = b[x];
+            r[x] = ((76 * R) + (150 * G) + (29 * B)) / 256;
+            g[x] = ((-43 * R) + (-85 * G) + (128 * B) + 128) / 256;
+            b[x] = ((128 * R) + (-107* G) + (-21 * B) + 128) / 256;
         }
     }
 }
 
 void image_level_shift(image_t* im)
 {
-    for (int y = 0; y < im->height; y++) {
-        for (int x = 0; x < im->width; x++) {
-            int idx = y * im->width + x;
-            for (int i = 0; i < 4; i++) {
-                im->components[idx][i] -= 128;
-            }
-        }
+    // all of the planes are contiguous, so this is just one long loop.
+    const size_t nsamples = (size_t)im->stride * im->height * im->depth;
+    int16_t* restrict samples = im->planes[0];
+    for (size_t i = 0; i < nsamples; i++) {
+        samples[i] -= 128;
     }
 }
 
@@ -150,17 +148,20 @@ void image_pad_out(image_t* im)
 int* image_copy_mcu(image_t* im, int xstart, int ystart)
 {
     int* result = calloc(64, sizeof(int));
+    image_copy_mcu_into(im, xstart, ystart, result);
+    return result;
+}
 
+void image_copy_mcu_into(const image_t* im, int xstart, int ystart, int* dest)
+{
     for (int y = ystart; y < (ystart + 8); y++) {
+        const int16_t* row = im->planes[0] + (y * im->stride);
         for (int x = xstart; x < (xstart + 8); x++) {
-            int im_idx = (y * im->width) + x;
             int res_idx = (y - ystart) * 8 + (x - xstart);
 
-            result[res_idx] = im->components[im_idx][0];
+            dest[res_idx] = row[x];
         }
     }
-
-    return result;
 }
 
 
@@ -198,41 +199,40 @@ void mcu_fdct_floats(int* data_in, int* data_out)
 
 
 /**
- * data_in is 24q7, but should be treated as if it's just q7.
- * data_out is in 24q7, but should be treated as if it's just 8q7.
+ * Same O(n^4) DCT as mcu_fdct_floats, but every cosine is truncated to q7 and every product is
+ * truncated back down before it's accumulated, roughly the way narrow fixed-point hardware would
+ * do it.
  */
-#if 0
 void mcu_fdct_fixedpoint(int* data_in, int* data_out)
 {
-    memset(data_out, 0, sizeof(data_out));
+    int accum[64];
+    memset(accum, 0, sizeof(accum));
 
-    // input data is  output data is in 16q15
     for (int v = 0; v < 8; v++) {
         for (int u = 0; u < 8; u++) {
             for (int y = 0; y < 8; y++) {
                 for (int x = 0; x < 8; x++) {
                     int data_in_idx = y * 8 + x;
-                    float coeff = (((int)floor(128.f * cos(((2.f * (float)x + 1.f) * u * PI) / 16))) *
-                                   ((int)floor(128.f * cos(((2.f * (float)y + 1.f) * v * PI) / 16)))) / 128;
-                    data_out[v * 8 + u] += ((data_in[data_in_idx]) * coeff) / 128;
+                    int coeff = (((int)floor(128.f * cos(((2.f * (float)x + 1.f) * u * PI) / 16))) *
+                                 ((int)floor(128.f * cos(((2.f * (float)y + 1.f) * v * PI) / 16)))) / 128;
+                    accum[v * 8 + u] += ((data_in[data_in_idx]) * coeff) / 128;
                 }
             }
-            data_out[v * 8 + u] /= 4.f;
+            accum[v * 8 + u] /= 4;
         }
     }
 
     for (int j = 0; j < 8; j++) {
         for (int i = 0; i < 8; i++) {
             // for u, v = 0, component is scaled by (1 / sqrt(2))
-            float Cv = (j == 0) ? (int)floor(128.f * (1 / sqrt(2))) : 1;
-            float Cu = (i == 0) ? (int)floor(128.f * (1 / sqrt(2))) : 1;
+            int Cv = (j == 0) ? (int)floor(128.f * (1 / sqrt(2))) : 128;
+            int Cu = (i == 0) ? (int)floor(128.f * (1 / sqrt(2))) : 128;
 
             int data_out_idx = j * 8 + i;
-            data_out[data_out_idx] = (data_out[j][i] * Cu * Cv) / (128 * 128);
+            data_out[data_out_idx] = (accum[data_out_idx] * Cu * Cv) / (128 * 128);
         }
     }
 }
-#endif
 
 
 /**
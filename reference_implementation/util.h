@@ -1,16 +1,8 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
-#include <pam.h>
 #include <stdint.h>
 
-#define PAM_MEMBER_OFFSET(mbrname)                    \
-  ((unsigned long int)(char*)&((struct pam *)0)->mbrname)
-#define PAM_MEMBER_SIZE(mbrname) \
-  sizeof(((struct pam *)0)->mbrname)
-#define PAM_STRUCT_SIZE(mbrname) \
-(PAM_MEMBER_OFFSET(mbrname) + PAM_MEMBER_SIZE(mbrname))
-
 #define PI (3.14159265358979f)
 
 
@@ -23,12 +15,22 @@ const extern int quant_table_low_quality[64];
 typedef struct image {
     int width;
     int height;
+
+    // number of planes. Supports images with up to 4 components.
     int depth;
 
-    // supports images with up to 4 components.
-    int (*components)[4];
+    // distance in samples from the start of one row to the start of the next. Rows are padded out
+    // to a multiple of IMAGE_ROW_ALIGN samples so that loops over a row don't need a scalar tail.
+    int stride;
+
+    // one plane per component, stored planar: sample (x, y) of component c is
+    // planes[c][y * stride + x]. All of the planes live in one allocation that starts at planes[0].
+    // Samples start out as 8-bit values in [0, 255] and are signed once they've been level-shifted.
+    int16_t* planes[4];
 } image_t;
 
+#define IMAGE_ROW_ALIGN 16
+
 typedef struct bytearray
 {
     uint8_t* data;
@@ -41,13 +43,14 @@ void bytearray_add_byte(bytearray_t* arr, uint8_t byte);
 void bytearray_add_bytes(bytearray_t* arr, const uint8_t* bytes, int len);
 
 /**
- * Given a
+ * Given a path to a binary PGM / PPM / PAM file, loads it into a new image. The file is mmap'd
+ * (see pnm.h) and samples are widened straight out of the raster.
  */
-image_t* image_create_from_pam(const char* filepath, char* argv0);
+image_t* image_create_from_pam(const char* filepath);
 void image_destroy(image_t* image);
 
 /**
- * Should be called BEFORE image_level_shift().
+ * Should be called BEFORE image_level_shift(). Needs an image with at least 3 planes.
  */
 void image_jfif_RGB_to_YCbCr(image_t* image);
 
@@ -66,11 +69,17 @@ void image_level_shift(image_t* im);
 void image_pad_out(image_t* im);
 
 /**
- * Allocates a new block and snips out an 8x8 section of the given image, putting it in the newly
- * allocated block.
+ * Allocates a new block and snips out an 8x8 section of the given image's first plane, putting it
+ * in the newly allocated block.
  */
 int* image_copy_mcu(image_t* im, int xstart, int ystart);
 
+/**
+ * Same as image_copy_mcu(), but copies into a caller-provided block of 64 ints instead of
+ * allocating one.
+ */
+void image_copy_mcu_into(const image_t* im, int xstart, int ystart, int* dest);
+
 /**
  * slow, O(n^2) forward DCT on an 8x8 block.
  *
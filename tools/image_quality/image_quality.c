@@ -0,0 +1,553 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "image_quality.h"
+#include "jmcujd.h"
+
+#define SSIM_WINDOW (8)
+
+// (k1 * L)^2 and (k2 * L)^2 with k1 = 0.01, k2 = 0.03 and L = 255
+#define SSIM_C1 (6.5025f)
+#define SSIM_C2 (58.5225f)
+
+static const double ms_ssim_weights[IQ_MAX_SCALES] = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+
+// ======= loading =======
+static uint8_t* read_file(const char* path, long* len)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t* data = malloc(*len + 1);
+    if ((data != NULL) && (fread(data, 1, *len, fp) != (size_t)*len)) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(fp);
+    return data;
+}
+
+/**
+ * Reads one whitespace-separated number out of a pnm header, skipping comments.
+ */
+static int pnm_read_header_int(const uint8_t* data, long len, long* idx)
+{
+    while (*idx < len) {
+        if (data[*idx] == '#') {
+            while ((*idx < len) && (data[*idx] != '\n')) (*idx)++;
+        } else if ((data[*idx] == ' ') || (data[*idx] == '\t') ||
+                   (data[*idx] == '\r') || (data[*idx] == '\n')) {
+            (*idx)++;
+        } else {
+            break;
+        }
+    }
+
+    int value = -1;
+    while ((*idx < len) && (data[*idx] >= '0') && (data[*idx] <= '9')) {
+        value = ((value < 0) ? 0 : (value * 10)) + (data[*idx] - '0');
+        (*idx)++;
+    }
+    return value;
+}
+
+static int pnm_parse(const uint8_t* data, long len, iq_image_t* image)
+{
+    image->channels = (data[1] == '5') ? 1 : 3;
+
+    long idx = 2;
+    image->width = pnm_read_header_int(data, len, &idx);
+    image->height = pnm_read_header_int(data, len, &idx);
+    const int maxval = pnm_read_header_int(data, len, &idx);
+
+    // exactly one whitespace character comes between the header and the raster.
+    idx++;
+
+    if ((image->width <= 0) || (image->height <= 0) || (maxval != 255)) {
+        return IQ_ERR_FORMAT;
+    }
+
+    const long size = (long)image->width * image->height * image->channels;
+    if ((idx + size) > len) {
+        return IQ_ERR_FORMAT;
+    }
+
+    image->pixels = malloc(size);
+    if (image->pixels == NULL) {
+        return IQ_ERR_OUT_OF_MEMORY;
+    }
+    memcpy(image->pixels, &data[idx], size);
+
+    return 0;
+}
+
+static int jpeg_parse(const uint8_t* data, long len, iq_image_t* image)
+{
+    jmcujd_image_t decoded;
+    if (jmcujd_decode(data, len, &decoded)) {
+        return IQ_ERR_DECODE;
+    }
+
+    int retval = 0;
+    image->width = decoded.width;
+    image->height = decoded.height;
+    image->pixels = malloc((size_t)decoded.width * decoded.height * 3);
+    if (image->pixels == NULL) {
+        retval = IQ_ERR_OUT_OF_MEMORY;
+        goto _end;
+    }
+
+    image->channels = jmcujd_image_to_pixels(&decoded, image->pixels);
+    if (image->channels < 0) {
+        free(image->pixels);
+        image->pixels = NULL;
+        retval = IQ_ERR_DECODE;
+    }
+
+_end:
+    jmcujd_image_free(&decoded);
+    return retval;
+}
+
+int iq_image_load(const char* path, iq_image_t* image)
+{
+    memset(image, 0, sizeof(iq_image_t));
+
+    long len;
+    uint8_t* data = read_file(path, &len);
+    if (data == NULL) {
+        return IQ_ERR_OPEN;
+    }
+
+    int retval;
+    if ((len >= 2) && (data[0] == 'P') && ((data[1] == '5') || (data[1] == '6'))) {
+        retval = pnm_parse(data, len, image);
+    } else if ((len >= 2) && (data[0] == 0xff) && (data[1] == 0xd8)) {
+        retval = jpeg_parse(data, len, image);
+    } else {
+        retval = IQ_ERR_FORMAT;
+    }
+
+    free(data);
+    return retval;
+}
+
+void iq_image_free(iq_image_t* image)
+{
+    free(image->pixels);
+    image->pixels = NULL;
+}
+
+// ======= SSIM =======
+typedef struct iq_plane
+{
+    int width;
+    int height;
+    float* samples;
+} iq_plane_t;
+
+static int plane_from_image(const iq_image_t* image, iq_plane_t* plane)
+{
+    plane->width = image->width;
+    plane->height = image->height;
+    plane->samples = malloc(sizeof(float) * image->width * image->height);
+    if (plane->samples == NULL) {
+        return IQ_ERR_OUT_OF_MEMORY;
+    }
+
+    const int n = image->width * image->height;
+    if (image->channels == 1) {
+        for (int i = 0; i < n; i++) {
+            plane->samples[i] = image->pixels[i];
+        }
+    } else {
+        // BT.601 luma
+        for (int i = 0; i < n; i++) {
+            const uint8_t* px = &image->pixels[i * 3];
+            plane->samples[i] = (0.299f * px[0]) + (0.587f * px[1]) + (0.114f * px[2]);
+        }
+    }
+
+    return 0;
+}
+
+static int plane_downsample(const iq_plane_t* in, iq_plane_t* out)
+{
+    out->width = in->width / 2;
+    out->height = in->height / 2;
+    out->samples = malloc(sizeof(float) * out->width * out->height);
+    if (out->samples == NULL) {
+        return IQ_ERR_OUT_OF_MEMORY;
+    }
+
+    for (int y = 0; y < out->height; y++) {
+        const float* r0 = &in->samples[(2 * y) * in->width];
+        const float* r1 = r0 + in->width;
+        for (int x = 0; x < out->width; x++) {
+            out->samples[(y * out->width) + x] =
+                0.25f * (r0[2 * x] + r0[(2 * x) + 1] + r1[2 * x] + r1[(2 * x) + 1]);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Window sums for one row of window positions: sums of x, y, x^2, y^2 and xy over 8 horizontally
+ * adjacent samples, for each of the (width - 7) positions.
+ */
+typedef struct window_sums
+{
+    float* x;
+    float* y;
+    float* xx;
+    float* yy;
+    float* xy;
+} window_sums_t;
+
+static void horizontal_sums(const float* x, const float* y, int nout, window_sums_t* out)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (; (i + 4) <= nout; i += 4) {
+        __m128 sx = _mm_setzero_ps(), sy = _mm_setzero_ps();
+        __m128 sxx = _mm_setzero_ps(), syy = _mm_setzero_ps(), sxy = _mm_setzero_ps();
+        for (int k = 0; k < SSIM_WINDOW; k++) {
+            const __m128 a = _mm_loadu_ps(&x[i + k]);
+            const __m128 b = _mm_loadu_ps(&y[i + k]);
+            sx = _mm_add_ps(sx, a);
+            sy = _mm_add_ps(sy, b);
+            sxx = _mm_add_ps(sxx, _mm_mul_ps(a, a));
+            syy = _mm_add_ps(syy, _mm_mul_ps(b, b));
+            sxy = _mm_add_ps(sxy, _mm_mul_ps(a, b));
+        }
+        _mm_storeu_ps(&out->x[i], sx);
+        _mm_storeu_ps(&out->y[i], sy);
+        _mm_storeu_ps(&out->xx[i], sxx);
+        _mm_storeu_ps(&out->yy[i], syy);
+        _mm_storeu_ps(&out->xy[i], sxy);
+    }
+#endif
+    for (; i < nout; i++) {
+        float sx = 0.f, sy = 0.f, sxx = 0.f, syy = 0.f, sxy = 0.f;
+        for (int k = 0; k < SSIM_WINDOW; k++) {
+            const float a = x[i + k];
+            const float b = y[i + k];
+            sx += a;
+            sy += b;
+            sxx += a * a;
+            syy += b * b;
+            sxy += a * b;
+        }
+        out->x[i] = sx;
+        out->y[i] = sy;
+        out->xx[i] = sxx;
+        out->yy[i] = syy;
+        out->xy[i] = sxy;
+    }
+}
+
+/**
+ * Adds up 8 rows of horizontal window sums to get the sums over 8x8 windows, turns them into SSIM
+ * values, and adds those (and the contrast-structure part on its own) to *ssim_sum and *cs_sum.
+ */
+static void ssim_row(const window_sums_t* rows, int nout, double* ssim_sum, double* cs_sum)
+{
+    const float inv_n = 1.f / (SSIM_WINDOW * SSIM_WINDOW);
+    float ssim_acc = 0.f, cs_acc = 0.f;
+
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 v_inv_n = _mm_set1_ps(inv_n);
+    const __m128 v_c1 = _mm_set1_ps(SSIM_C1);
+    const __m128 v_c2 = _mm_set1_ps(SSIM_C2);
+    const __m128 v_two = _mm_set1_ps(2.f);
+    __m128 v_ssim_acc = _mm_setzero_ps(), v_cs_acc = _mm_setzero_ps();
+    for (; (i + 4) <= nout; i += 4) {
+        __m128 sx = _mm_setzero_ps(), sy = _mm_setzero_ps();
+        __m128 sxx = _mm_setzero_ps(), syy = _mm_setzero_ps(), sxy = _mm_setzero_ps();
+        for (int k = 0; k < SSIM_WINDOW; k++) {
+            sx = _mm_add_ps(sx, _mm_loadu_ps(&rows[k].x[i]));
+            sy = _mm_add_ps(sy, _mm_loadu_ps(&rows[k].y[i]));
+            sxx = _mm_add_ps(sxx, _mm_loadu_ps(&rows[k].xx[i]));
+            syy = _mm_add_ps(syy, _mm_loadu_ps(&rows[k].yy[i]));
+            sxy = _mm_add_ps(sxy, _mm_loadu_ps(&rows[k].xy[i]));
+        }
+
+        const __m128 mux = _mm_mul_ps(sx, v_inv_n);
+        const __m128 muy = _mm_mul_ps(sy, v_inv_n);
+        const __m128 muxx = _mm_mul_ps(mux, mux);
+        const __m128 muyy = _mm_mul_ps(muy, muy);
+        const __m128 muxy = _mm_mul_ps(mux, muy);
+        const __m128 vx = _mm_sub_ps(_mm_mul_ps(sxx, v_inv_n), muxx);
+        const __m128 vy = _mm_sub_ps(_mm_mul_ps(syy, v_inv_n), muyy);
+        const __m128 cov = _mm_sub_ps(_mm_mul_ps(sxy, v_inv_n), muxy);
+
+        const __m128 l = _mm_div_ps(_mm_add_ps(_mm_mul_ps(v_two, muxy), v_c1),
+                                    _mm_add_ps(_mm_add_ps(muxx, muyy), v_c1));
+        const __m128 cs = _mm_div_ps(_mm_add_ps(_mm_mul_ps(v_two, cov), v_c2),
+                                     _mm_add_ps(_mm_add_ps(vx, vy), v_c2));
+        v_ssim_acc = _mm_add_ps(v_ssim_acc, _mm_mul_ps(l, cs));
+        v_cs_acc = _mm_add_ps(v_cs_acc, cs);
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, v_ssim_acc);
+    ssim_acc += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_ps(lanes, v_cs_acc);
+    cs_acc += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < nout; i++) {
+        float sx = 0.f, sy = 0.f, sxx = 0.f, syy = 0.f, sxy = 0.f;
+        for (int k = 0; k < SSIM_WINDOW; k++) {
+            sx += rows[k].x[i];
+            sy += rows[k].y[i];
+            sxx += rows[k].xx[i];
+            syy += rows[k].yy[i];
+            sxy += rows[k].xy[i];
+        }
+
+        const float mux = sx * inv_n;
+        const float muy = sy * inv_n;
+        const float vx = (sxx * inv_n) - (mux * mux);
+        const float vy = (syy * inv_n) - (muy * muy);
+        const float cov = (sxy * inv_n) - (mux * muy);
+        const float l = ((2.f * mux * muy) + SSIM_C1) / ((mux * mux) + (muy * muy) + SSIM_C1);
+        const float cs = ((2.f * cov) + SSIM_C2) / (vx + vy + SSIM_C2);
+        ssim_acc += l * cs;
+        cs_acc += cs;
+    }
+
+    *ssim_sum += ssim_acc;
+    *cs_sum += cs_acc;
+}
+
+/**
+ * Sums SSIM and contrast-structure over window rows [row_start, row_end) of one scale. The
+ * horizontal sums for the last 8 sample rows are kept in a ring so that every sample row only gets
+ * summed once.
+ */
+static int ssim_band(const iq_plane_t* a, const iq_plane_t* b, int row_start, int row_end,
+                     double* ssim_sum, double* cs_sum)
+{
+    const int nout = a->width - SSIM_WINDOW + 1;
+    float* storage = malloc(sizeof(float) * 5 * SSIM_WINDOW * nout);
+    if (storage == NULL) {
+        return IQ_ERR_OUT_OF_MEMORY;
+    }
+
+    window_sums_t ring[SSIM_WINDOW];
+    for (int k = 0; k < SSIM_WINDOW; k++) {
+        float* base = &storage[5 * k * nout];
+        ring[k] = (window_sums_t){ base, base + nout, base + (2 * nout), base + (3 * nout),
+                                   base + (4 * nout) };
+    }
+
+    for (int y = row_start; y < (row_end + SSIM_WINDOW - 1); y++) {
+        horizontal_sums(&a->samples[y * a->width], &b->samples[y * b->width], nout,
+                        &ring[y % SSIM_WINDOW]);
+
+        // the order of the rows in the ring doesn't matter; they all just get added up.
+        if (y >= (row_start + SSIM_WINDOW - 1)) {
+            ssim_row(ring, nout, ssim_sum, cs_sum);
+        }
+    }
+
+    free(storage);
+    return 0;
+}
+
+// ======= threading =======
+typedef struct compare_job
+{
+    const iq_image_t* reference;
+    const iq_image_t* test;
+    const iq_plane_t* reference_planes;
+    const iq_plane_t* test_planes;
+    int nscales;
+
+    int thread_idx;
+    int nthreads;
+
+    // outputs
+    int retval;
+    double squared_error;
+    double ssim_sum[IQ_MAX_SCALES];
+    double cs_sum[IQ_MAX_SCALES];
+} compare_job_t;
+
+static void band_bounds(int total, int idx, int n, int* start, int* end)
+{
+    const int per_band = (total + n - 1) / n;
+    *start = (idx * per_band < total) ? (idx * per_band) : total;
+    *end = ((*start + per_band) < total) ? (*start + per_band) : total;
+}
+
+static void* compare_job_run(void* arg)
+{
+    compare_job_t* job = arg;
+
+    // squared error over this job's band of image rows, on every channel.
+    int start, end;
+    band_bounds(job->reference->height, job->thread_idx, job->nthreads, &start, &end);
+    const int row_len = job->reference->width * job->reference->channels;
+    for (int y = start; y < end; y++) {
+        const uint8_t* r = &job->reference->pixels[y * row_len];
+        const uint8_t* t = &job->test->pixels[y * row_len];
+        int64_t row_error = 0;
+        for (int x = 0; x < row_len; x++) {
+            const int d = (int)r[x] - (int)t[x];
+            row_error += d * d;
+        }
+        job->squared_error += row_error;
+    }
+
+    // SSIM on this job's band of window rows at every scale.
+    for (int s = 0; s < job->nscales; s++) {
+        const int window_rows = job->reference_planes[s].height - SSIM_WINDOW + 1;
+        band_bounds(window_rows, job->thread_idx, job->nthreads, &start, &end);
+        if (start < end) {
+            job->retval = ssim_band(&job->reference_planes[s], &job->test_planes[s], start, end,
+                                    &job->ssim_sum[s], &job->cs_sum[s]);
+            if (job->retval) {
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int iq_compare(const iq_image_t* reference, const iq_image_t* test, int nthreads, iq_result_t* result)
+{
+    memset(result, 0, sizeof(iq_result_t));
+
+    if ((reference->width != test->width) || (reference->height != test->height) ||
+        (reference->channels != test->channels)) {
+        return IQ_ERR_SIZE_MISMATCH;
+    }
+    if ((reference->width < SSIM_WINDOW) || (reference->height < SSIM_WINDOW)) {
+        return IQ_ERR_TOO_SMALL;
+    }
+
+    int retval = 0;
+    iq_plane_t reference_planes[IQ_MAX_SCALES] = { { 0 } };
+    iq_plane_t test_planes[IQ_MAX_SCALES] = { { 0 } };
+    compare_job_t* jobs = NULL;
+    pthread_t* threads = NULL;
+    int nscales = 0;
+    int started = 0;
+    double squared_error = 0.;
+    double ssim_sum[IQ_MAX_SCALES] = { 0. };
+    double cs_sum[IQ_MAX_SCALES] = { 0. };
+
+    // luma pyramids; every scale needs to be big enough for at least one window.
+    if ((retval = plane_from_image(reference, &reference_planes[0])) ||
+        (retval = plane_from_image(test, &test_planes[0]))) {
+        goto _end;
+    }
+    for (nscales = 1; nscales < IQ_MAX_SCALES; nscales++) {
+        if (((reference_planes[nscales - 1].width / 2) < SSIM_WINDOW) ||
+            ((reference_planes[nscales - 1].height / 2) < SSIM_WINDOW)) {
+            break;
+        }
+        if ((retval = plane_downsample(&reference_planes[nscales - 1], &reference_planes[nscales])) ||
+            (retval = plane_downsample(&test_planes[nscales - 1], &test_planes[nscales]))) {
+            goto _end;
+        }
+    }
+
+    nthreads = (nthreads < 1) ? 1 : nthreads;
+    jobs = calloc(nthreads, sizeof(compare_job_t));
+    threads = calloc(nthreads, sizeof(pthread_t));
+    if ((jobs == NULL) || (threads == NULL)) {
+        retval = IQ_ERR_OUT_OF_MEMORY;
+        goto _end;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        jobs[i] = (compare_job_t){ .reference = reference, .test = test,
+                                   .reference_planes = reference_planes,
+                                   .test_planes = test_planes, .nscales = nscales,
+                                   .thread_idx = i, .nthreads = nthreads };
+    }
+    for (started = 1; started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, compare_job_run, &jobs[started])) {
+            retval = IQ_ERR_THREAD;
+            break;
+        }
+    }
+    compare_job_run(&jobs[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (retval) {
+        goto _end;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        if (jobs[i].retval) {
+            retval = jobs[i].retval;
+            goto _end;
+        }
+        squared_error += jobs[i].squared_error;
+        for (int s = 0; s < nscales; s++) {
+            ssim_sum[s] += jobs[i].ssim_sum[s];
+            cs_sum[s] += jobs[i].cs_sum[s];
+        }
+    }
+
+    const double nsamples = (double)reference->width * reference->height * reference->channels;
+    result->l2_norm = sqrt(squared_error);
+    result->mse = squared_error / nsamples;
+    result->psnr = (squared_error == 0.) ? INFINITY : (10. * log10((255. * 255.) / result->mse));
+
+    // MS-SSIM is the product of the contrast-structure term at every scale but the last, and the
+    // full SSIM at the last one, each raised to its weight.
+    double weight_total = 0.;
+    for (int s = 0; s < nscales; s++) {
+        weight_total += ms_ssim_weights[s];
+    }
+
+    result->ms_ssim = 1.;
+    for (int s = 0; s < nscales; s++) {
+        const double nwindows = (double)(reference_planes[s].width - SSIM_WINDOW + 1) *
+                                (reference_planes[s].height - SSIM_WINDOW + 1);
+        const double mean_ssim = ssim_sum[s] / nwindows;
+        const double mean_cs = cs_sum[s] / nwindows;
+        if (s == 0) {
+            result->ssim = mean_ssim;
+        }
+
+        // negative values can't be raised to fractional powers; they mean "very different" anyway.
+        double v = (s == (nscales - 1)) ? mean_ssim : mean_cs;
+        v = (v < 0.) ? 0. : v;
+        result->ms_ssim *= pow(v, ms_ssim_weights[s] / weight_total);
+    }
+    result->ms_ssim_scales = nscales;
+
+_end:
+    for (int s = 0; s < IQ_MAX_SCALES; s++) {
+        free(reference_planes[s].samples);
+        free(test_planes[s].samples);
+    }
+    free(jobs);
+    free(threads);
+    return retval;
+}
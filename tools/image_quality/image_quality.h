@@ -0,0 +1,75 @@
+#ifndef _IMAGE_QUALITY_H
+#define _IMAGE_QUALITY_H
+
+#include <stdint.h>
+
+/**
+ * Image quality metrics for comparing a compressed image against its original.
+ *
+ * This replaces tools/image_error.py, which needed a whole python process (and PIL and numpy) for
+ * every pair of images. Everything here is in-process: pgm / ppm files are parsed directly and
+ * jpegs are decoded with jmcujd.
+ *
+ * SSIM uses an 8x8 box window at every position instead of the 11x11 gaussian from the original
+ * paper; that's what most fast implementations do and it makes the window sums cheap to vectorize.
+ * MS-SSIM uses the 5 scales and weights from Wang, Simoncelli and Bovik 2003, with 2x2 averaging
+ * between scales. Both are computed on luma only.
+ */
+
+// error codes
+#define IQ_ERR_OPEN           (-1)
+#define IQ_ERR_FORMAT         (-2)
+#define IQ_ERR_DECODE         (-3)
+#define IQ_ERR_SIZE_MISMATCH  (-4)
+#define IQ_ERR_TOO_SMALL      (-5)
+#define IQ_ERR_OUT_OF_MEMORY  (-6)
+#define IQ_ERR_THREAD         (-7)
+
+#define IQ_MAX_SCALES (5)
+
+typedef struct iq_image
+{
+    int width;
+    int height;
+
+    // 1 for grayscale, 3 for RGB. Samples are packed, with no padding between rows.
+    int channels;
+    uint8_t* pixels;
+} iq_image_t;
+
+typedef struct iq_result
+{
+    // Square root of the sum of the squared differences of every sample.
+    double l2_norm;
+
+    double mse;
+
+    // infinity if the images are identical.
+    double psnr;
+
+    double ssim;
+    double ms_ssim;
+
+    // how many scales MS-SSIM used. Images that are too small for all 5 get fewer, with the weights
+    // scaled up to make up for it.
+    int ms_ssim_scales;
+} iq_result_t;
+
+/**
+ * Loads a binary pgm / ppm (P5 / P6, maxval 255) or a baseline jpeg. The type is picked based on
+ * the file's contents, not its name.
+ */
+int iq_image_load(const char* path, iq_image_t* image);
+
+void iq_image_free(iq_image_t* image);
+
+/**
+ * Computes every metric for one pair of images. The images need to be the same size and have the
+ * same number of channels, and need to be at least 8x8 for SSIM.
+ *
+ * The work is split into horizontal bands across nthreads threads; nthreads = 1 does everything on
+ * the calling thread.
+ */
+int iq_compare(const iq_image_t* reference, const iq_image_t* test, int nthreads, iq_result_t* result);
+
+#endif
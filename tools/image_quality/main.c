@@ -0,0 +1,342 @@
+/**
+ * Compares images against their originals.
+ *
+ *     image_quality [-j threads] [-m metric] <reference> <test>
+ *
+ * If reference and test are files, they're compared to each other. If they're directories, every
+ * file in the reference directory is compared to the file in the test directory with the same name
+ * minus the extension, so that "foo.pgm" gets compared to "foo.jpg".
+ *
+ * By default, every metric gets printed for every pair. With -m, only that metric's value gets
+ * printed, one per line, which is handy for scripts. -m l2 replaces the old tools/image_error.py;
+ * note that that script subtracted uint8 arrays in numpy, so its differences wrapped around and it
+ * reported much bigger numbers than this does.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image_quality.h"
+
+typedef enum metric
+{
+    METRIC_ALL,
+    METRIC_L2,
+    METRIC_PSNR,
+    METRIC_SSIM,
+    METRIC_MS_SSIM
+} metric_t;
+
+typedef struct pair
+{
+    char* reference_path;
+    char* test_path;
+    const char* name;
+
+    int retval;
+    iq_result_t result;
+    long pixels;
+} pair_t;
+
+typedef struct worker_state
+{
+    pair_t* pairs;
+    int npairs;
+
+    // threads per pair
+    int nthreads;
+
+    pthread_mutex_t lock;
+    int next_pair;
+} worker_state_t;
+
+static bool is_directory(const char* path)
+{
+    struct stat st;
+    return (stat(path, &st) == 0) && S_ISDIR(st.st_mode);
+}
+
+static char* join_path(const char* dir, const char* name)
+{
+    char* path = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+/**
+ * Length of the part of a filename before its extension.
+ */
+static size_t stem_length(const char* name)
+{
+    const char* dot = strrchr(name, '.');
+    return ((dot == NULL) || (dot == name)) ? strlen(name) : (size_t)(dot - name);
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Lists the regular files in a directory, sorted by name.
+ */
+static char** list_directory(const char* path, int* count)
+{
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    int capacity = 64;
+    char** names = malloc(capacity * sizeof(char*));
+    *count = 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* full_path = join_path(path, entry->d_name);
+        struct stat st;
+        const bool regular = (stat(full_path, &st) == 0) && S_ISREG(st.st_mode);
+        free(full_path);
+        if (!regular) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            names = realloc(names, capacity * sizeof(char*));
+        }
+        names[(*count)++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+
+    qsort(names, *count, sizeof(char*), compare_strings);
+    return names;
+}
+
+static pair_t* pair_directories(const char* reference_dir, const char* test_dir, int* npairs)
+{
+    int nreference, ntest;
+    char** reference_names = list_directory(reference_dir, &nreference);
+    char** test_names = list_directory(test_dir, &ntest);
+    if ((reference_names == NULL) || (test_names == NULL)) {
+        return NULL;
+    }
+
+    pair_t* pairs = calloc(nreference, sizeof(pair_t));
+    *npairs = 0;
+    for (int i = 0; i < nreference; i++) {
+        const size_t len = stem_length(reference_names[i]);
+        int match = -1;
+        for (int j = 0; j < ntest; j++) {
+            if ((stem_length(test_names[j]) == len) &&
+                (strncmp(reference_names[i], test_names[j], len) == 0)) {
+                match = j;
+                break;
+            }
+        }
+
+        if (match < 0) {
+            fprintf(stderr, "warning: nothing in %s to compare %s to\n", test_dir,
+                    reference_names[i]);
+            continue;
+        }
+
+        pair_t* p = &pairs[(*npairs)++];
+        p->reference_path = join_path(reference_dir, reference_names[i]);
+        p->test_path = join_path(test_dir, test_names[match]);
+        p->name = reference_names[i];
+    }
+
+    for (int j = 0; j < ntest; j++) {
+        free(test_names[j]);
+    }
+    free(test_names);
+
+    // reference_names are still used by the pairs, so they don't get freed.
+    return pairs;
+}
+
+static void process_pair(pair_t* p, int nthreads)
+{
+    iq_image_t reference, test;
+    if ((p->retval = iq_image_load(p->reference_path, &reference))) {
+        return;
+    }
+    if ((p->retval = iq_image_load(p->test_path, &test))) {
+        iq_image_free(&reference);
+        return;
+    }
+
+    p->retval = iq_compare(&reference, &test, nthreads, &p->result);
+    p->pixels = (long)reference.width * reference.height;
+
+    iq_image_free(&reference);
+    iq_image_free(&test);
+}
+
+static void* worker_run(void* arg)
+{
+    worker_state_t* state = arg;
+    while (1) {
+        pthread_mutex_lock(&state->lock);
+        const int i = state->next_pair++;
+        pthread_mutex_unlock(&state->lock);
+
+        if (i >= state->npairs) {
+            return NULL;
+        }
+        process_pair(&state->pairs[i], state->nthreads);
+    }
+}
+
+static void print_result(const pair_t* p, metric_t metric)
+{
+    if (p->retval) {
+        fprintf(stderr, "couldn't compare %s and %s: error %i\n", p->reference_path, p->test_path,
+                p->retval);
+        return;
+    }
+
+    const iq_result_t* r = &p->result;
+    switch (metric) {
+        case METRIC_L2:      printf("%f\n", r->l2_norm); break;
+        case METRIC_PSNR:    printf("%f\n", r->psnr);    break;
+        case METRIC_SSIM:    printf("%f\n", r->ssim);    break;
+        case METRIC_MS_SSIM: printf("%f\n", r->ms_ssim); break;
+        case METRIC_ALL: {
+            printf("%-32s  psnr %7.3f dB  ssim %.5f  ms-ssim %.5f  l2 %10.1f\n", p->name, r->psnr,
+                   r->ssim, r->ms_ssim, r->l2_norm);
+            break;
+        }
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static void usage(const char* argv0)
+{
+    printf("usage: %s [-j threads] [-m all | l2 | psnr | ssim | ms-ssim] <reference> <test>\n"
+           "reference and test can both be files or both be directories.\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    metric_t metric = METRIC_ALL;
+
+    int argi;
+    for (argi = 1; (argi < (argc - 1)) && (argv[argi][0] == '-'); argi += 2) {
+        if (strcmp(argv[argi], "-j") == 0) {
+            nthreads = atoi(argv[argi + 1]);
+        } else if (strcmp(argv[argi], "-m") == 0) {
+            const char* names[] = { "all", "l2", "psnr", "ssim", "ms-ssim" };
+            int m;
+            for (m = 0; (m < 5) && (strcmp(argv[argi + 1], names[m]) != 0); m++);
+            if (m == 5) {
+                usage(argv[0]);
+                return -1;
+            }
+            metric = (metric_t)m;
+        } else {
+            break;
+        }
+    }
+
+    if ((argc - argi) != 2) {
+        usage(argv[0]);
+        return -1;
+    }
+    nthreads = (nthreads < 1) ? 1 : nthreads;
+
+    const char* reference = argv[argi];
+    const char* test = argv[argi + 1];
+
+    pair_t* pairs;
+    int npairs;
+    const bool directories = is_directory(reference);
+    if (directories != is_directory(test)) {
+        fprintf(stderr, "%s and %s need to both be files or both be directories\n", reference, test);
+        return -1;
+    }
+
+    if (directories) {
+        pairs = pair_directories(reference, test, &npairs);
+        if (pairs == NULL) {
+            fprintf(stderr, "couldn't read %s or %s\n", reference, test);
+            return -1;
+        }
+    } else {
+        pairs = calloc(1, sizeof(pair_t));
+        pairs[0].reference_path = strdup(reference);
+        pairs[0].test_path = strdup(test);
+        pairs[0].name = reference;
+        npairs = 1;
+    }
+
+    // When there are more pairs than threads, it's cheapest to give every pair its own thread.
+    // Otherwise the threads get split up between pairs, and each pair gets split into bands.
+    worker_state_t state = { .pairs = pairs, .npairs = npairs, .next_pair = 0 };
+    pthread_mutex_init(&state.lock, NULL);
+    const int nworkers = (npairs < nthreads) ? npairs : nthreads;
+    state.nthreads = (nworkers > 0) ? (nthreads / nworkers) : 1;
+
+    const double start = now();
+    pthread_t* workers = calloc(nworkers, sizeof(pthread_t));
+    for (int i = 1; i < nworkers; i++) {
+        pthread_create(&workers[i], NULL, worker_run, &state);
+    }
+    worker_run(&state);
+    for (int i = 1; i < nworkers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    const double elapsed = now() - start;
+
+    int nfailed = 0;
+    long total_pixels = 0;
+    double psnr_total = 0., ssim_total = 0., ms_ssim_total = 0.;
+    for (int i = 0; i < npairs; i++) {
+        print_result(&pairs[i], metric);
+        if (pairs[i].retval) {
+            nfailed++;
+            continue;
+        }
+        total_pixels += pairs[i].pixels;
+        psnr_total += pairs[i].result.psnr;
+        ssim_total += pairs[i].result.ssim;
+        ms_ssim_total += pairs[i].result.ms_ssim;
+    }
+
+    if (directories && (metric == METRIC_ALL) && (npairs > nfailed)) {
+        const int n = npairs - nfailed;
+        printf("%-32s  psnr %7.3f dB  ssim %.5f  ms-ssim %.5f\n", "mean", psnr_total / n,
+               ssim_total / n, ms_ssim_total / n);
+    }
+    if (directories) {
+        fprintf(stderr, "%i pairs in %.3f s (%.1f pairs/s, %.1f Mpixels/s) on %i threads\n",
+                npairs, elapsed, npairs / elapsed, (total_pixels / elapsed) * 1e-6, nthreads);
+    }
+
+    pthread_mutex_destroy(&state.lock);
+    free(workers);
+    for (int i = 0; i < npairs; i++) {
+        free(pairs[i].reference_path);
+        free(pairs[i].test_path);
+    }
+    free(pairs);
+    return nfailed ? -1 : 0;
+}
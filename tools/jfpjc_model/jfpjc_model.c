@@ -0,0 +1,530 @@
+#include "jfpjc_model.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 3q12 constants from fixed_point_consts.v
+#define _1C3_COS_3Q12      (1204)
+#define _1C3_SIN_3Q12      (805)
+#define _1C1_COS_3Q12      (1420)
+#define _1C1_SIN_3Q12      (283)
+#define _R2C1_COS_3Q12     (784)
+#define _R2C1_SIN_3Q12     (1892)
+#define _SQRT2_3Q12        (5793)
+#define _SQRT2_OVER4_3Q12  (1448)
+
+// address_zigzagger.v
+static const uint8_t zig_zag_to_row_major[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// The tables that huffman_table_ram in jpeg_huffman_encode.v comes up holding: the luminance tables
+// from K.3 and K.5 of the spec. The model doesn't know about tables written at runtime.
+static const uint8_t lum_dc_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t lum_dc_vals[12] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+                                         0x09, 0x0a, 0x0b };
+
+static const uint8_t lum_ac_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 125 };
+static const uint8_t lum_ac_vals[162] =
+{
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+/**
+ * One huffman table EBR. Entries that aren't in the table read back as code 0 with a stored bitlen
+ * of 4'hf, which the encoder turns into a 16-bit code.
+ */
+typedef struct huffman_ebr
+{
+    uint16_t code[256];
+    uint8_t length[256];
+} huffman_ebr_t;
+
+typedef struct model_state
+{
+    huffman_ebr_t dc_table;
+    huffman_ebr_t ac_table;
+
+    // jpeg_huffman_encode
+    int16_t dc_prev;
+
+    // bitpacker
+    uint32_t bit_accumulator;
+    int bit_counter;
+
+    jfpjc_model_output_t* out;
+} model_state_t;
+
+static void huffman_ebr_init(huffman_ebr_t* ebr, const uint8_t* bits, const uint8_t* vals)
+{
+    for (int i = 0; i < 256; i++) {
+        ebr->code[i] = 0x0000;
+        ebr->length[i] = 16;
+    }
+
+    uint16_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++, k++) {
+            ebr->code[vals[k]] = code++;
+            ebr->length[vals[k]] = len;
+        }
+        code <<= 1;
+    }
+}
+
+static inline int16_t wrap16(int32_t x)
+{
+    return (int16_t)(uint16_t)x;
+}
+
+/**
+ * pipelined_multiplier output bits [27:12].
+ */
+static inline int16_t mul_3q12(int16_t x, int16_t c)
+{
+    return wrap16((((int32_t)x) * c) >> 12);
+}
+
+/**
+ * Same sequence of operations as the loeffler_dct_8 microcode. Every scratchpad write is 16 bits.
+ */
+static void loeffler_dct_8(const int16_t* in, int16_t* out)
+{
+    const int16_t sp0 = wrap16(in[0] + in[7]);
+    const int16_t sp1 = wrap16(in[1] + in[6]);
+    const int16_t sp2 = wrap16(in[2] + in[5]);
+    const int16_t sp3 = wrap16(in[3] + in[4]);
+    const int16_t sp4 = wrap16(in[3] - in[4]);
+    const int16_t sp5 = wrap16(in[2] - in[5]);
+    const int16_t sp6 = wrap16(in[1] - in[6]);
+    const int16_t sp7 = wrap16(in[0] - in[7]);
+
+    const int16_t sp8  = wrap16(sp0 + sp3);
+    const int16_t sp9  = wrap16(sp1 + sp2);
+    const int16_t sp10 = wrap16(sp1 - sp2);
+    const int16_t sp11 = wrap16(sp0 - sp3);
+
+    const int16_t sp12 = wrap16(mul_3q12(sp4, _1C3_COS_3Q12) + mul_3q12(sp7, _1C3_SIN_3Q12));
+    const int16_t sp15 = wrap16(-mul_3q12(sp4, _1C3_SIN_3Q12) + mul_3q12(sp7, _1C3_COS_3Q12));
+    const int16_t sp13 = wrap16(mul_3q12(sp5, _1C1_COS_3Q12) + mul_3q12(sp6, _1C1_SIN_3Q12));
+    const int16_t sp14 = wrap16(-mul_3q12(sp5, _1C1_SIN_3Q12) + mul_3q12(sp6, _1C1_COS_3Q12));
+
+    out[0] = wrap16(mul_3q12(sp8, _SQRT2_OVER4_3Q12) + mul_3q12(sp9, _SQRT2_OVER4_3Q12));
+    out[4] = wrap16(mul_3q12(sp8, _SQRT2_OVER4_3Q12) - mul_3q12(sp9, _SQRT2_OVER4_3Q12));
+    out[2] = wrap16(mul_3q12(sp10, _R2C1_COS_3Q12) + mul_3q12(sp11, _R2C1_SIN_3Q12));
+    out[6] = wrap16(-mul_3q12(sp10, _R2C1_SIN_3Q12) + mul_3q12(sp11, _R2C1_COS_3Q12));
+
+    const int16_t sp20 = wrap16(sp12 + sp14);
+    const int16_t sp21 = wrap16(-sp13 + sp15);
+    const int16_t sp22 = wrap16(sp12 - sp14);
+    const int16_t sp23 = wrap16(sp13 + sp15);
+
+    out[7] = wrap16(-sp20 + sp23);
+    out[1] = wrap16(sp20 + sp23);
+    out[3] = mul_3q12(sp21, _SQRT2_3Q12);
+    out[5] = mul_3q12(sp22, _SQRT2_3Q12);
+}
+
+void jfpjc_model_dct88(const int8_t* samples, int16_t* result)
+{
+    // row pass results go to tempmem in row-major order.
+    int16_t tempmem[64];
+    for (int y = 0; y < 8; y++) {
+        int16_t in[8];
+        for (int x = 0; x < 8; x++) {
+            // { {4{src_data_in[7]}}, src_data_in[7:0], 4'h0 }
+            in[x] = wrap16(samples[(y * 8) + x] * 16);
+        }
+        loeffler_dct_8(in, &tempmem[y * 8]);
+    }
+
+    for (int u = 0; u < 8; u++) {
+        int16_t in[8], out[8];
+        for (int y = 0; y < 8; y++) {
+            in[y] = tempmem[(y * 8) + u];
+        }
+        loeffler_dct_8(in, out);
+        for (int v = 0; v < 8; v++) {
+            // (dct_result_out + 16'sh0008) >>> 4
+            result[(v * 8) + u] = wrap16(out[v] + 8) >> 4;
+        }
+    }
+}
+
+uint16_t jfpjc_model_quant_reciprocal(uint8_t Q)
+{
+    if (Q == 0) {
+        return 0;
+    }
+
+    int e = 0;
+    for (int i = 1; i < 8; i++) {
+        if ((Q > 2) && (((Q - 1) >> i) & 1)) {
+            e = i;
+        }
+    }
+
+    uint32_t M = ((1u << (13 + e)) + Q - 1) / Q;
+    if (M > 0x1fff) {
+        M = 0x1fff;
+    }
+    return (uint16_t)((e << 13) | M);
+}
+
+void jfpjc_model_quantize(const int16_t* dct, const jfpjc_model_quant_table_t* quant_table,
+                          int16_t* quotients)
+{
+    for (int k = 0; k < 64; k++) {
+        const int16_t dividend = dct[zig_zag_to_row_major[k]];
+        const uint16_t reciprocal = jfpjc_model_quant_reciprocal(quant_table->Q[k]);
+        const int e = reciprocal >> 13;
+        const int32_t M = reciprocal & 0x1fff;
+
+        // -(-32768) wraps back around to -32768, and the multiplier treats it as signed.
+        const int16_t magnitude = (dividend < 0) ? wrap16(-(int32_t)dividend) : dividend;
+        const uint32_t rounded = (uint32_t)(magnitude * M) + (0x1000u << e);
+        const uint16_t quotient = (uint16_t)(rounded >> (13 + e));
+        quotients[k] = (dividend < 0) ? wrap16(-(int32_t)quotient) : (int16_t)quotient;
+    }
+}
+
+/**
+ * coefficient_encoder.v. Only bits [14:0] of the magnitude are looked at.
+ */
+static int encode_coefficient(int16_t coefficient, uint16_t* coded_value)
+{
+    const uint16_t magnitude = (coefficient < 0) ? (uint16_t)(-(int32_t)coefficient) : coefficient;
+
+    int length = 0;
+    while ((length < 15) && ((magnitude & 0x7fff) >> length)) {
+        length++;
+    }
+
+    *coded_value = (coefficient < 0) ? (uint16_t)(coefficient + ((1 << length) - 1)) : coefficient;
+    return length;
+}
+
+static int output_reserve(jfpjc_model_output_t* out, size_t nbytes)
+{
+    if ((out->len + nbytes) <= out->capacity) {
+        return 0;
+    }
+
+    size_t capacity = (out->capacity == 0) ? 4096 : out->capacity;
+    while (capacity < (out->len + nbytes)) {
+        capacity *= 2;
+    }
+    uint8_t* data = realloc(out->data, capacity);
+    if (data == NULL) {
+        return JFPJC_MODEL_ERR_OUT_OF_MEMORY;
+    }
+    out->data = data;
+    out->capacity = capacity;
+    return 0;
+}
+
+/**
+ * bit_packer_le puts the most significant byte first, and the bytestuffer follows every 0xff with
+ * a 0x00. Space has already been reserved.
+ */
+static void write_word(model_state_t* state, uint32_t word)
+{
+    jfpjc_model_output_t* out = state->out;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        const uint8_t byte = (word >> shift) & 0xff;
+        out->data[out->len++] = byte;
+        if (byte == 0xff) {
+            out->data[out->len++] = 0x00;
+        }
+    }
+}
+
+/**
+ * Bytes that go out without being stuffed: fill bytes and markers.
+ */
+static void write_marker_bytes(model_state_t* state, const uint8_t* bytes, int n)
+{
+    jfpjc_model_output_t* out = state->out;
+    memcpy(&out->data[out->len], bytes, n);
+    out->len += n;
+}
+
+/**
+ * bitpacker.v's pad: the accumulator is padded out to a byte with 1's and the rest of the word is
+ * 0xff fill bytes, which don't get stuffed.
+ */
+static void bitpacker_pad(model_state_t* state)
+{
+    if (state->bit_counter != 0) {
+        const uint32_t word = state->bit_accumulator | (0xffffffffu >> state->bit_counter);
+        const int bytes_used = (state->bit_counter + 7) / 8;
+        jfpjc_model_output_t* out = state->out;
+        for (int i = 0; i < 4; i++) {
+            const uint8_t byte = (word >> (24 - (8 * i))) & 0xff;
+            out->data[out->len++] = byte;
+            if ((i < bytes_used) && (byte == 0xff)) {
+                out->data[out->len++] = 0x00;
+            }
+        }
+    }
+    state->bit_accumulator = 0;
+    state->bit_counter = 0;
+}
+
+/**
+ * bitpacker.v. data is left-justified.
+ */
+static void bitpacker_push(model_state_t* state, uint32_t data, int length)
+{
+    const uint64_t shifted_input = (((uint64_t)data) << 32) >> state->bit_counter;
+    if ((state->bit_counter + length) >= 32) {
+        write_word(state, state->bit_accumulator | (uint32_t)(shifted_input >> 32));
+        state->bit_accumulator = (uint32_t)shifted_input;
+    } else {
+        state->bit_accumulator |= (uint32_t)(shifted_input >> 32);
+    }
+    state->bit_counter = (state->bit_counter + length) & 0x1f;
+}
+
+/**
+ * double_bit_concatenator.v: a huffman code followed by an optional coded coefficient.
+ */
+static void push_code(model_state_t* state, const huffman_ebr_t* table, int addr,
+                      uint16_t coded_value, int coded_length)
+{
+    const int length_0 = table->length[addr];
+    uint32_t data = ((uint32_t)table->code[addr]) << (32 - length_0);
+    if (coded_length != 0) {
+        data |= ((uint32_t)coded_value) << (32 - (length_0 + coded_length));
+    }
+    bitpacker_push(state, data, length_0 + coded_length);
+}
+
+/**
+ * One DHT segment, like jpeg_header_generator reads it out of a huffman_spec_ram.
+ */
+static void write_dht(jfpjc_model_output_t* out, uint8_t table_class, const uint8_t* bits,
+                      const uint8_t* vals)
+{
+    int nvals = 0;
+    for (int i = 0; i < 16; i++) {
+        nvals += bits[i];
+    }
+
+    const int length = 19 + nvals;
+    const uint8_t dht[5] = { 0xff, 0xc4, (length >> 8) & 0xff, length & 0xff, table_class };
+    memcpy(&out->data[out->len], dht, 5);
+    out->len += 5;
+    memcpy(&out->data[out->len], bits, 16);
+    out->len += 16;
+    memcpy(&out->data[out->len], vals, nvals);
+    out->len += nvals;
+}
+
+/**
+ * Everything that jpeg_header_generator puts out when start_header is pulsed: SOI, APP0, DQT, DHT
+ * for DC and AC, SOF0 and SOS. Space has already been reserved.
+ */
+static void write_header(jfpjc_model_output_t* out, const jfpjc_model_quant_table_t* quant_table,
+                         int width, int height, int restart_interval)
+{
+    static const uint8_t prefix[25] =
+    {
+        0xff, 0xd8,
+        0xff, 0xe0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01,
+        0x00, 0x00,
+        0xff, 0xdb, 0x00, 0x43, 0x00
+    };
+    memcpy(&out->data[out->len], prefix, sizeof(prefix));
+    out->len += sizeof(prefix);
+    memcpy(&out->data[out->len], quant_table->Q, 64);
+    out->len += 64;
+
+    write_dht(out, 0x00, lum_dc_bits, lum_dc_vals);
+    write_dht(out, 0x10, lum_ac_bits, lum_ac_vals);
+
+    if (restart_interval != 0) {
+        const uint8_t dri[6] = { 0xff, 0xdd, 0x00, 0x04, (restart_interval >> 8) & 0xff,
+                                 restart_interval & 0xff };
+        memcpy(&out->data[out->len], dri, sizeof(dri));
+        out->len += sizeof(dri);
+    }
+
+    const uint8_t frame[23] =
+    {
+        0xff, 0xc0, 0x00, 0x0b, 0x08, (height >> 8) & 0xff, height & 0xff,
+        (width >> 8) & 0xff, width & 0xff, 0x01, 0x00, 0x11, 0x00,
+        0xff, 0xda, 0x00, 0x08, 0x01, 0x00, 0x00, 0x00, 0x3f, 0x00
+    };
+    memcpy(&out->data[out->len], frame, sizeof(frame));
+    out->len += sizeof(frame);
+}
+
+/**
+ * What jpeg_huffman_encode puts out for one block of quantized coefficients in zig-zag order.
+ */
+static void huffman_encode_block(model_state_t* state, const int16_t* coefficients)
+{
+    uint16_t coded_value;
+    int coded_length;
+
+    const int16_t dc_diff = wrap16(coefficients[0] - state->dc_prev);
+    state->dc_prev = coefficients[0];
+    coded_length = encode_coefficient(dc_diff, &coded_value);
+    push_code(state, &state->dc_table, coded_length, coded_value, coded_length);
+
+    int zeros = 0;
+    for (int k = 1; k < 64; ) {
+        coded_length = encode_coefficient(coefficients[k], &coded_value);
+
+        if ((coded_length != 0) && (zeros > 15)) {
+            // ZRL: it covers 16 zeros, and the run starts over right after them.
+            push_code(state, &state->ac_table, 0xf0, 0, 0);
+            k = k - zeros + 16;
+            zeros = 0;
+        } else if (coded_length != 0) {
+            push_code(state, &state->ac_table, ((zeros & 0x0f) << 4) | coded_length,
+                      coded_value, coded_length);
+            zeros = 0;
+            k++;
+        } else if (k == 63) {
+            push_code(state, &state->ac_table, 0x00, 0, 0);
+            k++;
+        } else {
+            zeros++;
+            k++;
+        }
+    }
+}
+
+int jfpjc_model_compress_frame(const uint8_t* pixels, int width, int height, int stride,
+                               const jfpjc_model_quant_table_t* quant_table, int restart_interval,
+                               jfpjc_model_output_t* out)
+{
+    if ((width <= 0) || (height <= 0) || (width % 8) || (height % 8) ||
+        (restart_interval < 0) || (restart_interval > 0xffff)) {
+        return JFPJC_MODEL_ERR_SIZE;
+    }
+
+    // worst case for one MCU is a bit under 256 bytes before stuffing; see width_adapter_buffer.v.
+    // Plus the header, a padded word and a marker word per restart, the flush word and the EOI.
+    const size_t nmcus = ((size_t)width / 8) * (height / 8);
+    const size_t header_len = 25 + 64 + (2 * (5 + 16)) + sizeof(lum_dc_vals) +
+                              sizeof(lum_ac_vals) + 6 + 23;
+    if (output_reserve(out, header_len + (nmcus * ((2 * 256) + 8 + 4)) + 8 + 2)) {
+        return JFPJC_MODEL_ERR_OUT_OF_MEMORY;
+    }
+
+    model_state_t* state = calloc(1, sizeof(model_state_t));
+    if (state == NULL) {
+        return JFPJC_MODEL_ERR_OUT_OF_MEMORY;
+    }
+    huffman_ebr_init(&state->dc_table, lum_dc_bits, lum_dc_vals);
+    huffman_ebr_init(&state->ac_table, lum_ac_bits, lum_ac_vals);
+    state->out = out;
+
+    write_header(out, quant_table, width, height, restart_interval);
+
+    size_t mcus_encoded = 0;
+    int mcus_since_restart = 0;
+    int restart_marker_index = 0;
+    for (int mcu_y = 0; mcu_y < height; mcu_y += 8) {
+        for (int mcu_x = 0; mcu_x < width; mcu_x += 8) {
+            int8_t samples[64];
+            for (int y = 0; y < 8; y++) {
+                const uint8_t* row = pixels + ((size_t)(mcu_y + y) * stride) + mcu_x;
+                for (int x = 0; x < 8; x++) {
+                    // ingester_output_pixval + 8'h80
+                    samples[(y * 8) + x] = (int8_t)(row[x] ^ 0x80);
+                }
+            }
+
+            int16_t dct[64], quotients[64];
+            jfpjc_model_dct88(samples, dct);
+            jfpjc_model_quantize(dct, quant_table, quotients);
+            huffman_encode_block(state, quotients);
+
+            // BIT_PACKER_FLUSH_STATE_RESTART_PAD and _RESTART_MARKER. There's no restart marker
+            // after the last MCU.
+            mcus_encoded++;
+            if ((restart_interval != 0) && (++mcus_since_restart == restart_interval)) {
+                mcus_since_restart = 0;
+                if (mcus_encoded < nmcus) {
+                    const uint8_t marker[4] = { 0xff, 0xff, 0xff, 0xd0 | restart_marker_index };
+                    bitpacker_pad(state);
+                    write_marker_bytes(state, marker, 4);
+                    restart_marker_index = (restart_marker_index + 1) & 0x07;
+                    state->dc_prev = 0;
+                }
+            }
+        }
+    }
+
+    // BIT_PACKER_FLUSH_STATE_FLUSH pads out whatever's left, same as before a restart marker.
+    bitpacker_pad(state);
+
+    out->data[out->len++] = 0xff;
+    out->data[out->len++] = 0xd9;
+
+    free(state);
+    return 0;
+}
+
+void jfpjc_model_output_destroy(jfpjc_model_output_t* out)
+{
+    free(out->data);
+    memset(out, 0, sizeof(jfpjc_model_output_t));
+}
+
+int jfpjc_model_read_hex_file(const char* path, uint8_t** data, int* len)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return JFPJC_MODEL_ERR_OPEN;
+    }
+
+    int capacity = 256;
+    *data = malloc(capacity);
+    *len = 0;
+
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '/') {
+            while (((c = fgetc(f)) != EOF) && (c != '\n'));
+        } else if (isxdigit(c)) {
+            unsigned int value = 0;
+            do {
+                value = (value << 4) | (isdigit(c) ? (c - '0') : ((tolower(c) - 'a') + 10));
+            } while (((c = fgetc(f)) != EOF) && isxdigit(c));
+
+            if (*len == capacity) {
+                capacity *= 2;
+                *data = realloc(*data, capacity);
+            }
+            (*data)[(*len)++] = value & 0xff;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef _JFPJC_MODEL_H
+#define _JFPJC_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Bit-exact C model of the jfpjc hardware pipeline (jfpjc/verilog/jfpjc.v).
+ *
+ * Running one image through jfpjc_tb.vvp takes minutes; this does the same thing in well under a
+ * millisecond, so expected bitstreams for a whole image set can be generated up front and the
+ * simulator only needs to confirm that it matches on a sample of them.
+ *
+ * Every stage copies what the hardware does, quirks included, rather than what a jpeg encoder
+ * "should" do:
+ *
+ *     loeffler_dct_88    3q12 fixed point with 16-bit wraparound. Multiplies keep bits [27:12] of
+ *                        the 32-bit product, so they round towards -inf, and "subtracting" a
+ *                        product negates it after the multiply, not before.
+ *     jfpjc.v            3q12 -> 7q8 conversion is (x + 8) >>> 4 in 16 bits.
+ *     reciprocal_quantizer  multiplies magnitudes by a 13-bit reciprocal of the quantization table
+ *                        entry and fixes up the sign after. For every value the DCT can produce,
+ *                        that rounds to nearest with halves going away from 0. A quantization
+ *                        table entry of 0 quantizes everything to 0.
+ *     coefficient_encoder  -32768 has no bits set in [14:0], so it gets coded as a 0.
+ *     jpeg_huffman_encode  DC prediction restarts at 0 every frame and every restart interval.
+ *                        Runs of 16+ zeros followed by a nonzero coefficient emit 0xf0 and restart
+ *                        the run, like the hardware's ZRL symbols do. Sizes that aren't in the
+ *                        hardware's tables (DC > 11, AC > 10) get the table's "invalid" entry: 16
+ *                        zero bits. The hardware hands the bitpacker up to 2 symbols at a time,
+ *                        but that doesn't change the bits that come out.
+ *     bitpacker          at the end of each frame, the accumulator is padded out the same way it
+ *                        is before a restart marker (see below). If the frame happened to end on
+ *                        a 32-bit boundary, nothing extra goes out.
+ *     bytestuffer        0xff is followed by 0x00.
+ *     restart markers    the bitpacker pads out to a byte with 1's and fills the rest of the word
+ *                        with 0xff fill bytes, then a word of 2 more fill bytes and RSTn goes in.
+ *                        Fill bytes and markers aren't stuffed.
+ *     jpeg_header_generator  SOI, APP0, DQT, DHT, SOF0 and SOS go in front of the scan data and
+ *                        EOI goes after it.
+ *
+ * The output is exactly the sequence of bytes that shows up on jfpjc's data_out while hsync is
+ * high, which is a complete jpeg. Overflowing the width adapter or bytestuffer fifos isn't
+ * modeled.
+ */
+
+#define JFPJC_MODEL_ERR_SIZE           (-1)
+#define JFPJC_MODEL_ERR_OUT_OF_MEMORY  (-2)
+#define JFPJC_MODEL_ERR_OPEN           (-3)
+
+typedef struct jfpjc_model_output
+{
+    uint8_t* data;
+    size_t len;
+    size_t capacity;
+} jfpjc_model_output_t;
+
+/**
+ * 64 8-bit quantization table entries in zig-zag order, same as the quantization_table_ebr.
+ */
+typedef struct jfpjc_model_quant_table
+{
+    uint8_t Q[64];
+} jfpjc_model_quant_table_t;
+
+/**
+ * loeffler_dct_88 followed by the 3q12 -> 7q8 conversion. samples are level-shifted pixels in
+ * row-major order; the result is in row-major order, same as the dct_output_mem EBRs.
+ */
+void jfpjc_model_dct88(const int8_t* samples, int16_t* result);
+
+/**
+ * The reciprocal that quant_reciprocal_builder puts in the reciprocal table for quantization table
+ * entry Q: { e[2:0], M[12:0] }. See reciprocal_quantizer.v.
+ */
+uint16_t jfpjc_model_quant_reciprocal(uint8_t Q);
+
+/**
+ * Reads coefficients out of a dct88 result in zig-zag order and divides each by the matching
+ * quantization table entry the way reciprocal_quantizer does. The result is in zig-zag order, same
+ * as the quotient_output_mems.
+ */
+void jfpjc_model_quantize(const int16_t* dct, const jfpjc_model_quant_table_t* quant_table,
+                          int16_t* quotients);
+
+/**
+ * Compresses one frame of 8-bit grayscale pixels and appends the bytes that jfpjc would put out
+ * for it, header and EOI included, to 'out'. Width and height must be multiples of 8. MCUs are
+ * coded in raster order. restart_interval is jfpjc's restart interval in MCUs; 0 means no restart
+ * markers.
+ *
+ * 'out' should be zeroed before first use. It can be reused for any number of frames (set
+ * out->len to 0 in between) so that it only gets allocated once.
+ */
+int jfpjc_model_compress_frame(const uint8_t* pixels, int width, int height, int stride,
+                               const jfpjc_model_quant_table_t* quant_table, int restart_interval,
+                               jfpjc_model_output_t* out);
+
+void jfpjc_model_output_destroy(jfpjc_model_output_t* out);
+
+/**
+ * Reads a file in $readmemh format: whitespace separated hex words and // comments. Every word is
+ * truncated to 8 bits. *data needs to be freed by the caller.
+ */
+int jfpjc_model_read_hex_file(const char* path, uint8_t** data, int* len);
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * Generates the jpegs that jfpjc_images_test/jfpjc_tb.vvp would, without running verilog.
+ *
+ *     jfpjc_model -q quant_table.hextestcase [-R restart_interval] [-o out.jpg | -d dir]
+ *                 image.pgm ...
+ *
+ * The quantization table is the same zig-zag ordered hex file that gets loaded into the
+ * quantization_table_ebr. Output files are exactly the bytes off of data_out, which are a complete
+ * jpeg now that jfpjc makes its own header. -R matches jfpjc's restart interval (0 by default).
+ *
+ * With -o, there has to be exactly one image. Otherwise each image's output goes into -d's
+ * directory (default ".") with the same name as the image but ending in ".jpg".
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jfpjc_model.h"
+#include "pnm.h"
+
+static char* output_path_for(const char* dir, const char* image_path)
+{
+    const char* name = strrchr(image_path, '/');
+    name = (name == NULL) ? image_path : (name + 1);
+    const char* dot = strrchr(name, '.');
+    const size_t stem_len = (dot == NULL) ? strlen(name) : (size_t)(dot - name);
+
+    char* path = malloc(strlen(dir) + stem_len + 6);
+    sprintf(path, "%s/%.*s.jpg", dir, (int)stem_len, name);
+    return path;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static void usage(const char* argv0)
+{
+    printf("Usage: %s -q quant_table [-R restart_interval] [-o output | -d dir] image ...\n",
+           argv0);
+    printf("    -q quant_table   zig-zag ordered quantization table, one hex byte per entry.\n");
+    printf("    -R interval      restart interval in MCUs; 0 for none (0).\n");
+    printf("    -o output        output file. Only allowed with one image.\n");
+    printf("    -d dir           directory to put <image name>.jpg files in (.).\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* quant_table_path = NULL;
+    const char* output_path = NULL;
+    const char* output_dir = ".";
+    int restart_interval = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "q:R:o:d:")) != -1) {
+        switch (opt) {
+            case 'q': quant_table_path = optarg; break;
+            case 'R': restart_interval = atoi(optarg); break;
+            case 'o': output_path = optarg; break;
+            case 'd': output_dir = optarg; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    if ((quant_table_path == NULL) || (optind == argc) ||
+        (restart_interval < 0) || (restart_interval > 0xffff) ||
+        ((output_path != NULL) && ((argc - optind) != 1))) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    int retval = 0;
+    uint8_t* quant_bytes = NULL;
+    int quant_len = 0;
+    jfpjc_model_quant_table_t quant_table;
+    jfpjc_model_output_t out = { 0 };
+
+    if (jfpjc_model_read_hex_file(quant_table_path, &quant_bytes, &quant_len) || (quant_len < 64)) {
+        printf("couldn't read 64 quantization table entries from %s\n", quant_table_path);
+        retval = -1;
+        goto _end;
+    }
+    memcpy(quant_table.Q, quant_bytes, 64);
+
+    const double start = now_seconds();
+    long total_bytes = 0;
+    for (int i = optind; i < argc; i++) {
+        pnm_image_t image;
+        int err;
+        if ((err = pnm_image_map(argv[i], &image))) {
+            printf("failed to load %s (%i)\n", argv[i], err);
+            retval = -1;
+            goto _end;
+        }
+        if (image.depth != 1) {
+            printf("%s isn't grayscale\n", argv[i]);
+            pnm_image_unmap(&image);
+            retval = -1;
+            goto _end;
+        }
+
+        out.len = 0;
+        err = jfpjc_model_compress_frame(image.pixels, image.width, image.height, image.width,
+                                         &quant_table, restart_interval, &out);
+        pnm_image_unmap(&image);
+        if (err) {
+            printf("failed to compress %s (%i); width and height need to be multiples of 8\n",
+                   argv[i], err);
+            retval = -1;
+            goto _end;
+        }
+
+        char* path = (output_path != NULL) ? strdup(output_path) : output_path_for(output_dir, argv[i]);
+        FILE* f = fopen(path, "wb");
+        if (f == NULL) {
+            printf("couldn't open %s\n", path);
+            free(path);
+            retval = -1;
+            goto _end;
+        }
+        fwrite(out.data, 1, out.len, f);
+        fclose(f);
+        free(path);
+        total_bytes += out.len;
+    }
+
+    const double elapsed = now_seconds() - start;
+    fprintf(stderr, "%i images, %li bytes of jpeg in %.3f s\n", argc - optind,
+            total_bytes, elapsed);
+
+_end:
+    jfpjc_model_output_destroy(&out);
+    free(quant_bytes);
+    return retval;
+}
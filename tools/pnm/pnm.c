@@ -0,0 +1,174 @@
+// mmap and friends aren't part of c99.
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "pnm.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int is_whitespace(uint8_t c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '\v') || (c == '\f');
+}
+
+/**
+ * Skips whitespace and comments in a header.
+ */
+static void skip_whitespace(const uint8_t* data, size_t len, size_t* idx)
+{
+    while (*idx < len) {
+        if (data[*idx] == '#') {
+            while ((*idx < len) && (data[*idx] != '\n')) (*idx)++;
+        } else if (is_whitespace(data[*idx])) {
+            (*idx)++;
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * Reads one whitespace-separated decimal number. Returns -1 if there isn't one.
+ */
+static int read_header_int(const uint8_t* data, size_t len, size_t* idx)
+{
+    skip_whitespace(data, len, idx);
+
+    int value = -1;
+    while ((*idx < len) && (data[*idx] >= '0') && (data[*idx] <= '9')) {
+        value = ((value < 0) ? 0 : (value * 10)) + (data[*idx] - '0');
+        if (value > (1 << 24)) {
+            return -1;
+        }
+        (*idx)++;
+    }
+    return value;
+}
+
+/**
+ * P7 headers are a list of "KEYWORD value" lines that ends with ENDHDR.
+ */
+static int parse_pam_header(const uint8_t* data, size_t len, size_t* idx, pnm_image_t* image)
+{
+    image->width = image->height = image->depth = image->maxval = -1;
+
+    while (1) {
+        skip_whitespace(data, len, idx);
+
+        const size_t start = *idx;
+        while ((*idx < len) && !is_whitespace(data[*idx])) (*idx)++;
+        const size_t keylen = *idx - start;
+        const char* key = (const char*)&data[start];
+
+        if (keylen == 0) {
+            return PNM_ERR_TRUNCATED;
+        } else if ((keylen == 6) && !memcmp(key, "ENDHDR", 6)) {
+            // ENDHDR is followed by exactly one newline.
+            (*idx)++;
+            return 0;
+        } else if ((keylen == 5) && !memcmp(key, "WIDTH", 5)) {
+            image->width = read_header_int(data, len, idx);
+        } else if ((keylen == 6) && !memcmp(key, "HEIGHT", 6)) {
+            image->height = read_header_int(data, len, idx);
+        } else if ((keylen == 5) && !memcmp(key, "DEPTH", 5)) {
+            image->depth = read_header_int(data, len, idx);
+        } else if ((keylen == 6) && !memcmp(key, "MAXVAL", 6)) {
+            image->maxval = read_header_int(data, len, idx);
+        } else {
+            // TUPLTYPE and anything else we don't care about; skip the rest of the line.
+            while ((*idx < len) && (data[*idx] != '\n')) (*idx)++;
+        }
+    }
+}
+
+int pnm_image_map(const char* path, pnm_image_t* image)
+{
+    memset(image, 0, sizeof(pnm_image_t));
+    int retval = 0;
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return PNM_ERR_OPEN;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        retval = PNM_ERR_OPEN;
+        goto _end;
+    }
+    if (st.st_size < 3) {
+        retval = PNM_ERR_FORMAT;
+        goto _end;
+    }
+    image->map_len = st.st_size;
+
+    // MAP_PRIVATE + PROT_WRITE is copy-on-write: the file never changes, and pages that nobody
+    // writes to are never copied.
+    image->map = mmap(NULL, image->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (image->map == MAP_FAILED) {
+        image->map = NULL;
+        retval = PNM_ERR_OPEN;
+        goto _end;
+    }
+
+    const uint8_t* data = image->map;
+    const size_t len = image->map_len;
+    size_t idx = 2;
+    if ((data[0] != 'P') || (data[1] < '5') || (data[1] > '7')) {
+        retval = PNM_ERR_FORMAT;
+        goto _end;
+    }
+
+    if (data[1] == '7') {
+        if ((retval = parse_pam_header(data, len, &idx, image))) {
+            goto _end;
+        }
+    } else {
+        image->depth = (data[1] == '5') ? 1 : 3;
+        image->width = read_header_int(data, len, &idx);
+        image->height = read_header_int(data, len, &idx);
+        image->maxval = read_header_int(data, len, &idx);
+
+        // exactly one whitespace character comes between the header and the raster.
+        idx++;
+    }
+
+    if ((image->width <= 0) || (image->height <= 0) || (image->depth <= 0) || (image->maxval <= 0)) {
+        retval = PNM_ERR_FORMAT;
+        goto _end;
+    }
+    if (image->maxval > 255) {
+        retval = PNM_ERR_UNSUPPORTED;
+        goto _end;
+    }
+    if ((idx > len) ||
+        (((size_t)image->width * image->height * image->depth) > (len - idx))) {
+        retval = PNM_ERR_TRUNCATED;
+        goto _end;
+    }
+
+    image->pixels = (uint8_t*)image->map + idx;
+
+    // we're going to go through the raster front-to-back.
+    posix_madvise(image->map, image->map_len, POSIX_MADV_SEQUENTIAL);
+
+_end:
+    close(fd);
+    if (retval) {
+        pnm_image_unmap(image);
+    }
+    return retval;
+}
+
+void pnm_image_unmap(pnm_image_t* image)
+{
+    if (image->map != NULL) {
+        munmap(image->map, image->map_len);
+    }
+    memset(image, 0, sizeof(pnm_image_t));
+}
@@ -0,0 +1,47 @@
+#ifndef _TOOLS_PNM_H
+#define _TOOLS_PNM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Minimal loader for binary netpbm files (P5 / P6 / P7) that doesn't need libnetpbm.
+ *
+ * Instead of reading the file one tuple at a time, the whole file gets mmap'd and the raster is
+ * used right where it is. The mapping is private and writable, so callers can scribble on the
+ * pixels without touching the file; pages only get copied if they actually do.
+ *
+ * Only maxvals up to 255 are supported, so every sample is exactly one byte.
+ */
+
+// error codes
+#define PNM_ERR_OPEN         (-1)
+#define PNM_ERR_FORMAT       (-2)
+#define PNM_ERR_UNSUPPORTED  (-3)
+#define PNM_ERR_TRUNCATED    (-4)
+
+typedef struct pnm_image
+{
+    int width;
+    int height;
+
+    // samples per pixel: 1 for P5, 3 for P6, and whatever DEPTH says for P7.
+    int depth;
+    int maxval;
+
+    // points into the mapping. Samples are interleaved and there's no padding between rows.
+    uint8_t* pixels;
+
+    // the whole mapped file, for pnm_image_unmap()
+    void* map;
+    size_t map_len;
+} pnm_image_t;
+
+/**
+ * Maps the given file and parses its header. On failure nothing is left mapped.
+ */
+int pnm_image_map(const char* path, pnm_image_t* image);
+
+void pnm_image_unmap(pnm_image_t* image);
+
+#endif